@@ -0,0 +1,1276 @@
+// V4L2ViewerBench - throughput of the frame conversions on synthetic frames.
+//
+// Every pixel format ImageTransform can convert is generated at several
+// resolutions and strides and run through ConvertFrame with the option sets
+// the viewer uses, followed by the kernels that also run on their own:
+// demosaic, orientation, flat-field correction and frame statistics. The
+// results go to stdout or --output as one JSON document, progress to stderr.
+// With --golden it checks the results of the conversions instead of their
+// speed, see RunGolden, and with --compare-scalar it checks that they do not
+// depend on the vector kernels, see RunScalarComparison.
+
+#include "BufferWrapper.h"
+#include "ColorCorrection.h"
+#include "Demosaic.h"
+#include "FlatFieldCorrection.h"
+#include "FrameStatistics.h"
+#include "GitRevision.h"
+#include "ImageOrientation.h"
+#include "ImageTransform.h"
+#include "PixelFormatRegistry.h"
+#include "WorkerPool.h"
+
+#include <QBuffer>
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QImage>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QMap>
+#include <QRect>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <vector>
+
+using namespace PixelFormatRegistry;
+
+// Allocations are counted by interposing the allocator of glibc, which also
+// sees the allocations of operator new and of QImage. Sanitizers bring an
+// allocator of their own.
+#if defined(__GLIBC__) && !defined(__SANITIZE_ADDRESS__)
+#define HAS_ALLOCATION_COUNT 1
+
+static std::atomic<bool> s_CountAllocations{false};
+static std::atomic<uint64_t> s_Allocations{0};
+static std::atomic<uint64_t> s_AllocatedBytes{0};
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+void __libc_free(void *pointer);
+}
+
+static void CountAllocation(size_t size)
+{
+    if (s_CountAllocations.load(std::memory_order_relaxed))
+    {
+        s_Allocations.fetch_add(1, std::memory_order_relaxed);
+        s_AllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    }
+}
+
+extern "C" void *malloc(size_t size) noexcept
+{
+    CountAllocation(size);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size) noexcept
+{
+    CountAllocation(count * size);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size) noexcept
+{
+    CountAllocation(size);
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void *memalign(size_t alignment, size_t size) noexcept
+{
+    CountAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    CountAllocation(size);
+    return __libc_memalign(alignment, size);
+}
+
+extern "C" int posix_memalign(void **pointer, size_t alignment, size_t size) noexcept
+{
+    CountAllocation(size);
+    void *memory = __libc_memalign(alignment, size);
+    if (memory == nullptr)
+    {
+        return ENOMEM;
+    }
+    *pointer = memory;
+    return 0;
+}
+
+extern "C" void free(void *pointer) noexcept
+{
+    __libc_free(pointer);
+}
+#endif
+
+struct Resolution
+{
+    const char *name;
+    uint32_t width;
+    uint32_t height;
+};
+
+static const Resolution s_Resolutions[] = {
+    { "VGA", 640, 480 },
+    { "HD", 1280, 720 },
+    { "FHD", 1920, 1080 },
+    { "5MP", 2592, 1944 },
+    { "12MP", 4056, 3040 },
+    { "20MP", 5472, 3648 },
+};
+
+static const char *const s_Kernels[] = { "ConvertFrame", "Statistics", "FlatField", "Demosaic", "Orientation" };
+
+// Padded lines end 64 bytes after the pixels at the least, rounded up to
+// 256 bytes as the Jetson VI does
+static uint32_t PaddedStride(uint32_t bytesPerLine)
+{
+    return (bytesPerLine + 64 + 255) & ~255u;
+}
+
+// A frame as a driver would hand it out
+struct SyntheticFrame
+{
+    std::vector<uint8_t> data;
+    BufferWrapper buffer;
+};
+
+// This function fills a frame with noise, which keeps the statistics and the
+// JPEG encoder from taking shortcuts on flat content
+static void FillNoise(uint8_t *data, size_t size, uint32_t seed)
+{
+    uint32_t state = seed * 2654435761u + 1;
+    for (size_t i = 0; i < size; i++)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        data[i] = uint8_t(state >> 24);
+    }
+}
+
+static std::unique_ptr<SyntheticFrame> MakeFrame(const PixelFormatDescriptor &desc, uint32_t width, uint32_t height,
+                                                 uint32_t bytesPerLine)
+{
+    auto frame = std::make_unique<SyntheticFrame>();
+    if (desc.family == PixelFamily::Compressed)
+    {
+        // A smooth gradient under mild noise compresses like a camera image
+        QImage image(int(width), int(height), QImage::Format_RGB888);
+        std::vector<uint8_t> noise(size_t(width) * 3);
+        for (uint32_t y = 0; y < height; y++)
+        {
+            FillNoise(noise.data(), noise.size(), y);
+            uint8_t *line = image.scanLine(int(y));
+            for (uint32_t x = 0; x < width; x++)
+            {
+                line[3 * x] = uint8_t(x * 255 / width) ^ (noise[3 * x] & 15);
+                line[3 * x + 1] = uint8_t(y * 255 / height) ^ (noise[3 * x + 1] & 15);
+                line[3 * x + 2] = uint8_t((x + y) * 127 / (width + height)) ^ (noise[3 * x + 2] & 15);
+            }
+        }
+        QByteArray jpeg;
+        QBuffer device(&jpeg);
+        device.open(QIODevice::WriteOnly);
+        image.save(&device, "JPEG", 90);
+        frame->data.assign(jpeg.constData(), jpeg.constData() + jpeg.size());
+        bytesPerLine = 0;
+    }
+    else
+    {
+        // Two planes of a full stride cover every layout, 4:2:2 semi-planar included
+        frame->data.resize(size_t(bytesPerLine) * height * 2);
+        FillNoise(frame->data.data(), frame->data.size(), desc.fourcc);
+    }
+
+    BufferWrapper &buffer = frame->buffer;
+    std::memset(&buffer, 0, sizeof(buffer));
+    buffer.data = frame->data.data();
+    buffer.length = frame->data.size();
+    buffer.width = width;
+    buffer.height = height;
+    buffer.pixelFormat = desc.fourcc;
+    buffer.payloadSize = uint32_t(frame->data.size());
+    buffer.bytesPerLine = bytesPerLine;
+    return frame;
+}
+
+// This function returns the option sets of preview, stream, snapshot and
+// recording that apply to a format, orientation aside
+static std::vector<std::pair<QString, ImageTransform::ConversionOptions>> ConversionVariants(const PixelFormatDescriptor &desc)
+{
+    const bool bayer = desc.family == PixelFamily::Bayer;
+
+    std::vector<std::pair<QString, ImageTransform::ConversionOptions>> variants;
+    variants.emplace_back("Default", ImageTransform::ConversionOptions());
+    if (desc.family == PixelFamily::Rgb)
+    {
+        ImageTransform::ConversionOptions borrow;
+        borrow.allowBorrow = true;
+        variants.emplace_back("Borrow", borrow);
+    }
+    if (desc.family == PixelFamily::Yuv)
+    {
+        ImageTransform::ConversionOptions hdtv;
+        hdtv.yuvMatrix = ImageTransform::YuvMatrix::Bt709;
+        variants.emplace_back("Bt709", hdtv);
+
+        ImageTransform::ConversionOptions fullRange;
+        fullRange.yuvRange = ImageTransform::YuvRange::Full;
+        variants.emplace_back("FullRange", fullRange);
+    }
+    if (bayer)
+    {
+        ImageTransform::ConversionOptions nearest;
+        nearest.demosaic = Demosaic::Method::Nearest;
+        variants.emplace_back("Nearest", nearest);
+
+        ImageTransform::ConversionOptions malvar;
+        malvar.demosaic = Demosaic::Method::MalvarHeCutler;
+        variants.emplace_back("MalvarHeCutler", malvar);
+
+        ColorCorrectionSettings colors;
+        colors.enabled = true;
+        colors.blackLevel = 0.06;
+        colors.gains[0] = 1.8;
+        colors.gains[2] = 1.5;
+        colors.matrix[0] = 1.6;
+        colors.matrix[1] = -0.4;
+        colors.matrix[2] = -0.2;
+        colors.gamma = 2.2;
+        malvar.colorCorrection = std::make_shared<ColorCorrection>(colors);
+        variants.emplace_back("MalvarHeCutler+Color", malvar);
+    }
+    if (desc.bitDepth > 8 && (bayer || desc.family == PixelFamily::Mono))
+    {
+        ImageTransform::ConversionOptions full;
+        full.fullDepth = true;
+        variants.emplace_back("FullDepth", full);
+    }
+    if (desc.family != PixelFamily::Compressed)
+    {
+        ImageTransform::ConversionOptions downscale;
+        downscale.downscale = 2;
+        variants.emplace_back("Downscale2", downscale);
+    }
+    return variants;
+}
+
+struct Settings
+{
+    QStringList formats;
+    QStringList sizes;
+    QStringList kernels;
+    QStringList strides;
+    double minTime = 0.3;
+    int minIterations = 5;
+    int maxIterations = 1000;
+};
+
+struct Measurement
+{
+    int result = 0;
+    int iterations = 0;
+    double medianNs = 0.0;
+    double minNs = 0.0;
+    double meanNs = 0.0;
+    double allocations = 0.0;
+    double allocatedBytes = 0.0;
+};
+
+// This function times run after one untimed call, which grows the scratch
+// memory and the destination image to their steady state
+static Measurement Measure(const Settings &settings, const std::function<int()> &run)
+{
+    using Clock = std::chrono::steady_clock;
+
+    Measurement measurement;
+    measurement.result = run();
+    if (measurement.result != 0)
+    {
+        return measurement;
+    }
+
+    std::vector<double> times;
+    times.reserve(size_t(settings.maxIterations));
+#ifdef HAS_ALLOCATION_COUNT
+    s_Allocations = 0;
+    s_AllocatedBytes = 0;
+    s_CountAllocations = true;
+#endif
+    const Clock::time_point start = Clock::now();
+    double elapsed = 0.0;
+    while (int(times.size()) < settings.maxIterations &&
+           (int(times.size()) < settings.minIterations || elapsed < settings.minTime))
+    {
+        const Clock::time_point before = Clock::now();
+        run();
+        const Clock::time_point after = Clock::now();
+        times.push_back(std::chrono::duration<double, std::nano>(after - before).count());
+        elapsed = std::chrono::duration<double>(after - start).count();
+    }
+#ifdef HAS_ALLOCATION_COUNT
+    s_CountAllocations = false;
+    measurement.allocations = double(s_Allocations) / times.size();
+    measurement.allocatedBytes = double(s_AllocatedBytes) / times.size();
+#endif
+
+    measurement.iterations = int(times.size());
+    measurement.meanNs = elapsed * 1e9 / times.size();
+    std::sort(times.begin(), times.end());
+    measurement.minNs = times.front();
+    measurement.medianNs = times[times.size() / 2];
+    return measurement;
+}
+
+class Bench
+{
+public:
+    explicit Bench(const Settings &settings)
+        : m_Settings(settings)
+    {
+    }
+
+    void Run();
+    QJsonObject Results() const;
+
+private:
+    bool Selected(const QStringList &filter, const QString &name) const
+    {
+        return filter.isEmpty() || filter.contains(name, Qt::CaseInsensitive);
+    }
+
+    void RunFormat(const PixelFormatDescriptor &desc, const Resolution &resolution, const char *stride,
+                   uint32_t bytesPerLine);
+    void RunDemosaic(const Resolution &resolution);
+    void RunOrientation(const Resolution &resolution);
+    void Report(const QString &kernel, const QString &variant, const QString &format,
+                uint32_t width, uint32_t height, const char *stride, uint32_t bytesPerLine,
+                const std::function<int()> &run);
+
+    Settings m_Settings;
+    QJsonArray m_Results;
+};
+
+void Bench::Report(const QString &kernel, const QString &variant, const QString &format,
+                   uint32_t width, uint32_t height, const char *stride, uint32_t bytesPerLine,
+                   const std::function<int()> &run)
+{
+    const Measurement measurement = Measure(m_Settings, run);
+    const double pixels = double(width) * height;
+
+    QJsonObject result;
+    result["kernel"] = kernel;
+    result["variant"] = variant;
+    result["format"] = format;
+    result["width"] = int(width);
+    result["height"] = int(height);
+    result["stride"] = QString(stride);
+    result["bytesPerLine"] = int(bytesPerLine);
+    if (measurement.result != 0)
+    {
+        result["error"] = measurement.result;
+        std::fprintf(stderr, "%-12s %-24s %-5s %5ux%-5u %-6s failed (%d)\n", qPrintable(kernel), qPrintable(variant),
+                     qPrintable(format), width, height, stride, measurement.result);
+        m_Results.append(result);
+        return;
+    }
+
+    const double mpixPerSecond = pixels / measurement.medianNs * 1e3;
+    result["iterations"] = measurement.iterations;
+    result["medianNs"] = measurement.medianNs;
+    result["minNs"] = measurement.minNs;
+    result["meanNs"] = measurement.meanNs;
+    result["mpixPerSecond"] = mpixPerSecond;
+    result["nsPerPixel"] = measurement.medianNs / pixels;
+#ifdef HAS_ALLOCATION_COUNT
+    result["allocationsPerCall"] = measurement.allocations;
+    result["bytesAllocatedPerCall"] = measurement.allocatedBytes;
+#endif
+    m_Results.append(result);
+
+    std::fprintf(stderr, "%-12s %-24s %-5s %5ux%-5u %-6s %9.2f ms %9.1f MPix/s %7.3f ns/px %6.1f allocs\n",
+                 qPrintable(kernel), qPrintable(variant), qPrintable(format), width, height, stride,
+                 measurement.medianNs / 1e6, mpixPerSecond, measurement.medianNs / pixels, measurement.allocations);
+}
+
+void Bench::RunFormat(const PixelFormatDescriptor &desc, const Resolution &resolution, const char *stride,
+                      uint32_t bytesPerLine)
+{
+    const uint32_t width = resolution.width;
+    const uint32_t height = resolution.height;
+    const std::unique_ptr<SyntheticFrame> frame = MakeFrame(desc, width, height, bytesPerLine);
+    const BufferWrapper &buffer = frame->buffer;
+    const QString format = desc.name;
+    const bool bayer = desc.family == PixelFamily::Bayer;
+
+    if (Selected(m_Settings.kernels, "ConvertFrame"))
+    {
+        // Each option set once, then a flip and a quarter turn of the default
+        std::vector<std::pair<QString, ImageTransform::ConversionOptions>> variants = ConversionVariants(desc);
+        if (desc.family != PixelFamily::Compressed)
+        {
+            ImageTransform::ConversionOptions flip;
+            flip.orientation.flipX = true;
+            variants.emplace_back("FlipX", flip);
+        }
+        ImageTransform::ConversionOptions rotate;
+        rotate.orientation.rotation = ImageOrientation::Rotation::Rotate90;
+        variants.emplace_back("Rotate90", rotate);
+
+        for (const auto &variant : variants)
+        {
+            // The image lives across calls, as in the consumers
+            QImage image;
+            const ImageTransform::ConversionOptions &options = variant.second;
+            Report("ConvertFrame", variant.first, format, width, height, stride, bytesPerLine, [&]() {
+                return ImageTransform::ConvertFrame(buffer, image, options);
+            });
+        }
+
+        // The default again with the scalar code the vector kernels fall
+        // back to, which shows their gain
+        if (desc.family == PixelFamily::Yuv)
+        {
+            QImage image;
+            ImageTransform::SetVectorKernels(false);
+            Report("ConvertFrame", "Scalar", format, width, height, stride, bytesPerLine, [&]() {
+                return ImageTransform::ConvertFrame(buffer, image);
+            });
+            ImageTransform::SetVectorKernels(true);
+        }
+
+        // The zoomed in preview and the pixel probe convert a part of the
+        // frame, rated by the pixels of that part
+        QImage image;
+        const QRect region(int(width * 3 / 8), int(height * 3 / 8), int(width / 4), int(height / 4));
+        Report("ConvertFrame", "Region1/16", format, width / 4, height / 4, stride, bytesPerLine, [&]() {
+            return ImageTransform::ConvertFrame(buffer, region, image);
+        });
+    }
+
+    if (Selected(m_Settings.kernels, "Statistics") && desc.family != PixelFamily::Compressed)
+    {
+        FrameStatistics::Statistics stats;
+        Report("Statistics", "64x48", format, width, height, stride, bytesPerLine, [&]() {
+            return FrameStatistics::Compute(buffer, stats);
+        });
+    }
+
+    if (Selected(m_Settings.kernels, "FlatField") && (bayer || desc.family == PixelFamily::Mono))
+    {
+        // Neutral maps with one defect per 10000 pixels
+        const size_t pixels = size_t(width) * height;
+        std::vector<uint32_t> defects;
+        for (size_t index = 5003; index < pixels; index += 10007)
+        {
+            defects.push_back(uint32_t(index));
+        }
+        const FlatFieldCorrection correction(desc.fourcc, width, height,
+                                             std::vector<uint16_t>(pixels, 0),
+                                             std::vector<uint16_t>(pixels, uint16_t(1u << FlatFieldCorrection::s_GainShift)),
+                                             std::move(defects));
+        uint8_t *data = frame->data.data();
+        Report("FlatField", "Defects1e-4", format, width, height, stride, bytesPerLine, [&]() {
+            return correction.Apply(buffer, data);
+        });
+    }
+}
+
+void Bench::RunDemosaic(const Resolution &resolution)
+{
+    const uint32_t width = resolution.width;
+    const uint32_t height = resolution.height;
+    const Demosaic::CfaCell rggb = { 0, 1, 2, 3 };
+    const std::pair<QString, Demosaic::Method> methods[] = {
+        { "Nearest", Demosaic::Method::Nearest },
+        { "Bilinear", Demosaic::Method::Bilinear },
+        { "MalvarHeCutler", Demosaic::Method::MalvarHeCutler },
+    };
+
+    // The samples come from memory, which separates the interpolation from
+    // the unpacking of the source format
+    std::vector<uint8_t> cfa8(size_t(width) * height);
+    std::vector<uint16_t> cfa16(size_t(width) * height);
+    FillNoise(cfa8.data(), cfa8.size(), 8);
+    FillNoise(reinterpret_cast<uint8_t *>(cfa16.data()), cfa16.size() * 2, 16);
+    const Demosaic::LineSource<uint8_t> source8 = [&](uint32_t y, uint8_t *dst) {
+        std::memcpy(dst, cfa8.data() + size_t(y) * width, width);
+    };
+    const Demosaic::LineSource<uint16_t> source16 = [&](uint32_t y, uint16_t *dst) {
+        std::memcpy(dst, cfa16.data() + size_t(y) * width, size_t(width) * 2);
+    };
+
+    std::vector<uint8_t> rgb(size_t(width) * height * 8);
+    const ImageOrientation::LineWriter output8({}, width, height, 3, rgb.data(), size_t(width) * 3);
+    const ImageOrientation::LineWriter output16({}, width, height, 8, rgb.data(), size_t(width) * 8);
+    for (const auto &method : methods)
+    {
+        Report("Demosaic", method.first + "/8bit", "", width, height, "tight", width, [&]() {
+            Demosaic::Run<uint8_t>(method.second, rggb, width, height, source8, output8);
+            return 0;
+        });
+        Report("Demosaic", method.first + "/16bit", "", width, height, "tight", width * 2, [&]() {
+            Demosaic::Run<uint16_t>(method.second, rggb, width, height, source16, output16);
+            return 0;
+        });
+    }
+}
+
+void Bench::RunOrientation(const Resolution &resolution)
+{
+    const uint32_t width = resolution.width;
+    const uint32_t height = resolution.height;
+    const std::pair<QString, ImageOrientation::Rotation> rotations[] = {
+        { "FlipX", ImageOrientation::Rotation::None },
+        { "Rotate90", ImageOrientation::Rotation::Rotate90 },
+        { "Rotate180", ImageOrientation::Rotation::Rotate180 },
+    };
+
+    // Grayscale8, RGB888 and RGBX64 lines
+    for (uint32_t bytesPerPixel : { 1u, 3u, 8u })
+    {
+        const size_t lineBytes = size_t(width) * bytesPerPixel;
+        std::vector<uint8_t> source(lineBytes * height);
+        std::vector<uint8_t> destination(lineBytes * height);
+        FillNoise(source.data(), source.size(), bytesPerPixel);
+
+        for (const auto &rotation : rotations)
+        {
+            ImageOrientation::Orientation orientation;
+            orientation.flipX = rotation.second == ImageOrientation::Rotation::None;
+            orientation.rotation = rotation.second;
+            uint32_t orientedWidth = 0;
+            uint32_t orientedHeight = 0;
+            ImageOrientation::OrientedSize(orientation, width, height, orientedWidth, orientedHeight);
+            const ImageOrientation::LineWriter writer(orientation, width, height, bytesPerPixel,
+                                                      destination.data(), size_t(orientedWidth) * bytesPerPixel);
+
+            const QString variant = QString("%1/%2B").arg(rotation.first).arg(bytesPerPixel);
+            Report("Orientation", variant, "", width, height, "tight", uint32_t(lineBytes), [&]() {
+                ImageOrientation::LineWriter::Band band(writer);
+                for (uint32_t y = 0; y < height; y++)
+                {
+                    std::memcpy(band.Line(y), source.data() + y * lineBytes, lineBytes);
+                    band.Commit(y);
+                }
+                return 0;
+            });
+        }
+    }
+}
+
+void Bench::Run()
+{
+    for (const Resolution &resolution : s_Resolutions)
+    {
+        if (!Selected(m_Settings.sizes, resolution.name))
+        {
+            continue;
+        }
+
+        for (size_t i = 0; i < s_PixelFormatCount; i++)
+        {
+            const PixelFormatDescriptor &desc = s_PixelFormats[i];
+            if (!ImageTransform::CanConvert(desc.fourcc) || !Selected(m_Settings.formats, desc.name))
+            {
+                continue;
+            }
+
+            const uint32_t tight = desc.MinimumBytesPerLine(resolution.width);
+            if (Selected(m_Settings.strides, "tight"))
+            {
+                RunFormat(desc, resolution, "tight", tight);
+            }
+            // A compressed frame has no lines
+            if (Selected(m_Settings.strides, "padded") && desc.family != PixelFamily::Compressed)
+            {
+                RunFormat(desc, resolution, "padded", PaddedStride(tight));
+            }
+        }
+
+        if (Selected(m_Settings.kernels, "Demosaic"))
+        {
+            RunDemosaic(resolution);
+        }
+        if (Selected(m_Settings.kernels, "Orientation"))
+        {
+            RunOrientation(resolution);
+        }
+    }
+}
+
+QJsonObject Bench::Results() const
+{
+    QJsonObject document;
+    document["benchmark"] = "V4L2ViewerBench";
+    document["revision"] = QString(GIT_VERSION);
+    document["compiler"] = QString(__VERSION__);
+    document["threads"] = int(WorkerPool::Instance().Concurrency());
+    document["minTimeSeconds"] = m_Settings.minTime;
+    document["minIterations"] = m_Settings.minIterations;
+#ifdef HAS_ALLOCATION_COUNT
+    document["allocationsCounted"] = true;
+#else
+    document["allocationsCounted"] = false;
+#endif
+    document["results"] = m_Results;
+    return document;
+}
+
+// Golden mode: every format is converted from fixed patterns, including odd
+// sizes, padded lines and each Bayer phase the registry lists, and the
+// hashes of the results are compared with the ones stored in a file. The
+// hashes do not depend on the target, so x86 and ARM builds and their
+// vector code are held to the same results. Oriented and region
+// conversions are compared with the full unoriented image instead.
+// Compressed formats are left out, the decoded pixels depend on the JPEG
+// library.
+static const Resolution s_GoldenResolutions[] = {
+    { "Even", 64, 48 },
+    { "Odd", 37, 23 },
+    { "Banded", 331, 257 },     // several demosaic and flat-field bands
+};
+
+// The planes of a frame in the layout the converters expect: the only or
+// luma plane, then the chroma planes of the planar formats
+struct Plane
+{
+    size_t offset;
+    uint32_t bytesPerLine;
+    uint32_t lines;
+};
+
+static std::vector<Plane> PlanesOf(const PixelFormatDescriptor &desc, uint32_t height, uint32_t bytesPerLine)
+{
+    std::vector<Plane> planes = { { 0, bytesPerLine, height } };
+    if (desc.packing == SamplePacking::Planar || desc.packing == SamplePacking::SemiPlanar)
+    {
+        const uint32_t chromaLines = (height + (1u << desc.chromaShiftY) - 1) >> desc.chromaShiftY;
+        const uint32_t chromaBytesPerLine = desc.packing == SamplePacking::SemiPlanar
+            ? bytesPerLine
+            : (bytesPerLine + (1u << desc.chromaShiftX) - 1) >> desc.chromaShiftX;
+        const uint32_t chromaPlanes = desc.packing == SamplePacking::SemiPlanar ? 1 : 2;
+        for (uint32_t i = 0; i < chromaPlanes; i++)
+        {
+            const Plane &previous = planes.back();
+            planes.push_back({ previous.offset + size_t(previous.bytesPerLine) * previous.lines,
+                               chromaBytesPerLine, chromaLines });
+        }
+    }
+    return planes;
+}
+
+static uint32_t Mix(uint32_t a, uint32_t b, uint32_t c)
+{
+    uint32_t hash = a * 0x9e3779b1u ^ b * 0x85ebca77u ^ c * 0xc2b2ae3du;
+    hash ^= hash >> 15;
+    hash *= 0x2c1b3c6du;
+    hash ^= hash >> 12;
+    return hash;
+}
+
+// Bands of four lines with ramps, noise and alternating extremes, which
+// covers rounding, every bit of the packed formats and clamping
+static uint8_t PatternByte(uint32_t plane, uint32_t line, uint32_t column)
+{
+    switch ((line / 4) % 3)
+    {
+    case 0:  return uint8_t(column * 7 + line * 3 + plane * 64);
+    case 1:  return uint8_t(Mix(plane, line, column) >> 24);
+    default: return ((column / 3 + line) & 1) ? 0xff : 0x00;
+    }
+}
+
+// This function fills a frame with the pattern. The bytes past the pattern,
+// the padding of wider lines, get noise of their own, so that a converter
+// reading them changes the result.
+static std::unique_ptr<SyntheticFrame> MakePatternFrame(const PixelFormatDescriptor &desc, uint32_t width,
+                                                        uint32_t height, uint32_t bytesPerLine)
+{
+    const std::vector<Plane> planes = PlanesOf(desc, height, bytesPerLine);
+    const std::vector<Plane> tightPlanes = PlanesOf(desc, height, desc.MinimumBytesPerLine(width));
+
+    auto frame = std::make_unique<SyntheticFrame>();
+    frame->data.resize(planes.back().offset + size_t(planes.back().bytesPerLine) * planes.back().lines);
+    for (uint32_t p = 0; p < planes.size(); p++)
+    {
+        for (uint32_t line = 0; line < planes[p].lines; line++)
+        {
+            uint8_t *dst = frame->data.data() + planes[p].offset + size_t(line) * planes[p].bytesPerLine;
+            for (uint32_t column = 0; column < planes[p].bytesPerLine; column++)
+            {
+                dst[column] = column < tightPlanes[p].bytesPerLine ? PatternByte(p, line, column)
+                                                                   : uint8_t(Mix(p + 16, line, column));
+            }
+        }
+    }
+
+    BufferWrapper &buffer = frame->buffer;
+    std::memset(&buffer, 0, sizeof(buffer));
+    buffer.data = frame->data.data();
+    buffer.length = frame->data.size();
+    buffer.width = width;
+    buffer.height = height;
+    buffer.pixelFormat = desc.fourcc;
+    buffer.payloadSize = uint32_t(frame->data.size());
+    buffer.bytesPerLine = bytesPerLine;
+    return frame;
+}
+
+// 64 bit FNV-1a
+static uint64_t Hash(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = static_cast<const uint8_t *>(data);
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+static const uint64_t s_HashSeed = 0xcbf29ce484222325ull;
+
+// This function hashes the size, format and pixels of an image, without the
+// padding at the end of its lines
+static QString ImageHash(const QImage &image)
+{
+    const int32_t header[3] = { image.width(), image.height(), int32_t(image.format()) };
+    uint64_t hash = Hash(s_HashSeed, header, sizeof(header));
+    const size_t lineBytes = (size_t(image.width()) * image.depth() + 7) / 8;
+    for (int y = 0; y < image.height(); y++)
+    {
+        hash = Hash(hash, image.constScanLine(y), lineBytes);
+    }
+    return QString("%1").arg(qulonglong(hash), 16, 16, QChar('0'));
+}
+
+// This function returns the pixel bytes of an image, without the padding of
+// its lines
+static QByteArray ImageBytes(const QImage &image)
+{
+    const int lineBytes = (image.width() * image.depth() + 7) / 8;
+    QByteArray bytes;
+    bytes.reserve(lineBytes * image.height());
+    for (int y = 0; y < image.height(); y++)
+    {
+        bytes.append(reinterpret_cast<const char *>(image.constScanLine(y)), lineBytes);
+    }
+    return bytes;
+}
+
+// This function hashes the pattern bytes of a frame, without the padding
+static QString FrameHash(const PixelFormatDescriptor &desc, const BufferWrapper &frame, const uint8_t *data)
+{
+    const std::vector<Plane> planes = PlanesOf(desc, frame.height, frame.bytesPerLine);
+    const std::vector<Plane> tightPlanes = PlanesOf(desc, frame.height, desc.MinimumBytesPerLine(frame.width));
+    uint64_t hash = Hash(s_HashSeed, &frame.pixelFormat, sizeof(frame.pixelFormat));
+    for (size_t p = 0; p < planes.size(); p++)
+    {
+        for (uint32_t line = 0; line < planes[p].lines; line++)
+        {
+            hash = Hash(hash, data + planes[p].offset + size_t(line) * planes[p].bytesPerLine, tightPlanes[p].bytesPerLine);
+        }
+    }
+    return QString("%1").arg(qulonglong(hash), 16, 16, QChar('0'));
+}
+
+// This function checks an oriented conversion pixel by pixel against the
+// unoriented one, which the golden hash already covers
+static bool MatchesOrientation(const QImage &identity, const QImage &oriented,
+                               const ImageOrientation::Orientation &orientation)
+{
+    uint32_t width = 0;
+    uint32_t height = 0;
+    ImageOrientation::OrientedSize(orientation, uint32_t(identity.width()), uint32_t(identity.height()), width, height);
+    if (oriented.format() != identity.format() || uint32_t(oriented.width()) != width ||
+        uint32_t(oriented.height()) != height)
+    {
+        return false;
+    }
+
+    const size_t bytesPerPixel = size_t(identity.depth()) / 8;
+    for (uint32_t y = 0; y < height; y++)
+    {
+        const uint8_t *line = oriented.constScanLine(int(y));
+        for (uint32_t x = 0; x < width; x++)
+        {
+            double sourceX = x + 0.5;
+            double sourceY = y + 0.5;
+            ImageOrientation::MapToFrame(orientation, uint32_t(identity.width()), uint32_t(identity.height()),
+                                         sourceX, sourceY);
+            const uint8_t *expected = identity.constScanLine(int(sourceY)) + size_t(sourceX) * bytesPerPixel;
+            if (std::memcmp(line + x * bytesPerPixel, expected, bytesPerPixel) != 0)
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The orientations besides the identity that lead to different results
+static std::vector<ImageOrientation::Orientation> DistinctOrientations()
+{
+    std::vector<ImageOrientation::Orientation> orientations;
+    for (int rotation : { 0, 90 })
+    {
+        for (int flips = 0; flips < 4; flips++)
+        {
+            ImageOrientation::Orientation orientation;
+            orientation.flipX = flips & 1;
+            orientation.flipY = flips & 2;
+            orientation.rotation = ImageOrientation::RotationFromDegrees(rotation);
+            if (!orientation.IsIdentity())
+            {
+                orientations.push_back(orientation);
+            }
+        }
+    }
+    return orientations;
+}
+
+// Parts of a frame that the region conversion is checked with: single
+// pixels, odd offsets and sizes, and parts reaching over the edges
+static std::vector<QRect> GoldenRegions(uint32_t width, uint32_t height)
+{
+    const int w = int(width);
+    const int h = int(height);
+    return { QRect(0, 0, 1, 1), QRect(w - 1, h - 1, 1, 1), QRect(w / 2 + 1, h / 3 + 1, 1, 1),
+             QRect(3, 5, w / 3, h / 4), QRect(w / 2 - 1, h / 2 - 3, w, h), QRect(-2, 1, w, h - 2) };
+}
+
+// This function checks a region conversion against the same part of the
+// full conversion, unoriented and with a quarter turn
+static bool MatchesRegion(const BufferWrapper &frame, const QRect &region, const QImage &full,
+                          const ImageTransform::ConversionOptions &options)
+{
+    // Output pixel i of a downscaled image is taken from input pixel i * step
+    const int step = std::max(1, options.downscale);
+    const QRect clipped = region.intersected(QRect(0, 0, int(frame.width), int(frame.height)));
+    const int x0 = (clipped.left() + step - 1) / step;
+    const int y0 = (clipped.top() + step - 1) / step;
+    const int x1 = std::min(clipped.right() / step + 1, full.width());
+    const int y1 = std::min(clipped.bottom() / step + 1, full.height());
+
+    QImage part;
+    const int result = ImageTransform::ConvertFrame(frame, region, part, options);
+    if (clipped.isEmpty() || x0 >= x1 || y0 >= y1)
+    {
+        return result != 0;
+    }
+    if (result != 0 || part.format() != full.format() || part.width() != x1 - x0 || part.height() != y1 - y0)
+    {
+        return false;
+    }
+    const size_t bytesPerPixel = size_t(full.depth()) / 8;
+    for (int y = y0; y < y1; y++)
+    {
+        if (std::memcmp(part.constScanLine(y - y0), full.constScanLine(y) + x0 * bytesPerPixel,
+                        (x1 - x0) * bytesPerPixel) != 0)
+        {
+            return false;
+        }
+    }
+
+    ImageTransform::ConversionOptions rotated = options;
+    rotated.orientation.flipX = true;
+    rotated.orientation.rotation = ImageOrientation::Rotation::Rotate90;
+    QImage orientedPart;
+    return ImageTransform::ConvertFrame(frame, region, orientedPart, rotated) == 0 &&
+           MatchesOrientation(part, orientedPart, rotated.orientation);
+}
+
+// Golden file: one "format size variant hash" line per case, # starts a comment
+static bool LoadGolden(const QString &path, QMap<QString, QString> &hashes)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    for (const QByteArray &line : file.readAll().split('\n'))
+    {
+        const QString text = QString::fromUtf8(line).trimmed();
+        if (text.isEmpty() || text.startsWith('#'))
+        {
+            continue;
+        }
+        const QStringList fields = text.split(' ', Qt::SkipEmptyParts);
+        if (fields.size() != 4)
+        {
+            std::fprintf(stderr, "Malformed golden entry: %s\n", qPrintable(text));
+            return false;
+        }
+        hashes[fields.mid(0, 3).join(' ')] = fields[3];
+    }
+    return true;
+}
+
+static bool SaveGolden(const QString &path, const QMap<QString, QString> &hashes)
+{
+    QByteArray text = "# Hashes of the conversions by V4L2ViewerBench --golden,\n"
+                      "# rewrite with --update-golden after an intended change of the output\n";
+    for (auto it = hashes.constBegin(); it != hashes.constEnd(); ++it)
+    {
+        text.append((it.key() + ' ' + it.value() + '\n').toUtf8());
+    }
+    QFile file(path);
+    return file.open(QIODevice::WriteOnly | QIODevice::Truncate) && file.write(text) == text.size();
+}
+
+// Flat-field maps of the golden cases: offsets, gains from 0.75 to 1.25 and
+// defects at the corners and scattered over the frame
+static FlatFieldCorrection GoldenFlatField(const PixelFormatDescriptor &desc, uint32_t width, uint32_t height)
+{
+    const size_t pixels = size_t(width) * height;
+    std::vector<uint16_t> dark(pixels);
+    std::vector<uint16_t> gain(pixels);
+    for (size_t index = 0; index < pixels; index++)
+    {
+        dark[index] = uint16_t(Mix(1, uint32_t(index), 0) % 24);
+        gain[index] = uint16_t((3u << (FlatFieldCorrection::s_GainShift - 2)) +
+                               Mix(2, uint32_t(index), 0) % (1u << (FlatFieldCorrection::s_GainShift - 1)));
+    }
+    std::vector<uint32_t> defects = { 0, width - 1, width + 1, uint32_t(pixels - 1) };
+    for (size_t index = 97; index < pixels - 1; index += 211)
+    {
+        defects.push_back(uint32_t(index));
+    }
+    std::sort(defects.begin(), defects.end());
+
+    return FlatFieldCorrection(desc.fourcc, width, height, std::move(dark), std::move(gain), std::move(defects));
+}
+
+// This function runs the golden cases and compares them with, or with update
+// stores them in, the golden file
+//
+// Returns:
+// (int) - process exit code, 0 when every case matched
+static int RunGolden(const Settings &settings, const QString &path, bool update)
+{
+    QMap<QString, QString> golden;
+    const bool complete = settings.formats.isEmpty() && settings.sizes.isEmpty();
+    if (!LoadGolden(path, golden) && !update)
+    {
+        std::fprintf(stderr, "Failed to read %s\n", qPrintable(path));
+        return 1;
+    }
+    if (update && complete)
+    {
+        // A full run drops the entries of cases that no longer exist
+        golden.clear();
+    }
+
+    const std::vector<ImageOrientation::Orientation> orientations = DistinctOrientations();
+    int cases = 0;
+    int failures = 0;
+
+    // This function compares a result with the golden one. In update mode
+    // the tight stride run defines the hash and the padded one must match.
+    const auto check = [&](const QString &key, const QString &value, bool defines) {
+        cases++;
+        if (update && defines)
+        {
+            golden[key] = value;
+            return;
+        }
+        const QString expected = golden.value(key);
+        if (expected != value)
+        {
+            failures++;
+            std::fprintf(stderr, "FAIL %s: %s, expected %s\n", qPrintable(key), qPrintable(value),
+                         expected.isEmpty() ? "no entry" : qPrintable(expected));
+        }
+    };
+
+    for (const Resolution &resolution : s_GoldenResolutions)
+    {
+        if (!settings.sizes.isEmpty() && !settings.sizes.contains(resolution.name, Qt::CaseInsensitive))
+        {
+            continue;
+        }
+        const uint32_t width = resolution.width;
+        const uint32_t height = resolution.height;
+        const QString size = QString("%1x%2").arg(width).arg(height);
+
+        for (size_t i = 0; i < s_PixelFormatCount; i++)
+        {
+            const PixelFormatDescriptor &desc = s_PixelFormats[i];
+            if (!ImageTransform::CanConvert(desc.fourcc) || desc.family == PixelFamily::Compressed ||
+                (!settings.formats.isEmpty() && !settings.formats.contains(desc.name, Qt::CaseInsensitive)))
+            {
+                continue;
+            }
+            const QString format = desc.name;
+            const uint32_t tight = desc.MinimumBytesPerLine(width);
+
+            for (uint32_t bytesPerLine : { tight, PaddedStride(tight) })
+            {
+                const bool padded = bytesPerLine != tight;
+                const std::unique_ptr<SyntheticFrame> frame = MakePatternFrame(desc, width, height, bytesPerLine);
+
+                for (const auto &variant : ConversionVariants(desc))
+                {
+                    const QString key = format + ' ' + size + ' ' + variant.first;
+                    QImage image;
+                    const int result = ImageTransform::ConvertFrame(frame->buffer, image, variant.second);
+                    check(key, result == 0 ? ImageHash(image) : QString("error%1").arg(result), !padded);
+                    if (result != 0 || padded)
+                    {
+                        continue;
+                    }
+
+                    for (const ImageOrientation::Orientation &orientation : orientations)
+                    {
+                        ImageTransform::ConversionOptions options = variant.second;
+                        options.orientation = orientation;
+                        QImage oriented;
+                        cases++;
+                        if (ImageTransform::ConvertFrame(frame->buffer, oriented, options) != 0 ||
+                            !MatchesOrientation(image, oriented, orientation))
+                        {
+                            failures++;
+                            std::fprintf(stderr, "FAIL %s: flipX %d flipY %d rotation %d differs from the unoriented image\n",
+                                         qPrintable(key), orientation.flipX, orientation.flipY, orientation.Degrees());
+                        }
+                    }
+
+                    for (const QRect &region : GoldenRegions(width, height))
+                    {
+                        cases++;
+                        if (!MatchesRegion(frame->buffer, region, image, variant.second))
+                        {
+                            failures++;
+                            std::fprintf(stderr, "FAIL %s: region %d,%d %dx%d differs from the full image\n",
+                                         qPrintable(key), region.x(), region.y(), region.width(), region.height());
+                        }
+                    }
+                }
+
+                if (desc.family == PixelFamily::Mono || desc.family == PixelFamily::Bayer)
+                {
+                    const FlatFieldCorrection correction = GoldenFlatField(desc, width, height);
+                    std::vector<uint8_t> data = frame->data;
+                    const int result = correction.Apply(frame->buffer, data.data());
+                    check(format + ' ' + size + " FlatField",
+                          result == 0 ? FrameHash(desc, frame->buffer, data.data()) : QString("error%1").arg(result),
+                          !padded);
+                }
+            }
+        }
+    }
+
+    if (update)
+    {
+        if (!SaveGolden(path, golden))
+        {
+            std::fprintf(stderr, "Failed to write %s\n", qPrintable(path));
+            return 1;
+        }
+        std::fprintf(stderr, "%d cases, %d failed, %d hashes written to %s\n", cases, failures, golden.size(),
+                     qPrintable(path));
+    }
+    else
+    {
+        std::fprintf(stderr, "%d cases, %d failed\n", cases, failures);
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+// This function converts every golden case, tight and padded, with the
+// vector kernels and again with the scalar code they fall back to, and
+// compares the results byte for byte. Unlike the golden hashes this needs
+// no file and names the first differing byte.
+//
+// Returns:
+// (int) - process exit code, 0 when every case matched
+static int RunScalarComparison(const Settings &settings)
+{
+    int cases = 0;
+    int failures = 0;
+
+    // This function runs work with and without the vector kernels and
+    // compares the bytes each run returns
+    const auto compare = [&](const QString &key, const std::function<QByteArray()> &work) {
+        cases++;
+        ImageTransform::SetVectorKernels(true);
+        const QByteArray vector = work();
+        ImageTransform::SetVectorKernels(false);
+        const QByteArray scalar = work();
+        ImageTransform::SetVectorKernels(true);
+        if (vector != scalar)
+        {
+            int offset = 0;
+            while (offset < std::min(vector.size(), scalar.size()) && vector[offset] == scalar[offset])
+            {
+                offset++;
+            }
+            failures++;
+            std::fprintf(stderr, "FAIL %s: scalar result differs from the vector one at byte %d\n", qPrintable(key), offset);
+        }
+    };
+
+    for (const Resolution &resolution : s_GoldenResolutions)
+    {
+        if (!settings.sizes.isEmpty() && !settings.sizes.contains(resolution.name, Qt::CaseInsensitive))
+        {
+            continue;
+        }
+        const uint32_t width = resolution.width;
+        const uint32_t height = resolution.height;
+        const QString size = QString("%1x%2").arg(width).arg(height);
+
+        for (size_t i = 0; i < s_PixelFormatCount; i++)
+        {
+            const PixelFormatDescriptor &desc = s_PixelFormats[i];
+            if (!ImageTransform::CanConvert(desc.fourcc) || desc.family == PixelFamily::Compressed ||
+                (!settings.formats.isEmpty() && !settings.formats.contains(desc.name, Qt::CaseInsensitive)))
+            {
+                continue;
+            }
+            const uint32_t tight = desc.MinimumBytesPerLine(width);
+
+            for (uint32_t bytesPerLine : { tight, PaddedStride(tight) })
+            {
+                const QString prefix = QString(desc.name) + ' ' + size + (bytesPerLine != tight ? " padded " : " tight ");
+                const std::unique_ptr<SyntheticFrame> frame = MakePatternFrame(desc, width, height, bytesPerLine);
+
+                for (const auto &variant : ConversionVariants(desc))
+                {
+                    compare(prefix + variant.first, [&]() {
+                        QImage image;
+                        const int result = ImageTransform::ConvertFrame(frame->buffer, image, variant.second);
+                        return result == 0 ? ImageBytes(image) : QByteArray("error") + QByteArray::number(result);
+                    });
+                }
+
+                if (desc.family == PixelFamily::Mono || desc.family == PixelFamily::Bayer)
+                {
+                    const FlatFieldCorrection correction = GoldenFlatField(desc, width, height);
+                    compare(prefix + "FlatField", [&]() {
+                        QByteArray data(reinterpret_cast<const char *>(frame->data.data()), int(frame->data.size()));
+                        const int result = correction.Apply(frame->buffer, reinterpret_cast<uint8_t *>(data.data()));
+                        return result == 0 ? data : QByteArray("error") + QByteArray::number(result);
+                    });
+                }
+            }
+        }
+    }
+
+    std::fprintf(stderr, "%d cases, %d failed\n", cases, failures);
+    return failures == 0 ? 0 : 1;
+}
+
+static QStringList SplitList(const QStringList &values)
+{
+    QStringList items;
+    for (const QString &value : values)
+    {
+        for (const QString &item : value.split(',', Qt::SkipEmptyParts))
+        {
+            items.append(item.trimmed());
+        }
+    }
+    return items;
+}
+
+int main(int argc, char *argv[])
+{
+    // The JPEG encoder and decoder plugins need the application object
+    QCoreApplication application(argc, argv);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Throughput of the V4L2 Viewer frame conversions");
+    parser.addHelpOption();
+    QCommandLineOption formatOption("format", "Pixel formats by name, e.g. RGGB,pRAA (default all).", "names");
+    QCommandLineOption sizeOption("size", "Resolutions: VGA, HD, FHD, 5MP, 12MP, 20MP (default all).", "names");
+    QCommandLineOption kernelOption("kernel", "Kernels: ConvertFrame, Statistics, FlatField, Demosaic, Orientation (default all).", "names");
+    QCommandLineOption strideOption("stride", "Strides: tight, padded (default both).", "names");
+    QCommandLineOption timeOption("min-time", "Minimum time per case in milliseconds (default 300).", "ms", "300");
+    QCommandLineOption iterationOption("iterations", "Minimum iterations per case (default 5).", "count", "5");
+    QCommandLineOption outputOption("output", "Write the JSON results to a file instead of stdout.", "path");
+    QCommandLineOption listOption("list", "List pixel formats, resolutions and kernels.");
+    QCommandLineOption goldenOption("golden", "Check the conversion results against the hashes in a golden file "
+                                    "instead of timing them. --format and --size (Even, Odd, Banded) select cases.", "path");
+    QCommandLineOption updateGoldenOption("update-golden", "With --golden, write the hashes of this build to the file.");
+    QCommandLineOption compareScalarOption("compare-scalar", "Check that the golden cases give the same bytes with the "
+                                           "vector kernels disabled. --format and --size select cases.");
+    parser.addOptions({ formatOption, sizeOption, kernelOption, strideOption, timeOption, iterationOption,
+                        outputOption, listOption, goldenOption, updateGoldenOption, compareScalarOption });
+    parser.process(application);
+
+    if (parser.isSet(listOption))
+    {
+        std::printf("Formats:");
+        for (size_t i = 0; i < s_PixelFormatCount; i++)
+        {
+            if (ImageTransform::CanConvert(s_PixelFormats[i].fourcc))
+            {
+                std::printf(" %s", s_PixelFormats[i].name);
+            }
+        }
+        std::printf("\nResolutions:");
+        for (const Resolution &resolution : s_Resolutions)
+        {
+            std::printf(" %s (%ux%u)", resolution.name, resolution.width, resolution.height);
+        }
+        std::printf("\nKernels:");
+        for (const char *kernel : s_Kernels)
+        {
+            std::printf(" %s", kernel);
+        }
+        std::printf("\n");
+        return 0;
+    }
+
+    Settings settings;
+    settings.formats = SplitList(parser.values(formatOption));
+    settings.sizes = SplitList(parser.values(sizeOption));
+    settings.kernels = SplitList(parser.values(kernelOption));
+    settings.strides = SplitList(parser.values(strideOption));
+    settings.minTime = std::max(0.0, parser.value(timeOption).toDouble()) / 1000.0;
+    settings.minIterations = std::max(1, parser.value(iterationOption).toInt());
+    settings.maxIterations = std::max(settings.minIterations, settings.maxIterations);
+
+    if (parser.isSet(goldenOption))
+    {
+        return RunGolden(settings, parser.value(goldenOption), parser.isSet(updateGoldenOption));
+    }
+    if (parser.isSet(compareScalarOption))
+    {
+        return RunScalarComparison(settings);
+    }
+
+    Bench bench(settings);
+    bench.Run();
+    const QByteArray json = QJsonDocument(bench.Results()).toJson();
+
+    if (parser.isSet(outputOption))
+    {
+        QFile file(parser.value(outputOption));
+        if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size())
+        {
+            std::fprintf(stderr, "Failed to write %s\n", qPrintable(parser.value(outputOption)));
+            return 1;
+        }
+        return 0;
+    }
+    std::fwrite(json.constData(), 1, size_t(json.size()), stdout);
+    return 0;
+}
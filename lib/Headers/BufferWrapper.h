@@ -16,6 +16,10 @@ struct BufferWrapper
     uint32_t payloadSize;
     uint32_t bytesPerLine;
     uint64_t frameID;
+    // Colorimetry of YUV formats as enum v4l2_ycbcr_encoding and enum
+    // v4l2_quantization, the defaults already resolved for the format
+    uint32_t ycbcrEnc;
+    uint32_t quantization;
 };
 
 #endif
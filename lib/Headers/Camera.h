@@ -127,6 +127,16 @@ public:
     // Returns:
     // (int) - result of the reading
     int ReadFrameSize(uint32_t &width, uint32_t &height);
+    // This function reads the colorimetry of YUV formats, the driver's
+    // defaults resolved for the current colorspace and frame size
+    //
+    // Parameters:
+    // [out] (uint32_t &) ycbcrEnc - enum v4l2_ycbcr_encoding
+    // [out] (uint32_t &) quantization - enum v4l2_quantization
+    //
+    // Returns:
+    // (int) - result of the reading
+    int ReadColorimetry(uint32_t &ycbcrEnc, uint32_t &quantization);
     // This function sets frame size
     //
     // Parameters:
@@ -9,6 +9,8 @@
 
 #include "Camera.h"
 #include "BufferWrapper.h"
+#include "SoftwareAutoControl.h"
+#include "FlatFieldCorrection.h"
 
 class FrameStreamServer;
 class VideoRecorder;
@@ -60,6 +62,22 @@ public:
     Q_INVOKABLE QJsonObject getWhiteBalance();
     Q_INVOKABLE QJsonObject setAutoWhiteBalance(bool enabled);
 
+    // Color correction
+    Q_INVOKABLE QJsonObject getColorCorrection();
+    Q_INVOKABLE QJsonObject setColorCorrection(const QJsonObject &profile);
+
+    // Software auto exposure and white balance
+    Q_INVOKABLE QJsonObject getSoftwareAuto();
+    Q_INVOKABLE QJsonObject setSoftwareAutoExposure(bool enabled);
+    Q_INVOKABLE QJsonObject setSoftwareWhiteBalance(const QString &mode);
+
+    // Flat-field and defect pixel correction
+    Q_INVOKABLE QJsonObject getFlatField();
+    Q_INVOKABLE QJsonObject startFlatFieldCapture(const QString &reference, int frames);
+    Q_INVOKABLE QJsonObject buildFlatField();
+    Q_INVOKABLE QJsonObject loadFlatField();
+    Q_INVOKABLE QJsonObject setFlatFieldEnabled(bool enabled);
+
     // Frame rate
     Q_INVOKABLE QJsonObject getFrameRate();
     Q_INVOKABLE QJsonObject setFrameRate(double hz);
@@ -73,6 +91,10 @@ public:
     Q_INVOKABLE QJsonObject setFlipX(bool enabled);
     Q_INVOKABLE QJsonObject setFlipY(bool enabled);
 
+    // Software flip and rotation of the stream, snapshots and recordings
+    Q_INVOKABLE QJsonObject getOrientation();
+    Q_INVOKABLE QJsonObject setOrientation(bool flipX, bool flipY, int rotation);
+
     // Format / Size
     Q_INVOKABLE QJsonObject getPixelFormats();
     Q_INVOKABLE QJsonObject setPixelFormat(const QString &fmt);
@@ -101,6 +123,10 @@ public:
     Q_INVOKABLE QJsonObject saveImageDialog();
     Q_INVOKABLE QJsonObject getStats();
 
+    // HTTP MJPEG and snapshot endpoints
+    Q_INVOKABLE QJsonObject getHttpServer();
+    Q_INVOKABLE QJsonObject setHttpServer(bool enabled, const QString &address, int port);
+
 signals:
     void cameraListChanged(const QJsonObject &data);
     void openStateChanged(bool open);
@@ -152,6 +178,8 @@ private:
     uint32_t pixelFormatFromString(const QString &str);
 
     Camera m_Camera;
+    SoftwareAutoControl m_softwareAutoControl;
+    FlatFieldCalibration m_flatFieldCalibration;
     FrameStreamServer *m_pFrameServer;
     bool m_bIsOpen = false;
     bool m_bIsStreaming = false;
@@ -176,7 +204,9 @@ private:
 
     bool m_blockingMode = true;
     IO_METHOD_TYPE m_ioMethod = IO_METHOD_USERPTR;
-    int32_t m_numFrames = 5;
+    // Enough for the stream encoders, the waiting frame and the snapshot
+    // frame to hold one each while the driver still has buffers to fill
+    int32_t m_numFrames = 8;
     int m_savedFrameCounter = 0;
 
     // Throttled frame info — updated per-frame, emitted on stats timer
@@ -0,0 +1,75 @@
+#ifndef COLORCORRECTION_H
+#define COLORCORRECTION_H
+
+#include <QJsonObject>
+#include <QString>
+
+#include <cstdint>
+#include <functional>
+#include <memory>
+
+// Parameters of the software ISP, in the order they are applied
+struct ColorCorrectionSettings
+{
+    bool enabled = false;
+    double blackLevel = 0.0;                            // fraction of full scale
+    double gains[3] = { 1.0, 1.0, 1.0 };                // white balance of R, G and B
+    double matrix[9] = { 1.0, 0.0, 0.0,                 // color correction matrix, row major
+                         0.0, 1.0, 0.0,
+                         0.0, 0.0, 1.0 };
+    double gamma = 1.0;                                 // output = input ^ (1 / gamma)
+};
+
+// Software ISP for Bayer sensors without one. The demosaic applies it to
+// every line right after interpolating it, while the line is still in the
+// cache, so correct colors cost no additional pass over the frame. Black
+// level, gains and matrix are folded into one fixed point matrix, the gamma
+// curve is a lookup table. Both are built once per settings change, along
+// with per sample tables that spare 8 bit frames the multiplications.
+class ColorCorrection
+{
+public:
+    explicit ColorCorrection(const ColorCorrectionSettings &settings);
+
+    const ColorCorrectionSettings &Settings() const { return m_Settings; }
+
+    // These functions correct count RGB888 or RGBX64 pixels in place
+    void Apply(uint8_t *rgb, uint32_t count) const;
+    void Apply(uint16_t *rgbx, uint32_t count) const;
+
+    // The correction shared by preview, streaming and snapshots. Current()
+    // returns null while it is disabled.
+    static std::shared_ptr<const ColorCorrection> Current();
+    static ColorCorrectionSettings CurrentSettings();
+    static void SetCurrent(const ColorCorrectionSettings &settings);
+    // This function changes the current settings in place: change gets a
+    // copy of them and returns false to keep them as they are. Changes
+    // don't interleave, so one only touching the gains keeps whatever
+    // another made to the rest meanwhile. Returns what change returned.
+    static bool UpdateCurrent(const std::function<bool(ColorCorrectionSettings &)> &change);
+
+    // JSON profile: { "enabled", "blackLevel", "gains": [3], "matrix": [9], "gamma" }.
+    // Missing keys keep the values of settings, malformed ones fail.
+    static QJsonObject ToJson(const ColorCorrectionSettings &settings);
+    static bool FromJson(const QJsonObject &json, ColorCorrectionSettings &settings);
+    static bool LoadProfile(const QString &path, ColorCorrectionSettings &settings);
+    static bool SaveProfile(const QString &path, const ColorCorrectionSettings &settings);
+
+private:
+    // What one input sample adds to the R, G and B sums, padded to 16 bytes
+    struct alignas(16) Contribution
+    {
+        int32_t value[4];
+    };
+
+    ColorCorrectionSettings m_Settings;
+    int32_t m_Black;                        // 12 bit
+    int32_t m_Matrix[9];                    // 10 fractional bits
+    Contribution m_Contribution[3][256];    // black level, gains and matrix for 8 bit samples
+    bool m_Diagonal;                        // the matrix does not mix channels
+    uint8_t m_Direct8[3][256];              // complete mapping of 8 bit samples for a diagonal matrix
+    uint8_t m_Lut8[4096];
+    uint16_t m_Lut16[4096];
+};
+
+#endif // COLORCORRECTION_H
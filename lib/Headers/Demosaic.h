@@ -0,0 +1,56 @@
+#ifndef DEMOSAIC_H
+#define DEMOSAIC_H
+
+#include "ImageOrientation.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+
+class ColorCorrection;
+
+// CPU demosaicing of Bayer frames with a choice between speed and quality.
+// Lines are split into their even and odd columns when they enter the
+// sliding window, so all methods run as unit stride loops the compiler can
+// vectorize. The frame is cut into bands of lines that run on the WorkerPool.
+namespace Demosaic
+{
+    enum class Method
+    {
+        Nearest,        // every pixel takes the colors of its 2x2 CFA cell, fastest
+        Bilinear,       // average of the closest samples of each color
+        MalvarHeCutler  // bilinear with gradient correction, sharper and less color fringing
+    };
+
+    // Positions of the colors inside a 2x2 CFA cell, as index into { row0[0], row0[1], row1[0], row1[1] }
+    struct CfaCell
+    {
+        int red;
+        int green0;
+        int green1;
+        int blue;
+    };
+
+    // Fetches line y of the CFA as width samples into dst
+    template <typename T>
+    using LineSource = std::function<void(uint32_t y, T *dst)>;
+
+    // This function demosaics a CFA of at least 2x2 samples into output. 8 bit
+    // samples produce RGB888 lines, 16 bit samples RGBX64 lines. Samples
+    // outside the frame are mirrored at the border.
+    //
+    // Parameters:
+    // [in] (Method) method
+    // [in] (const CfaCell &) cell - color layout of the top left cell
+    // [in] (uint32_t) width - width of the frame
+    // [in] (uint32_t) height - height of the frame
+    // [in] (const LineSource<T> &) source - called concurrently from several threads
+    // [in] (const ImageOrientation::LineWriter &) output - places the lines in the oriented image
+    // [in] (const ColorCorrection *) correction - applied to each output line while it is in the cache, may be null
+    template <typename T>
+    void Run(Method method, const CfaCell &cell, uint32_t width, uint32_t height,
+             const LineSource<T> &source, const ImageOrientation::LineWriter &output,
+             const ColorCorrection *correction = nullptr);
+}
+
+#endif // DEMOSAIC_H
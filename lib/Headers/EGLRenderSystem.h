@@ -21,8 +21,7 @@ public:
     EGLRenderSystem();
     ~EGLRenderSystem();
     void SetScaleFactor(double scale) override;
-    void SetFlipX(bool flip);
-    void SetFlipY(bool flip);
+    void SetOrientation(const ImageOrientation::Orientation &orientation) override;
 
     QWidget* GetWidget() const override;
     void PassFrame(BufferWrapper const& buffer, std::function<void()> doneCallback) override;
@@ -50,8 +49,7 @@ private:
     QScrollBar *verticalScrollbar;
     QScrollBar *horizontalScrollbar;
     EGLRenderWidget *glWidget;
-    bool flipX = false;
-    bool flipY = false;
+    ImageOrientation::Orientation orientation;
     int curWidth = 0;
     int curHeight = 0;
     int curPixelformat = 0;
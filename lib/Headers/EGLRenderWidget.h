@@ -8,6 +8,7 @@
 #include <QOpenGLTexture>
 #include <QMutex>
 #include "BufferWrapper.h"
+#include "ImageOrientation.h"
 #include <string>
 #include <memory>
 
@@ -34,8 +35,7 @@ class EGLRenderWidget: public QOpenGLWidget, protected QOpenGLFunctions {
     QMatrix4x4 fullMatrix;
     QMatrix4x4 frameMatrix;
     QMatrix4x4 viewMatrix;
-    bool flipX = false;
-    bool flipY = false;
+    ImageOrientation::Orientation orientation;
     float scale = 1.0f;
     float scrollX = 0.0f;
     float scrollY = 0.0f;
@@ -65,7 +65,7 @@ protected:
 public:
     void setFormat(int width, int height, int pixelformat);
     void setScale(float scale);
-    void setFlip(bool flipX, bool flipY);
+    void setOrientation(const ImageOrientation::Orientation &orientation);
     EGLRenderWidget(std::function<void()> onDraw);
     ~EGLRenderWidget();
     void nextFrame(BufferWrapper const& buffer, std::function<void()> doneCallback);
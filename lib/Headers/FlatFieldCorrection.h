@@ -0,0 +1,143 @@
+#ifndef FLATFIELDCORRECTION_H
+#define FLATFIELDCORRECTION_H
+
+#include "BufferWrapper.h"
+
+#include <QString>
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Per pixel offset and gain correction plus defect pixel replacement for
+// raw mono and Bayer frames. The maps are built from averaged dark and flat
+// frames, stored on disk and applied in place to every received frame before
+// any consumer sees it. The correction runs in 16 bit lanes over bands of
+// lines on the WorkerPool, reading 4 bytes of map per pixel, so it is bound
+// by memory bandwidth rather than arithmetic.
+//
+// The dark map holds the whole dark level of each pixel, including the
+// pedestal the sensor adds to every sample. The mean dark level of each CFA
+// position is added back after the gain, so corrected frames keep the black
+// level of the uncorrected ones: the blackLevel of ColorCorrection removes
+// the pedestal once, whether or not flat-field maps are active.
+class FlatFieldCorrection
+{
+public:
+    // Gains are fixed point with this many fractional bits, 1.0 = 16384
+    static const int s_GainShift = 14;
+
+    FlatFieldCorrection(uint32_t pixelFormat, uint32_t width, uint32_t height,
+                        std::vector<uint16_t> dark, std::vector<uint16_t> gain,
+                        std::vector<uint32_t> defects);
+
+    uint32_t PixelFormat() const { return m_PixelFormat; }
+    uint32_t Width() const { return m_Width; }
+    uint32_t Height() const { return m_Height; }
+    size_t DefectCount() const { return m_Defects.size(); }
+
+    // This function corrects a frame in place
+    //
+    // Parameters:
+    // [in] (const BufferWrapper &) frame - format and geometry of the frame
+    // [in/out] (uint8_t *) data - writable frame data
+    //
+    // Returns:
+    // (int) - 0 on success, -1 if the frame does not match the maps
+    int Apply(const BufferWrapper &frame, uint8_t *data) const;
+
+    // Binary map file: header, dark map, gain map and defect indices, all in
+    // host byte order
+    bool Save(const QString &path) const;
+    static std::shared_ptr<const FlatFieldCorrection> Load(const QString &path);
+
+    // Where the maps go unless the user picks a file
+    static QString DefaultPath();
+
+    // The maps shared by all frame consumers. Current() returns null while
+    // the correction is disabled or no maps are loaded.
+    static std::shared_ptr<const FlatFieldCorrection> Current();
+    static std::shared_ptr<const FlatFieldCorrection> CurrentMaps();
+    static void SetCurrentMaps(std::shared_ptr<const FlatFieldCorrection> maps);
+    static bool IsEnabled();
+    static void SetEnabled(bool enabled);
+
+private:
+    // A defect and the same color neighbors that replace it
+    struct Defect
+    {
+        uint32_t x;
+        uint32_t y;
+        uint32_t count;
+        uint32_t neighbors[4][2];
+    };
+
+    void CorrectDefects(const BufferWrapper &frame, uint8_t *data) const;
+
+    uint32_t m_PixelFormat;
+    uint32_t m_Width;
+    uint32_t m_Height;
+    std::vector<uint16_t> m_Dark;
+    uint16_t m_Pedestal[4];         // mean dark level, by line and column parity
+    std::vector<uint16_t> m_Gain;
+    std::vector<uint32_t> m_DefectIndices;
+    std::vector<Defect> m_Defects;
+};
+
+// Collects the reference frames for FlatFieldCorrection from the live stream
+class FlatFieldCalibration
+{
+public:
+    enum class Reference
+    {
+        Dark,       // covered lens, measures offsets and hot pixels
+        Flat        // evenly lit target, measures gains and dead pixels
+    };
+
+    FlatFieldCalibration();
+
+    // This function starts averaging the next frames as reference, replacing
+    // a previous capture of the same reference
+    //
+    // Parameters:
+    // [in] (Reference) reference
+    // [in] (uint32_t) frames - number of frames to average, 1 to 256
+    //
+    // Returns:
+    // (int) - 0 on success, -1 for an invalid frame count
+    int Start(Reference reference, uint32_t frames);
+    bool IsCapturing() const;
+    uint32_t CapturedFrames(Reference reference) const;
+
+    // This function accumulates a frame while a capture runs. It is meant
+    // to see the frames before they are corrected.
+    //
+    // Parameters:
+    // [in] (const BufferWrapper &) frame
+    void AddFrame(const BufferWrapper &frame);
+
+    // This function turns the captured references into maps. Without dark
+    // frames the offsets are zero, without flat frames the gains are one.
+    //
+    // Returns:
+    // (std::shared_ptr<FlatFieldCorrection>) - null while capturing or without references
+    std::shared_ptr<FlatFieldCorrection> Build() const;
+
+private:
+    struct Accumulator
+    {
+        std::vector<uint32_t> sums;
+        uint32_t frames = 0;
+    };
+
+    mutable std::mutex m_Mutex;
+    uint32_t m_PixelFormat;
+    uint32_t m_Width;
+    uint32_t m_Height;
+    Accumulator m_References[2];
+    Reference m_Capturing;
+    uint32_t m_Remaining;
+};
+
+#endif // FLATFIELDCORRECTION_H
@@ -69,12 +69,15 @@ public:
     // [in] (uint32_t) width - width of the frame
     // [in] (uint32_t) height - height of the frame
     // [in] (uint32_t) bytesPerLine
+    // [in] (uint32_t) ycbcrEnc - Y'CbCr encoding of YUV formats
+    // [in] (uint32_t) quantization - quantization of YUV formats
     // [in] (uint32_t) enableLogging
     //
     // Returns:
     // (int) - result of stream starting
     int StartStream(bool blockingMode, int fileDescriptor, uint32_t pixelFormat,
                     uint32_t payloadSize, uint32_t width, uint32_t height, uint32_t bytesPerLine,
+                    uint32_t ycbcrEnc, uint32_t quantization,
                     uint32_t enableLogging);
     // This function stops streaming
     //
@@ -139,6 +142,12 @@ public:
     using DataProcessorFunc = std::function<void(BufferWrapper const&, DataProcessorDoneCallback)>;
     int AddRawDataProcessor(DataProcessorFunc processor);
 
+    // Corrections modify the frame in place, in the order they were added,
+    // before the data processors see it. They run on the capture thread and
+    // must be done with the frame when they return.
+    using DataCorrectionFunc = std::function<void(BufferWrapper const&, uint8_t *data)>;
+    int AddRawDataCorrection(DataCorrectionFunc correction);
+
 protected:
     // v4l2
     // This function reads frame
@@ -184,6 +193,8 @@ protected:
     uint32_t m_PayloadSize;
     uint32_t m_RealPayloadSize;
     uint32_t m_BytesPerLine;
+    uint32_t m_YcbcrEnc;
+    uint32_t m_Quantization;
     uint64_t m_FrameId;
     uint32_t m_DQBUF_last_errno;
 
@@ -200,6 +211,7 @@ protected:
     mutable base::LocalMutex              m_UsedBufferMutex;
 
     std::list<DataProcessorFunc> m_rawDataProcessors;
+    std::list<DataCorrectionFunc> m_rawDataCorrections;
 };
 
 #endif /* FRAMEOBSERVER_H */
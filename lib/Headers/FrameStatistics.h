@@ -0,0 +1,43 @@
+#ifndef FRAMESTATISTICS_H
+#define FRAMESTATISTICS_H
+
+#include "BufferWrapper.h"
+
+#include <cstdint>
+
+// Exposure and color statistics for the software auto exposure and white
+// balance. Only one sample (one CFA cell of Bayer frames) per cell of a
+// coarse grid is read, so a frame costs a few thousand memory reads
+// regardless of its resolution.
+namespace FrameStatistics
+{
+    // Luminance histogram of 8 bit values in bins of 4
+    const int s_HistogramBins = 64;
+
+    struct Statistics
+    {
+        uint32_t samples = 0;
+        bool color = false;                     // R, G and B are measured, not copies of the luminance
+        uint32_t histogram[s_HistogramBins] = {};
+        double luminance = 0.0;                 // mean luminance of all samples, 0..255
+        double clipped = 0.0;                   // fraction of samples with a channel at full scale
+        double mean[3] = {};                    // R, G, B mean of the samples that are neither clipped nor black
+        double highlight[3] = {};               // R, G, B mean of the brightest unclipped samples
+    };
+
+    // This function samples frame on a grid of columns x rows cells.
+    // Bayer, mono and RGB formats produce color statistics, YUV formats
+    // luminance only.
+    //
+    // Parameters:
+    // [in] (const BufferWrapper &) frame
+    // [out] (Statistics &) stats
+    // [in] (uint32_t) columns - horizontal grid size
+    // [in] (uint32_t) rows - vertical grid size
+    //
+    // Returns:
+    // (int) - 0 on success, -1 for compressed or unknown formats
+    int Compute(const BufferWrapper &frame, Statistics &stats, uint32_t columns = 64, uint32_t rows = 48);
+}
+
+#endif // FRAMESTATISTICS_H
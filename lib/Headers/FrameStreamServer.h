@@ -4,16 +4,38 @@
 #include <QObject>
 #include <QWebSocketServer>
 #include <QWebSocket>
+#include <QTcpServer>
+#include <QTcpSocket>
 #include <QImage>
+#include <QJsonArray>
+#include <QJsonObject>
+#include <QThread>
 
 #include <thread>
 #include <mutex>
 #include <condition_variable>
+#include <array>
 #include <atomic>
+#include <chrono>
+#include <deque>
 #include <functional>
+#include <map>
+#include <memory>
+#include <vector>
 
 #include "BufferWrapper.h"
+#include "ColorCorrection.h"
+#include "ImageOrientation.h"
 
+class JpegEncoder;
+class H264Encoder;
+
+// Streams the camera frames to the web UI over a WebSocket and to other
+// tools over HTTP. Encoder threads convert and compress the frames, the
+// sockets live on an I/O thread of their own, so a busy UI thread never
+// holds up a frame. Built with libx264, a video thread compresses the
+// frames into an H.264 stream for clients that decode video and for MKV
+// recordings. The public functions may be called from any thread.
 class FrameStreamServer : public QObject
 {
     Q_OBJECT
@@ -31,37 +53,386 @@ public:
 
     using RecordingCallback = std::function<void(const QByteArray &jpeg, const BufferWrapper &raw)>;
     void setRecordingCallback(RecordingCallback cb);
+    // H.264 recordings get the access units of the video stream at full
+    // resolution, as Annex B NAL units, from the video thread. If the
+    // encoder can't take the pictures the callback is cleared and
+    // recordingFailed is emitted.
+    using VideoRecordingCallback =
+        std::function<void(const QByteArray &accessUnit, bool key, uint32_t width, uint32_t height)>;
+    void setVideoRecordingCallback(VideoRecordingCallback cb);
+    // Clears both callbacks
     void clearRecordingCallback();
 
+    // Whether the build can encode H.264, for video clients and recordings
+    static bool hasVideoEncoding();
+
+    // Frames sent to, acknowledged by and dropped for each client, its rate
+    // level and the quality and binning of the last frame it was given
+    QJsonArray clientStatistics();
+
+    // HTTP endpoints for tools that don't speak the WebSocket framing, like
+    // VLC, ffplay or dashboards: /stream.mjpg, /snapshot.jpg, /snapshot.png
+    // and /snapshot.raw. MJPEG viewers and JPEG snapshots are clients like
+    // the WebSocket ones and share their encodes.
+    bool startHttp(const QHostAddress &address, quint16 port);
+    void stopHttp();
+    bool isHttpListening();
+    QHostAddress httpAddress();
+    int httpPort();
+
+    // A snapshot the stream can't serve, PNG and raw need the camera frame.
+    // The provider runs on a snapshot thread, one request at a time, so a
+    // slow conversion holds up neither the stream nor the camera.
+    struct Snapshot
+    {
+        QByteArray contentType;
+        QByteArray headers;     // additional header lines, each ending in \r\n
+        QByteArray data;
+    };
+    using SnapshotProvider = std::function<bool(const QString &format, Snapshot &snapshot)>;
+    void setSnapshotProvider(SnapshotProvider provider);
+
+    // Connections, requests and bandwidth of each endpoint
+    QJsonObject endpointStatistics();
+
 signals:
     void frameConverted(uint64_t frameId, uint32_t width, uint32_t height);
-    void broadcastReady(const QByteArray &message);
+    void broadcastReady();
+    void videoReady();
+    // The H.264 recording ended early, its callback is cleared
+    void recordingFailed(const QString &reason);
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    enum class Endpoint
+    {
+        WebSocket,
+        Mjpeg,      // multipart/x-mixed-replace stream
+        Snapshot,   // a single frame, HTTP
+        Count
+    };
+
+    struct EndpointStatistics
+    {
+        uint64_t requests = 0;
+        uint64_t bytes = 0;
+        uint64_t sampleBytes = 0;   // bytes at sampleTime
+        Clock::time_point sampleTime;
+        double bytesPerSecond = 0;
+    };
+
+    // A JPEG of a stream frame, in the size and quality of a rate control level
+    struct StreamJpeg
+    {
+        int downscale = 1;
+        int quality = 0;        // 0 = compressed by the camera
+        double encodeMs = 0;    // conversion and compression
+        QRect region;           // of the oriented frame, as a region client asked for it
+        QByteArray message;
+    };
+
+    // The JPEG of a rectangle of tiles of a tiled rendition
+    struct TilePatch
+    {
+        uint32_t column = 0;    // first tile it covers
+        uint32_t row = 0;
+        uint32_t columns = 0;   // tiles it covers
+        uint32_t rows = 0;
+        uint32_t x = 0;         // position in the tiled image
+        uint32_t y = 0;
+        QByteArray jpeg;
+    };
+
+    // The tiles an encoder found changed in a frame. A key frame is one
+    // patch that covers all tiles.
+    struct EncodedTiles
+    {
+        int downscale = 1;
+        int quality = 0;
+        double encodeMs = 0;
+        uint64_t generation = 0;    // of the tile grid, see TileState
+        bool key = false;
+        uint32_t width = 0;         // tiled image
+        uint32_t height = 0;
+        uint32_t columns = 0;
+        uint32_t rows = 0;
+        std::vector<std::shared_ptr<const TilePatch>> patches;
+    };
+
+    // The latest patch of every tile of a rendition, as of one delivered
+    // frame. Versions count up with the frames, a client that got version
+    // v of a tile needs the patches of the versions after it.
+    struct TileTable
+    {
+        uint64_t generation = 0;
+        uint32_t width = 0;
+        uint32_t height = 0;
+        uint32_t columns = 0;
+        uint32_t rows = 0;
+        uint64_t frameId = 0;       // header of the messages built from it
+        uint32_t frameWidth = 0;
+        uint32_t frameHeight = 0;
+        std::vector<uint64_t> versions;                         // by tile
+        std::vector<std::shared_ptr<const TilePatch>> patches;  // by tile
+    };
+
+    // A tiled rendition of a stream frame
+    struct StreamTiles
+    {
+        int downscale = 1;
+        int quality = 0;
+        double encodeMs = 0;
+        std::shared_ptr<const TileTable> table;
+    };
+
+    // One frame in every format the clients asked for
+    struct StreamFrame
+    {
+        uint64_t sequence = 0;
+        uint32_t width = 0;                             // oriented frame
+        uint32_t height = 0;
+        QByteArray raw;                                 // empty unless a client converts raw frames
+        std::vector<StreamJpeg> jpegs;                  // by downscale
+        std::vector<StreamTiles> tiles;                 // for clients that composite tiles
+        std::vector<StreamJpeg> regions;                // for clients that show part of the frame
+        bool video = false;                             // went to the video encoder, video clients get it from there
+
+        bool IsEmpty() const { return raw.isEmpty() && jpegs.empty() && tiles.empty() && regions.empty() && !video; }
+    };
 
-private slots:
+    // A frame on its way from an encoder to the video encoder
+    struct VideoPicture
+    {
+        uint64_t frameId = 0;
+        uint32_t frameWidth = 0;    // oriented frame, for the message header
+        uint32_t frameHeight = 0;
+        uint32_t width = 0;         // of the picture, binned for the video clients
+        uint32_t height = 0;
+        int downscale = 1;
+        bool recording = false;     // full resolution, the recording gets it
+        double encodeMs = 0;        // conversion
+        QByteArray planes;          // I420, empty if the frame doesn't go to the video encoder
+    };
+
+    // An access unit of the video stream, as the message the clients get
+    struct VideoPacket
+    {
+        bool key = false;
+        int downscale = 1;          // of the picture
+        double encodeMs = 0;        // conversion and compression
+        QByteArray message;
+    };
+
+    // A frame on its way from an encoder to the clients
+    struct EncodedFrame
+    {
+        StreamFrame stream;                 // empty if the conversion failed
+        std::vector<EncodedTiles> tiles;    // become stream.tiles on delivery
+        VideoPicture video;                 // queued for the video encoder on delivery
+        BufferWrapper buffer;
+        std::function<void()> doneCallback; // still held for the recording callback
+        bool recording = false;
+        bool videoRecording = false;
+    };
+
+    // What the encoders have to produce for a client
+    struct ClientNeeds
+    {
+        bool raw = false;           // the client converts raw frames itself
+        bool tiles = false;         // the client composites the changed tiles of JPEG frames
+        bool video = false;         // the client decodes the H.264 stream
+        uint32_t viewportWidth = 0; // source pixels its canvas shows, 0 = full frame
+        uint32_t viewportHeight = 0;
+        QRect region;               // part of the oriented frame it shows, null = all of it
+        int level = 0;              // of the rate controller, 0 = best quality
+    };
+
+    // Pacing of one client. Every client has its own window of frames sent
+    // but not acknowledged, a full window parks the newest frame in
+    // 'pending' so a slow client only ever skips frames, never delays the
+    // others. The rate controller lowers the JPEG quality and resolution of
+    // a client whose frames take longer to encode or to acknowledge than
+    // the camera takes to deliver them.
+    struct ClientState
+    {
+        Endpoint endpoint = Endpoint::WebSocket;
+        QWebSocket *socket = nullptr;   // WebSocket clients
+        QTcpSocket *http = nullptr;     // HTTP clients
+        ClientNeeds needs;
+        uint32_t window = 1;        // frames it may have in flight
+        uint32_t inFlight = 0;
+        QByteArray pending;         // newest frame that did not fit the window
+        std::shared_ptr<const TileTable> pendingTiles;  // the same for tile clients
+        bool offered = false;       // lastSequence is valid
+        uint64_t lastSequence = 0;  // of the last frame offered to it
+        uint64_t sent = 0;
+        uint64_t acknowledged = 0;
+        uint64_t dropped = 0;       // frames it never got
+        int quality = 0;            // of the last frame it was given, 0 = not a JPEG of ours
+        int downscale = 1;          // of the same, viewport and region included
+
+        std::deque<Clock::time_point> sendTimes; // of the frames in flight
+        double roundTripMs = 0;     // send to ack, averaged
+        double encodeMs = 0;        // of the JPEGs it got, averaged
+        uint32_t settleAcks = 0;    // acks until the next level change
+        uint32_t calmAcks = 0;      // acks in a row with time to spare
+
+        // Tiles the client has, of the tiled rendition it got last
+        uint64_t tileGeneration = 0;    // 0 = none, the next tile message has all tiles
+        std::vector<uint64_t> tileVersions;
+
+        // The client got the key frame the next video packet builds on
+        bool videoKeyed = false;
+    };
+
+    // Change detection of a tiled rendition, shared by the encoders. A
+    // tile is compared by the mean samples of a few cells of its part of
+    // the raw frame against the means of the content last encoded for it,
+    // so a slow change adds up until it shows.
+    // Anything that changes the converted image without changing the raw
+    // frame starts a new generation with a key frame.
+    struct TileState
+    {
+        uint64_t generation = 0;
+        bool keyed = false;         // the key frame of the generation is encoded
+        uint32_t pixelFormat = 0;
+        uint32_t frameWidth = 0;
+        uint32_t frameHeight = 0;
+        ImageOrientation::Orientation orientation;
+        std::shared_ptr<const ColorCorrection> colorCorrection;
+        std::vector<double> reference;  // cell means by tile
+    };
+
+    // Handlers of the socket signals, on the I/O thread
     void onNewConnection();
-    void onClientDisconnected();
-    void onClientTextMessage(const QString &msg);
-    void onBroadcast(const QByteArray &message);
+    void onClientDisconnected(QWebSocket *socket);
+    void onClientTextMessage(QWebSocket *socket, const QString &msg);
+    void onBroadcast();
+    void onVideo();
+    void onHttpConnection();
+    void onHttpReadyRead(QTcpSocket *socket);
+    void onHttpBytesWritten(QTcpSocket *socket);
+    void onHttpDisconnected(QTcpSocket *socket);
 
-private:
-    void conversionThreadMain();
+    void runOnIoThread(const std::function<void()> &call);
+    void startEncoders();
+    void stopEncoders();
+    void encoderThreadMain();
+    void videoThreadMain();
+    void encodeVideoPicture(H264Encoder &encoder, const VideoPicture &picture);
+    void encodeFrame(const BufferWrapper &buffer, EncodedFrame &frame, QImage &convertedImage, JpegEncoder *encoder);
+    bool encodeTiles(const BufferWrapper &buffer, int quality, int downscale,
+                     const ImageOrientation::Orientation &orientation,
+                     const std::shared_ptr<const ColorCorrection> &colorCorrection,
+                     EncodedTiles &tiles, QImage &convertedImage, JpegEncoder *encoder);
+    void encodeRegion(const BufferWrapper &buffer, int quality, int downscale, const QRect &region,
+                      const ImageOrientation::Orientation &orientation,
+                      const std::shared_ptr<const ColorCorrection> &colorCorrection,
+                      StreamFrame &stream, QImage &convertedImage, JpegEncoder *encoder);
+    bool convertVideoPicture(const BufferWrapper &buffer, int downscale, bool recording,
+                             const ImageOrientation::Orientation &orientation,
+                             const std::shared_ptr<const ColorCorrection> &colorCorrection,
+                             EncodedFrame &frame, QImage &convertedImage);
+    void deliverTiles(uint64_t sequence, EncodedFrame &frame);
+    void deliver(uint64_t sequence, EncodedFrame frame);
+
+    ClientState *clientState(QObject *socket);
+    void removeClient(QObject *socket);
+    void acknowledge(ClientState &client);
+    void offer(ClientState &client, const StreamFrame &frame);
+    void offerVideo(ClientState &client, const VideoPacket &packet);
+    void send(ClientState &client, const QByteArray &message);
+    void sendTiles(ClientState &client, const TileTable &table);
+    void handleHttpRequest(QTcpSocket *socket, const QByteArray &target);
+    void sendHttpResponse(QTcpSocket *socket, Endpoint endpoint, const QByteArray &status,
+                          const QByteArray &contentType, const QByteArray &body,
+                          const QByteArray &headers = QByteArray());
+    void updateClientNeeds();
+    void updateClientRoom();
+    void updateRate(ClientState &client, double roundTripMs);
+    void startSnapshots();
+    void stopSnapshots();
+    void snapshotThreadMain();
+    void onSnapshotDone(uint64_t id, bool served, const Snapshot &snapshot);
+    static const StreamJpeg *RecordingJpeg(const StreamFrame &frame);
 
+    // The servers and sockets are children of m_pIo, which lives on
+    // m_ioThread. Everything they touch is used on that thread only.
+    QThread m_ioThread;
+    QObject *m_pIo = nullptr;
     QWebSocketServer *m_pServer = nullptr;
-    QList<QWebSocket *> m_clients;
+    QTcpServer *m_pHttpServer = nullptr;
+    std::atomic<int> m_port{0};     // of m_pServer, once it listens
+    std::vector<ClientState> m_clientStates;
+    std::array<EndpointStatistics, size_t(Endpoint::Count)> m_endpoints;
+    std::map<uint64_t, QTcpSocket *> m_snapshotSockets;    // waiting for the provider, by request
+    uint64_t m_nextSnapshotId = 0;
 
-    std::unique_ptr<std::thread> m_conversionThread;
+    // The snapshot thread runs the provider for the queued requests and
+    // hands the responses back to the I/O thread
+    struct SnapshotRequest
+    {
+        uint64_t id;
+        QString format;
+    };
+    std::thread m_snapshotThread;
+    std::mutex m_snapshotMutex;
+    std::condition_variable m_snapshotWake;
+    std::deque<SnapshotRequest> m_snapshotRequests;
+    bool m_snapshotStop = false;
+    SnapshotProvider m_snapshotProvider;
+
+    // Encoder threads convert and compress frames in parallel, deliver()
+    // passes them on in the order they were taken
+    std::vector<std::thread> m_encoderThreads;
+    unsigned m_encoderCount = 1;
     std::atomic<bool> m_stopThread{false};
     std::atomic<bool> m_broadcastPending{false};
-    std::atomic<bool> m_clientReady{true};
+    std::atomic<bool> m_clientRoom{true};     // some client can take a frame right away
+    std::atomic<bool> m_recording{false};     // some recording callback is set
+
+    std::mutex m_needsMutex;
+    std::vector<ClientNeeds> m_clientNeeds;   // snapshot of the needs for the encoders
+
+    std::mutex m_latestMutex;
+    std::shared_ptr<const StreamFrame> m_latestFrame; // last delivered, picked up by onBroadcast
+    std::deque<std::shared_ptr<const VideoPacket>> m_videoPackets; // encoded, picked up by onVideo
+    bool m_videoLost = false;   // packets were dropped before onVideo got to them
 
     std::mutex m_recordMutex;
     RecordingCallback m_recordingCallback;
+    VideoRecordingCallback m_videoRecordingCallback;
+
+    // The video thread compresses the pictures of the delivered frames in
+    // their order, into one stream for all video clients and the recording
+    std::thread m_videoThread;
+    std::mutex m_videoMutex;
+    std::condition_variable m_videoWake;
+    std::deque<VideoPicture> m_videoPictures;
+    bool m_videoStop = false;
+    std::atomic<bool> m_videoKeyRequest{false};  // a client joined or lost a packet
+    std::atomic<bool> m_videoFailed{false};      // the encoder refused the pictures, JPEG it is
+    std::atomic<bool> m_videoPending{false};     // videoReady is on its way
 
     std::mutex m_frameMutex;
     std::condition_variable m_frameAvailable;
     BufferWrapper m_nextBuffer;
     std::function<void()> m_nextDoneCallback;
     bool m_bufferReady = false;
+    Clock::time_point m_lastPush;
+    std::atomic<double> m_sourceIntervalMs{0};  // between camera frames, averaged
+    uint64_t m_nextSequence = 0;    // of the next frame taken
+    uint32_t m_inFlight = 0;        // frames taken and not yet delivered, or recorded and not yet encoded
+
+    std::mutex m_deliveryMutex;
+    std::map<uint64_t, EncodedFrame> m_encodedFrames;   // done, waiting for an earlier frame
+    uint64_t m_nextDelivery = 0;
+    std::map<std::pair<int, int>, std::shared_ptr<const TileTable>> m_tileTables;  // by quality and downscale
+
+    std::mutex m_tileMutex;
+    std::map<std::pair<int, int>, TileState> m_tileStates;  // by quality and downscale
+    uint64_t m_tileGeneration = 0;  // of the last tile grid set up
 };
 
 #endif // FRAMESTREAMSERVER_H
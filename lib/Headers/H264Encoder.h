@@ -0,0 +1,73 @@
+#ifndef H264ENCODER_H
+#define H264ENCODER_H
+
+#include <QByteArray>
+#include <QImage>
+
+#include <cstdint>
+#include <memory>
+
+// Low latency H.264 encoding of the video stream and MKV recordings with
+// libx264. The encoder is set up for live video: no B-frames and no
+// lookahead, so every picture comes out of Encode as soon as it went in,
+// and x264 spreads each picture over the cores in slices instead of
+// working on several pictures at once. An encoder holds the state of one
+// stream, its pictures have to come from one thread, in frame order.
+class H264Encoder
+{
+public:
+    H264Encoder();
+    ~H264Encoder();
+
+    H264Encoder(const H264Encoder &) = delete;
+    H264Encoder &operator=(const H264Encoder &) = delete;
+
+    // This function starts a stream of width x height pictures, the first
+    // picture of it is a key frame. A running stream is closed first.
+    //
+    // Parameters:
+    // [in] (uint32_t) width - even
+    // [in] (uint32_t) height - even
+    // [in] (double) fps - the rate control aims at it, 0 for 30
+    //
+    // Returns:
+    // (bool) - false if libx264 refused the settings
+    bool Open(uint32_t width, uint32_t height, double fps);
+    void Close();
+    bool IsOpen() const;
+    uint32_t Width() const;
+    uint32_t Height() const;
+
+    // This function compresses one picture and appends its access unit to
+    // output, as Annex B NAL units. Key frames carry the SPS and PPS.
+    //
+    // Parameters:
+    // [in] (const QByteArray &) planes - an I420 picture of the open size, see ToI420
+    // [in] (bool) key - make the picture a key frame
+    // [in/out] (QByteArray &) output - keeps its content, the access unit follows it
+    // [out] (bool &) keyFrame - the picture became a key frame
+    //
+    // Returns:
+    // (bool) - false if x264 failed, output is left as it was in that case
+    bool Encode(const QByteArray &planes, bool key, QByteArray &output, bool &keyFrame);
+
+    // This function converts an image to the I420 planes Encode takes, in
+    // BT.601 limited range: Y, then U and V at half width and height. An
+    // odd width or height loses its last column or line.
+    //
+    // Parameters:
+    // [in] (const QImage &) image
+    // [out] (QByteArray &) planes
+    // [out] (uint32_t &) width - of the picture
+    // [out] (uint32_t &) height
+    //
+    // Returns:
+    // (bool) - false if the image is smaller than 2 x 2 pixels
+    static bool ToI420(const QImage &image, QByteArray &planes, uint32_t &width, uint32_t &height);
+
+private:
+    struct State;
+    std::unique_ptr<State> m_State;
+};
+
+#endif // H264ENCODER_H
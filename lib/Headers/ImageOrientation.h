@@ -0,0 +1,129 @@
+#ifndef IMAGEORIENTATION_H
+#define IMAGEORIENTATION_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Mirroring and rotation of converted frames. The converters hand every line
+// they produce to a LineWriter, which stores it at its oriented place while
+// it is still in the cache: flips reverse the line or pick the destination
+// row, quarter turns collect a block of lines and write it transposed, one
+// cache line wide run per destination row. Orienting therefore never costs
+// a pass over the frame of its own.
+namespace ImageOrientation
+{
+    // Clockwise rotation, applied after the flips
+    enum class Rotation
+    {
+        None,
+        Rotate90,
+        Rotate180,
+        Rotate270
+    };
+
+    struct Orientation
+    {
+        bool flipX = false;     // mirror left and right
+        bool flipY = false;     // mirror top and bottom
+        Rotation rotation = Rotation::None;
+
+        bool IsIdentity() const;
+
+        // Quarter turns exchange width and height
+        bool SwapsAxes() const;
+
+        // Rotation in degrees, 0, 90, 180 or 270
+        int Degrees() const;
+    };
+
+    // This function returns the rotation for an angle in degrees
+    //
+    // Parameters:
+    // [in] (int) degrees - multiple of 90, negative angles turn counterclockwise
+    //
+    // Returns:
+    // (Rotation)
+    Rotation RotationFromDegrees(int degrees);
+
+    // This function returns the size of a width x height frame after orienting
+    void OrientedSize(const Orientation &orientation, uint32_t width, uint32_t height,
+                      uint32_t &orientedWidth, uint32_t &orientedHeight);
+
+    // This function maps a position in the oriented image back into the
+    // width x height frame it was converted from
+    //
+    // Parameters:
+    // [in] (const Orientation &) orientation
+    // [in] (uint32_t) width - width of the frame
+    // [in] (uint32_t) height - height of the frame
+    // [in/out] (double &) x
+    // [in/out] (double &) y
+    void MapToFrame(const Orientation &orientation, uint32_t width, uint32_t height, double &x, double &y);
+
+    // The orientation shared by preview, streaming, snapshots and recordings
+    Orientation Current();
+    void SetCurrent(const Orientation &orientation);
+
+    // Places the lines of a width x height image into its oriented copy
+    class LineWriter
+    {
+    public:
+        // Parameters:
+        // [in] (const Orientation &) orientation
+        // [in] (uint32_t) width - width of the unoriented image
+        // [in] (uint32_t) height - height of the unoriented image
+        // [in] (uint32_t) bytesPerPixel
+        // [out] (uint8_t *) dst - first line of the oriented image
+        // [in] (size_t) bytesPerLine - stride of dst
+        LineWriter(const Orientation &orientation, uint32_t width, uint32_t height,
+                   uint32_t bytesPerPixel, uint8_t *dst, size_t bytesPerLine);
+
+        // Writes the lines of one band of the image. Each thread takes its own
+        // Band, lines are written in ascending order and the last block is
+        // stored when the Band goes out of scope.
+        class Band
+        {
+        public:
+            explicit Band(const LineWriter &writer);
+            ~Band();
+
+            Band(const Band &) = delete;
+            Band &operator=(const Band &) = delete;
+
+            // This function returns where line y of the unoriented image has
+            // to be written, either its place in dst or scratch memory
+            uint8_t *Line(uint32_t y);
+
+            // This function stores line y once it is complete
+            void Commit(uint32_t y);
+
+        private:
+            void Flush();
+
+            const LineWriter &m_Writer;
+            uint8_t *m_Scratch;
+            uint32_t m_First;       // first line of the collected block
+            uint32_t m_Count;       // lines collected in the block
+        };
+
+    private:
+        uint8_t *Row(uint32_t row) const;
+        void StoreReversed(const uint8_t *line, uint32_t y) const;
+        void StoreTransposed(const uint8_t *block, uint32_t first, uint32_t count) const;
+
+        uint32_t m_Width;
+        uint32_t m_Height;
+        uint32_t m_BytesPerPixel;
+        uint8_t *m_Dst;
+        size_t m_BytesPerLine;
+
+        // The orientation as mirroring of the source followed by an optional
+        // transposition, which is what the kernels below implement
+        bool m_MirrorX;
+        bool m_MirrorY;
+        bool m_Transpose;
+        uint32_t m_BlockLines;
+    };
+}
+
+#endif // IMAGEORIENTATION_H
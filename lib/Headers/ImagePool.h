@@ -0,0 +1,28 @@
+#ifndef IMAGEPOOL_H
+#define IMAGEPOOL_H
+
+#include <QImage>
+#include <vector>
+
+// Small ring of destination images for ImageTransform::ConvertFrame.
+// A slot is handed out again once every copy given to a consumer (e.g.
+// the render widget) has been released, so steady state streaming
+// converts into the same few allocations over and over.
+class ImagePool
+{
+public:
+    explicit ImagePool(size_t size = 3);
+
+    // This function returns the next image nobody else references anymore.
+    // If all slots are still in use the oldest one is returned and
+    // ConvertFrame will allocate a fresh image for it.
+    QImage &Acquire();
+
+    void Clear();
+
+private:
+    std::vector<QImage> m_Images;
+    size_t m_Next = 0;
+};
+
+#endif // IMAGEPOOL_H
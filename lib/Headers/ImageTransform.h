@@ -20,12 +20,84 @@
 #define IMAGETRANSFORM_H
 
 #include <QImage>
+#include <QRect>
 
 #include <stdint.h>
+#include <memory>
+
+#include "BufferWrapper.h"
+#include "ColorCorrection.h"
+#include "Demosaic.h"
+#include "ImageOrientation.h"
 
 
 namespace ImageTransform {
-    // This function convert frame and return results of conversion
+    // Y'CbCr to R'G'B' matrix of YUV frames
+    enum class YuvMatrix
+    {
+        Bt601,
+        Bt709
+    };
+
+    // Limited range uses 16..235 for luma and 16..240 for chroma
+    enum class YuvRange
+    {
+        Limited,
+        Full
+    };
+
+    struct ConversionOptions
+    {
+        // Let the converted image reference the frame buffer instead of copying it
+        // when the frame already has a QImage compatible layout. The caller has to
+        // keep the buffer queued until it is done with the image.
+        bool allowBorrow = false;
+
+        // Keep all significant bits of formats deeper than 8 bit. Mono frames
+        // are converted to Format_Grayscale16 instead of Format_Grayscale8,
+        // Bayer frames to Format_RGBX64 instead of Format_RGB888. Samples are
+        // MSB aligned. Binned Bayer previews (see downscale) stay 8 bit.
+        bool fullDepth = false;
+
+        // Produce a 1/2, 1/4 or 1/8 sized preview. Bayer frames are binned into
+        // one RGB pixel per CFA cell, all other formats are decimated. Any other
+        // value converts at full resolution.
+        int downscale = 1;
+
+        // Colorimetry of YUV frames, the defaults match V4L2_YCBCR_ENC_DEFAULT
+        // and V4L2_QUANTIZATION_DEFAULT for SDTV sized YUV streams. Use
+        // SetColorimetry to take them from the frame.
+        YuvMatrix yuvMatrix = YuvMatrix::Bt601;
+        YuvRange yuvRange = YuvRange::Limited;
+
+        // Interpolation of full resolution Bayer frames. Previews can take the
+        // fast Nearest, snapshots and recordings MalvarHeCutler.
+        Demosaic::Method demosaic = Demosaic::Method::Bilinear;
+
+        // Black level, white balance, color matrix and gamma of Bayer frames,
+        // applied inside the demosaic. Null leaves the colors as they are.
+        std::shared_ptr<const ColorCorrection> colorCorrection;
+
+        // Flips and rotation of the result, applied while the converter
+        // writes its lines. Quarter turns exchange width and height of the
+        // image, anything but the identity rules out borrowing the buffer.
+        ImageOrientation::Orientation orientation;
+    };
+
+    // This function sets the YUV colorimetry of the options from the one the
+    // frame was captured with. BT.2020 and SMPTE 240M frames get the BT.709
+    // matrix, the closest one supported.
+    //
+    // Parameters:
+    // [in] (const BufferWrapper &) buffer
+    // [in/out] (ConversionOptions &) options
+    void SetColorimetry(const BufferWrapper &buffer, ConversionOptions &options);
+
+    // This function convert frame and return results of conversion.
+    // Mono formats result in a grayscale image, everything else in RGB.
+    // convertedImage is converted into in place when it already has the
+    // resulting size and format and no other QImage shares its pixels, so
+    // callers that keep their images around avoid a per frame allocation.
     //
     // Parameters:
     // [in] (const uint8_t *) pBuffer
@@ -35,16 +107,69 @@ namespace ImageTransform {
     // [in] (uint32_t) pixelFormat
     // [in] (uint32_t &) payloadSize
     // [in] (uint32_t &) bytesPerLine
-    // [in] (QImage &) convertedImage
+    // [in/out] (QImage &) convertedImage
+    // [in] (const ConversionOptions &) options
     //
     // Returns:
     // (int) - result of converting
     int ConvertFrame(const uint8_t* pBuffer, uint32_t length,
                             uint32_t width, uint32_t height, uint32_t pixelFormat,
-                            uint32_t payloadSize, uint32_t bytesPerLine, QImage &convertedImage);
+                            uint32_t payloadSize, uint32_t bytesPerLine, QImage &convertedImage,
+                            const ConversionOptions &options = ConversionOptions());
+
+    // This function converts the frame held by a BufferWrapper, see above
+    int ConvertFrame(const BufferWrapper &buffer, QImage &convertedImage,
+                     const ConversionOptions &options = ConversionOptions());
+
+    // This function converts only the part of the frame inside region, for
+    // consumers that read or show a small part of it. The result is that
+    // part of the full conversion with the same options: the region is in
+    // frame coordinates, reduced by options.downscale and oriented the way
+    // the full image would be. Packed sample groups, chroma subsampling,
+    // CFA cells and the pixels the demosaic reads around the region are
+    // taken care of internally. JPEG frames are still decoded as a whole.
+    //
+    // Parameters:
+    // [in] (const BufferWrapper &) buffer
+    // [in] (const QRect &) region - pixels of the frame, clipped to it
+    // [in/out] (QImage &) convertedImage
+    // [in] (const ConversionOptions &) options
+    //
+    // Returns:
+    // (int) - 0 on success, -1 for an invalid frame or a region without pixels
+    int ConvertFrame(const BufferWrapper &buffer, const QRect &region, QImage &convertedImage,
+                     const ConversionOptions &options = ConversionOptions());
 
+    // This function checks whether the pixel format is known to the
+    // PixelFormatRegistry and a converter exists for its layout
+    //
+    // Parameters:
+    // [in] (uint32_t) pixelFormat
+    //
+    // Returns:
+    // (bool) - true if ConvertFrame can handle the format
     bool CanConvert(uint32_t pixelFormat);
 
+    // This function turns the vector kernels of the conversions and of the
+    // FlatFieldCorrection off and back on, for all threads. The scalar code
+    // gives the same results, so this is only of interest to the benchmark
+    // and the golden check.
+    //
+    // Parameters:
+    // [in] (bool) enabled
+    void SetVectorKernels(bool enabled);
+
+    // This function reports whether the vector kernels are in use
+    //
+    // Returns:
+    // (bool) - false after SetVectorKernels(false)
+    bool VectorKernels();
+
+    // This function pre-sizes the scratch memory of the calling thread
+    //
+    // Parameters:
+    // [in] (uint32_t) width - width of the frame
+    // [in] (uint32_t) height - height of the frame
     void Init(uint32_t width, uint32_t height);
 }
 
@@ -0,0 +1,23 @@
+#ifndef IMAGEWRITER_H
+#define IMAGEWRITER_H
+
+#include <QImage>
+#include <QString>
+
+// Saves converted frames without dropping bits. PNG goes through the Qt
+// image plugins, which write Grayscale16 and RGBX64 images as 16 bit PNG.
+// TIFF is written here, the Qt TIFF plugin is an optional module.
+namespace ImageWriter
+{
+    // This function saves the image, the format follows the file suffix
+    // (.tif/.tiff or anything Qt can write). Gray and RGB images with 8 or
+    // 16 bit samples are written unchanged, other formats are saved as RGB888
+    // to TIFF. Returns false if the file could not be written.
+    bool Save(const QImage &image, const QString &path);
+
+    // This function saves the image as TIFF whatever the file suffix is,
+    // with the same sample handling as Save.
+    bool SaveTiff(const QImage &image, const QString &path);
+}
+
+#endif // IMAGEWRITER_H
@@ -0,0 +1,32 @@
+#ifndef JPEGDECODER_H
+#define JPEGDECODER_H
+
+#include <QImage>
+
+#include <cstddef>
+#include <cstdint>
+
+// Direct libjpeg(-turbo) decoding of MJPEG frames. Compared to the Qt image
+// plugins this decodes straight into a reused QImage, can scale by 1/2, 1/4
+// or 1/8 in the DCT domain and decodes streams with restart markers on
+// several threads.
+namespace JpegDecoder
+{
+    struct Header
+    {
+        uint32_t width;         // output size, already divided by the scale
+        uint32_t height;
+        QImage::Format format;  // Format_Grayscale8 or Format_RGB888
+    };
+
+    // This function reads the frame header for a decode with 'scale'
+    // (1, 2, 4 or 8). Returns false if the data is no decodable JPEG.
+    bool ReadHeader(const uint8_t *data, size_t size, uint32_t scale, Header &header);
+
+    // This function decodes into dst, which has to have the size and format
+    // returned by ReadHeader. Returns false if the data is corrupt, dst may
+    // be partially written in that case.
+    bool Decode(const uint8_t *data, size_t size, uint32_t scale, QImage &dst);
+}
+
+#endif // JPEGDECODER_H
@@ -0,0 +1,43 @@
+#ifndef JPEGENCODER_H
+#define JPEGENCODER_H
+
+#include <QByteArray>
+#include <QImage>
+
+#include <memory>
+
+// Direct libjpeg(-turbo) encoding of stream and recording frames. Compared
+// to the Qt image plugins an encoder keeps its compressor from frame to
+// frame and writes the JPEG straight into the caller's buffer, behind
+// whatever header is already in it. The buffer is sized from the previous
+// JPEG, so it rarely has to grow, and 8 bit gray, RGB888 and 32 bit RGB
+// images are compressed without an intermediate copy. An encoder is used by
+// one thread at a time, parallel encoding takes one encoder per thread.
+class JpegEncoder
+{
+public:
+    JpegEncoder();
+    ~JpegEncoder();
+
+    JpegEncoder(const JpegEncoder &) = delete;
+    JpegEncoder &operator=(const JpegEncoder &) = delete;
+
+    // This function compresses the image and appends the JPEG to output.
+    // Formats other than Grayscale8, RGB888, RGB32 and RGBX8888 are
+    // converted to RGB888 first.
+    //
+    // Parameters:
+    // [in] (const QImage &) image
+    // [in] (int) quality - 0 to 100
+    // [in/out] (QByteArray &) output - keeps its content, the JPEG follows it
+    //
+    // Returns:
+    // (bool) - false if libjpeg failed, output is left as it was in that case
+    bool Encode(const QImage &image, int quality, QByteArray &output);
+
+private:
+    struct State;
+    std::unique_ptr<State> m_State;
+};
+
+#endif // JPEGENCODER_H
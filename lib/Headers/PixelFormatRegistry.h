@@ -0,0 +1,252 @@
+#ifndef PIXELFORMATREGISTRY_H
+#define PIXELFORMATREGISTRY_H
+
+#include <linux/videodev2.h>
+#include <cstddef>
+#include <cstdint>
+
+#include "videodev2_av.h"
+
+// Single source of truth for every pixel format the viewer understands.
+// ImageTransform instantiates its converters from these traits, the GL renderer
+// selects its shaders from them and the web/recording path queries them for
+// format metadata. Adding a format that fits an existing packing only needs a
+// new row in the table below.
+namespace PixelFormatRegistry {
+
+    enum class PixelFamily : uint8_t
+    {
+        Rgb,
+        Yuv,
+        Mono,
+        Bayer,
+        Compressed,
+    };
+
+    // Memory layout of a single line of samples
+    enum class SamplePacking : uint8_t
+    {
+        Byte,           // one byte per sample
+        Word16,         // little endian 16 bit container, see 'shift'
+        Csi2Packed10,   // 4 samples in 5 bytes, 8 MSBs first, 2 LSBs of all four in the 5th byte
+        Csi2Packed12,   // 2 samples in 3 bytes, 8 MSBs first, 4 LSBs of both in the 3rd byte
+        Rgb24,          // R, G, B
+        Bgr24,          // B, G, R
+        Rgb565,         // little endian rrrrrggg gggbbbbb
+        Bgrx32,         // B, G, R, X
+        Bgra32,         // B, G, R, A
+        Xrgb32,         // X, R, G, B
+        Native32,       // legacy RGB32/BGR32, copied as is
+        Yuyv,           // Y0, U, Y1, V
+        Uyvy,           // U, Y0, V, Y1
+        Vyuy,           // V, Y0, U, Y1
+        Yvyu,           // Y0, V, Y1, U
+        Planar,         // separate Y, U and V planes
+        SemiPlanar,     // Y plane followed by one plane of interleaved U, V pairs
+        Jpeg,           // compressed bit stream
+    };
+
+    // Color of the top left pixel and its right neighbour
+    enum class CfaOrder : uint8_t
+    {
+        None,
+        RGGB,
+        GRBG,
+        GBRG,
+        BGGR,
+    };
+
+    struct PixelFormatDescriptor
+    {
+        uint32_t fourcc;
+        const char *name;
+        PixelFamily family;
+        SamplePacking packing;
+        uint8_t bitDepth;       // significant bits per sample
+        uint8_t shift;          // right shift that moves the 8 most significant bits of a Word16 sample into the low byte
+        CfaOrder cfa;
+        uint8_t planes;         // number of planes within the buffer
+        uint8_t chromaShiftX;   // log2 of the horizontal chroma subsampling
+        uint8_t chromaShiftY;   // log2 of the vertical chroma subsampling
+        bool swapChroma;        // V precedes U (plane order or order inside a semi-planar pair)
+
+        // Size of one line of the first plane in bytes, without padding
+        constexpr uint32_t MinimumBytesPerLine(uint32_t width) const
+        {
+            switch (packing)
+            {
+                case SamplePacking::Byte:
+                case SamplePacking::Planar:
+                    return width;
+                case SamplePacking::SemiPlanar:
+                    return (width + 1) & ~1u;
+                case SamplePacking::Word16:
+                case SamplePacking::Rgb565:
+                    return width * 2;
+                case SamplePacking::Yuyv:
+                case SamplePacking::Uyvy:
+                case SamplePacking::Vyuy:
+                case SamplePacking::Yvyu:
+                    return (width + 1) / 2 * 4;
+                case SamplePacking::Csi2Packed10:
+                    return (width * 5 + 3) / 4;
+                case SamplePacking::Csi2Packed12:
+                    return (width * 3 + 1) / 2;
+                case SamplePacking::Rgb24:
+                case SamplePacking::Bgr24:
+                    return width * 3;
+                case SamplePacking::Bgrx32:
+                case SamplePacking::Bgra32:
+                case SamplePacking::Xrgb32:
+                case SamplePacking::Native32:
+                    return width * 4;
+                case SamplePacking::Jpeg:
+                    return 0;
+            }
+            return 0;
+        }
+    };
+
+    namespace detail {
+        constexpr PixelFormatDescriptor Rgb(uint32_t fourcc, const char *name, SamplePacking packing)
+        {
+            return { fourcc, name, PixelFamily::Rgb, packing, 8, 0, CfaOrder::None, 1, 0, 0, false };
+        }
+
+        constexpr PixelFormatDescriptor Yuv(uint32_t fourcc, const char *name, SamplePacking packing,
+                                            uint8_t planes, uint8_t chromaShiftX, uint8_t chromaShiftY, bool swapChroma)
+        {
+            return { fourcc, name, PixelFamily::Yuv, packing, 8, 0, CfaOrder::None, planes, chromaShiftX, chromaShiftY, swapChroma };
+        }
+
+        constexpr PixelFormatDescriptor Mono(uint32_t fourcc, const char *name, SamplePacking packing,
+                                             uint8_t bitDepth, uint8_t shift = 0)
+        {
+            return { fourcc, name, PixelFamily::Mono, packing, bitDepth, shift, CfaOrder::None, 1, 0, 0, false };
+        }
+
+        constexpr PixelFormatDescriptor Bayer(uint32_t fourcc, const char *name, SamplePacking packing,
+                                              uint8_t bitDepth, CfaOrder cfa, uint8_t shift = 0)
+        {
+            return { fourcc, name, PixelFamily::Bayer, packing, bitDepth, shift, cfa, 1, 0, 0, false };
+        }
+
+        constexpr PixelFormatDescriptor Compressed(uint32_t fourcc, const char *name)
+        {
+            return { fourcc, name, PixelFamily::Compressed, SamplePacking::Jpeg, 8, 0, CfaOrder::None, 1, 0, 0, false };
+        }
+    }
+
+    constexpr PixelFormatDescriptor s_PixelFormats[] = {
+        detail::Rgb(V4L2_PIX_FMT_RGB24,  "RGB3", SamplePacking::Rgb24),
+        detail::Rgb(V4L2_PIX_FMT_BGR24,  "BGR3", SamplePacking::Bgr24),
+        detail::Rgb(V4L2_PIX_FMT_RGB565, "RGBP", SamplePacking::Rgb565),
+        detail::Rgb(V4L2_PIX_FMT_XBGR32, "XR24", SamplePacking::Bgrx32),
+        detail::Rgb(V4L2_PIX_FMT_ABGR32, "AR24", SamplePacking::Bgra32),
+        detail::Rgb(V4L2_PIX_FMT_XRGB32, "BX24", SamplePacking::Xrgb32),
+        detail::Rgb(V4L2_PIX_FMT_RGB32,  "RGB4", SamplePacking::Native32),
+        detail::Rgb(V4L2_PIX_FMT_BGR32,  "BGR4", SamplePacking::Native32),
+
+        detail::Yuv(V4L2_PIX_FMT_YUYV,   "YUYV", SamplePacking::Yuyv, 1, 1, 0, false),
+        detail::Yuv(V4L2_PIX_FMT_UYVY,   "UYVY", SamplePacking::Uyvy, 1, 1, 0, false),
+        detail::Yuv(V4L2_PIX_FMT_VYUY,   "VYUY", SamplePacking::Vyuy, 1, 1, 0, false),
+        detail::Yuv(V4L2_PIX_FMT_YVYU,   "YVYU", SamplePacking::Yvyu, 1, 1, 0, false),
+        detail::Yuv(V4L2_PIX_FMT_YUV420, "YU12", SamplePacking::Planar, 3, 1, 1, false),
+        detail::Yuv(V4L2_PIX_FMT_YVU420, "YV12", SamplePacking::Planar, 3, 1, 1, true),
+        detail::Yuv(V4L2_PIX_FMT_NV12,   "NV12", SamplePacking::SemiPlanar, 2, 1, 1, false),
+        detail::Yuv(V4L2_PIX_FMT_NV21,   "NV21", SamplePacking::SemiPlanar, 2, 1, 1, true),
+        detail::Yuv(V4L2_PIX_FMT_NV16,   "NV16", SamplePacking::SemiPlanar, 2, 1, 0, false),
+        detail::Yuv(V4L2_PIX_FMT_NV61,   "NV61", SamplePacking::SemiPlanar, 2, 1, 0, true),
+
+        detail::Compressed(V4L2_PIX_FMT_MJPEG, "MJPG"),
+        detail::Compressed(V4L2_PIX_FMT_JPEG,  "JPEG"),
+
+        detail::Mono(V4L2_PIX_FMT_GREY,    "GREY", SamplePacking::Byte, 8),
+        detail::Mono(V4L2_PIX_FMT_Y10P,    "Y10P", SamplePacking::Csi2Packed10, 10),
+        detail::Mono(V4L2_PIX_FMT_Y12P,    "Y12P", SamplePacking::Csi2Packed12, 12),
+        detail::Mono(V4L2_PIX_FMT_GREY12P, "G12P", SamplePacking::Csi2Packed12, 12),
+        detail::Mono(V4L2_PIX_FMT_Y10,     "Y10",  SamplePacking::Word16, 10, 8),
+        detail::Mono(V4L2_PIX_FMT_Y12,     "Y12",  SamplePacking::Word16, 12, 8),
+        detail::Mono(V4L2_PIX_FMT_Y16,     "Y16",  SamplePacking::Word16, 16, 8),
+
+        detail::Bayer(V4L2_PIX_FMT_SRGGB8, "RGGB", SamplePacking::Byte, 8, CfaOrder::RGGB),
+        detail::Bayer(V4L2_PIX_FMT_SGRBG8, "GRBG", SamplePacking::Byte, 8, CfaOrder::GRBG),
+        detail::Bayer(V4L2_PIX_FMT_SGBRG8, "GBRG", SamplePacking::Byte, 8, CfaOrder::GBRG),
+        detail::Bayer(V4L2_PIX_FMT_SBGGR8, "BA81", SamplePacking::Byte, 8, CfaOrder::BGGR),
+
+        detail::Bayer(V4L2_PIX_FMT_SRGGB10P, "pRAA", SamplePacking::Csi2Packed10, 10, CfaOrder::RGGB),
+        detail::Bayer(V4L2_PIX_FMT_SGRBG10P, "pgAA", SamplePacking::Csi2Packed10, 10, CfaOrder::GRBG),
+        detail::Bayer(V4L2_PIX_FMT_SGBRG10P, "pGAA", SamplePacking::Csi2Packed10, 10, CfaOrder::GBRG),
+        detail::Bayer(V4L2_PIX_FMT_SBGGR10P, "pBAA", SamplePacking::Csi2Packed10, 10, CfaOrder::BGGR),
+
+        detail::Bayer(V4L2_PIX_FMT_SRGGB12P, "pRCC", SamplePacking::Csi2Packed12, 12, CfaOrder::RGGB),
+        detail::Bayer(V4L2_PIX_FMT_SGRBG12P, "pgCC", SamplePacking::Csi2Packed12, 12, CfaOrder::GRBG),
+        detail::Bayer(V4L2_PIX_FMT_SGBRG12P, "pGCC", SamplePacking::Csi2Packed12, 12, CfaOrder::GBRG),
+        detail::Bayer(V4L2_PIX_FMT_SBGGR12P, "pBCC", SamplePacking::Csi2Packed12, 12, CfaOrder::BGGR),
+
+        /* Nano/Generic 10, 12 and 16 bit, 8 most significant bits in the upper byte */
+        detail::Bayer(V4L2_PIX_FMT_SRGGB10, "RG10", SamplePacking::Word16, 10, CfaOrder::RGGB, 8),
+        detail::Bayer(V4L2_PIX_FMT_SGRBG10, "BA10", SamplePacking::Word16, 10, CfaOrder::GRBG, 8),
+        detail::Bayer(V4L2_PIX_FMT_SGBRG10, "GB10", SamplePacking::Word16, 10, CfaOrder::GBRG, 8),
+        detail::Bayer(V4L2_PIX_FMT_SBGGR10, "BG10", SamplePacking::Word16, 10, CfaOrder::BGGR, 8),
+        detail::Bayer(V4L2_PIX_FMT_SRGGB12, "RG12", SamplePacking::Word16, 12, CfaOrder::RGGB, 8),
+        detail::Bayer(V4L2_PIX_FMT_SGRBG12, "BA12", SamplePacking::Word16, 12, CfaOrder::GRBG, 8),
+        detail::Bayer(V4L2_PIX_FMT_SGBRG12, "GB12", SamplePacking::Word16, 12, CfaOrder::GBRG, 8),
+        detail::Bayer(V4L2_PIX_FMT_SBGGR12, "BG12", SamplePacking::Word16, 12, CfaOrder::BGGR, 8),
+        detail::Bayer(V4L2_PIX_FMT_SRGGB16, "RG16", SamplePacking::Word16, 16, CfaOrder::RGGB, 8),
+        detail::Bayer(V4L2_PIX_FMT_SGRBG16, "GR16", SamplePacking::Word16, 16, CfaOrder::GRBG, 8),
+        detail::Bayer(V4L2_PIX_FMT_SGBRG16, "GB16", SamplePacking::Word16, 16, CfaOrder::GBRG, 8),
+        detail::Bayer(V4L2_PIX_FMT_SBGGR16, "BYR2", SamplePacking::Word16, 16, CfaOrder::BGGR, 8),
+
+        /* Special 10 and 12 bit pixel formats for NVidia Jetson */
+        /* AGX Xavier and Xavier NX */
+        detail::Mono(V4L2_PIX_FMT_XAVIER_Y10, "JXY0", SamplePacking::Word16, 10, 7),
+        detail::Mono(V4L2_PIX_FMT_XAVIER_Y12, "JXY2", SamplePacking::Word16, 12, 7),
+        detail::Bayer(V4L2_PIX_FMT_XAVIER_SRGGB10, "JXR0", SamplePacking::Word16, 10, CfaOrder::RGGB, 7),
+        detail::Bayer(V4L2_PIX_FMT_XAVIER_SGRBG10, "JXA0", SamplePacking::Word16, 10, CfaOrder::GRBG, 7),
+        detail::Bayer(V4L2_PIX_FMT_XAVIER_SGBRG10, "JXG0", SamplePacking::Word16, 10, CfaOrder::GBRG, 7),
+        detail::Bayer(V4L2_PIX_FMT_XAVIER_SBGGR10, "JXB0", SamplePacking::Word16, 10, CfaOrder::BGGR, 7),
+        detail::Bayer(V4L2_PIX_FMT_XAVIER_SRGGB12, "JXR2", SamplePacking::Word16, 12, CfaOrder::RGGB, 7),
+        detail::Bayer(V4L2_PIX_FMT_XAVIER_SGRBG12, "JXA2", SamplePacking::Word16, 12, CfaOrder::GRBG, 7),
+        detail::Bayer(V4L2_PIX_FMT_XAVIER_SGBRG12, "JXG2", SamplePacking::Word16, 12, CfaOrder::GBRG, 7),
+        detail::Bayer(V4L2_PIX_FMT_XAVIER_SBGGR12, "JXB2", SamplePacking::Word16, 12, CfaOrder::BGGR, 7),
+
+        /* TX2 and Nano */
+        detail::Mono(V4L2_PIX_FMT_TX2_Y10, "J2Y0", SamplePacking::Word16, 10, 6),
+        detail::Mono(V4L2_PIX_FMT_TX2_Y12, "J2Y2", SamplePacking::Word16, 12, 6),
+        detail::Bayer(V4L2_PIX_FMT_TX2_SRGGB10, "J2R0", SamplePacking::Word16, 10, CfaOrder::RGGB, 6),
+        detail::Bayer(V4L2_PIX_FMT_TX2_SGRBG10, "J2A0", SamplePacking::Word16, 10, CfaOrder::GRBG, 6),
+        detail::Bayer(V4L2_PIX_FMT_TX2_SGBRG10, "J2G0", SamplePacking::Word16, 10, CfaOrder::GBRG, 6),
+        detail::Bayer(V4L2_PIX_FMT_TX2_SBGGR10, "J2B0", SamplePacking::Word16, 10, CfaOrder::BGGR, 6),
+        detail::Bayer(V4L2_PIX_FMT_TX2_SRGGB12, "J2R2", SamplePacking::Word16, 12, CfaOrder::RGGB, 6),
+        detail::Bayer(V4L2_PIX_FMT_TX2_SGRBG12, "J2A2", SamplePacking::Word16, 12, CfaOrder::GRBG, 6),
+        detail::Bayer(V4L2_PIX_FMT_TX2_SGBRG12, "J2G2", SamplePacking::Word16, 12, CfaOrder::GBRG, 6),
+        detail::Bayer(V4L2_PIX_FMT_TX2_SBGGR12, "J2B2", SamplePacking::Word16, 12, CfaOrder::BGGR, 6),
+    };
+
+    constexpr size_t s_PixelFormatCount = sizeof(s_PixelFormats) / sizeof(s_PixelFormats[0]);
+
+    // This function looks up the descriptor of a V4L2 pixel format
+    //
+    // Parameters:
+    // [in] (uint32_t) fourcc - V4L2 pixel format
+    //
+    // Returns:
+    // (const PixelFormatDescriptor *) - descriptor or nullptr if the format is unknown
+    constexpr const PixelFormatDescriptor *Find(uint32_t fourcc)
+    {
+        for (size_t i = 0; i < s_PixelFormatCount; ++i)
+        {
+            if (s_PixelFormats[i].fourcc == fourcc)
+            {
+                return &s_PixelFormats[i];
+            }
+        }
+        return nullptr;
+    }
+
+    static_assert(Find(V4L2_PIX_FMT_SGRBG12P)->cfa == CfaOrder::GRBG, "pixel format table is inconsistent");
+    static_assert(Find(V4L2_PIX_FMT_TX2_Y12)->shift == 6, "pixel format table is inconsistent");
+}
+
+#endif // PIXELFORMATREGISTRY_H
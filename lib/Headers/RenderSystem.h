@@ -5,14 +5,14 @@
 #include <functional>
 #include "BufferWrapper.h"
 #include "FPSCalculator.h"
+#include "ImageOrientation.h"
 
 class RenderSystem: public QObject
 {
     Q_OBJECT
 public:
     RenderSystem();
-    virtual void SetFlipX(bool flip) = 0;
-    virtual void SetFlipY(bool flip) = 0;
+    virtual void SetOrientation(const ImageOrientation::Orientation &orientation) = 0;
     virtual void SetScaleFactor(double scaleFactor) = 0;
     virtual QWidget* GetWidget() const = 0;
     virtual void PassFrame(BufferWrapper const& buffer, std::function<void()> doneCallback) = 0;
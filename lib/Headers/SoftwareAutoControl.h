@@ -0,0 +1,88 @@
+#ifndef SOFTWAREAUTOCONTROL_H
+#define SOFTWAREAUTOCONTROL_H
+
+#include "BufferWrapper.h"
+#include "FrameStatistics.h"
+
+#include <cstdint>
+#include <mutex>
+
+class Camera;
+
+// Auto exposure and auto white balance for sensors that have neither on
+// board. Frames are measured with FrameStatistics on the capture thread,
+// exposure and gain are written through the camera controls and the white
+// balance goes into the gains of the software ISP (ColorCorrection).
+//
+// The exposure loop moves at most one stop per iteration and only 60 % of
+// the measured error, so it cannot overshoot on a sensor with a linear
+// response; an error inside the dead band counts as converged. Starting
+// anywhere in the range it needs about log2(max / min exposure) + 3
+// iterations, plus at most 16 for the gain, each iteration waiting a few
+// frames for the new values to reach the sensor output.
+class SoftwareAutoControl
+{
+public:
+    enum class WhiteBalance
+    {
+        Off,
+        GrayWorld,      // the unclipped average is gray
+        WhitePatch      // the brightest unclipped samples are white
+    };
+
+    explicit SoftwareAutoControl(Camera &camera);
+
+    // This function starts or stops the exposure loop. It reads the
+    // current exposure, gain and their ranges from the camera, so it has
+    // to be called from the thread that owns the camera.
+    //
+    // Parameters:
+    // [in] (bool) enable
+    //
+    // Returns:
+    // (int) - 0 on success, -1 if the camera has no usable exposure control
+    int SetAutoExposure(bool enable);
+    bool IsAutoExposure() const;
+
+    // This function selects the white balance estimate. Turning it off
+    // restores the gains the color correction had before.
+    //
+    // Parameters:
+    // [in] (WhiteBalance) mode
+    void SetWhiteBalance(WhiteBalance mode);
+    WhiteBalance GetWhiteBalance() const;
+
+    // This function measures a frame and updates exposure and white balance
+    // when they are due. It is meant to run as a raw data processor on the
+    // capture thread; control writes are queued to the camera's thread so a
+    // slow sensor write never stalls the capture.
+    //
+    // Parameters:
+    // [in] (const BufferWrapper &) frame
+    void ProcessFrame(const BufferWrapper &frame);
+
+private:
+    void UpdateExposure(const FrameStatistics::Statistics &stats);
+    void UpdateWhiteBalance(const FrameStatistics::Statistics &stats);
+
+    Camera &m_Camera;
+    mutable std::mutex m_Mutex;
+
+    bool m_AutoExposure;
+    bool m_HasGain;
+    int64_t m_Exposure;
+    int64_t m_MinExposure;
+    int64_t m_MaxExposure;
+    int64_t m_Gain;
+    int64_t m_MinGain;
+    int64_t m_MaxGain;
+    uint32_t m_ExposureWait;            // frames until the next exposure iteration
+
+    WhiteBalance m_WhiteBalance;
+    double m_BalanceGains[3];           // R, G, B gains as currently applied
+    double m_SavedGains[3];             // gains of the color correction before the white balance took over
+    bool m_SavedEnabled;
+    uint32_t m_BalanceWait;             // frames until the next white balance iteration
+};
+
+#endif // SOFTWAREAUTOCONTROL_H
@@ -2,7 +2,7 @@
 #define SOFTWARERENDERSYSTEM_H
 
 #include <QGraphicsView>
-#include <QGraphicsPixmapItem>
+#include "ImagePool.h"
 #include "RenderSystem.h"
 #include "SoftwareRenderWidget.h"
 #include <QMutex>
@@ -20,8 +20,7 @@ public:
     SoftwareRenderSystem();
     ~SoftwareRenderSystem();
     void SetScaleFactor(double scale) override;
-    void SetFlipX(bool flip);
-    void SetFlipY(bool flip);
+    void SetOrientation(const ImageOrientation::Orientation &orientation) override;
 
     QWidget* GetWidget() const override;
     void PassFrame(BufferWrapper const& buffer, std::function<void()> doneCallback) override;
@@ -42,10 +41,11 @@ private:
     QScrollArea *scrollArea;
     QBoxLayout *layout;
     SoftwareRenderWidget *widget;
-    bool flipX = false;
-    bool flipY = false;
 
     void ApplyScale();
+    static int PreviewDownscale(double scale);
+    bool VisibleRegion(BufferWrapper const& buffer, ImageOrientation::Orientation const& orientation,
+                       QRect &region, QRect &orientedRegion) const;
     void ConversionThreadMain();
 
     // TODO encapsulate for re-use in hwaccel renderer?
@@ -56,6 +56,16 @@ private:
     QWaitCondition newFrameAvailable;
     BufferWrapper nextBuffer;
     std::function<void()> nextDoneCallback;
+    ImagePool imagePool;
+    // Downscale factor for the conversion, follows the zoom
+    std::atomic<int> previewDownscale{1};
+    // The conversion orients the image, clicks are mapped back to the frame
+    // with the orientation and size of the image on screen
+    QMutex orientationMutex;
+    ImageOrientation::Orientation orientation;
+    ImageOrientation::Orientation shownOrientation;
+    uint32_t shownWidth = 0;
+    uint32_t shownHeight = 0;
 };
 
 #endif
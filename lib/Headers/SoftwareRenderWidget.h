@@ -1,33 +1,69 @@
 #ifndef SOFTWARERENDERWIDGET_H
 #define SOFTWARERENDERWIDGET_H
 
-#include <QPixmap>
+#include <QGraphicsItem>
+#include <QGraphicsView>
+#include <QImage>
+#include <QMutex>
+
+// Draws the current frame straight from its QImage. This saves the
+// QPixmap conversion (a full copy on raster backends) for every frame.
+class FrameImageItem: public QGraphicsItem {
+public:
+  // The item is scaled up by 'scale' so that binned preview images cover
+  // the same scene area as a full resolution frame
+  void SetImage(QImage image, int scale);
+
+  QRectF boundingRect() const override;
+  void paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) override;
+
+private:
+  QImage m_Image;
+  int m_Scale = 1;
+};
 
 class SoftwareRenderWidget: public QGraphicsView {
   Q_OBJECT
 private:
   QGraphicsScene *m_Scene;
-  QGraphicsPixmapItem m_PixmapItem;
-  QPixmap *m_CurrentPixmap = nullptr;
+  FrameImageItem m_ImageItem;
+  mutable QMutex m_VisibleMutex;
+  QRectF m_VisibleRect;
 
 signals:
   void RequestZoom(QPointF center, bool zoomIn);
   void Clicked(QPointF point);
   void DoubleClicked();
-  void SetPixmapSignal(QPixmap pixmap);
+  void SetImageSignal(QImage image, int scale, QPoint offset, QSize sceneSize);
 
 private slots:
-  void OnSetPixmap(QPixmap pixmap);
+  void OnSetImage(QImage image, int scale, QPoint offset, QSize sceneSize);
 
 public:
   SoftwareRenderWidget(QWidget *parent = nullptr);
   ~SoftwareRenderWidget();
 
-  void SetPixmap(QPixmap pixmap);
+  // Thread safe, the image is shared with the GUI thread until the next one arrives.
+  // 'scale' is the downscale factor the image was converted with.
+  void SetImage(QImage image, int scale = 1);
+
+  // Same for an image of a part of the frame, placed at 'offset' in a scene
+  // of the size of the whole (oriented) frame
+  void SetImage(QImage image, QPoint offset, QSize sceneSize);
+
+  // Thread safe, the part of the scene inside the viewport
+  QRectF VisibleSceneRect() const;
+
+  // To be called after the view transformation changed
+  void UpdateVisibleRect();
 
   void wheelEvent(QWheelEvent *event) override;
   void mousePressEvent(QMouseEvent *event) override;
   void mouseDoubleClickEvent(QMouseEvent *event) override;
+
+protected:
+  void scrollContentsBy(int dx, int dy) override;
+  void resizeEvent(QResizeEvent *event) override;
 };
 
 #endif
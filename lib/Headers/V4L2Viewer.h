@@ -25,6 +25,8 @@
 #include "ui_V4L2Viewer.h"
 #include "ControlsHolderWidget.h"
 #include "RenderSystem.h"
+#include "SoftwareAutoControl.h"
+#include "FlatFieldCorrection.h"
 
 #include <memory>
 #include <list>
@@ -68,6 +70,10 @@ protected:
     // The currently streaming camera
     Camera m_Camera;
     uint32_t m_nStreamNumber;
+    // Auto exposure and white balance computed from the frames
+    SoftwareAutoControl m_SoftwareAutoControl;
+    // Reference frames for the flat-field correction
+    FlatFieldCalibration m_FlatFieldCalibration;
 
     // Value stores counter for saved frames
     uint64_t m_SavedFramesCounter;
@@ -204,10 +210,28 @@ protected:
     // Set control labels to default values in user interface
     void SetDefaultLabels();
 
+    // This function applies a new flip and rotation to the preview and to
+    // everything converted from now on
+    //
+    // Parameters:
+    // [in] (const ImageOrientation::Orientation &) orientation
+    void UpdateOrientation(const ImageOrientation::Orientation &orientation);
+
     void closeEvent(QCloseEvent *e) override;
 
 protected slots:
     void OnLogToFile();
+    // The event handlers of the software color correction
+    void OnColorCorrection();
+    void OnLoadColorProfile();
+    // The event handlers of the software auto exposure and white balance
+    void OnSoftwareAutoExposure();
+    void OnSoftwareWhiteBalance();
+    // The event handlers of the flat-field correction and its calibration
+    void OnFlatFieldCorrection();
+    void OnCaptureFlatFieldReference();
+    void OnSaveFlatField();
+    void OnLoadFlatField();
     void OnShowFrames();
     // The event handler to close the program
     void OnMenuCloseTriggered();
@@ -423,6 +447,7 @@ protected slots:
 
     void OnFlipHorizontal(int state);
     void OnFlipVertical(int state);
+    void OnRotationChanged(int index);
 
 	void OnFrameSizeIndexChanged(int index);
 
@@ -15,16 +15,19 @@ class VideoRecorder : public QObject
     Q_OBJECT
 
 public:
-    enum Format { AVI_MJPEG, RAW };
+    enum Format { AVI_MJPEG, RAW, MKV_H264 };
 
     explicit VideoRecorder(QObject *parent = nullptr);
     ~VideoRecorder();
 
     bool start(const QString &path, Format fmt, uint32_t width, uint32_t height,
-               double fps, qint64 maxBytes);
+               uint32_t pixelFormat, double fps, qint64 maxBytes);
     bool writeJpegFrame(const QByteArray &jpeg);
     bool writeRawFrame(const uint8_t *data, size_t len);
-    void stop();
+    // An access unit of Annex B NAL units, the file starts at the first key frame
+    bool writeH264Frame(const QByteArray &accessUnit, bool key, uint32_t width, uint32_t height);
+    // reason goes to recordingStopped
+    void stop(const QString &reason = "complete");
 
     qint64 bytesWritten() const;
     bool isRecording() const;
@@ -35,6 +38,10 @@ signals:
 
 private:
     void writeAviHeader(bool finalize);
+    QByteArray rawHeader() const;
+    void writeMkvHeader(const QByteArray &sps, const QByteArray &pps);
+    void closeMkvCluster();
+    void finishMkv();
     void checkSizeLimit();
 
     std::mutex m_mutex;
@@ -45,6 +52,8 @@ private:
     qint64 m_maxBytes = 0;
     uint32_t m_width = 0;
     uint32_t m_height = 0;
+    uint32_t m_pixelFormat = 0;
+    qint64 m_rawFrameBytes = 0;
     double m_fps = 30.0;
     uint32_t m_frameCount = 0;
     QElapsedTimer m_elapsed;
@@ -56,6 +65,22 @@ private:
     };
     QVector<AviIndexEntry> m_aviIndex;
     qint64 m_moviStart = 0; // file position of 'movi' list data start
+
+    // Matroska: positions are relative to the segment data, times in ms
+    // since the first frame
+    struct MkvCue {
+        qint64 time;
+        qint64 clusterPosition;
+    };
+    QVector<MkvCue> m_mkvCues;  // one per cluster, each starts with a key frame
+    bool m_mkvStarted = false;  // header written, at the first key frame
+    qint64 m_segmentStart = 0;  // file position of the segment data
+    qint64 m_seekHeadPos = 0;   // file position of the space for the SeekHead
+    qint64 m_durationPos = 0;   // file position of the Duration value
+    qint64 m_clusterSizePos = 0; // file position of the open cluster's size, 0 = none
+    qint64 m_clusterTime = 0;
+    qint64 m_firstFrameMs = 0;  // m_elapsed at the first frame
+    qint64 m_lastFrameTime = 0;
 };
 
 #endif // VIDEORECORDER_H
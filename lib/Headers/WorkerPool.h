@@ -0,0 +1,52 @@
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads that split per frame work (JPEG restart segments,
+// image tiles) across the cores. The calling thread always takes part, so
+// a pool that is busy with another caller degrades to serial execution
+// instead of blocking.
+class WorkerPool
+{
+public:
+    explicit WorkerPool(unsigned threadCount);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool &) = delete;
+    WorkerPool &operator=(const WorkerPool &) = delete;
+
+    // Process wide pool with one worker less than there are cores
+    static WorkerPool &Instance();
+
+    // Number of threads a ParallelFor call can use, including the caller
+    unsigned Concurrency() const;
+
+    // This function runs job(i) for every i in [0, count) and returns
+    // when all of them are done. Jobs must not call ParallelFor themselves.
+    void ParallelFor(uint32_t count, const std::function<void(uint32_t)> &job);
+
+private:
+    void WorkerMain();
+    void RunJobs();
+
+    std::vector<std::thread> m_Threads;
+
+    std::mutex m_CallMutex;         // one ParallelFor at a time
+    std::mutex m_Mutex;
+    std::condition_variable m_WorkAvailable;
+    std::condition_variable m_WorkDone;
+    const std::function<void(uint32_t)> *m_pJob = nullptr;
+    uint32_t m_Count = 0;
+    uint32_t m_NextIndex = 0;
+    uint32_t m_Pending = 0;
+    uint64_t m_Generation = 0;
+    bool m_Stop = false;
+};
+
+#endif // WORKERPOOL_H
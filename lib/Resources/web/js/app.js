@@ -10,6 +10,7 @@ const ControlSlider = defineComponent({
         min: { type: Number, default: 0 },
         max: { type: Number, default: 100 },
         step: { type: Number, default: 1 },
+        decimals: { type: Number, default: 0 },
         unit: { type: String, default: '' },
         disabled: { type: Boolean, default: false },
         logarithmic: { type: Boolean, default: false },
@@ -20,6 +21,7 @@ const ControlSlider = defineComponent({
     setup(props, { emit }) {
         const displayValue = computed(() => {
             if (props.value == null) return '—';
+            if (props.decimals > 0) return Number(props.value.toFixed(props.decimals));
             return Math.round(props.value);
         });
 
@@ -79,7 +81,7 @@ const ControlSlider = defineComponent({
                     :disabled="disabled || autoEnabled"
                     class="slider">
                 <input type="number"
-                    :value="displayValue"
+                    :value="displayValue" :step="step"
                     @change="onInputChange"
                     :disabled="disabled || autoEnabled"
                     class="value-input">
@@ -269,8 +271,32 @@ const SettingsPanel = defineComponent({
         show: Boolean,
         recordingFormat: String,
         maxRecordMb: Number,
+        tileStreaming: Boolean,
+        videoStreaming: Boolean,
+        httpServer: Object,
+    },
+    emits: ['close', 'update:recordingFormat', 'update:maxRecordMb', 'update:tileStreaming', 'update:videoStreaming', 'update:httpServer'],
+    setup(props, { emit }) {
+        // Edited locally, the server is only restarted on apply
+        const httpAddress = ref(props.httpServer.address);
+        const httpPort = ref(props.httpServer.port);
+        watch(() => props.httpServer, (server) => {
+            httpAddress.value = server.address;
+            httpPort.value = server.port;
+        });
+
+        function applyHttpServer(enabled) {
+            emit('update:httpServer', { enabled, address: httpAddress.value, port: Number(httpPort.value) });
+        }
+
+        const httpUrl = computed(() => {
+            if (!props.httpServer.enabled) return null;
+            const host = props.httpServer.address === '0.0.0.0' ? location.hostname || 'localhost' : props.httpServer.address;
+            return 'http://' + host + ':' + props.httpServer.port;
+        });
+
+        return { httpAddress, httpPort, applyHttpServer, httpUrl };
     },
-    emits: ['close', 'update:recordingFormat', 'update:maxRecordMb'],
     template: `
         <div class="settings-modal-backdrop" v-if="show" @click.self="$emit('close')">
             <div class="settings-modal">
@@ -282,6 +308,7 @@ const SettingsPanel = defineComponent({
                         <option value="webm">WebM (VP9 — client-side)</option>
                         <option value="avi">AVI (MJPEG — server-side)</option>
                         <option value="raw">Raw (V4L2 frames — server-side)</option>
+                        <option value="mkv">MKV (H.264 — server-side)</option>
                     </select>
                 </div>
                 <div class="settings-field">
@@ -289,6 +316,36 @@ const SettingsPanel = defineComponent({
                     <input type="number" :value="maxRecordMb" min="1" max="10000" step="1"
                         @change="$emit('update:maxRecordMb', Number($event.target.value))">
                 </div>
+                <div class="settings-field">
+                    <label>
+                        <input type="checkbox" :checked="tileStreaming"
+                            @change="$emit('update:tileStreaming', $event.target.checked)">
+                        Tile Streaming (only changed areas, for static scenes)
+                    </label>
+                </div>
+                <div class="settings-field">
+                    <label>
+                        <input type="checkbox" :checked="videoStreaming"
+                            @change="$emit('update:videoStreaming', $event.target.checked)">
+                        Video Streaming (H.264, decoded with WebCodecs)
+                    </label>
+                </div>
+                <div class="settings-field">
+                    <label>
+                        <input type="checkbox" :checked="httpServer.enabled"
+                            @change="applyHttpServer($event.target.checked)">
+                        HTTP Stream (MJPEG and snapshots)
+                    </label>
+                    <div class="settings-row">
+                        <input type="text" v-model="httpAddress" placeholder="localhost" title="localhost, 0.0.0.0 or an interface address"
+                            @change="httpServer.enabled && applyHttpServer(true)">
+                        <input type="number" v-model="httpPort" min="0" max="65535" step="1" title="Port, 0 picks a free one"
+                            @change="httpServer.enabled && applyHttpServer(true)">
+                    </div>
+                    <div class="settings-hint" v-if="httpUrl">
+                        {{ httpUrl }}/stream.mjpg, /snapshot.jpg, /snapshot.png, /snapshot.raw
+                    </div>
+                </div>
             </div>
         </div>
     `
@@ -304,9 +361,10 @@ const Toolbar = defineComponent({
         zoom: Number,
         flipX: Boolean,
         flipY: Boolean,
+        rotation: Number,
         isCropped: Boolean,
     },
-    emits: ['start-stream', 'stop-stream', 'zoom-in', 'zoom-out', 'zoom-fit', 'save-image', 'flip-x', 'flip-y', 'snapshot', 'reset-crop', 'start-record', 'stop-record', 'toggle-settings'],
+    emits: ['start-stream', 'stop-stream', 'zoom-in', 'zoom-out', 'zoom-fit', 'save-image', 'flip-x', 'flip-y', 'rotate', 'snapshot', 'reset-crop', 'start-record', 'stop-record', 'toggle-settings'],
     template: `
         <div class="toolbar">
             <div class="toolbar-group">
@@ -337,6 +395,9 @@ const Toolbar = defineComponent({
                 <button class="tool-btn" :class="{ active: flipY }" @click="$emit('flip-y')" :disabled="!isOpen" title="Flip Vertical">
                     <span class="icon" style="transform:rotate(90deg)" v-html="Icons.flip"></span>
                 </button>
+                <button class="tool-btn" :class="{ active: rotation }" @click="$emit('rotate')" :disabled="!isOpen || isRecording" title="Rotate Clockwise">
+                    <span class="icon" v-html="Icons.rotate_right"></span> {{ rotation }}&deg;
+                </button>
                 <div class="toolbar-divider"></div>
                 <div class="zoom-control">
                     <button @click="$emit('zoom-out')" title="Zoom Out">
@@ -370,6 +431,9 @@ const ControlPanel = defineComponent({
         gamma: Object,
         brightness: Object,
         whiteBalance: Object,
+        colorCorrection: Object,
+        softwareAuto: Object,
+        flatField: Object,
         frameRate: Object,
         pixelFormats: Object,
         frameSizes: Object,
@@ -382,6 +446,9 @@ const ControlPanel = defineComponent({
         'set-gain', 'set-auto-gain',
         'set-gamma', 'set-brightness',
         'set-auto-white-balance',
+        'set-software-auto-exposure', 'set-software-white-balance',
+        'set-color-correction', 'load-color-profile', 'save-color-profile',
+        'capture-flat-field', 'build-flat-field', 'load-flat-field', 'set-flat-field-enabled',
         'set-frame-rate', 'set-frame-rate-auto',
         'set-pixel-format', 'set-frame-size',
         'set-crop',
@@ -391,8 +458,11 @@ const ControlPanel = defineComponent({
         'toggle-pin',
     ],
     setup() {
+        const flatFieldFrames = ref(16);
         const sections = reactive({
             image: true,
+            color: false,
+            flatField: false,
             format: true,
             controls: true,
             advanced: false,
@@ -402,7 +472,15 @@ const ControlPanel = defineComponent({
             sections[name] = !sections[name];
         }
 
-        return { sections, toggleSection };
+        return {
+            sections, toggleSection, flatFieldFrames,
+            gainLabels: ['Red Gain', 'Green Gain', 'Blue Gain'],
+            whiteBalanceModes: [
+                { value: 'off', label: 'Off' },
+                { value: 'grayWorld', label: 'Gray World' },
+                { value: 'whitePatch', label: 'White Patch' },
+            ],
+        };
     },
     template: `
         <aside class="right-panel" :class="{ collapsed: !pinned }">
@@ -463,6 +541,107 @@ const ControlPanel = defineComponent({
                         </div>
                         <span class="switch-label">Auto White Balance</span>
                     </div>
+                    <template v-if="softwareAuto">
+                        <div class="toggle-switch">
+                            <div class="switch" :class="{ on: softwareAuto.autoExposure }" @click="$emit('set-software-auto-exposure', !softwareAuto.autoExposure)">
+                                <div class="knob"></div>
+                            </div>
+                            <span class="switch-label">Software Auto Exposure</span>
+                        </div>
+                        <div class="control-row">
+                            <div class="control-label"><span>Software White Balance</span></div>
+                            <select class="modern-select" @change="$emit('set-software-white-balance', $event.target.value)">
+                                <option v-for="mode in whiteBalanceModes" :key="mode.value"
+                                        :value="mode.value" :selected="mode.value === softwareAuto.whiteBalance">
+                                    {{ mode.label }}
+                                </option>
+                            </select>
+                        </div>
+                    </template>
+                </div>
+            </div>
+
+            <!-- Color Correction -->
+            <div class="panel-section" v-if="colorCorrection">
+                <div class="panel-header" @click="toggleSection('color')">
+                    <h3><span class="icon" v-html="Icons.palette"></span> Color Correction</h3>
+                    <span class="toggle-icon" :class="{ open: sections.color }" v-html="Icons.expand_more"></span>
+                </div>
+                <div class="panel-body" v-show="sections.color">
+                    <div class="toggle-switch">
+                        <div class="switch" :class="{ on: colorCorrection.enabled }" @click="$emit('set-color-correction', { enabled: !colorCorrection.enabled })">
+                            <div class="knob"></div>
+                        </div>
+                        <span class="switch-label">Bayer Color Correction</span>
+                    </div>
+                    <control-slider
+                        label="Black Level"
+                        :value="colorCorrection.blackLevel * 100"
+                        :min="0" :max="25" :step="0.1" :decimals="1"
+                        unit="%"
+                        :disabled="!colorCorrection.enabled"
+                        @update="$emit('set-color-correction', { blackLevel: $event / 100 })"
+                    />
+                    <control-slider v-for="(label, idx) in gainLabels" :key="label"
+                        :label="label"
+                        :value="colorCorrection.gains[idx]"
+                        :min="0" :max="4" :step="0.01" :decimals="2"
+                        :disabled="!colorCorrection.enabled"
+                        @update="$emit('set-color-correction', { gains: colorCorrection.gains.map((g, i) => i === idx ? $event : g) })"
+                    />
+                    <control-slider
+                        label="Gamma"
+                        :value="colorCorrection.gamma"
+                        :min="0.5" :max="3" :step="0.05" :decimals="2"
+                        :disabled="!colorCorrection.enabled"
+                        @update="$emit('set-color-correction', { gamma: $event })"
+                    />
+                    <div class="control-row">
+                        <div class="control-label"><span>Profile</span></div>
+                        <div class="inline-group">
+                            <label class="tool-btn">
+                                Load
+                                <input type="file" accept=".json,application/json" style="display:none"
+                                    @change="$emit('load-color-profile', $event.target.files[0]); $event.target.value = ''">
+                            </label>
+                            <button class="tool-btn" @click="$emit('save-color-profile')">Save</button>
+                        </div>
+                    </div>
+                </div>
+            </div>
+
+            <!-- Flat Field -->
+            <div class="panel-section" v-if="flatField">
+                <div class="panel-header" @click="toggleSection('flatField')">
+                    <h3><span class="icon" v-html="Icons.tune"></span> Flat Field</h3>
+                    <span class="toggle-icon" :class="{ open: sections.flatField }" v-html="Icons.expand_more"></span>
+                </div>
+                <div class="panel-body" v-show="sections.flatField">
+                    <div class="toggle-switch">
+                        <div class="switch" :class="{ on: flatField.enabled }" @click="$emit('set-flat-field-enabled', !flatField.enabled)">
+                            <div class="knob"></div>
+                        </div>
+                        <span class="switch-label">Flat-Field Correction</span>
+                    </div>
+                    <div class="control-row">
+                        <div class="control-label"><span>Reference Frames</span></div>
+                        <div class="inline-group">
+                            <input type="number" v-model.number="flatFieldFrames" class="value-input" min="1" max="256" step="1">
+                            <button class="tool-btn" :disabled="!isStreaming || flatField.capturing" @click="$emit('capture-flat-field', 'dark', flatFieldFrames)">Dark</button>
+                            <button class="tool-btn" :disabled="!isStreaming || flatField.capturing" @click="$emit('capture-flat-field', 'flat', flatFieldFrames)">Flat</button>
+                        </div>
+                    </div>
+                    <p class="hint-text">
+                        {{ flatField.capturing ? 'Capturing...' : 'Dark: ' + flatField.darkFrames + ' frames, flat: ' + flatField.flatFrames + ' frames' }}
+                        <template v-if="flatField.loaded">, {{ flatField.defects }} defect pixels</template>
+                    </p>
+                    <div class="control-row">
+                        <div class="control-label"><span>Maps</span></div>
+                        <div class="inline-group">
+                            <button class="tool-btn" :disabled="flatField.capturing" @click="$emit('build-flat-field')">Build &amp; Save</button>
+                            <button class="tool-btn" @click="$emit('load-flat-field')">Load</button>
+                        </div>
+                    </div>
                 </div>
             </div>
 
@@ -569,8 +748,6 @@ const FrameViewer = defineComponent({
         recordingInfo: Object,
         frameStreamPort: Number,
         zoom: Number,
-        flipX: Boolean,
-        flipY: Boolean,
         fps: Object,
         frameInfo: Object,
         pixelFormats: Object,
@@ -630,15 +807,14 @@ const FrameViewer = defineComponent({
             }
         }
 
-        // Convert mouse event to frame-pixel coordinates
+        // Convert mouse event to frame-pixel coordinates. The server orients
+        // the frames, so these are coordinates in the oriented frame.
         function mouseToFrame(e) {
             const canvas = canvasRef.value;
             if (!canvas) return null;
             const rect = canvas.getBoundingClientRect();
-            let mx = (e.clientX - rect.left) * (canvas.width / rect.width);
-            let my = (e.clientY - rect.top) * (canvas.height / rect.height);
-            if (props.flipX) mx = canvas.width - mx;
-            if (props.flipY) my = canvas.height - my;
+            const mx = (e.clientX - rect.left) * (canvas.width / rect.width);
+            const my = (e.clientY - rect.top) * (canvas.height / rect.height);
             return { x: Math.round(mx), y: Math.round(my) };
         }
 
@@ -918,8 +1094,8 @@ const FrameViewer = defineComponent({
             appliedRect.value = { x: cx, y: cy, w: crw, h: crh };
             clearOverlay();
 
-            // Apply software crop in renderer
-            FrameRenderer.cropRegion = { x: cx, y: cy, w: crw, h: crh };
+            // Crop in the renderer, the server streams only the region
+            FrameRenderer.setCropRegion({ x: cx, y: cy, w: crw, h: crh });
 
             // Emit event so parent can attempt hardware crop
             emit('apply-crop', cx, cy, crw, crh);
@@ -927,7 +1103,7 @@ const FrameViewer = defineComponent({
         }
 
         function resetCrop() {
-            FrameRenderer.cropRegion = null;
+            FrameRenderer.setCropRegion(null);
             activeMode.value = null;
             selectionRect.value = null;
             appliedRect.value = null;
@@ -944,18 +1120,14 @@ const FrameViewer = defineComponent({
         // Watch for crop reset from parent
         watch(() => props.isCropped, (val) => {
             if (!val && activeMode.value === 'crop') {
-                FrameRenderer.cropRegion = null;
+                FrameRenderer.setCropRegion(null);
                 activeMode.value = null;
             }
         });
 
         const canvasStyle = computed(() => {
-            const sx = props.zoom * (props.flipX ? -1 : 1);
-            const sy = props.zoom * (props.flipY ? -1 : 1);
-            const tx = props.flipX ? `${props.zoom * 100}%` : '0';
-            const ty = props.flipY ? `${props.zoom * 100}%` : '0';
             return {
-                transform: `translate(${tx}, ${ty}) scale(${sx}, ${sy})`,
+                transform: `scale(${props.zoom})`,
                 transformOrigin: 'top left',
             };
         });
@@ -1110,6 +1282,9 @@ const StatusBar = defineComponent({
                 <span class="status-item" v-if="fps">
                     {{ fps.received.toFixed(1) }} fps
                 </span>
+                <span class="status-item" v-if="fps && fps.dropped > 0">
+                    {{ fps.dropped }} dropped
+                </span>
                 <span class="status-item" v-if="frameInfo">
                     Frame #{{ frameInfo.frameId }}
                 </span>
@@ -1135,6 +1310,9 @@ const app = createApp({
         const gammaCtrl = ref(null);
         const brightness = ref(null);
         const whiteBalance = ref(null);
+        const colorCorrection = ref(null);
+        const softwareAuto = ref(null);
+        const flatField = ref(null);
         const frameRate = ref(null);
         const pixelFormats = ref(null);
         const frameSizes = ref(null);
@@ -1144,9 +1322,10 @@ const app = createApp({
         const fps = ref(null);
         const frameInfo = ref(null);
 
-        // Flip state tracking
+        // Orientation applied by the server to stream, snapshots and recordings
         const flipX = ref(false);
         const flipY = ref(false);
+        const rotation = ref(0);
 
         // Panel pin state
         const sidebarPinned = ref(true);
@@ -1160,6 +1339,9 @@ const app = createApp({
         const recordingFormat = ref('avi');
         const maxRecordMb = ref(200);
         const showSettings = ref(false);
+        const tileStreaming = ref(false);
+        const videoStreaming = ref(false);
+        const httpServer = ref({ enabled: false, address: 'localhost', port: 8080 });
         const recordingInfo = ref(null);
 
         // WebM recording state
@@ -1200,7 +1382,10 @@ const app = createApp({
                 });
 
                 bridge.statsUpdated.connect((data) => {
-                    fps.value = { received: data.receivedFps || 0 };
+                    // Frames the stream clients skipped because they were busy
+                    const clients = data.streamClients || [];
+                    const dropped = clients.reduce((sum, client) => sum + (client.dropped || 0), 0);
+                    fps.value = { received: data.receivedFps || 0, dropped };
                 });
 
                 bridge.frameInfoUpdated.connect((data) => {
@@ -1283,6 +1468,11 @@ const app = createApp({
                     selectedCamera.value = 0;
                 }
 
+                const http = await CameraChannel.getHttpServer();
+                if (http.enabled) {
+                    httpServer.value = { enabled: true, address: http.address, port: http.port };
+                }
+
                 statusText.value = 'Ready';
             } catch (err) {
                 statusText.value = 'Failed to initialize: ' + err.message;
@@ -1303,7 +1493,7 @@ const app = createApp({
                 controls.value = [];
                 await CameraChannel.enumerateControls();
 
-                const [expData, gainData, gammaData, brightData, wbData, frData, pfData, cropData] =
+                const [expData, gainData, gammaData, brightData, wbData, frData, pfData, cropData, ccData, saData, ffData, orData] =
                     await Promise.all([
                         CameraChannel.getExposure(),
                         CameraChannel.getGain(),
@@ -1313,6 +1503,10 @@ const app = createApp({
                         CameraChannel.getFrameRate(),
                         CameraChannel.getPixelFormats(),
                         CameraChannel.getCrop(),
+                        CameraChannel.getColorCorrection(),
+                        CameraChannel.getSoftwareAuto(),
+                        CameraChannel.getFlatField(),
+                        CameraChannel.getOrientation(),
                     ]);
 
                 exposure.value = expData;
@@ -1323,6 +1517,12 @@ const app = createApp({
                 frameRate.value = frData;
                 pixelFormats.value = pfData;
                 crop.value = cropData;
+                colorCorrection.value = ccData.profile;
+                softwareAuto.value = saData;
+                flatField.value = ffData;
+                flipX.value = orData.flipX;
+                flipY.value = orData.flipY;
+                rotation.value = orData.rotation;
 
                 if (pfData.current) {
                     const fsData = await CameraChannel.getFrameSizes(pfData.current);
@@ -1343,11 +1543,15 @@ const app = createApp({
             pixelFormats.value = null;
             frameSizes.value = null;
             crop.value = null;
+            colorCorrection.value = null;
+            softwareAuto.value = null;
+            flatField.value = null;
             controls.value = [];
             fps.value = null;
             frameInfo.value = null;
             flipX.value = false;
             flipY.value = false;
+            rotation.value = 0;
         }
 
         async function toggleOpen() {
@@ -1402,6 +1606,97 @@ const app = createApp({
         async function setAutoWhiteBalance(enabled) {
             try { await CameraChannel.setAutoWhiteBalance(enabled); whiteBalance.value = { ...whiteBalance.value, autoEnabled: enabled }; } catch(e) { statusText.value = e.message; }
         }
+        async function setColorCorrection(changes) {
+            try {
+                const result = await CameraChannel.setColorCorrection(changes);
+                colorCorrection.value = result.profile;
+            } catch(e) { statusText.value = e.message; }
+        }
+        async function setSoftwareAutoExposure(enabled) {
+            try { await CameraChannel.setSoftwareAutoExposure(enabled); softwareAuto.value = { ...softwareAuto.value, autoExposure: enabled }; } catch(e) { statusText.value = e.message; }
+        }
+        async function setSoftwareWhiteBalance(mode) {
+            try {
+                await CameraChannel.setSoftwareWhiteBalance(mode);
+                softwareAuto.value = { ...softwareAuto.value, whiteBalance: mode };
+                // The white balance drives the color correction gains
+                colorCorrection.value = (await CameraChannel.getColorCorrection()).profile;
+            } catch(e) { statusText.value = e.message; }
+        }
+        async function captureFlatField(reference, frames) {
+            try {
+                await CameraChannel.startFlatFieldCapture(reference, frames);
+                flatField.value = await CameraChannel.getFlatField();
+                // The capture runs on the stream, poll until it has all frames
+                while (flatField.value && flatField.value.capturing) {
+                    await new Promise(resolve => setTimeout(resolve, 500));
+                    if (!isOpen.value) return;
+                    flatField.value = await CameraChannel.getFlatField();
+                }
+            } catch(e) { statusText.value = e.message; }
+        }
+        async function buildFlatField() {
+            try {
+                flatField.value = await CameraChannel.buildFlatField();
+                statusText.value = 'Flat-field maps saved, ' + flatField.value.defects + ' defect pixels';
+            } catch(e) { statusText.value = e.message; }
+        }
+        async function loadFlatField() {
+            try {
+                flatField.value = await CameraChannel.loadFlatField();
+                statusText.value = 'Flat-field maps loaded';
+            } catch(e) { statusText.value = e.message; }
+        }
+        function setTileStreaming(enabled) {
+            tileStreaming.value = enabled;
+            FrameRenderer.setTiles(enabled);
+        }
+        function setVideoStreaming(enabled) {
+            videoStreaming.value = enabled;
+            FrameRenderer.setVideo(enabled);
+        }
+        async function setHttpServer(server) {
+            try {
+                const result = await CameraChannel.setHttpServer(server.enabled, server.address, server.port);
+                // The address and port the server took, the port may have been picked
+                httpServer.value = result.enabled
+                    ? { enabled: true, address: result.address, port: result.port }
+                    : { ...server, enabled: false };
+            } catch(e) {
+                httpServer.value = { ...server, enabled: false };
+                statusText.value = e.message;
+            }
+        }
+        async function setFlatFieldEnabled(enabled) {
+            try { await CameraChannel.setFlatFieldEnabled(enabled); flatField.value = { ...flatField.value, enabled }; } catch(e) { statusText.value = e.message; }
+        }
+        function loadColorProfile(file) {
+            if (!file) return;
+            const reader = new FileReader();
+            reader.onload = async () => {
+                let profile;
+                try {
+                    profile = JSON.parse(reader.result);
+                } catch(e) {
+                    statusText.value = 'Invalid color profile: ' + e.message;
+                    return;
+                }
+                // A loaded profile is meant to be seen
+                await setColorCorrection({ ...profile, enabled: true });
+                statusText.value = 'Color profile loaded: ' + file.name;
+            };
+            reader.readAsText(file);
+        }
+        function saveColorProfile() {
+            if (!colorCorrection.value) return;
+            const blob = new Blob([JSON.stringify(colorCorrection.value, null, 4)], { type: 'application/json' });
+            const url = URL.createObjectURL(blob);
+            const a = document.createElement('a');
+            a.href = url;
+            a.download = 'color_profile.json';
+            a.click();
+            URL.revokeObjectURL(url);
+        }
         async function setFrameRate(hz) {
             try { await CameraChannel.setFrameRate(hz); frameRate.value = { ...frameRate.value, fps: hz, auto: false }; } catch(e) { statusText.value = e.message; }
         }
@@ -1429,11 +1724,47 @@ const app = createApp({
         async function setCrop(x, y, w, h) {
             try { await CameraChannel.setCrop(x, y, w, h); } catch(e) { statusText.value = e.message; }
         }
+        async function setOrientation(fx, fy, rot) {
+            try {
+                const result = await CameraChannel.setOrientation(fx, fy, rot);
+                flipX.value = result.flipX;
+                flipY.value = result.flipY;
+                rotation.value = result.rotation;
+            } catch(e) { statusText.value = e.message; }
+        }
         function toggleFlipX() {
-            flipX.value = !flipX.value;
+            setOrientation(!flipX.value, flipY.value, rotation.value);
         }
         function toggleFlipY() {
-            flipY.value = !flipY.value;
+            setOrientation(flipX.value, !flipY.value, rotation.value);
+        }
+        function rotateClockwise() {
+            setOrientation(flipX.value, flipY.value, (rotation.value + 90) % 360);
+        }
+
+        // Maps a rectangle of the oriented frame back to sensor coordinates,
+        // the inverse of the flips followed by the clockwise rotation
+        function orientedRectToSensor(x, y, w, h) {
+            const sw = frameInfo.value ? frameInfo.value.width : 0;
+            const sh = frameInfo.value ? frameInfo.value.height : 0;
+            if (!sw || !sh) return { x, y, w, h };
+            const toSensor = (px, py) => {
+                let fx = px, fy = py;
+                switch (rotation.value) {
+                    case 90: fx = py; fy = sh - px; break;
+                    case 180: fx = sw - px; fy = sh - py; break;
+                    case 270: fx = sw - py; fy = px; break;
+                }
+                if (flipX.value) fx = sw - fx;
+                if (flipY.value) fy = sh - fy;
+                return [fx, fy];
+            };
+            const [x0, y0] = toSensor(x, y);
+            const [x1, y1] = toSensor(x + w, y + h);
+            return {
+                x: Math.min(x0, x1), y: Math.min(y0, y1),
+                w: Math.abs(x1 - x0), h: Math.abs(y1 - y0),
+            };
         }
         async function setControlInt(id, val) {
             try { await CameraChannel.setControlInt(id, val); } catch(e) { statusText.value = e.message; }
@@ -1462,13 +1793,14 @@ const app = createApp({
             isCropped.value = true;
             // Attempt hardware crop if supported
             if (crop.value && crop.value.supported) {
-                try { await CameraChannel.setCrop(x, y, w, h); } catch(e) { /* software crop still active */ }
+                const r = orientedRectToSensor(x, y, w, h);
+                try { await CameraChannel.setCrop(r.x, r.y, r.w, r.h); } catch(e) { /* software crop still active */ }
             }
         }
 
         function resetCrop() {
             isCropped.value = false;
-            FrameRenderer.cropRegion = null;
+            FrameRenderer.setCropRegion(null);
         }
 
         // Zoom
@@ -1591,15 +1923,18 @@ const app = createApp({
 
         return {
             cameras, selectedCamera, isOpen, isStreaming, frameStreamPort, zoom, statusText,
-            exposure, gain, gammaCtrl, brightness, whiteBalance, frameRate,
-            pixelFormats, frameSizes, crop, controls, fps, frameInfo, flipX, flipY,
+            exposure, gain, gammaCtrl, brightness, whiteBalance, colorCorrection, softwareAuto, flatField, frameRate,
+            pixelFormats, frameSizes, crop, controls, fps, frameInfo, flipX, flipY, rotation,
             sidebarPinned, controlsPinned, isCropped,
-            isRecording, recordingFormat, maxRecordMb, showSettings, recordingInfo,
+            isRecording, recordingFormat, maxRecordMb, showSettings, recordingInfo, tileStreaming, setTileStreaming, videoStreaming, setVideoStreaming, httpServer, setHttpServer,
             toggleOpen, startStream, stopStream, applyCropFromSelection, resetCrop,
             setExposure, setAutoExposure, setGain, setAutoGain,
             setGamma, setBrightness, setAutoWhiteBalance,
+            setSoftwareAutoExposure, setSoftwareWhiteBalance,
+            captureFlatField, buildFlatField, loadFlatField, setFlatFieldEnabled,
+            setColorCorrection, loadColorProfile, saveColorProfile,
             setFrameRate, setFrameRateAuto, setPixelFormat, setFrameSizeByIndex,
-            setCrop, toggleFlipX, toggleFlipY,
+            setCrop, toggleFlipX, toggleFlipY, rotateClockwise,
             setControlInt, setControlInt64, setControlBool, setControlButton,
             setControlList, setControlIntList, setControlString,
             zoomIn, zoomOut, zoomFit, saveImage,
@@ -107,6 +107,46 @@ window.CameraChannel = {
         return this._call('setAutoWhiteBalance', enabled);
     },
 
+    getColorCorrection() {
+        return this._call('getColorCorrection');
+    },
+
+    setColorCorrection(profile) {
+        return this._call('setColorCorrection', profile);
+    },
+
+    getSoftwareAuto() {
+        return this._call('getSoftwareAuto');
+    },
+
+    setSoftwareAutoExposure(enabled) {
+        return this._call('setSoftwareAutoExposure', enabled);
+    },
+
+    setSoftwareWhiteBalance(mode) {
+        return this._call('setSoftwareWhiteBalance', mode);
+    },
+
+    getFlatField() {
+        return this._call('getFlatField');
+    },
+
+    startFlatFieldCapture(reference, frames) {
+        return this._call('startFlatFieldCapture', reference, frames);
+    },
+
+    buildFlatField() {
+        return this._call('buildFlatField');
+    },
+
+    loadFlatField() {
+        return this._call('loadFlatField');
+    },
+
+    setFlatFieldEnabled(enabled) {
+        return this._call('setFlatFieldEnabled', enabled);
+    },
+
     getFrameRate() {
         return this._call('getFrameRate');
     },
@@ -135,6 +175,14 @@ window.CameraChannel = {
         return this._call('setFlipY', enabled);
     },
 
+    getOrientation() {
+        return this._call('getOrientation');
+    },
+
+    setOrientation(flipX, flipY, rotation) {
+        return this._call('setOrientation', flipX, flipY, rotation);
+    },
+
     getPixelFormats() {
         return this._call('getPixelFormats');
     },
@@ -215,6 +263,14 @@ window.CameraChannel = {
         return this._call('getStats');
     },
 
+    getHttpServer() {
+        return this._call('getHttpServer');
+    },
+
+    setHttpServer(enabled, address, port) {
+        return this._call('setHttpServer', enabled, address, port);
+    },
+
     // Internal: call a bridge method and return a promise
     _call(method, ...args) {
         return new Promise((resolve, reject) => {
@@ -1,4 +1,4 @@
-// frame-renderer.js — WebSocket receiver + canvas renderer
+// frame-renderer.js — WebSocket receiver + canvas renderer, JPEG, tiled, raw (see raw-renderer.js) or H.264 frames
 
 window.FrameRenderer = {
     ws: null,
@@ -10,10 +10,33 @@ window.FrameRenderer = {
     width: 0,
     height: 0,
     _rendering: false,
-    // Software crop region (frame pixels); null = full frame
+    // Crop region (frame pixels); null = full frame. Set through
+    // setCropRegion(), the server then sends only that part of the frame.
     cropRegion: null,
     // Callback invoked after each frame render with (canvasWidth, canvasHeight)
     onCanvasResize: null,
+    // Last viewport reported to the server, see _reportViewport()
+    _viewportWidth: 0,
+    _viewportHeight: 0,
+    // Tile streaming: the server sends only the tiles that changed, which
+    // are composited here. Magic of a tile message, after the frame header.
+    TILE_MAGIC: 0x4C495456,
+    tiles: false,
+    _tileCanvas: null,
+    _tileChain: Promise.resolve(),
+    // Magic of a message holding the JPEG of part of the frame
+    REGION_MAGIC: 0x47455256,
+    // Video streaming: the server sends one H.264 stream, which WebCodecs
+    // decodes here. Magic of a video message, after the frame header.
+    VIDEO_MAGIC: 0x44495656,
+    video: false,
+    _decoder: null,
+    _decoderCodec: '',
+    _decoderWidth: 0,
+    _decoderHeight: 0,
+    // Frame sizes of the chunks being decoded, in order
+    _videoPending: [],
+    _videoKeyed: false,
 
     connect(port, canvas) {
         console.log('[FrameRenderer] Connecting to ws://127.0.0.1:' + port, 'canvas:', canvas);
@@ -26,6 +49,8 @@ window.FrameRenderer = {
         this.ctx = canvas.getContext('2d');
         this.frameCount = 0;
         this._rendering = false;
+        this._viewportWidth = 0;
+        this._viewportHeight = 0;
 
         if (this.ws) {
             this.ws.close();
@@ -38,6 +63,7 @@ window.FrameRenderer = {
         this.ws.onopen = () => {
             console.log('[FrameRenderer] WebSocket connected');
             this.connected = true;
+            this._sendModes();
             // Signal server we're ready for the first frame
             this.ws.send('ack');
         };
@@ -57,22 +83,83 @@ window.FrameRenderer = {
         };
     },
 
+    // Switches tile streaming on or off, tiles are JPEG so raw frames go off with it
+    setTiles(enabled) {
+        this.tiles = enabled;
+        if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+            this._sendModes();
+        }
+    },
+
+    // Switches video streaming on or off, it needs a browser with WebCodecs
+    setVideo(enabled) {
+        this.video = enabled;
+        if (!enabled) {
+            this._closeDecoder();
+        }
+        if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+            this._sendModes();
+        }
+    },
+
+    // Shows only part of the frame, or all of it again for null
+    setCropRegion(region) {
+        this.cropRegion = region;
+        if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+            this._sendRegion();
+        }
+    },
+
+    _sendRegion() {
+        const r = this.cropRegion;
+        this.ws.send(JSON.stringify(r
+            ? { type: 'region', x: Math.round(r.x), y: Math.round(r.y), width: Math.round(r.w), height: Math.round(r.h) }
+            : { type: 'region', x: 0, y: 0, width: 0, height: 0 }));
+    },
+
+    _sendModes() {
+        this._sendRegion();
+        this.ws.send(JSON.stringify({ type: 'tiles', enabled: this.tiles }));
+        this.ws.send(JSON.stringify({ type: 'video', enabled: this.video && 'VideoDecoder' in window }));
+        // Take frames unconverted when WebGL2 can demosaic them here
+        if (!this.tiles && !this.video && RawRenderer.init()) {
+            this.ws.send(JSON.stringify({ type: 'raw', enabled: true }));
+        } else {
+            this.ws.send(JSON.stringify({ type: 'raw', enabled: false }));
+        }
+    },
+
     disconnect() {
         if (this.ws) {
             this.ws.close();
             this.ws = null;
         }
         this.connected = false;
+        this._closeDecoder();
     },
 
     _handleFrame(data) {
         if (data.byteLength < 16) return;
 
+        // Tile messages build on each other, they are queued instead of dropped
+        const view = new DataView(data);
+        if (data.byteLength >= 32 && view.getUint32(16, true) === this.TILE_MAGIC) {
+            this._tileChain = this._tileChain.then(() => this._drawTiles(data, view)).catch((err) => {
+                console.error('[FrameRenderer] Tile error:', err);
+            }).then(() => this._acknowledge());
+            return;
+        }
+
+        // Video messages build on each other too, the decoder queues them
+        if (data.byteLength >= 32 && view.getUint32(16, true) === this.VIDEO_MAGIC) {
+            this._decodeVideo(data, view);
+            return;
+        }
+
         // Drop frames while previous decode is still in flight
         if (this._rendering) return;
         this._rendering = true;
 
-        const view = new DataView(data);
         const width = view.getUint32(0, true);   // LE
         const height = view.getUint32(4, true);   // LE
         const frameIdLo = view.getUint32(8, true);
@@ -84,11 +171,35 @@ window.FrameRenderer = {
         this.height = height;
 
         if (this.frameCount === 0) {
-            console.log('[FrameRenderer] First frame received:', width, 'x', height, 'jpeg size:', data.byteLength - 16);
+            console.log('[FrameRenderer] First frame received:', width, 'x', height,
+                        RawRenderer.isRaw(view) ? 'raw' : 'jpeg', 'size:', data.byteLength - 16);
+        }
+
+        // Raw frames are converted synchronously by the shader
+        if (RawRenderer.isRaw(view)) {
+            if (RawRenderer.render(data, view)) {
+                this._present(RawRenderer.canvas, width, height);
+            } else if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+                console.warn('[FrameRenderer] Raw frame not renderable, falling back to JPEG');
+                this.ws.send(JSON.stringify({ type: 'raw', enabled: false }));
+            }
+            this._frameDone();
+            return;
         }
 
-        // Extract JPEG data
-        const jpegData = new Uint8Array(data, 16);
+        // Extract JPEG data, a region JPEG shows only the part of the frame given before it
+        let source = null;
+        let jpegOffset = 16;
+        if (data.byteLength >= 36 && view.getUint32(16, true) === this.REGION_MAGIC) {
+            source = {
+                x: view.getUint32(20, true),
+                y: view.getUint32(24, true),
+                w: view.getUint32(28, true),
+                h: view.getUint32(32, true)
+            };
+            jpegOffset = 36;
+        }
+        const jpegData = new Uint8Array(data, jpegOffset);
         const blob = new Blob([jpegData], { type: 'image/jpeg' });
 
         // Async decode to keep UI responsive
@@ -99,42 +210,206 @@ window.FrameRenderer = {
                 return;
             }
 
-            const cr = this.cropRegion;
-            let dw, dh;
-
-            if (cr) {
-                // Software crop: draw only the selected region
-                dw = cr.w;
-                dh = cr.h;
-                if (this.canvas.width !== dw || this.canvas.height !== dh) {
-                    this.canvas.width = dw;
-                    this.canvas.height = dh;
-                    if (this.onCanvasResize) this.onCanvasResize(dw, dh);
-                }
-                this.ctx.drawImage(bitmap, cr.x, cr.y, cr.w, cr.h, 0, 0, dw, dh);
-            } else {
-                // Full frame
-                dw = width;
-                dh = height;
-                if (this.canvas.width !== dw || this.canvas.height !== dh) {
-                    console.log('[FrameRenderer] Resizing canvas to', dw, 'x', dh);
-                    this.canvas.width = dw;
-                    this.canvas.height = dh;
-                    if (this.onCanvasResize) this.onCanvasResize(dw, dh);
-                }
-                this.ctx.drawImage(bitmap, 0, 0);
-            }
-
+            this._present(bitmap, width, height, source);
             bitmap.close();
-            this.frameCount++;
-            this._rendering = false;
-            // Tell server we're ready for the next frame
-            if (this.ws && this.ws.readyState === WebSocket.OPEN) {
-                this.ws.send('ack');
-            }
+            this._frameDone();
         }).catch((err) => {
+            // Camera JPEGs pass through unchecked, a corrupt one must not stall the stream
             console.error('[FrameRenderer] Decode error:', err);
-            this._rendering = false;
+            this._frameDone();
+        });
+    },
+
+    // Draws a converted frame, a JPEG bitmap or the raw canvas, onto the
+    // canvas. source is the part of the frame the image shows, all of it
+    // unless the server sent a region.
+    _present(image, width, height, source) {
+        const src = source || { x: 0, y: 0, w: width, h: height };
+        const cr = this.cropRegion || { x: 0, y: 0, w: width, h: height };
+        if (this.canvas.width !== cr.w || this.canvas.height !== cr.h) {
+            console.log('[FrameRenderer] Resizing canvas to', cr.w, 'x', cr.h);
+            this.canvas.width = cr.w;
+            this.canvas.height = cr.h;
+            if (this.onCanvasResize) this.onCanvasResize(cr.w, cr.h);
+        }
+
+        // The server may send a binned preview that is smaller than the
+        // frame. Parts of the crop a region sent for an earlier crop lacks
+        // keep what they showed.
+        const sx = (image.displayWidth || image.width) / src.w;
+        const sy = (image.displayHeight || image.height) / src.h;
+        this.ctx.drawImage(image, (cr.x - src.x) * sx, (cr.y - src.y) * sy, cr.w * sx, cr.h * sy,
+                           0, 0, cr.w, cr.h);
+    },
+
+    // Decodes the tiles of a message in parallel and draws them in order
+    // onto the tiled image, which is then presented like a JPEG frame
+    async _drawTiles(data, view) {
+        const width = view.getUint32(0, true);
+        const height = view.getUint32(4, true);
+        this.lastFrameId = view.getUint32(8, true) + view.getUint32(12, true) * 0x100000000;
+        this.width = width;
+        this.height = height;
+
+        const imageWidth = view.getUint32(20, true);
+        const imageHeight = view.getUint32(24, true);
+        const count = view.getUint32(28, true);
+        if (!this._tileCanvas) {
+            this._tileCanvas = document.createElement('canvas');
+        }
+        const tileCanvas = this._tileCanvas;
+        if (tileCanvas.width !== imageWidth || tileCanvas.height !== imageHeight) {
+            tileCanvas.width = imageWidth;
+            tileCanvas.height = imageHeight;
+        }
+
+        const tiles = [];
+        let offset = 32;
+        for (let i = 0; i < count && offset + 12 <= data.byteLength; i++) {
+            const x = view.getUint32(offset, true);
+            const y = view.getUint32(offset + 4, true);
+            const size = view.getUint32(offset + 8, true);
+            offset += 12;
+            if (offset + size > data.byteLength) break;
+            tiles.push({ x, y, blob: new Blob([new Uint8Array(data, offset, size)], { type: 'image/jpeg' }) });
+            offset += size;
+        }
+
+        const bitmaps = await Promise.all(tiles.map((tile) => createImageBitmap(tile.blob).catch(() => null)));
+        const ctx = tileCanvas.getContext('2d');
+        bitmaps.forEach((bitmap, i) => {
+            if (!bitmap) return;
+            ctx.drawImage(bitmap, tiles[i].x, tiles[i].y);
+            bitmap.close();
+        });
+        if (this.canvas) {
+            this._present(tileCanvas, width, height);
+        }
+    },
+
+    // Hands an H.264 access unit to the decoder, which is set up again
+    // whenever a key frame changes the profile or the picture size. Each
+    // message is acknowledged once its picture is drawn.
+    _decodeVideo(data, view) {
+        const width = view.getUint32(0, true);
+        const height = view.getUint32(4, true);
+        this.lastFrameId = view.getUint32(8, true) + view.getUint32(12, true) * 0x100000000;
+        const key = (view.getUint32(20, true) & 1) !== 0;
+        const pictureWidth = view.getUint32(24, true);
+        const pictureHeight = view.getUint32(28, true);
+        const accessUnit = new Uint8Array(data, 32);
+
+        if (key) {
+            const codec = this._avcCodec(accessUnit);
+            if (codec && (!this._decoder || this._decoder.state === 'closed' || codec !== this._decoderCodec ||
+                          pictureWidth !== this._decoderWidth || pictureHeight !== this._decoderHeight)) {
+                this._openDecoder(codec, pictureWidth, pictureHeight);
+            }
+            this._videoKeyed = !!this._decoder;
+        }
+        // The server resends from a key frame after a loss
+        if (!this._videoKeyed || !this._decoder || this._decoder.state !== 'configured') {
+            this._acknowledge();
+            return;
+        }
+
+        this._videoPending.push({ width, height });
+        try {
+            this._decoder.decode(new EncodedVideoChunk({
+                type: key ? 'key' : 'delta',
+                timestamp: this.lastFrameId,
+                data: accessUnit
+            }));
+        } catch (err) {
+            this._videoError(err);
+        }
+    },
+
+    _openDecoder(codec, width, height) {
+        this._closeDecoder();
+        console.log('[FrameRenderer] Decoding', codec, width, 'x', height);
+        const decoder = new VideoDecoder({
+            output: (frame) => {
+                const pending = this._videoPending.shift();
+                if (pending && this.canvas) {
+                    this.width = pending.width;
+                    this.height = pending.height;
+                    this._present(frame, pending.width, pending.height);
+                }
+                frame.close();
+                if (pending) this._acknowledge();
+            },
+            error: (err) => this._videoError(err)
         });
+        // Annex B chunks without a description, low latency so every chunk
+        // comes out before the next one arrives
+        decoder.configure({ codec, codedWidth: width, codedHeight: height, optimizeForLatency: true });
+        this._decoder = decoder;
+        this._decoderCodec = codec;
+        this._decoderWidth = width;
+        this._decoderHeight = height;
+    },
+
+    _closeDecoder() {
+        if (this._decoder && this._decoder.state !== 'closed') {
+            this._decoder.close();
+        }
+        this._decoder = null;
+        this._videoKeyed = false;
+        // Chunks that won't come out any more still count for the server
+        const pending = this._videoPending.length;
+        this._videoPending = [];
+        for (let i = 0; i < pending; i++) this._acknowledge();
+    },
+
+    // A failed decoder is closed, the next key frame opens a new one
+    _videoError(err) {
+        console.error('[FrameRenderer] Video decode error:', err);
+        this._closeDecoder();
+    },
+
+    // This function returns the codec string of the SPS of a key frame,
+    // "avc1." and its profile, constraints and level in hex
+    _avcCodec(accessUnit) {
+        for (let i = 0; i + 7 < accessUnit.length; i++) {
+            if (accessUnit[i] === 0 && accessUnit[i + 1] === 0 && accessUnit[i + 2] === 1 &&
+                (accessUnit[i + 3] & 0x1f) === 7) {
+                const hex = (b) => b.toString(16).padStart(2, '0');
+                return 'avc1.' + hex(accessUnit[i + 4]) + hex(accessUnit[i + 5]) + hex(accessUnit[i + 6]);
+            }
+        }
+        return '';
+    },
+
+    _frameDone() {
+        this._rendering = false;
+        this._acknowledge();
+    },
+
+    _acknowledge() {
+        this.frameCount++;
+        this._reportViewport();
+        // Tell server we're ready for the next frame
+        if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+            this.ws.send('ack');
+        }
+    },
+
+    // Tell the server how many frame pixels the canvas can show on screen,
+    // so it can bin the frame down when the view is zoomed out
+    _reportViewport() {
+        const canvas = this.canvas;
+        if (!canvas || !canvas.width || !canvas.height || !canvas.clientWidth || !canvas.clientHeight) return;
+
+        const dpr = window.devicePixelRatio || 1;
+        const w = Math.ceil(canvas.clientWidth * dpr * this.width / canvas.width);
+        const h = Math.ceil(canvas.clientHeight * dpr * this.height / canvas.height);
+        if (w === this._viewportWidth && h === this._viewportHeight) return;
+
+        this._viewportWidth = w;
+        this._viewportHeight = h;
+        if (this.ws && this.ws.readyState === WebSocket.OPEN) {
+            this.ws.send(JSON.stringify({ type: 'viewport', width: w, height: h }));
+        }
     }
 };
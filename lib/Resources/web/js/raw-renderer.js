@@ -0,0 +1,246 @@
+// raw-renderer.js — WebGL conversion of raw frames sent by FrameStreamServer
+//
+// The server sends mono, Bayer and packed YUV 4:2:2 frames as they come
+// from the camera, see the message layout in FrameStreamServer.cpp. The
+// samples are uploaded as an integer texture and a fragment shader
+// demosaics, converts and orients them into an offscreen canvas, which
+// FrameRenderer then draws like a decoded JPEG.
+
+window.RawRenderer = {
+    // Byte offsets of the raw header, after the 16 byte frame header
+    MAGIC: 0x57415256,
+    PAYLOAD_OFFSET: 48,
+
+    canvas: null,
+    gl: null,
+    _program: null,
+    _uniforms: null,
+    _texture: null,
+    _textureWidth: 0,
+    _textureHeight: 0,
+    _textureFormat: 0,
+
+    // Creates the WebGL2 context and shader, returns false if the browser lacks them
+    init() {
+        if (this.gl) return !this.gl.isContextLost();
+
+        const canvas = document.createElement('canvas');
+        const gl = canvas.getContext('webgl2', { alpha: false, antialias: false, depth: false });
+        if (!gl) return false;
+
+        const program = this._createProgram(gl);
+        if (!program) return false;
+
+        this.canvas = canvas;
+        this.gl = gl;
+        this._program = program;
+        this._uniforms = {};
+        for (const name of ['u_samples', 'u_size', 'u_layout', 'u_scale', 'u_red', 'u_yuv', 'u_orient']) {
+            this._uniforms[name] = gl.getUniformLocation(program, name);
+        }
+        this._texture = gl.createTexture();
+        gl.bindTexture(gl.TEXTURE_2D, this._texture);
+        // Integer textures can't be filtered
+        gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_MIN_FILTER, gl.NEAREST);
+        gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_MAG_FILTER, gl.NEAREST);
+        gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_WRAP_S, gl.CLAMP_TO_EDGE);
+        gl.texParameteri(gl.TEXTURE_2D, gl.TEXTURE_WRAP_T, gl.CLAMP_TO_EDGE);
+        gl.pixelStorei(gl.UNPACK_ALIGNMENT, 1);
+        return true;
+    },
+
+    isRaw(view) {
+        return view.byteLength >= this.PAYLOAD_OFFSET && view.getUint32(16, true) === this.MAGIC;
+    },
+
+    // Converts the raw frame in data into this.canvas, sized to the oriented
+    // frame. Returns false when the frame can't be shown this way.
+    render(data, view) {
+        const gl = this.gl;
+        if (!gl || gl.isContextLost()) return false;
+
+        const width = view.getUint32(24, true);
+        const height = view.getUint32(28, true);
+        const lineBytes = view.getUint32(32, true);
+        const layout = view.getUint8(36);
+        const bytesPerSample = view.getUint8(37);
+        const shift = view.getUint8(38);
+        const order = view.getUint8(39);
+        const orientation = view.getUint8(40);
+
+        if (!width || !height || data.byteLength < this.PAYLOAD_OFFSET + lineBytes * height) return false;
+
+        const textureWidth = lineBytes / bytesPerSample;
+        const maxSize = gl.getParameter(gl.MAX_TEXTURE_SIZE);
+        if (textureWidth > maxSize || height > maxSize) return false;
+
+        // Upload the samples, reallocating the texture only when the frame changes
+        const deep = bytesPerSample === 2;
+        const format = deep ? gl.R16UI : gl.R8UI;
+        const type = deep ? gl.UNSIGNED_SHORT : gl.UNSIGNED_BYTE;
+        const samples = deep
+            ? new Uint16Array(data, this.PAYLOAD_OFFSET, textureWidth * height)
+            : new Uint8Array(data, this.PAYLOAD_OFFSET, textureWidth * height);
+        gl.bindTexture(gl.TEXTURE_2D, this._texture);
+        if (textureWidth !== this._textureWidth || height !== this._textureHeight || format !== this._textureFormat) {
+            gl.texImage2D(gl.TEXTURE_2D, 0, format, textureWidth, height, 0, gl.RED_INTEGER, type, samples);
+            this._textureWidth = textureWidth;
+            this._textureHeight = height;
+            this._textureFormat = format;
+        } else {
+            gl.texSubImage2D(gl.TEXTURE_2D, 0, 0, 0, textureWidth, height, gl.RED_INTEGER, type, samples);
+        }
+
+        // Every orientation is a mirroring followed by an optional quarter
+        // turn, the way ImageOrientation implements it
+        const flipX = (orientation & 1) !== 0;
+        const flipY = (orientation & 2) !== 0;
+        const turns = (orientation >> 2) & 3;
+        const halfTurn = turns >= 2;
+        const transpose = (turns & 1) !== 0;
+        const orientedWidth = transpose ? height : width;
+        const orientedHeight = transpose ? width : height;
+
+        if (this.canvas.width !== orientedWidth || this.canvas.height !== orientedHeight) {
+            this.canvas.width = orientedWidth;
+            this.canvas.height = orientedHeight;
+        }
+        gl.viewport(0, 0, orientedWidth, orientedHeight);
+
+        // Position of red in the CFA cell, indexed by PixelFormatRegistry::CfaOrder
+        const red = [[0, 0], [0, 0], [1, 0], [0, 1], [1, 1]][order] || [0, 0];
+        // Offsets of Y0, U, Y1 and V in a 4:2:2 group, indexed by the YuvOrder of the server
+        const yuv = [[0, 1, 2, 3], [1, 0, 3, 2], [1, 2, 3, 0], [0, 3, 2, 1]][order] || [0, 1, 2, 3];
+
+        const u = this._uniforms;
+        gl.useProgram(this._program);
+        gl.uniform1i(u.u_samples, 0);
+        gl.uniform2i(u.u_size, width, height);
+        gl.uniform1i(u.u_layout, layout);
+        gl.uniform1f(u.u_scale, 1 / ((1 << (8 + shift)) - 1));
+        gl.uniform2i(u.u_red, red[0], red[1]);
+        gl.uniform4i(u.u_yuv, yuv[0], yuv[1], yuv[2], yuv[3]);
+        gl.uniform3i(u.u_orient, flipX !== halfTurn ? 1 : 0, flipY !== halfTurn ? 1 : 0, transpose ? 1 : 0);
+        gl.drawArrays(gl.TRIANGLES, 0, 3);
+        return true;
+    },
+
+    _createProgram(gl) {
+        // One triangle covering the viewport, no vertex buffer needed
+        const vertexSource = `#version 300 es
+            void main() {
+                vec2 p = vec2(float((gl_VertexID << 1) & 2), float(gl_VertexID & 2));
+                gl_Position = vec4(p * 2.0 - 1.0, 0.0, 1.0);
+            }`;
+
+        const fragmentSource = `#version 300 es
+            precision highp float;
+            precision highp int;
+            precision highp usampler2D;
+
+            uniform usampler2D u_samples;
+            uniform ivec2 u_size;       // unoriented frame
+            uniform int u_layout;       // 0 mono, 1 Bayer, 2 YUV 4:2:2
+            uniform float u_scale;      // 1 / full scale of a sample
+            uniform ivec2 u_red;        // position of red in the CFA cell
+            uniform ivec4 u_yuv;        // offsets of Y0, U, Y1, V in a 4:2:2 group
+            uniform ivec3 u_orient;     // mirror x, mirror y, transpose
+            out vec4 outColor;
+
+            uint texel(int x, int y) {
+                return texelFetch(u_samples, ivec2(x, y), 0).r;
+            }
+
+            // Mirrored at the edges, which keeps the CFA color of the position
+            float bayer(int x, int y) {
+                x = x < 0 ? -x : (x >= u_size.x ? 2 * u_size.x - 2 - x : x);
+                y = y < 0 ? -y : (y >= u_size.y ? 2 * u_size.y - 2 - y : y);
+                return float(texel(clamp(x, 0, u_size.x - 1), clamp(y, 0, u_size.y - 1))) * u_scale;
+            }
+
+            vec3 demosaic(int x, int y) {
+                // Bilinear interpolation of the two missing colors
+                float c = bayer(x, y);
+                float horizontal = (bayer(x - 1, y) + bayer(x + 1, y)) * 0.5;
+                float vertical = (bayer(x, y - 1) + bayer(x, y + 1)) * 0.5;
+                float plus = (horizontal + vertical) * 0.5;
+                float diagonal = (bayer(x - 1, y - 1) + bayer(x + 1, y - 1) +
+                                  bayer(x - 1, y + 1) + bayer(x + 1, y + 1)) * 0.25;
+                bool redRow = (y & 1) == u_red.y;
+                bool redColumn = (x & 1) == u_red.x;
+                if (redRow && redColumn) return vec3(c, plus, diagonal);
+                if (!redRow && !redColumn) return vec3(diagonal, plus, c);
+                if (redRow) return vec3(horizontal, c, vertical);
+                return vec3(vertical, c, horizontal);
+            }
+
+            vec3 yuv422(int x, int y) {
+                // BT.601 limited range, the default of the server side conversion
+                int group = (x >> 1) * 4;
+                float luma = float(texel(group + ((x & 1) == 0 ? u_yuv.x : u_yuv.z), y));
+                float cb = float(texel(group + u_yuv.y, y)) - 128.0;
+                float cr = float(texel(group + u_yuv.w, y)) - 128.0;
+                luma = (luma - 16.0) * (255.0 / 219.0);
+                cb *= 255.0 / 224.0;
+                cr *= 255.0 / 224.0;
+                return vec3(luma + 1.402 * cr,
+                            luma - 0.344136 * cb - 0.714136 * cr,
+                            luma + 1.772 * cb) / 255.0;
+            }
+
+            void main() {
+                // Oriented pixel, the top line of the canvas is the top of the image
+                int column = int(gl_FragCoord.x);
+                int row = int(float(u_orient.z != 0 ? u_size.x : u_size.y) - gl_FragCoord.y);
+
+                // Its place in the frame, the inverse of ImageOrientation::LineWriter
+                int x, y;
+                if (u_orient.z != 0) {
+                    x = u_orient.x != 0 ? u_size.x - 1 - row : row;
+                    y = u_orient.y != 0 ? column : u_size.y - 1 - column;
+                } else {
+                    x = u_orient.x != 0 ? u_size.x - 1 - column : column;
+                    y = u_orient.y != 0 ? u_size.y - 1 - row : row;
+                }
+
+                vec3 rgb;
+                if (u_layout == 1) {
+                    rgb = demosaic(x, y);
+                } else if (u_layout == 2) {
+                    rgb = yuv422(x, y);
+                } else {
+                    rgb = vec3(float(texel(x, y)) * u_scale);
+                }
+                outColor = vec4(clamp(rgb, 0.0, 1.0), 1.0);
+            }`;
+
+        const compile = (type, source) => {
+            const shader = gl.createShader(type);
+            gl.shaderSource(shader, source);
+            gl.compileShader(shader);
+            if (!gl.getShaderParameter(shader, gl.COMPILE_STATUS)) {
+                console.error('[RawRenderer] Shader compile error:', gl.getShaderInfoLog(shader));
+                gl.deleteShader(shader);
+                return null;
+            }
+            return shader;
+        };
+
+        const vertexShader = compile(gl.VERTEX_SHADER, vertexSource);
+        const fragmentShader = compile(gl.FRAGMENT_SHADER, fragmentSource);
+        if (!vertexShader || !fragmentShader) return null;
+
+        const program = gl.createProgram();
+        gl.attachShader(program, vertexShader);
+        gl.attachShader(program, fragmentShader);
+        gl.linkProgram(program);
+        gl.deleteShader(vertexShader);
+        gl.deleteShader(fragmentShader);
+        if (!gl.getProgramParameter(program, gl.LINK_STATUS)) {
+            console.error('[RawRenderer] Program link error:', gl.getProgramInfoLog(program));
+            gl.deleteProgram(program);
+            return null;
+        }
+        return program;
+    }
+};
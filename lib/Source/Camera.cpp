@@ -108,6 +108,15 @@ public:
     virtual
     uint32_t GetPixelFormat(const v4l2_format& fmt) = 0;
 
+    virtual
+    uint32_t GetColorspace(const v4l2_format& fmt) = 0;
+
+    virtual
+    uint32_t GetYcbcrEnc(const v4l2_format& fmt) = 0;
+
+    virtual
+    uint32_t GetQuantization(const v4l2_format& fmt) = 0;
+
     virtual
     void SetSizeImage(v4l2_format& fmt, const uint32_t sizeImage) = 0;
 
@@ -148,6 +157,16 @@ public:
     virtual
     uint32_t GetPixelFormat(const v4l2_format& fmt) override {return fmt.fmt.pix.pixelformat;}
 
+    virtual
+    uint32_t GetColorspace(const v4l2_format& fmt) override {return fmt.fmt.pix.colorspace;}
+
+    // The fields behind priv are only valid when the driver says so
+    virtual
+    uint32_t GetYcbcrEnc(const v4l2_format& fmt) override {return fmt.fmt.pix.priv == V4L2_PIX_FMT_PRIV_MAGIC ? fmt.fmt.pix.ycbcr_enc : V4L2_YCBCR_ENC_DEFAULT;}
+
+    virtual
+    uint32_t GetQuantization(const v4l2_format& fmt) override {return fmt.fmt.pix.priv == V4L2_PIX_FMT_PRIV_MAGIC ? fmt.fmt.pix.quantization : V4L2_QUANTIZATION_DEFAULT;}
+
     virtual
     void SetSizeImage(v4l2_format& fmt, const uint32_t sizeImage) override {fmt.fmt.pix.sizeimage = sizeImage;}
 
@@ -188,6 +207,15 @@ public:
     virtual
     uint32_t GetPixelFormat(const v4l2_format& fmt) override {return fmt.fmt.pix_mp.pixelformat;}
 
+    virtual
+    uint32_t GetColorspace(const v4l2_format& fmt) override {return fmt.fmt.pix_mp.colorspace;}
+
+    virtual
+    uint32_t GetYcbcrEnc(const v4l2_format& fmt) override {return fmt.fmt.pix_mp.ycbcr_enc;}
+
+    virtual
+    uint32_t GetQuantization(const v4l2_format& fmt) override {return fmt.fmt.pix_mp.quantization;}
+
     virtual
     void SetSizeImage(v4l2_format& fmt, const uint32_t sizeImage) override {fmt.fmt.pix_mp.plane_fmt[0].sizeimage = sizeImage;}
 
@@ -745,8 +773,13 @@ int Camera::StartStreamChannel(uint32_t pixelFormat, uint32_t payloadSize, uint3
 
     LOG_EX("Camera::StartStreamChannel %s pixelFormat=%d, payloadSize=%d, width=%d, height=%d.", m_FileDescriptorToNameMap[m_DeviceFileDescriptor].c_str(), pixelFormat, payloadSize, width, height);
 
+    uint32_t ycbcrEnc = V4L2_YCBCR_ENC_DEFAULT;
+    uint32_t quantization = V4L2_QUANTIZATION_DEFAULT;
+    ReadColorimetry(ycbcrEnc, quantization);
+
     m_pFrameObserver->StartStream(m_BlockingMode, m_DeviceFileDescriptor, pixelFormat,
                                   payloadSize, width, height, bytesPerLine,
+                                  ycbcrEnc, quantization,
                                   enableLogging);
 
 
@@ -874,6 +907,48 @@ int Camera::ReadFrameSize(uint32_t &width, uint32_t &height)
     return result;
 }
 
+int Camera::ReadColorimetry(uint32_t &ycbcrEnc, uint32_t &quantization)
+{
+    int result = -1;
+    v4l2_format fmt;
+
+    CLEAR(fmt);
+    fmt.type = m_DeviceBufferType;
+
+    if (-1 != iohelper::xioctl(m_DeviceFileDescriptor, VIDIOC_G_FMT, &fmt))
+    {
+        // Resolve the defaults the way the kernel does: SDTV sizes are
+        // SMPTE 170M, HDTV sizes Rec. 709 and the encoding and quantization
+        // follow the colorspace
+        const uint32_t height = m_pPixFormat->GetHeight(fmt);
+        uint32_t colorspace = m_pPixFormat->GetColorspace(fmt);
+        if (colorspace == V4L2_COLORSPACE_DEFAULT)
+        {
+            colorspace = V4L2_MAP_COLORSPACE_DEFAULT(height <= 576, height >= 720);
+        }
+        ycbcrEnc = m_pPixFormat->GetYcbcrEnc(fmt);
+        if (ycbcrEnc == V4L2_YCBCR_ENC_DEFAULT)
+        {
+            ycbcrEnc = V4L2_MAP_YCBCR_ENC_DEFAULT(colorspace);
+        }
+        quantization = m_pPixFormat->GetQuantization(fmt);
+        if (quantization == V4L2_QUANTIZATION_DEFAULT)
+        {
+            quantization = V4L2_MAP_QUANTIZATION_DEFAULT(false, colorspace, ycbcrEnc);
+        }
+
+        LOG_EX("Camera::ReadColorimetry VIDIOC_G_FMT %s OK colorspace=%d, ycbcr_enc=%d, quantization=%d", m_FileDescriptorToNameMap[m_DeviceFileDescriptor].c_str(), colorspace, ycbcrEnc, quantization);
+
+        result = 0;
+    }
+    else
+    {
+        LOG_EX("Camera::ReadColorimetry VIDIOC_G_FMT %s failed errno=%d=%s", m_FileDescriptorToNameMap[m_DeviceFileDescriptor].c_str(), errno, v4l2helper::ConvertErrno2String(errno).c_str());
+    }
+
+    return result;
+}
+
 int Camera::SetFrameSize(uint32_t width, uint32_t height)
 {
     auto const isVideoDev = m_FrameSizeFileDescriptor == m_DeviceFileDescriptor;
@@ -1,20 +1,27 @@
 #include "CameraBridge.h"
 #include "FrameStreamServer.h"
 #include "ImageTransform.h"
+#include "ImageWriter.h"
+#include "PixelFormatRegistry.h"
 #include "VideoRecorder.h"
 #include "V4L2Helper.h"
 
+#include <QBuffer>
 #include <QDir>
 #include <QFile>
 #include <QFileDialog>
+#include <QHostAddress>
+#include <QJsonArray>
 #include <QJsonDocument>
 #include <QMutexLocker>
 
+#include <algorithm>
 #include <cmath>
 #include <thread>
 
 CameraBridge::CameraBridge(FrameStreamServer *frameServer, QObject *parent)
     : QObject(parent)
+    , m_softwareAutoControl(m_Camera)
     , m_pFrameServer(frameServer)
 {
     m_lastDoneCallback = nullptr;
@@ -73,6 +80,68 @@ CameraBridge::CameraBridge(FrameStreamServer *frameServer, QObject *parent)
             this,
             SLOT(onControlUpdate(v4l2_ext_control)));
 
+    // PNG and raw snapshots of the HTTP endpoints, from the frame kept for
+    // saving. The provider runs on the snapshot thread of the stream server.
+    m_pFrameServer->setSnapshotProvider(
+        [this](const QString &format, FrameStreamServer::Snapshot &snapshot) {
+            QMutexLocker locker(&m_lastFrameMutex);
+            if (!m_lastDoneCallback) {
+                return false;
+            }
+
+            if (format == "raw") {
+                // The frame as the camera delivered it, described in the headers
+                const PixelFormatRegistry::PixelFormatDescriptor *desc =
+                    PixelFormatRegistry::Find(m_lastFrame.pixelFormat);
+                const bool compressed = desc && desc->family == PixelFormatRegistry::PixelFamily::Compressed;
+                const uint32_t fourcc = m_lastFrame.pixelFormat;
+                const char name[] = { char(fourcc & 0xFF), char((fourcc >> 8) & 0xFF),
+                                      char((fourcc >> 16) & 0xFF), char((fourcc >> 24) & 0xFF) };
+                snapshot.contentType = "application/octet-stream";
+                snapshot.headers = "X-Width: " + QByteArray::number(m_lastFrame.width) + "\r\n" +
+                                   "X-Height: " + QByteArray::number(m_lastFrame.height) + "\r\n" +
+                                   "X-Bytes-Per-Line: " + QByteArray::number(m_lastFrame.bytesPerLine) + "\r\n" +
+                                   "X-Pixel-Format: " + QByteArray(name, 4).trimmed() + "\r\n" +
+                                   "X-Frame-Id: " + QByteArray::number(qulonglong(m_lastFrame.frameID)) + "\r\n";
+                snapshot.data = QByteArray(reinterpret_cast<const char *>(m_lastFrame.data),
+                                           int(compressed ? m_lastFrame.payloadSize : m_lastFrame.length));
+                return true;
+            }
+
+            // The frame is converted from a copy, the camera gets its
+            // buffer back while the demosaic and the PNG encoder run
+            const QByteArray frameData(reinterpret_cast<const char *>(m_lastFrame.data), int(m_lastFrame.length));
+            BufferWrapper frame = m_lastFrame;
+            frame.data = reinterpret_cast<const uint8_t *>(frameData.constData());
+            locker.unlock();
+
+            // PNG keeps mono and Bayer frames at their full bit depth
+            ImageTransform::ConversionOptions options;
+            options.fullDepth = true;
+            options.demosaic = Demosaic::Method::MalvarHeCutler;
+            options.colorCorrection = ColorCorrection::Current();
+            ImageTransform::SetColorimetry(frame, options);
+            options.orientation = ImageOrientation::Current();
+            QImage convertedImage;
+            const int result = ImageTransform::ConvertFrame(frame, convertedImage, options);
+            if (result != 0 || convertedImage.isNull()) {
+                return false;
+            }
+
+            QBuffer buffer(&snapshot.data);
+            buffer.open(QIODevice::WriteOnly);
+            snapshot.contentType = "image/png";
+            return convertedImage.save(&buffer, "PNG");
+        });
+
+    // The H.264 encoder gave up, the recording keeps what it has
+    connect(m_pFrameServer, &FrameStreamServer::recordingFailed, this,
+            [this](const QString &reason) {
+        if (m_recorder && m_recorder->isRecording()) {
+            m_recorder->stop(reason);
+        }
+    });
+
     // Stats timer
     m_statsTimer.setInterval(1000);
     connect(&m_statsTimer, &QTimer::timeout, this, &CameraBridge::onStatsTimer);
@@ -208,6 +277,15 @@ QJsonObject CameraBridge::openCamera(int index)
     m_bIsOpen = true;
     m_openCameraIndex = index;
 
+    // Flat-field calibration and correction, in place before any processor
+    m_Camera.GetFrameObserver()->AddRawDataCorrection(
+        [this](auto const &buf, uint8_t *data) {
+            m_flatFieldCalibration.AddFrame(buf);
+            if (auto correction = FlatFieldCorrection::Current()) {
+                correction->Apply(buf, data);
+            }
+        });
+
     // Register frame data processors (mirrors V4L2Viewer.cpp pattern)
     // Processor 1: frame info updates (store atomically, emit on stats timer)
     m_Camera.GetFrameObserver()->AddRawDataProcessor(
@@ -216,6 +294,18 @@ QJsonObject CameraBridge::openCamera(int index)
             doneCallback();
         });
 
+    // Processor 1b: statistics for the software auto exposure and white balance
+    m_Camera.GetFrameObserver()->AddRawDataProcessor(
+        [this](auto const &buf, auto doneCallback) {
+            m_softwareAutoControl.ProcessFrame(buf);
+            doneCallback();
+        });
+
+    // The ranges of exposure and gain belong to the camera just opened
+    if (m_softwareAutoControl.IsAutoExposure() && m_softwareAutoControl.SetAutoExposure(true) != 0) {
+        m_softwareAutoControl.SetAutoExposure(false);
+    }
+
     // Processor 2: send frames to WebSocket stream server
     m_Camera.GetFrameObserver()->AddRawDataProcessor(
         [this](auto const &buf, auto doneCallback) {
@@ -595,6 +685,146 @@ QJsonObject CameraBridge::setAutoWhiteBalance(bool enabled)
     return err == 0 ? makeResult(true) : makeResult(false, "Failed to set auto white balance");
 }
 
+// --- Color Correction ---
+
+QJsonObject CameraBridge::getColorCorrection()
+{
+    QJsonObject result = makeResult(true);
+    result["profile"] = ColorCorrection::ToJson(ColorCorrection::CurrentSettings());
+    return result;
+}
+
+QJsonObject CameraBridge::setColorCorrection(const QJsonObject &profile)
+{
+    // Keys the profile leaves out keep their current value, the auto white
+    // balance may change the gains at the same time
+    ColorCorrectionSettings settings;
+    const bool valid = ColorCorrection::UpdateCurrent([&profile, &settings](ColorCorrectionSettings &current) {
+        if (!ColorCorrection::FromJson(profile, current)) {
+            return false;
+        }
+        settings = current;
+        return true;
+    });
+    if (!valid) {
+        return makeResult(false, "Invalid color profile");
+    }
+
+    QJsonObject result = makeResult(true);
+    result["profile"] = ColorCorrection::ToJson(settings);
+    return result;
+}
+
+// --- Software Auto Exposure / White Balance ---
+
+static QString whiteBalanceName(SoftwareAutoControl::WhiteBalance mode)
+{
+    switch (mode) {
+    case SoftwareAutoControl::WhiteBalance::GrayWorld:  return "grayWorld";
+    case SoftwareAutoControl::WhiteBalance::WhitePatch: return "whitePatch";
+    default:                                            return "off";
+    }
+}
+
+QJsonObject CameraBridge::getSoftwareAuto()
+{
+    QJsonObject result = makeResult(true);
+    result["autoExposure"] = m_softwareAutoControl.IsAutoExposure();
+    result["whiteBalance"] = whiteBalanceName(m_softwareAutoControl.GetWhiteBalance());
+    return result;
+}
+
+QJsonObject CameraBridge::setSoftwareAutoExposure(bool enabled)
+{
+    if (enabled && !m_bIsOpen) return makeResult(false, "No camera open");
+    int err = m_softwareAutoControl.SetAutoExposure(enabled);
+    return err == 0 ? makeResult(true) : makeResult(false, "No adjustable exposure control");
+}
+
+QJsonObject CameraBridge::setSoftwareWhiteBalance(const QString &mode)
+{
+    SoftwareAutoControl::WhiteBalance value;
+    if (mode == "off") {
+        value = SoftwareAutoControl::WhiteBalance::Off;
+    } else if (mode == "grayWorld") {
+        value = SoftwareAutoControl::WhiteBalance::GrayWorld;
+    } else if (mode == "whitePatch") {
+        value = SoftwareAutoControl::WhiteBalance::WhitePatch;
+    } else {
+        return makeResult(false, "Unknown white balance mode");
+    }
+    m_softwareAutoControl.SetWhiteBalance(value);
+    return makeResult(true);
+}
+
+// --- Flat-Field Correction ---
+
+QJsonObject CameraBridge::getFlatField()
+{
+    std::shared_ptr<const FlatFieldCorrection> maps = FlatFieldCorrection::CurrentMaps();
+
+    QJsonObject result = makeResult(true);
+    result["enabled"] = FlatFieldCorrection::IsEnabled();
+    result["loaded"] = maps != nullptr;
+    result["defects"] = maps ? int(maps->DefectCount()) : 0;
+    result["capturing"] = m_flatFieldCalibration.IsCapturing();
+    result["darkFrames"] = int(m_flatFieldCalibration.CapturedFrames(FlatFieldCalibration::Reference::Dark));
+    result["flatFrames"] = int(m_flatFieldCalibration.CapturedFrames(FlatFieldCalibration::Reference::Flat));
+    return result;
+}
+
+QJsonObject CameraBridge::startFlatFieldCapture(const QString &reference, int frames)
+{
+    if (!m_bIsOpen) return makeResult(false, "No camera open");
+
+    FlatFieldCalibration::Reference value;
+    if (reference == "dark") {
+        value = FlatFieldCalibration::Reference::Dark;
+    } else if (reference == "flat") {
+        value = FlatFieldCalibration::Reference::Flat;
+    } else {
+        return makeResult(false, "Unknown reference");
+    }
+    if (frames < 1 || m_flatFieldCalibration.Start(value, uint32_t(frames)) != 0) {
+        return makeResult(false, "Frame count must be 1 to 256");
+    }
+    return makeResult(true);
+}
+
+QJsonObject CameraBridge::buildFlatField()
+{
+    std::shared_ptr<FlatFieldCorrection> maps = m_flatFieldCalibration.Build();
+    if (!maps) {
+        return makeResult(false, "Capture dark or flat frames of a raw format first");
+    }
+    if (!maps->Save(FlatFieldCorrection::DefaultPath())) {
+        return makeResult(false, "Failed to write the flat-field maps");
+    }
+    FlatFieldCorrection::SetCurrentMaps(maps);
+    FlatFieldCorrection::SetEnabled(true);
+    return getFlatField();
+}
+
+QJsonObject CameraBridge::loadFlatField()
+{
+    std::shared_ptr<const FlatFieldCorrection> maps = FlatFieldCorrection::Load(FlatFieldCorrection::DefaultPath());
+    if (!maps) {
+        return makeResult(false, "No valid flat-field maps saved");
+    }
+    FlatFieldCorrection::SetCurrentMaps(maps);
+    FlatFieldCorrection::SetEnabled(true);
+    return getFlatField();
+}
+
+QJsonObject CameraBridge::setFlatFieldEnabled(bool enabled)
+{
+    if (enabled && !FlatFieldCorrection::CurrentMaps()) {
+        return makeResult(false, "No flat-field maps loaded");
+    }
+    FlatFieldCorrection::SetEnabled(enabled);
+    return makeResult(true);
+}
+
 // --- Frame Rate ---
 
 QJsonObject CameraBridge::getFrameRate()
@@ -692,6 +922,39 @@ QJsonObject CameraBridge::setFlipY(bool enabled)
     return err == 0 ? makeResult(true) : makeResult(false, "Failed to set flip Y");
 }
 
+// --- Orientation ---
+
+QJsonObject CameraBridge::getOrientation()
+{
+    const ImageOrientation::Orientation orientation = ImageOrientation::Current();
+    QJsonObject result = makeResult(true);
+    result["flipX"] = orientation.flipX;
+    result["flipY"] = orientation.flipY;
+    result["rotation"] = orientation.Degrees();
+    return result;
+}
+
+QJsonObject CameraBridge::setOrientation(bool flipX, bool flipY, int rotation)
+{
+    if (rotation % 90 != 0) {
+        return makeResult(false, "Rotation must be a multiple of 90 degrees");
+    }
+
+    ImageOrientation::Orientation orientation;
+    orientation.flipX = flipX;
+    orientation.flipY = flipY;
+    orientation.rotation = ImageOrientation::RotationFromDegrees(rotation);
+
+    // The recorder writes the frame size into its header once
+    if (m_recorder && m_recorder->isRecording() &&
+        orientation.SwapsAxes() != ImageOrientation::Current().SwapsAxes()) {
+        return makeResult(false, "Cannot swap width and height while recording");
+    }
+
+    ImageOrientation::SetCurrent(orientation);
+    return getOrientation();
+}
+
 // --- Format / Size ---
 
 QJsonObject CameraBridge::getPixelFormats()
@@ -713,9 +976,11 @@ QJsonObject CameraBridge::getPixelFormats()
                         [&formats](uint32_t fmt) {
         QString name = QString::fromStdString(v4l2helper::ConvertPixelFormat2String(fmt));
         bool supported = ImageTransform::CanConvert(fmt);
+        const auto *desc = PixelFormatRegistry::Find(fmt);
         QJsonObject f;
         f["name"] = name;
         f["supported"] = supported;
+        f["bitDepth"] = desc ? static_cast<int>(desc->bitDepth) : 0;
         formats.append(f);
     });
 
@@ -844,6 +1109,11 @@ QJsonObject CameraBridge::startRecording(const QString &path, const QString &for
     VideoRecorder::Format fmt = VideoRecorder::AVI_MJPEG;
     if (format.toLower() == "raw") {
         fmt = VideoRecorder::RAW;
+    } else if (format.toLower() == "mkv") {
+        fmt = VideoRecorder::MKV_H264;
+        if (!FrameStreamServer::hasVideoEncoding()) {
+            return makeResult(false, "H.264 encoding is not available in this build");
+        }
     }
 
     if (!m_recorder) {
@@ -867,15 +1137,23 @@ QJsonObject CameraBridge::startRecording(const QString &path, const QString &for
     // Get current frame dimensions and FPS
     uint32_t width = m_latestWidth.load();
     uint32_t height = m_latestHeight.load();
+    uint32_t pixelFormat = 0;
     double fps = 30.0;
     if (m_bIsOpen) {
-        uint32_t w2 = 0, h2 = 0;
+        uint32_t w2 = 0, h2 = 0, bytesPerLine = 0;
+        QString pfText;
         m_Camera.ReadFrameSize(w2, h2);
         if (w2 > 0) width = w2;
         if (h2 > 0) height = h2;
+        m_Camera.ReadPixelFormat(pixelFormat, bytesPerLine, pfText);
+    }
+
+    // MJPEG and H.264 frames come from the stream, which is oriented
+    if (fmt != VideoRecorder::RAW && ImageOrientation::Current().SwapsAxes()) {
+        std::swap(width, height);
     }
 
-    if (!m_recorder->start(path, fmt, width, height, fps, m_maxRecordBytes)) {
+    if (!m_recorder->start(path, fmt, width, height, pixelFormat, fps, m_maxRecordBytes)) {
         return makeResult(false, "Failed to open file for recording");
     }
 
@@ -887,6 +1165,13 @@ QJsonObject CameraBridge::startRecording(const QString &path, const QString &for
                     m_recorder->writeJpegFrame(jpeg);
                 }
             });
+    } else if (fmt == VideoRecorder::MKV_H264) {
+        m_pFrameServer->setVideoRecordingCallback(
+            [this](const QByteArray &accessUnit, bool key, uint32_t width, uint32_t height) {
+                if (m_recorder) {
+                    m_recorder->writeH264Frame(accessUnit, key, width, height);
+                }
+            });
     } else {
         m_pFrameServer->setRecordingCallback(
             [this](const QByteArray &, const BufferWrapper &raw) {
@@ -941,6 +1226,9 @@ QJsonObject CameraBridge::recordDialog(const QString &format, double maxBytes)
     if (format.toLower() == "raw") {
         filter = "Raw Video (*.raw)";
         defaultExt = ".raw";
+    } else if (format.toLower() == "mkv") {
+        filter = "Matroska Video (*.mkv)";
+        defaultExt = ".mkv";
     } else {
         filter = "AVI Video (*.avi)";
         defaultExt = ".avi";
@@ -968,19 +1256,26 @@ QJsonObject CameraBridge::saveImage(const QString &path, const QString &format)
         return makeResult(false, "No frame available");
     }
 
-    if (format.toLower() == "png") {
+    const QString lowerFormat = format.toLower();
+    if (lowerFormat == "png" || lowerFormat == "tiff" || lowerFormat == "tif") {
+        // PNG and TIFF keep mono and Bayer frames at their full bit depth
+        ImageTransform::ConversionOptions options;
+        options.fullDepth = true;
+        options.demosaic = Demosaic::Method::MalvarHeCutler;
+        options.colorCorrection = ColorCorrection::Current();
+        ImageTransform::SetColorimetry(m_lastFrame, options);
+        options.orientation = ImageOrientation::Current();
         QImage convertedImage;
-        ImageTransform::ConvertFrame(m_lastFrame.data, m_lastFrame.length,
-                                     m_lastFrame.width, m_lastFrame.height,
-                                     m_lastFrame.pixelFormat,
-                                     m_lastFrame.payloadSize, m_lastFrame.bytesPerLine,
-                                     convertedImage);
+        if (ImageTransform::ConvertFrame(m_lastFrame, convertedImage, options) != 0) {
+            return makeResult(false, "Failed to convert frame");
+        }
         locker.unlock();
 
-        if (convertedImage.save(path, "PNG")) {
+        if (lowerFormat == "png" ? convertedImage.save(path, "PNG")
+                                 : ImageWriter::SaveTiff(convertedImage, path)) {
             return makeResult(true);
         }
-        return makeResult(false, "Failed to save PNG");
+        return makeResult(false, "Failed to save " + lowerFormat.toUpper());
     } else if (format.toLower() == "raw") {
         QByteArray data(reinterpret_cast<const char *>(m_lastFrame.data), m_lastFrame.length);
         locker.unlock();
@@ -994,7 +1289,7 @@ QJsonObject CameraBridge::saveImage(const QString &path, const QString &format)
         return makeResult(false, "Failed to write raw file");
     }
 
-    return makeResult(false, "Unknown format (use 'png' or 'raw')");
+    return makeResult(false, "Unknown format (use 'png', 'tiff' or 'raw')");
 }
 
 QJsonObject CameraBridge::saveImageDialog()
@@ -1005,12 +1300,14 @@ QJsonObject CameraBridge::saveImageDialog()
     }
 
     // Convert while we still hold the buffer
+    ImageTransform::ConversionOptions options;
+    options.fullDepth = true;
+    options.demosaic = Demosaic::Method::MalvarHeCutler;
+    options.colorCorrection = ColorCorrection::Current();
+    ImageTransform::SetColorimetry(m_lastFrame, options);
+    options.orientation = ImageOrientation::Current();
     QImage convertedImage;
-    ImageTransform::ConvertFrame(m_lastFrame.data, m_lastFrame.length,
-                                 m_lastFrame.width, m_lastFrame.height,
-                                 m_lastFrame.pixelFormat,
-                                 m_lastFrame.payloadSize, m_lastFrame.bytesPerLine,
-                                 convertedImage);
+    ImageTransform::ConvertFrame(m_lastFrame, convertedImage, options);
 
     QByteArray rawData(reinterpret_cast<const char *>(m_lastFrame.data), m_lastFrame.length);
     locker.unlock();
@@ -1020,7 +1317,7 @@ QJsonObject CameraBridge::saveImageDialog()
                           QString::number(m_savedFrameCounter) + ".png";
 
     QString fullPath = QFileDialog::getSaveFileName(
-        parentWidget, tr("Save Snapshot"), defaultName, "*.png *.raw");
+        parentWidget, tr("Save Snapshot"), defaultName, "*.png *.tiff *.raw");
 
     if (fullPath.isEmpty()) {
         return makeResult(false, "Save cancelled");
@@ -1038,16 +1335,18 @@ QJsonObject CameraBridge::saveImageDialog()
         }
         return makeResult(false, "Failed to write raw file");
     } else {
-        if (!fullPath.endsWith(".png", Qt::CaseInsensitive)) {
+        const bool tiff = fullPath.endsWith(".tif", Qt::CaseInsensitive) ||
+                          fullPath.endsWith(".tiff", Qt::CaseInsensitive);
+        if (!tiff && !fullPath.endsWith(".png", Qt::CaseInsensitive)) {
             fullPath += ".png";
         }
-        if (convertedImage.save(fullPath, "PNG")) {
+        if (ImageWriter::Save(convertedImage, fullPath)) {
             m_savedFrameCounter++;
             QJsonObject result = makeResult(true);
             result["path"] = fullPath;
             return result;
         }
-        return makeResult(false, "Failed to save PNG");
+        return makeResult(false, tiff ? "Failed to save TIFF" : "Failed to save PNG");
     }
 }
 
@@ -1058,15 +1357,56 @@ QJsonObject CameraBridge::getStats()
     QJsonObject result = makeResult(true);
     if (m_bIsStreaming) {
         result["receivedFps"] = m_Camera.GetReceivedFPS();
+        result["streamClients"] = m_pFrameServer->clientStatistics();
     }
+    result["endpoints"] = m_pFrameServer->endpointStatistics();
     return result;
 }
 
+// --- HTTP endpoints ---
+
+QJsonObject CameraBridge::getHttpServer()
+{
+    QJsonObject result = makeResult(true);
+    result["enabled"] = m_pFrameServer->isHttpListening();
+    result["address"] = m_pFrameServer->httpAddress().toString();
+    result["port"] = m_pFrameServer->httpPort();
+    return result;
+}
+
+QJsonObject CameraBridge::setHttpServer(bool enabled, const QString &address, int port)
+{
+    if (!enabled) {
+        m_pFrameServer->stopHttp();
+        return getHttpServer();
+    }
+
+    // "localhost" for this machine only, "0.0.0.0" for every interface
+    QHostAddress hostAddress;
+    if (address.isEmpty() || address == "localhost") {
+        hostAddress = QHostAddress::LocalHost;
+    } else if (!hostAddress.setAddress(address)) {
+        return makeResult(false, "Invalid address: " + address);
+    }
+    if (port < 0 || port > 65535) {
+        return makeResult(false, "Invalid port: " + QString::number(port));
+    }
+
+    if (!m_pFrameServer->startHttp(hostAddress, quint16(port))) {
+        return makeResult(false, "Failed to listen on " + address + ":" + QString::number(port));
+    }
+    emit statusMessage("HTTP stream on " + m_pFrameServer->httpAddress().toString() + ":" +
+                       QString::number(m_pFrameServer->httpPort()));
+    return getHttpServer();
+}
+
 void CameraBridge::onStatsTimer()
 {
     if (m_bIsStreaming) {
         QJsonObject data;
         data["receivedFps"] = m_Camera.GetReceivedFPS();
+        data["streamClients"] = m_pFrameServer->clientStatistics();
+        data["endpoints"] = m_pFrameServer->endpointStatistics();
         emit statsUpdated(data);
 
         if (m_frameInfoDirty.exchange(false)) {
@@ -0,0 +1,294 @@
+#include "ColorCorrection.h"
+
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+// Samples are processed at 12 bit, the resolution of the gamma tables
+static const int32_t s_LinearMax = 4095;
+
+// Fractional bits of the fixed point matrix
+static const int s_MatrixShift = 10;
+
+// Keeps three products of a 12 bit sample and a coefficient inside int32_t
+static const int32_t s_MaxCoefficient = 131071;
+
+// Changes of the current settings take s_UpdateMutex for their whole
+// duration, readers only take s_CurrentMutex to copy the pointer
+static std::mutex s_UpdateMutex;
+static std::mutex s_CurrentMutex;
+static ColorCorrectionSettings s_CurrentSettings;
+static std::shared_ptr<const ColorCorrection> s_Current;
+
+static inline int32_t ToLinear(uint8_t value)
+{
+    return (int32_t(value) << 4) | (value >> 4);
+}
+
+static inline int32_t ToLinear(uint16_t value)
+{
+    return value >> 4;
+}
+
+ColorCorrection::ColorCorrection(const ColorCorrectionSettings &settings)
+    : m_Settings(settings)
+{
+    m_Black = std::clamp(int32_t(std::lround(settings.blackLevel * s_LinearMax)), 0, s_LinearMax - 1);
+
+    // Stretch what is left above the black level back to full scale
+    const double stretch = double(s_LinearMax) / double(s_LinearMax - m_Black);
+    for (int row = 0; row < 3; row++)
+    {
+        for (int column = 0; column < 3; column++)
+        {
+            const double coefficient = settings.matrix[row * 3 + column] * settings.gains[column] * stretch;
+            m_Matrix[row * 3 + column] = int32_t(std::clamp<double>(std::lround(coefficient * (1 << s_MatrixShift)),
+                                                                    -s_MaxCoefficient, s_MaxCoefficient));
+        }
+    }
+
+    // 8 bit samples have few enough values to tabulate what each of them
+    // adds to the three outputs, the rounding goes with the red input
+    for (int channel = 0; channel < 3; channel++)
+    {
+        for (int32_t value = 0; value < 256; value++)
+        {
+            const int32_t linear = std::max(ToLinear(uint8_t(value)) - m_Black, 0);
+            for (int row = 0; row < 3; row++)
+            {
+                m_Contribution[channel][value].value[row] = m_Matrix[row * 3 + channel] * linear
+                                                            + (channel == 0 ? 1 << (s_MatrixShift - 1) : 0);
+            }
+            m_Contribution[channel][value].value[3] = 0;
+        }
+    }
+
+    const double exponent = 1.0 / std::clamp(settings.gamma, 0.1, 10.0);
+    for (int32_t i = 0; i <= s_LinearMax; i++)
+    {
+        const double encoded = std::pow(double(i) / s_LinearMax, exponent);
+        m_Lut8[i] = uint8_t(std::lround(encoded * 255.0));
+        m_Lut16[i] = uint16_t(std::lround(encoded * 65535.0));
+    }
+
+    // Without cross talk between the channels, which is the case for white
+    // balance alone, every 8 bit sample maps straight to its output
+    m_Diagonal = m_Matrix[1] == 0 && m_Matrix[2] == 0 && m_Matrix[3] == 0 &&
+                 m_Matrix[5] == 0 && m_Matrix[6] == 0 && m_Matrix[7] == 0;
+    for (int channel = 0; channel < 3; channel++)
+    {
+        for (int32_t value = 0; value < 256; value++)
+        {
+            const int32_t linear = std::max(ToLinear(uint8_t(value)) - m_Black, 0);
+            const int32_t sum = (m_Matrix[channel * 4] * linear + (1 << (s_MatrixShift - 1))) >> s_MatrixShift;
+            m_Direct8[channel][value] = m_Lut8[std::clamp(sum, 0, s_LinearMax)];
+        }
+    }
+}
+
+void ColorCorrection::Apply(uint8_t *rgb, uint32_t count) const
+{
+    if (m_Diagonal)
+    {
+        const uint8_t *const red = m_Direct8[0];
+        const uint8_t *const green = m_Direct8[1];
+        const uint8_t *const blue = m_Direct8[2];
+        for (uint32_t i = 0; i < count; i++)
+        {
+            rgb[0] = red[rgb[0]];
+            rgb[1] = green[rgb[1]];
+            rgb[2] = blue[rgb[2]];
+            rgb += 3;
+        }
+        return;
+    }
+
+    // Locals, as stores through uint8_t may alias the members
+    const Contribution *const red = m_Contribution[0];
+    const Contribution *const green = m_Contribution[1];
+    const Contribution *const blue = m_Contribution[2];
+    const uint8_t *const lut = m_Lut8;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const Contribution &r = red[rgb[0]];
+        const Contribution &g = green[rgb[1]];
+        const Contribution &b = blue[rgb[2]];
+
+        rgb[0] = lut[std::clamp((r.value[0] + g.value[0] + b.value[0]) >> s_MatrixShift, 0, s_LinearMax)];
+        rgb[1] = lut[std::clamp((r.value[1] + g.value[1] + b.value[1]) >> s_MatrixShift, 0, s_LinearMax)];
+        rgb[2] = lut[std::clamp((r.value[2] + g.value[2] + b.value[2]) >> s_MatrixShift, 0, s_LinearMax)];
+        rgb += 3;
+    }
+}
+
+void ColorCorrection::Apply(uint16_t *rgbx, uint32_t count) const
+{
+    const int32_t black = m_Black;
+    int32_t m[9];
+    std::copy(m_Matrix, m_Matrix + 9, m);
+    const uint16_t *const lut = m_Lut16;
+
+    const int32_t round = 1 << (s_MatrixShift - 1);
+    for (uint32_t i = 0; i < count; i++)
+    {
+        const int32_t r = std::max(ToLinear(rgbx[0]) - black, 0);
+        const int32_t g = std::max(ToLinear(rgbx[1]) - black, 0);
+        const int32_t b = std::max(ToLinear(rgbx[2]) - black, 0);
+
+        rgbx[0] = lut[std::clamp((m[0] * r + m[1] * g + m[2] * b + round) >> s_MatrixShift, 0, s_LinearMax)];
+        rgbx[1] = lut[std::clamp((m[3] * r + m[4] * g + m[5] * b + round) >> s_MatrixShift, 0, s_LinearMax)];
+        rgbx[2] = lut[std::clamp((m[6] * r + m[7] * g + m[8] * b + round) >> s_MatrixShift, 0, s_LinearMax)];
+        rgbx += 4;
+    }
+}
+
+std::shared_ptr<const ColorCorrection> ColorCorrection::Current()
+{
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    return s_Current;
+}
+
+ColorCorrectionSettings ColorCorrection::CurrentSettings()
+{
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    return s_CurrentSettings;
+}
+
+// This function publishes new settings, called with s_UpdateMutex held
+static void Publish(const ColorCorrectionSettings &settings)
+{
+    // Build the tables outside the lock, converting threads keep using the old ones meanwhile
+    std::shared_ptr<const ColorCorrection> correction;
+    if (settings.enabled)
+    {
+        correction = std::make_shared<const ColorCorrection>(settings);
+    }
+
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    s_CurrentSettings = settings;
+    s_Current = correction;
+}
+
+void ColorCorrection::SetCurrent(const ColorCorrectionSettings &settings)
+{
+    std::lock_guard<std::mutex> lock(s_UpdateMutex);
+    Publish(settings);
+}
+
+bool ColorCorrection::UpdateCurrent(const std::function<bool(ColorCorrectionSettings &)> &change)
+{
+    std::lock_guard<std::mutex> lock(s_UpdateMutex);
+    ColorCorrectionSettings settings = CurrentSettings();
+    if (!change(settings))
+    {
+        return false;
+    }
+    Publish(settings);
+    return true;
+}
+
+static QJsonArray ToJsonArray(const double *values, int count)
+{
+    QJsonArray array;
+    for (int i = 0; i < count; i++)
+    {
+        array.append(values[i]);
+    }
+    return array;
+}
+
+static bool FromJsonArray(const QJsonValue &value, double *values, int count)
+{
+    const QJsonArray array = value.toArray();
+    if (!value.isArray() || array.size() != count)
+    {
+        return false;
+    }
+    for (int i = 0; i < count; i++)
+    {
+        if (!array[i].isDouble())
+        {
+            return false;
+        }
+    }
+    for (int i = 0; i < count; i++)
+    {
+        values[i] = array[i].toDouble();
+    }
+    return true;
+}
+
+QJsonObject ColorCorrection::ToJson(const ColorCorrectionSettings &settings)
+{
+    QJsonObject json;
+    json["enabled"] = settings.enabled;
+    json["blackLevel"] = settings.blackLevel;
+    json["gains"] = ToJsonArray(settings.gains, 3);
+    json["matrix"] = ToJsonArray(settings.matrix, 9);
+    json["gamma"] = settings.gamma;
+    return json;
+}
+
+bool ColorCorrection::FromJson(const QJsonObject &json, ColorCorrectionSettings &settings)
+{
+    ColorCorrectionSettings result = settings;
+
+    if (json.contains("enabled"))
+    {
+        if (!json["enabled"].isBool())
+            return false;
+        result.enabled = json["enabled"].toBool();
+    }
+    if (json.contains("blackLevel"))
+    {
+        const double blackLevel = json["blackLevel"].toDouble(-1.0);
+        if (!json["blackLevel"].isDouble() || blackLevel < 0.0 || blackLevel >= 1.0)
+            return false;
+        result.blackLevel = blackLevel;
+    }
+    if (json.contains("gains") && !FromJsonArray(json["gains"], result.gains, 3))
+    {
+        return false;
+    }
+    if (json.contains("matrix") && !FromJsonArray(json["matrix"], result.matrix, 9))
+    {
+        return false;
+    }
+    if (json.contains("gamma"))
+    {
+        const double gamma = json["gamma"].toDouble(0.0);
+        if (!json["gamma"].isDouble() || gamma <= 0.0)
+            return false;
+        result.gamma = gamma;
+    }
+
+    settings = result;
+    return true;
+}
+
+bool ColorCorrection::LoadProfile(const QString &path, ColorCorrectionSettings &settings)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return false;
+    }
+    const QJsonDocument document = QJsonDocument::fromJson(file.readAll());
+    return document.isObject() && FromJson(document.object(), settings);
+}
+
+bool ColorCorrection::SaveProfile(const QString &path, const ColorCorrectionSettings &settings)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        return false;
+    }
+    const QByteArray data = QJsonDocument(ToJson(settings)).toJson();
+    return file.write(data) == data.size();
+}
@@ -0,0 +1,319 @@
+#include "Demosaic.h"
+#include "ColorCorrection.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+
+using Demosaic::CfaCell;
+using Demosaic::Method;
+
+// Lines per band below which splitting a frame across threads costs more
+// than it saves
+static const uint32_t s_MinBandLines = 64;
+
+// Lines of the sliding window, the interpolated line is the middle one
+static const int s_WindowLines = 5;
+
+// Samples kept left and right of every half line. Malvar-He-Cutler reads two
+// columns to each side, which is one sample of the same half and up to two
+// of the other half.
+static const int s_HalfPad = 2;
+
+// This function mirrors a coordinate outside [0, extent) back into the frame.
+// Mirroring around the border sample keeps the CFA phase. extent >= 2
+static int32_t Mirror(int32_t i, int32_t extent)
+{
+    while (i < 0 || i >= extent)
+    {
+        i = i < 0 ? -i : 2 * (extent - 1) - i;
+    }
+    return i;
+}
+
+// Scratch memory of the calling thread, every band worker has its own
+template <typename T>
+static std::vector<T> &Scratch()
+{
+    static thread_local std::vector<T> buffer;
+    return buffer;
+}
+
+template <typename T>
+static inline T Clamp(int32_t value)
+{
+    return T(std::min<int32_t>(std::max<int32_t>(value, 0), std::numeric_limits<T>::max()));
+}
+
+// One line of the window split by column parity
+template <typename T>
+struct HalfLines
+{
+    T *even;
+    T *odd;
+};
+
+// The window as seen from the interpolated line. 'green' holds the columns
+// in which the interpolated line has its green samples, 'color' the columns
+// of its red or blue samples.
+template <typename T>
+struct Window
+{
+    const T *green[s_WindowLines];
+    const T *color[s_WindowLines];
+};
+
+// Interpolated colors of one line. At green sites the color of the line
+// itself (C) and the other one (O) are missing, at color sites green and O.
+template <typename T>
+struct LineOutput
+{
+    T *greenC;
+    T *greenO;
+    T *colorG;
+    T *colorO;
+};
+
+// This function interpolates the missing colors of one line. greenShift and
+// colorShift are the index of the left neighbor of a green and a color site
+// in the other half, relative to the index of the site itself. The planes
+// never overlap the window, without telling the compiler it gives up on
+// vectorizing because of the number of alias checks.
+template <Method M, typename T>
+static void InterpolateLine(const Window<T> &window, uint32_t pairs, int greenShift, int colorShift, bool evenLine,
+                            T *__restrict greenC, T *__restrict greenO, T *__restrict colorG, T *__restrict colorO)
+{
+    const T *const G0 = window.green[0];
+    const T *const G1 = window.green[1];
+    const T *const G2 = window.green[2];
+    const T *const G3 = window.green[3];
+    const T *const G4 = window.green[4];
+    const T *const C0 = window.color[0];
+    const T *const C1 = window.color[1];
+    const T *const C2 = window.color[2];
+    const T *const C3 = window.color[3];
+    const T *const C4 = window.color[4];
+    const int32_t gs = greenShift;
+    const int32_t cs = colorShift;
+    const int32_t count = int32_t(pairs);
+
+    if constexpr (M == Method::Nearest)
+    {
+        // The other line of the CFA cell
+        const T *const Gp = evenLine ? G3 : G1;
+        const T *const Cp = evenLine ? C3 : C1;
+        for (int32_t i = 0; i < count; i++)
+        {
+            greenC[i] = C2[i];
+            greenO[i] = Gp[i];
+            colorG[i] = T((G2[i] + Cp[i] + 1) >> 1);
+            colorO[i] = Gp[i];
+        }
+    }
+    else if constexpr (M == Method::Bilinear)
+    {
+        for (int32_t i = 0; i < count; i++)
+        {
+            greenC[i] = T((C2[i + gs] + C2[i + gs + 1] + 1) >> 1);
+            greenO[i] = T((G1[i] + G3[i] + 1) >> 1);
+            colorG[i] = T((G2[i + cs] + G2[i + cs + 1] + C1[i] + C3[i] + 2) >> 2);
+            colorO[i] = T((G1[i + cs] + G1[i + cs + 1] + G3[i + cs] + G3[i + cs + 1] + 2) >> 2);
+        }
+    }
+    else
+    {
+        // Malvar, He, Cutler: "High-quality linear interpolation for demosaicing
+        // of Bayer-patterned color images", ICASSP 2004. Kernels scaled by 16.
+        for (int32_t i = 0; i < count; i++)
+        {
+            const int32_t green = G2[i];
+            const int32_t greenDiagonal = C1[i + gs] + C1[i + gs + 1] + C3[i + gs] + C3[i + gs + 1];
+            greenC[i] = Clamp<T>((10 * green + 8 * (C2[i + gs] + C2[i + gs + 1])
+                                      - 2 * (G2[i - 1] + G2[i + 1] + greenDiagonal) + G0[i] + G4[i] + 8) >> 4);
+            greenO[i] = Clamp<T>((10 * green + 8 * (G1[i] + G3[i])
+                                      - 2 * (G0[i] + G4[i] + greenDiagonal) + G2[i - 1] + G2[i + 1] + 8) >> 4);
+
+            const int32_t color = C2[i];
+            const int32_t colorFar = C2[i - 1] + C2[i + 1] + C0[i] + C4[i];
+            colorG[i] = Clamp<T>((8 * color + 4 * (G2[i + cs] + G2[i + cs + 1] + C1[i] + C3[i])
+                                      - 2 * colorFar + 8) >> 4);
+            colorO[i] = Clamp<T>((12 * color + 4 * (G1[i + cs] + G1[i + cs + 1] + G3[i + cs] + G3[i + cs + 1])
+                                      - 3 * colorFar + 8) >> 4);
+        }
+    }
+}
+
+// This function interleaves the planes of one line into RGB888 (8 bit) or
+// RGBX64 (16 bit). The planes of the even columns are followed by those of
+// the odd columns.
+template <typename T>
+static void StoreLine(const T *__restrict evenR, const T *__restrict evenG, const T *__restrict evenB,
+                      const T *__restrict oddR, const T *__restrict oddG, const T *__restrict oddB,
+                      uint32_t width, uint8_t *__restrict dst)
+{
+    const uint32_t pairs = width / 2;
+    if constexpr (sizeof(T) == 1)
+    {
+        for (uint32_t i = 0; i < pairs; i++)
+        {
+            dst[6 * i + 0] = evenR[i];
+            dst[6 * i + 1] = evenG[i];
+            dst[6 * i + 2] = evenB[i];
+            dst[6 * i + 3] = oddR[i];
+            dst[6 * i + 4] = oddG[i];
+            dst[6 * i + 5] = oddB[i];
+        }
+        if (width & 1)
+        {
+            dst[6 * pairs + 0] = evenR[pairs];
+            dst[6 * pairs + 1] = evenG[pairs];
+            dst[6 * pairs + 2] = evenB[pairs];
+        }
+    }
+    else
+    {
+        uint16_t *__restrict rgbx = reinterpret_cast<uint16_t *>(dst);
+        for (uint32_t i = 0; i < pairs; i++)
+        {
+            rgbx[8 * i + 0] = evenR[i];
+            rgbx[8 * i + 1] = evenG[i];
+            rgbx[8 * i + 2] = evenB[i];
+            rgbx[8 * i + 3] = 0xFFFF;
+            rgbx[8 * i + 4] = oddR[i];
+            rgbx[8 * i + 5] = oddG[i];
+            rgbx[8 * i + 6] = oddB[i];
+            rgbx[8 * i + 7] = 0xFFFF;
+        }
+        if (width & 1)
+        {
+            rgbx[8 * pairs + 0] = evenR[pairs];
+            rgbx[8 * pairs + 1] = evenG[pairs];
+            rgbx[8 * pairs + 2] = evenB[pairs];
+            rgbx[8 * pairs + 3] = 0xFFFF;
+        }
+    }
+}
+
+template <Method M, typename T>
+static void RunBands(const CfaCell &cell, uint32_t width, uint32_t height,
+                     const Demosaic::LineSource<T> &source, const ImageOrientation::LineWriter &output,
+                     const ColorCorrection *correction)
+{
+    const uint32_t pairs = (width + 1) / 2;
+    const size_t halfStride = pairs + 2 * s_HalfPad;
+    const size_t lineStride = 2 * halfStride;
+
+    WorkerPool &pool = WorkerPool::Instance();
+    const uint32_t bands = std::max(1u, std::min(pool.Concurrency(), height / s_MinBandLines));
+    pool.ParallelFor(bands, [&](uint32_t band) {
+        const uint32_t first = uint32_t(uint64_t(height) * band / bands);
+        const uint32_t last = uint32_t(uint64_t(height) * (band + 1) / bands);
+
+        // One padded full line, the window halves and the four output planes
+        std::vector<T> &scratch = Scratch<T>();
+        const size_t needed = lineStride + s_WindowLines * lineStride + 4 * pairs;
+        if (scratch.size() < needed)
+        {
+            scratch.resize(needed);
+        }
+        T *const line = scratch.data() + 2 * s_HalfPad;
+        T *const halves = scratch.data() + lineStride;
+        T *const planes = halves + s_WindowLines * lineStride;
+
+        HalfLines<T> slots[s_WindowLines];
+        for (int k = 0; k < s_WindowLines; k++)
+        {
+            slots[k].even = halves + k * lineStride + s_HalfPad;
+            slots[k].odd = slots[k].even + halfStride;
+        }
+        const LineOutput<T> out = { planes, planes + pairs, planes + 2 * pairs, planes + 3 * pairs };
+        ImageOrientation::LineWriter::Band writer(output);
+
+        const auto load = [&](int32_t y, const HalfLines<T> &slot) {
+            source(uint32_t(Mirror(y, height)), line);
+            for (int32_t x = -2 * s_HalfPad; x < 0; x++)
+            {
+                line[x] = line[Mirror(x, width)];
+            }
+            for (int32_t x = width; x < int32_t(2 * (pairs + s_HalfPad)); x++)
+            {
+                line[x] = line[Mirror(x, width)];
+            }
+            for (int32_t j = -s_HalfPad; j < int32_t(pairs + s_HalfPad); j++)
+            {
+                slot.even[j] = line[2 * j];
+                slot.odd[j] = line[2 * j + 1];
+            }
+        };
+
+        for (int k = 0; k < s_WindowLines - 1; k++)
+        {
+            load(int32_t(first) + k - s_WindowLines / 2, slots[k]);
+        }
+        for (uint32_t y = first; y < last; y++)
+        {
+            load(int32_t(y) + s_WindowLines / 2, slots[s_WindowLines - 1]);
+
+            const int parity = int(y & 1);
+            const int greenColumn = (cell.green0 >> 1) == parity ? (cell.green0 & 1) : (cell.green1 & 1);
+            const bool redLine = (cell.red >> 1) == parity;
+
+            Window<T> window;
+            for (int k = 0; k < s_WindowLines; k++)
+            {
+                window.green[k] = greenColumn ? slots[k].odd : slots[k].even;
+                window.color[k] = greenColumn ? slots[k].even : slots[k].odd;
+            }
+            const int greenShift = greenColumn ? 0 : -1;
+            InterpolateLine<M, T>(window, pairs, greenShift, -1 - greenShift, parity == 0,
+                                  out.greenC, out.greenO, out.colorG, out.colorO);
+
+            const T *const own = window.color[s_WindowLines / 2];
+            const T *const greenSites[3] = { redLine ? out.greenC : out.greenO,
+                                             window.green[s_WindowLines / 2],
+                                             redLine ? out.greenO : out.greenC };
+            const T *const colorSites[3] = { redLine ? own : out.colorO,
+                                             out.colorG,
+                                             redLine ? out.colorO : own };
+            const T *const *even = greenColumn ? colorSites : greenSites;
+            const T *const *odd = greenColumn ? greenSites : colorSites;
+            uint8_t *const dstLine = writer.Line(y);
+            StoreLine<T>(even[0], even[1], even[2], odd[0], odd[1], odd[2], width, dstLine);
+            if (correction)
+            {
+                correction->Apply(reinterpret_cast<T *>(dstLine), width);
+            }
+            writer.Commit(y);
+
+            std::rotate(slots, slots + 1, slots + s_WindowLines);
+        }
+    });
+}
+
+template <typename T>
+void Demosaic::Run(Method method, const CfaCell &cell, uint32_t width, uint32_t height,
+                   const LineSource<T> &source, const ImageOrientation::LineWriter &output,
+                   const ColorCorrection *correction)
+{
+    switch (method)
+    {
+    case Method::Nearest:
+        RunBands<Method::Nearest, T>(cell, width, height, source, output, correction);
+        break;
+    case Method::MalvarHeCutler:
+        RunBands<Method::MalvarHeCutler, T>(cell, width, height, source, output, correction);
+        break;
+    case Method::Bilinear:
+    default:
+        RunBands<Method::Bilinear, T>(cell, width, height, source, output, correction);
+        break;
+    }
+}
+
+template void Demosaic::Run<uint8_t>(Method, const CfaCell &, uint32_t, uint32_t,
+                                     const LineSource<uint8_t> &, const ImageOrientation::LineWriter &,
+                                     const ColorCorrection *);
+template void Demosaic::Run<uint16_t>(Method, const CfaCell &, uint32_t, uint32_t,
+                                      const LineSource<uint16_t> &, const ImageOrientation::LineWriter &,
+                                      const ColorCorrection *);
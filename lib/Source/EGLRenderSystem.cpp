@@ -60,14 +60,13 @@ void EGLRenderSystem::SetScaleFactor(double scale)
     emit EffectiveSizeChanged();
 }
 
-void EGLRenderSystem::SetFlipX(bool flip) {
-    flipX = flip;
-    glWidget->setFlip(flipX, flipY);
-}
-
-void EGLRenderSystem::SetFlipY(bool flip) {
-    flipY = flip;
-    glWidget->setFlip(flipX, flipY);
+void EGLRenderSystem::SetOrientation(const ImageOrientation::Orientation &orientation) {
+    bool const swapped = this->orientation.SwapsAxes() != orientation.SwapsAxes();
+    this->orientation = orientation;
+    glWidget->setOrientation(orientation);
+    if (swapped) {
+        emit EffectiveSizeChanged();
+    }
 }
 
 QWidget* EGLRenderSystem::GetWidget() const {
@@ -75,8 +74,11 @@ QWidget* EGLRenderSystem::GetWidget() const {
 }
 
 void EGLRenderSystem::UpdateScrollbars() {
-    int const effectiveWidth = int(scaleFactor * double(curWidth));
-    int const effectiveHeight = int(scaleFactor * double(curHeight));
+    // The texture is rotated on screen, a quarter turn swaps its extent
+    int const shownWidth = orientation.SwapsAxes() ? curHeight : curWidth;
+    int const shownHeight = orientation.SwapsAxes() ? curWidth : curHeight;
+    int const effectiveWidth = int(scaleFactor * double(shownWidth));
+    int const effectiveHeight = int(scaleFactor * double(shownHeight));
     int const scrollBarWidth = verticalScrollbar->width();
     int const scrollBarHeight = horizontalScrollbar->height();
 
@@ -5,7 +5,7 @@
 #include <QMutexLocker>
 #include <QOpenGLPixelTransferOptions>
 #include <QOffscreenSurface>
-#include <unordered_map>
+#include "PixelFormatRegistry.h"
 
 struct VertexData {
     QVector2D pos;
@@ -155,40 +155,84 @@ namespace {
         #define channelUV r
     )eof" + shaderBaseYUV;
 
-    static std::unordered_map<uint32_t, RenderSettings> const renderSettings {
-        { V4L2_PIX_FMT_RGB24,   { shaderRGB, GL_RGB, GL_UNSIGNED_BYTE, GL_RGB8, uploadRaw<3> } },
-        { V4L2_PIX_FMT_BGR24,   { shaderBGR, GL_RGB, GL_UNSIGNED_BYTE, GL_RGB8, uploadRaw<3> } },
-        { V4L2_PIX_FMT_XBGR32,  { shaderBGR, GL_RGBA, GL_UNSIGNED_BYTE, GL_RGBA8, uploadRaw<4> } },
-        { V4L2_PIX_FMT_ABGR32,  { shaderBGR, GL_RGBA, GL_UNSIGNED_BYTE, GL_RGBA8, uploadRaw<4> } },
-        { V4L2_PIX_FMT_RGB565,  { shaderRGB, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, GL_RGB565, uploadRaw<2> } },
-        { V4L2_PIX_FMT_GREY,    { shaderMono8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> } },
-
-        { V4L2_PIX_FMT_SRGGB8,  { shaderRGGB8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> } },
-        { V4L2_PIX_FMT_SGRBG8,  { shaderGRBG8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> } },
-        { V4L2_PIX_FMT_SGBRG8,  { shaderGBRG8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> } },
-        { V4L2_PIX_FMT_SBGGR8,  { shaderBGGR8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> } },
-
-        { V4L2_PIX_FMT_UYVY,    { shaderUYVY, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-        { V4L2_PIX_FMT_YUYV,    { shaderYUYV, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-
-        // Note: The i.MX8 Vivante GPU really doesn't like integer textures. Uploading 16 bit integer values
-        //       and using GL_RED_INTEGER / GL_UNSIGNED_SHORT / GL_R16UI led to glTexSubImage taking more than 100x
-        //       as long as just uploading to a GL_RG8 target.
-        //       GL_R16 is not supported by GLES3 at all, so instead we're going with an RG format and extract the
-        //       necessary parts from the two channels in the fragment shader.
-        { V4L2_PIX_FMT_Y10,     { shaderMono10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-        { V4L2_PIX_FMT_Y12,     { shaderMono10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-
-        { V4L2_PIX_FMT_SRGGB10, { shaderRGGB10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-        { V4L2_PIX_FMT_SGRBG10, { shaderGRBG10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-        { V4L2_PIX_FMT_SGBRG10, { shaderGBRG10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-        { V4L2_PIX_FMT_SBGGR10, { shaderBGGR10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-
-        { V4L2_PIX_FMT_SRGGB12, { shaderRGGB10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-        { V4L2_PIX_FMT_SGRBG12, { shaderGRBG10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-        { V4L2_PIX_FMT_SGBRG12, { shaderGBRG10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-        { V4L2_PIX_FMT_SBGGR12, { shaderBGGR10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> } },
-    };
+    static RenderSettings const settingsRGB24  { shaderRGB, GL_RGB, GL_UNSIGNED_BYTE, GL_RGB8, uploadRaw<3> };
+    static RenderSettings const settingsBGR24  { shaderBGR, GL_RGB, GL_UNSIGNED_BYTE, GL_RGB8, uploadRaw<3> };
+    static RenderSettings const settingsBGRX32 { shaderBGR, GL_RGBA, GL_UNSIGNED_BYTE, GL_RGBA8, uploadRaw<4> };
+    static RenderSettings const settingsRGB565 { shaderRGB, GL_RGB, GL_UNSIGNED_SHORT_5_6_5, GL_RGB565, uploadRaw<2> };
+    static RenderSettings const settingsMono8  { shaderMono8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> };
+
+    static RenderSettings const settingsRGGB8  { shaderRGGB8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> };
+    static RenderSettings const settingsGRBG8  { shaderGRBG8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> };
+    static RenderSettings const settingsGBRG8  { shaderGBRG8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> };
+    static RenderSettings const settingsBGGR8  { shaderBGGR8, GL_RED, GL_UNSIGNED_BYTE, GL_R8, uploadRaw<1> };
+
+    static RenderSettings const settingsUYVY   { shaderUYVY, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> };
+    static RenderSettings const settingsYUYV   { shaderYUYV, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> };
+
+    // Note: The i.MX8 Vivante GPU really doesn't like integer textures. Uploading 16 bit integer values
+    //       and using GL_RED_INTEGER / GL_UNSIGNED_SHORT / GL_R16UI led to glTexSubImage taking more than 100x
+    //       as long as just uploading to a GL_RG8 target.
+    //       GL_R16 is not supported by GLES3 at all, so instead we're going with an RG format and extract the
+    //       necessary parts from the two channels in the fragment shader.
+    static RenderSettings const settingsMono16 { shaderMono10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> };
+    static RenderSettings const settingsRGGB16 { shaderRGGB10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> };
+    static RenderSettings const settingsGRBG16 { shaderGRBG10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> };
+    static RenderSettings const settingsGBRG16 { shaderGBRG10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> };
+    static RenderSettings const settingsBGGR16 { shaderBGGR10_12_NXP, GL_RG, GL_UNSIGNED_BYTE, GL_RG8, uploadRaw<2> };
+
+    static RenderSettings const* bayerSettings(PixelFormatRegistry::CfaOrder cfa, bool wide) {
+        using PixelFormatRegistry::CfaOrder;
+        switch(cfa) {
+            case CfaOrder::RGGB: return wide ? &settingsRGGB16 : &settingsRGGB8;
+            case CfaOrder::GRBG: return wide ? &settingsGRBG16 : &settingsGRBG8;
+            case CfaOrder::GBRG: return wide ? &settingsGBRG16 : &settingsGBRG8;
+            case CfaOrder::BGGR: return wide ? &settingsBGGR16 : &settingsBGGR8;
+            case CfaOrder::None: break;
+        }
+        return nullptr;
+    }
+
+    // Picks the shader and texture layout from the pixel format traits. 16 bit containers are only supported
+    // when the 8 most significant bits end up in the second byte (shift 8), see the NXP note above.
+    static RenderSettings const* findRenderSettings(uint32_t pixelFormat) {
+        using namespace PixelFormatRegistry;
+        auto const desc = Find(pixelFormat);
+        if(desc == nullptr) {
+            return nullptr;
+        }
+
+        bool const wide = (desc->packing == SamplePacking::Word16) && (desc->shift == 8);
+        switch(desc->family) {
+            case PixelFamily::Rgb:
+                switch(desc->packing) {
+                    case SamplePacking::Rgb24:  return &settingsRGB24;
+                    case SamplePacking::Bgr24:  return &settingsBGR24;
+                    case SamplePacking::Bgrx32:
+                    case SamplePacking::Bgra32: return &settingsBGRX32;
+                    case SamplePacking::Rgb565: return &settingsRGB565;
+                    default: return nullptr;
+                }
+            case PixelFamily::Yuv:
+                switch(desc->packing) {
+                    case SamplePacking::Uyvy: return &settingsUYVY;
+                    case SamplePacking::Yuyv: return &settingsYUYV;
+                    default: return nullptr;
+                }
+            case PixelFamily::Mono:
+                if(desc->packing == SamplePacking::Byte) {
+                    return &settingsMono8;
+                }
+                return wide ? &settingsMono16 : nullptr;
+            case PixelFamily::Bayer:
+                if(desc->packing == SamplePacking::Byte || wide) {
+                    return bayerSettings(desc->cfa, wide);
+                }
+                return nullptr;
+            case PixelFamily::Compressed:
+                break;
+        }
+        return nullptr;
+    }
 
     static char const pixelShaderFramework[] = R"eof(
         #define texture texture2D
@@ -220,9 +264,9 @@ bool EGLRenderWidget::canRender(uint32_t pixelFormat) {
         ctx.doneCurrent();
         return ((err == GL_NO_ERROR) && v >= 3) || rgExt;
     }();
-    auto const renderSettingsIt = renderSettings.find(pixelFormat);
-    return (renderSettingsIt != renderSettings.end())
-           && ((renderSettingsIt->second.glPixelFormat != GL_RG) || rgTextureSupported);
+    auto const settings = findRenderSettings(pixelFormat);
+    return (settings != nullptr)
+           && ((settings->glPixelFormat != GL_RG) || rgTextureSupported);
 }
 
 void EGLRenderWidget::initializeGL() {
@@ -279,8 +323,8 @@ void EGLRenderWidget::paintGL() {
     if(recreatePipeline) {
         recreatePipeline = false;
        
-        auto const renderSettingsIt = renderSettings.find(pixelFormat);
-        if(renderSettingsIt == renderSettings.end()) {
+        auto const settings = findRenderSettings(pixelFormat);
+        if(settings == nullptr) {
             std::cerr << "Pixel format implementation missing (bug!)" << std::endl;
             abort();
         }
@@ -317,7 +361,7 @@ void EGLRenderWidget::paintGL() {
         vertices.write(0, verts, sizeof(verts));
 
 
-        currentRenderSettings = &renderSettingsIt->second;
+        currentRenderSettings = settings;
 
         texture = std::make_unique<QOpenGLTexture>(QOpenGLTexture::Target2D);
         texture->setSize(textureWidth, textureHeight);
@@ -386,7 +430,9 @@ void EGLRenderWidget::updateMatrix() {
 void EGLRenderWidget::updateViewMatrix() {
     viewMatrix.setToIdentity();
     viewMatrix.translate(-scrollX, scrollY);
-    viewMatrix.scale(flipX ? -scale : scale, flipY ? -scale : scale);
+    // Flips first, then the clockwise rotation, as the software conversion does
+    viewMatrix.rotate(-float(orientation.Degrees()), 0.0f, 0.0f, 1.0f);
+    viewMatrix.scale(orientation.flipX ? -scale : scale, orientation.flipY ? -scale : scale);
     updateMatrix();
 }
 
@@ -414,9 +460,8 @@ void EGLRenderWidget::setScale(float scale) {
     updateViewMatrix();
 }
 
-void EGLRenderWidget::setFlip(bool flipX, bool flipY) {
-    this->flipX = flipX;
-    this->flipY = flipY;
+void EGLRenderWidget::setOrientation(const ImageOrientation::Orientation &orientation) {
+    this->orientation = orientation;
     updateViewMatrix();
 }
 
@@ -0,0 +1,770 @@
+#include "FlatFieldCorrection.h"
+#include "ImageTransform.h"
+#include "PixelFormatRegistry.h"
+#include "WorkerPool.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+using PixelFormatRegistry::PixelFamily;
+using PixelFormatRegistry::PixelFormatDescriptor;
+using PixelFormatRegistry::SamplePacking;
+
+static const char s_FileMagic[4] = { 'V', '4', 'F', 'F' };
+static const uint32_t s_FileVersion = 1;
+
+// Largest gain a map can hold, and the gain of a pixel without flat reference
+static const double s_MaxGain = 65535.0 / (1 << FlatFieldCorrection::s_GainShift);
+static const uint16_t s_UnityGain = 1 << FlatFieldCorrection::s_GainShift;
+
+// Hot pixels exceed the mean dark level by this many standard deviations,
+// and at least by this fraction of full scale
+static const double s_HotSigma = 6.0;
+static const double s_HotMinimum = 1.0 / 64.0;
+
+// Dead or stuck pixels respond this far from their same color neighbors
+static const double s_DeadBelow = 0.5;
+static const double s_StuckAbove = 1.5;
+
+// Lines per band below which splitting the frame does not pay off
+static const uint32_t s_MinBandLines = 32;
+
+static const uint32_t s_MaxReferenceFrames = 256;
+
+struct FileHeader
+{
+    char magic[4];
+    uint32_t version;
+    uint32_t pixelFormat;
+    uint32_t width;
+    uint32_t height;
+    uint32_t defects;
+};
+
+static std::mutex s_CurrentMutex;
+static std::shared_ptr<const FlatFieldCorrection> s_CurrentMaps;
+static bool s_Enabled = false;
+
+// Formats the correction works on: raw samples with one value per pixel
+static const PixelFormatDescriptor *RawDescriptor(uint32_t pixelFormat)
+{
+    const PixelFormatDescriptor *desc = PixelFormatRegistry::Find(pixelFormat);
+    if (!desc || (desc->family != PixelFamily::Mono && desc->family != PixelFamily::Bayer))
+    {
+        return nullptr;
+    }
+    switch (desc->packing)
+    {
+    case SamplePacking::Byte:
+    case SamplePacking::Word16:
+    case SamplePacking::Csi2Packed10:
+    case SamplePacking::Csi2Packed12:
+        return desc;
+    default:
+        return nullptr;
+    }
+}
+
+static bool FrameMatches(const BufferWrapper &frame, const PixelFormatDescriptor &desc)
+{
+    return frame.width > 0 && frame.height > 0 &&
+           frame.bytesPerLine >= desc.MinimumBytesPerLine(frame.width) &&
+           size_t(frame.bytesPerLine) * frame.height <= frame.length;
+}
+
+// Largest sample value of a format
+static uint16_t MaxValue(const PixelFormatDescriptor &desc)
+{
+    switch (desc.packing)
+    {
+    case SamplePacking::Word16:
+        return uint16_t((1u << std::min(desc.shift + 8, 16)) - 1);
+    case SamplePacking::Csi2Packed10:
+        return 1023;
+    case SamplePacking::Csi2Packed12:
+        return 4095;
+    default:
+        return 255;
+    }
+}
+
+// Distance between samples of the same color
+static uint32_t ColorStep(const PixelFormatDescriptor &desc)
+{
+    return desc.family == PixelFamily::Bayer ? 2 : 1;
+}
+
+// Index of the CFA position, the mean levels are kept per position
+static inline uint32_t Phase(uint32_t x, uint32_t y, uint32_t step)
+{
+    return step == 2 ? (y & 1) * 2 + (x & 1) : 0;
+}
+
+// This function expands a packed line to one 16 bit value per sample.
+// Samples of an incomplete last group have no low bits in the line.
+static void UnpackLine(const uint8_t *src, uint16_t *dst, uint32_t width, SamplePacking packing)
+{
+    uint32_t x = 0;
+    if (packing == SamplePacking::Csi2Packed10)
+    {
+        for (; x + 4 <= width; x += 4, src += 5)
+        {
+            const uint8_t lsb = src[4];
+            dst[x + 0] = uint16_t((src[0] << 2) | (lsb & 3));
+            dst[x + 1] = uint16_t((src[1] << 2) | ((lsb >> 2) & 3));
+            dst[x + 2] = uint16_t((src[2] << 2) | ((lsb >> 4) & 3));
+            dst[x + 3] = uint16_t((src[3] << 2) | (lsb >> 6));
+        }
+        for (uint32_t i = 0; x < width; x++, i++)
+        {
+            dst[x] = uint16_t(src[i] << 2);
+        }
+    }
+    else if (packing == SamplePacking::Csi2Packed12)
+    {
+        for (; x + 2 <= width; x += 2, src += 3)
+        {
+            dst[x + 0] = uint16_t((src[0] << 4) | (src[2] & 0x0F));
+            dst[x + 1] = uint16_t((src[1] << 4) | (src[2] >> 4));
+        }
+        if (x < width)
+        {
+            dst[x] = uint16_t(src[0] << 4);
+        }
+    }
+    else if (packing == SamplePacking::Word16)
+    {
+        std::memcpy(dst, src, size_t(width) * sizeof(uint16_t));
+    }
+    else
+    {
+        std::copy(src, src + width, dst);
+    }
+}
+
+// The inverse of UnpackLine
+static void PackLine(const uint16_t *src, uint8_t *dst, uint32_t width, SamplePacking packing)
+{
+    uint32_t x = 0;
+    if (packing == SamplePacking::Csi2Packed10)
+    {
+        for (; x + 4 <= width; x += 4, dst += 5)
+        {
+            dst[0] = uint8_t(src[x + 0] >> 2);
+            dst[1] = uint8_t(src[x + 1] >> 2);
+            dst[2] = uint8_t(src[x + 2] >> 2);
+            dst[3] = uint8_t(src[x + 3] >> 2);
+            dst[4] = uint8_t((src[x + 0] & 3) | ((src[x + 1] & 3) << 2) | ((src[x + 2] & 3) << 4) | ((src[x + 3] & 3) << 6));
+        }
+        for (uint32_t i = 0; x < width; x++, i++)
+        {
+            dst[i] = uint8_t(src[x] >> 2);
+        }
+    }
+    else if (packing == SamplePacking::Csi2Packed12)
+    {
+        for (; x + 2 <= width; x += 2, dst += 3)
+        {
+            dst[0] = uint8_t(src[x + 0] >> 4);
+            dst[1] = uint8_t(src[x + 1] >> 4);
+            dst[2] = uint8_t((src[x + 0] & 0x0F) | ((src[x + 1] & 0x0F) << 4));
+        }
+        if (x < width)
+        {
+            dst[0] = uint8_t(src[x] >> 4);
+        }
+    }
+    else if (packing == SamplePacking::Word16)
+    {
+        std::memcpy(dst, src, size_t(width) * sizeof(uint16_t));
+    }
+    else
+    {
+        std::copy(src, src + width, dst);
+    }
+}
+
+// Eight 16 bit lanes, one SSE2 or NEON register, and their widened halves
+typedef uint8_t Uint8x8 __attribute__((vector_size(8)));
+typedef uint16_t Uint16x8 __attribute__((vector_size(16)));
+typedef uint32_t Uint32x4 __attribute__((vector_size(16)));
+
+static inline Uint16x8 LoadLanes(const uint16_t *p)
+{
+    Uint16x8 v;
+    std::memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline Uint16x8 LoadLanes(const uint8_t *p)
+{
+    Uint8x8 v;
+    std::memcpy(&v, p, sizeof(v));
+    return __builtin_convertvector(v, Uint16x8);
+}
+
+static inline void StoreLanes(uint16_t *p, Uint16x8 v)
+{
+    std::memcpy(p, &v, sizeof(v));
+}
+
+static inline void StoreLanes(uint8_t *p, Uint16x8 v)
+{
+    const Uint8x8 bytes = __builtin_convertvector(v, Uint8x8);
+    std::memcpy(p, &bytes, sizeof(bytes));
+}
+
+// level * gain plus pedestal for four lanes, rounded and limited to maxValue
+static inline Uint32x4 ScaleLanes(Uint32x4 level, Uint32x4 gain, Uint32x4 pedestal, Uint32x4 maxValue)
+{
+    const Uint32x4 value = ((level * gain + (1u << (FlatFieldCorrection::s_GainShift - 1))) >> FlatFieldCorrection::s_GainShift) +
+                           pedestal;
+    return value > maxValue ? maxValue : value;
+}
+
+// This function subtracts the dark level, applies the gain and adds back the
+// pedestal of even and odd columns to one line. Without vector the scalar
+// loop does the whole line.
+template <typename T>
+static void CorrectLine(T *__restrict samples, const uint16_t *__restrict dark, const uint16_t *__restrict gain,
+                        const uint16_t *pedestal, uint32_t width, uint16_t maxValue, bool vector)
+{
+    const Uint16x8 zero = {};
+    const Uint32x4 limit = Uint32x4{} + maxValue;
+    const Uint32x4 base = { pedestal[0], pedestal[1], pedestal[0], pedestal[1] };
+    const uint32_t vectorWidth = vector ? width : 0;
+
+    uint32_t x = 0;
+    for (; x + 8 <= vectorWidth; x += 8)
+    {
+        const Uint16x8 sample = LoadLanes(samples + x);
+        const Uint16x8 offset = LoadLanes(dark + x);
+        const Uint16x8 level = (sample - offset) & Uint16x8(sample > offset);
+        const Uint16x8 factor = LoadLanes(gain + x);
+
+        // Interleaving with zero widens the lanes to 32 bit
+        const Uint32x4 low = ScaleLanes(Uint32x4(__builtin_shufflevector(level, zero, 0, 8, 1, 9, 2, 10, 3, 11)),
+                                        Uint32x4(__builtin_shufflevector(factor, zero, 0, 8, 1, 9, 2, 10, 3, 11)), base, limit);
+        const Uint32x4 high = ScaleLanes(Uint32x4(__builtin_shufflevector(level, zero, 4, 12, 5, 13, 6, 14, 7, 15)),
+                                         Uint32x4(__builtin_shufflevector(factor, zero, 4, 12, 5, 13, 6, 14, 7, 15)), base, limit);
+        StoreLanes(samples + x, __builtin_shufflevector(Uint16x8(low), Uint16x8(high), 0, 2, 4, 6, 8, 10, 12, 14));
+    }
+    for (; x < width; x++)
+    {
+        const uint32_t level = samples[x] > dark[x] ? samples[x] - dark[x] : 0;
+        const uint32_t value = ((level * gain[x] + (1u << (FlatFieldCorrection::s_GainShift - 1))) >> FlatFieldCorrection::s_GainShift) +
+                               pedestal[x & 1];
+        samples[x] = T(std::min<uint32_t>(value, maxValue));
+    }
+}
+
+// Scratch memory of the calling thread, every band worker has its own
+static std::vector<uint16_t> &Scratch()
+{
+    static thread_local std::vector<uint16_t> buffer;
+    return buffer;
+}
+
+// Read and write access to single samples of a packed line
+static uint16_t ReadSample(const uint8_t *line, uint32_t x, uint32_t width, SamplePacking packing)
+{
+    uint16_t value[4];
+    switch (packing)
+    {
+    case SamplePacking::Csi2Packed10:
+    {
+        const uint32_t group = x / 4 * 4;
+        UnpackLine(line + size_t(group / 4) * 5, value, std::min(width - group, 4u), packing);
+        return value[x - group];
+    }
+    case SamplePacking::Csi2Packed12:
+    {
+        const uint32_t group = x / 2 * 2;
+        UnpackLine(line + size_t(group / 2) * 3, value, std::min(width - group, 2u), packing);
+        return value[x - group];
+    }
+    case SamplePacking::Word16:
+        std::memcpy(value, line + 2 * size_t(x), sizeof(uint16_t));
+        return value[0];
+    default:
+        return line[x];
+    }
+}
+
+static void WriteSample(uint8_t *line, uint32_t x, uint32_t width, SamplePacking packing, uint16_t sample)
+{
+    uint16_t value[4];
+    switch (packing)
+    {
+    case SamplePacking::Csi2Packed10:
+    {
+        const uint32_t group = x / 4 * 4;
+        const uint32_t count = std::min(width - group, 4u);
+        UnpackLine(line + size_t(group / 4) * 5, value, count, packing);
+        value[x - group] = sample;
+        PackLine(value, line + size_t(group / 4) * 5, count, packing);
+        break;
+    }
+    case SamplePacking::Csi2Packed12:
+    {
+        const uint32_t group = x / 2 * 2;
+        const uint32_t count = std::min(width - group, 2u);
+        UnpackLine(line + size_t(group / 2) * 3, value, count, packing);
+        value[x - group] = sample;
+        PackLine(value, line + size_t(group / 2) * 3, count, packing);
+        break;
+    }
+    case SamplePacking::Word16:
+        std::memcpy(line + 2 * size_t(x), &sample, sizeof(sample));
+        break;
+    default:
+        line[x] = uint8_t(sample);
+        break;
+    }
+}
+
+FlatFieldCorrection::FlatFieldCorrection(uint32_t pixelFormat, uint32_t width, uint32_t height,
+                                         std::vector<uint16_t> dark, std::vector<uint16_t> gain,
+                                         std::vector<uint32_t> defects)
+    : m_PixelFormat(pixelFormat)
+    , m_Width(width)
+    , m_Height(height)
+    , m_Dark(std::move(dark))
+    , m_Gain(std::move(gain))
+    , m_DefectIndices(std::move(defects))
+{
+    const PixelFormatDescriptor *desc = RawDescriptor(pixelFormat);
+    const uint32_t step = desc ? ColorStep(*desc) : 1;
+    std::sort(m_DefectIndices.begin(), m_DefectIndices.end());
+
+    // The pedestal of each CFA position, mono frames have a single one
+    uint64_t sum[4] = {};
+    uint64_t count[4] = {};
+    if (m_Dark.size() == size_t(width) * height)
+    {
+        for (uint32_t y = 0; y < height; y++)
+        {
+            for (uint32_t x = 0; x < width; x++)
+            {
+                sum[Phase(x, y, step)] += m_Dark[size_t(y) * width + x];
+                count[Phase(x, y, step)]++;
+            }
+        }
+    }
+    for (int phase = 0; phase < 4; phase++)
+    {
+        const int source = step == 2 ? phase : 0;
+        m_Pedestal[phase] = count[source] > 0 ? uint16_t((sum[source] + count[source] / 2) / count[source]) : 0;
+    }
+
+    // Neighbors that are defects themselves do not count
+    const auto isDefect = [&](uint32_t x, uint32_t y) {
+        return std::binary_search(m_DefectIndices.begin(), m_DefectIndices.end(), y * width + x);
+    };
+    for (uint32_t index : m_DefectIndices)
+    {
+        if (index >= width * height)
+        {
+            continue;
+        }
+        Defect defect = { index % width, index / width, 0, {} };
+        const int32_t offsets[4][2] = { { -int32_t(step), 0 }, { int32_t(step), 0 }, { 0, -int32_t(step) }, { 0, int32_t(step) } };
+        for (const auto &offset : offsets)
+        {
+            const int64_t x = int64_t(defect.x) + offset[0];
+            const int64_t y = int64_t(defect.y) + offset[1];
+            if (x >= 0 && x < width && y >= 0 && y < height && !isDefect(uint32_t(x), uint32_t(y)))
+            {
+                defect.neighbors[defect.count][0] = uint32_t(x);
+                defect.neighbors[defect.count][1] = uint32_t(y);
+                defect.count++;
+            }
+        }
+        m_Defects.push_back(defect);
+    }
+}
+
+int FlatFieldCorrection::Apply(const BufferWrapper &frame, uint8_t *data) const
+{
+    const PixelFormatDescriptor *desc = RawDescriptor(frame.pixelFormat);
+    if (!desc || frame.pixelFormat != m_PixelFormat || frame.width != m_Width || frame.height != m_Height ||
+        !FrameMatches(frame, *desc))
+    {
+        return -1;
+    }
+
+    const SamplePacking packing = desc->packing;
+    const uint16_t maxValue = MaxValue(*desc);
+    const bool inPlace16 = packing == SamplePacking::Word16 &&
+                           reinterpret_cast<uintptr_t>(data) % 2 == 0 && frame.bytesPerLine % 2 == 0;
+
+    const bool vector = ImageTransform::VectorKernels();
+
+    WorkerPool &pool = WorkerPool::Instance();
+    const uint32_t bands = std::max(1u, std::min(pool.Concurrency(), m_Height / s_MinBandLines));
+    pool.ParallelFor(bands, [&](uint32_t band) {
+        const uint32_t first = uint32_t(uint64_t(m_Height) * band / bands);
+        const uint32_t last = uint32_t(uint64_t(m_Height) * (band + 1) / bands);
+
+        std::vector<uint16_t> &scratch = Scratch();
+        if (scratch.size() < m_Width)
+        {
+            scratch.resize(m_Width);
+        }
+
+        for (uint32_t y = first; y < last; y++)
+        {
+            uint8_t *line = data + size_t(y) * frame.bytesPerLine;
+            const uint16_t *dark = m_Dark.data() + size_t(y) * m_Width;
+            const uint16_t *gain = m_Gain.data() + size_t(y) * m_Width;
+            const uint16_t *pedestal = m_Pedestal + (y & 1) * 2;
+
+            if (packing == SamplePacking::Byte)
+            {
+                CorrectLine(line, dark, gain, pedestal, m_Width, maxValue, vector);
+            }
+            else if (inPlace16)
+            {
+                CorrectLine(reinterpret_cast<uint16_t *>(line), dark, gain, pedestal, m_Width, maxValue, vector);
+            }
+            else
+            {
+                UnpackLine(line, scratch.data(), m_Width, packing);
+                CorrectLine(scratch.data(), dark, gain, pedestal, m_Width, maxValue, vector);
+                PackLine(scratch.data(), line, m_Width, packing);
+            }
+        }
+    });
+
+    CorrectDefects(frame, data);
+    return 0;
+}
+
+void FlatFieldCorrection::CorrectDefects(const BufferWrapper &frame, uint8_t *data) const
+{
+    const SamplePacking packing = RawDescriptor(frame.pixelFormat)->packing;
+    for (const Defect &defect : m_Defects)
+    {
+        if (defect.count == 0)
+        {
+            continue;
+        }
+        uint32_t sum = 0;
+        for (uint32_t i = 0; i < defect.count; i++)
+        {
+            sum += ReadSample(data + size_t(defect.neighbors[i][1]) * frame.bytesPerLine, defect.neighbors[i][0], m_Width, packing);
+        }
+        WriteSample(data + size_t(defect.y) * frame.bytesPerLine, defect.x, m_Width, packing,
+                    uint16_t((sum + defect.count / 2) / defect.count));
+    }
+}
+
+bool FlatFieldCorrection::Save(const QString &path) const
+{
+    QFileInfo info(path);
+    QDir().mkpath(info.absolutePath());
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate))
+    {
+        return false;
+    }
+
+    FileHeader header;
+    std::memcpy(header.magic, s_FileMagic, sizeof(header.magic));
+    header.version = s_FileVersion;
+    header.pixelFormat = m_PixelFormat;
+    header.width = m_Width;
+    header.height = m_Height;
+    header.defects = uint32_t(m_DefectIndices.size());
+
+    const qint64 mapBytes = qint64(m_Dark.size() * sizeof(uint16_t));
+    const qint64 defectBytes = qint64(m_DefectIndices.size() * sizeof(uint32_t));
+    return file.write(reinterpret_cast<const char *>(&header), sizeof(header)) == sizeof(header) &&
+           file.write(reinterpret_cast<const char *>(m_Dark.data()), mapBytes) == mapBytes &&
+           file.write(reinterpret_cast<const char *>(m_Gain.data()), mapBytes) == mapBytes &&
+           file.write(reinterpret_cast<const char *>(m_DefectIndices.data()), defectBytes) == defectBytes;
+}
+
+std::shared_ptr<const FlatFieldCorrection> FlatFieldCorrection::Load(const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+    {
+        return nullptr;
+    }
+
+    FileHeader header;
+    if (file.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header) ||
+        std::memcmp(header.magic, s_FileMagic, sizeof(header.magic)) != 0 || header.version != s_FileVersion ||
+        !RawDescriptor(header.pixelFormat) || header.width == 0 || header.height == 0)
+    {
+        return nullptr;
+    }
+
+    const size_t pixels = size_t(header.width) * header.height;
+    if (file.size() != qint64(sizeof(header) + 2 * pixels * sizeof(uint16_t) + size_t(header.defects) * sizeof(uint32_t)))
+    {
+        return nullptr;
+    }
+
+    std::vector<uint16_t> dark(pixels);
+    std::vector<uint16_t> gain(pixels);
+    std::vector<uint32_t> defects(header.defects);
+    const qint64 mapBytes = qint64(pixels * sizeof(uint16_t));
+    const qint64 defectBytes = qint64(defects.size() * sizeof(uint32_t));
+    if (file.read(reinterpret_cast<char *>(dark.data()), mapBytes) != mapBytes ||
+        file.read(reinterpret_cast<char *>(gain.data()), mapBytes) != mapBytes ||
+        file.read(reinterpret_cast<char *>(defects.data()), defectBytes) != defectBytes)
+    {
+        return nullptr;
+    }
+
+    return std::make_shared<const FlatFieldCorrection>(header.pixelFormat, header.width, header.height,
+                                                       std::move(dark), std::move(gain), std::move(defects));
+}
+
+QString FlatFieldCorrection::DefaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/flatfield.v4ff";
+}
+
+std::shared_ptr<const FlatFieldCorrection> FlatFieldCorrection::Current()
+{
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    return s_Enabled ? s_CurrentMaps : nullptr;
+}
+
+std::shared_ptr<const FlatFieldCorrection> FlatFieldCorrection::CurrentMaps()
+{
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    return s_CurrentMaps;
+}
+
+void FlatFieldCorrection::SetCurrentMaps(std::shared_ptr<const FlatFieldCorrection> maps)
+{
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    s_CurrentMaps = std::move(maps);
+}
+
+bool FlatFieldCorrection::IsEnabled()
+{
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    return s_Enabled;
+}
+
+void FlatFieldCorrection::SetEnabled(bool enabled)
+{
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    s_Enabled = enabled;
+}
+
+FlatFieldCalibration::FlatFieldCalibration()
+    : m_PixelFormat(0)
+    , m_Width(0)
+    , m_Height(0)
+    , m_Capturing(Reference::Dark)
+    , m_Remaining(0)
+{
+}
+
+int FlatFieldCalibration::Start(Reference reference, uint32_t frames)
+{
+    if (frames == 0 || frames > s_MaxReferenceFrames)
+    {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    Accumulator &accumulator = m_References[int(reference)];
+    accumulator.sums.clear();
+    accumulator.frames = 0;
+    m_Capturing = reference;
+    m_Remaining = frames;
+    return 0;
+}
+
+bool FlatFieldCalibration::IsCapturing() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_Remaining > 0;
+}
+
+uint32_t FlatFieldCalibration::CapturedFrames(Reference reference) const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_References[int(reference)].frames;
+}
+
+void FlatFieldCalibration::AddFrame(const BufferWrapper &frame)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (m_Remaining == 0)
+    {
+        return;
+    }
+
+    const PixelFormatDescriptor *desc = RawDescriptor(frame.pixelFormat);
+    if (!desc || !FrameMatches(frame, *desc))
+    {
+        return;
+    }
+
+    // References of another format or size cannot be combined with this one
+    if (frame.pixelFormat != m_PixelFormat || frame.width != m_Width || frame.height != m_Height)
+    {
+        for (Accumulator &accumulator : m_References)
+        {
+            accumulator.sums.clear();
+            accumulator.frames = 0;
+        }
+        m_PixelFormat = frame.pixelFormat;
+        m_Width = frame.width;
+        m_Height = frame.height;
+    }
+
+    Accumulator &accumulator = m_References[int(m_Capturing)];
+    accumulator.sums.resize(size_t(m_Width) * m_Height, 0);
+
+    const SamplePacking packing = desc->packing;
+    WorkerPool &pool = WorkerPool::Instance();
+    const uint32_t bands = std::max(1u, std::min(pool.Concurrency(), m_Height / s_MinBandLines));
+    pool.ParallelFor(bands, [&](uint32_t band) {
+        const uint32_t first = uint32_t(uint64_t(m_Height) * band / bands);
+        const uint32_t last = uint32_t(uint64_t(m_Height) * (band + 1) / bands);
+
+        std::vector<uint16_t> &scratch = Scratch();
+        if (scratch.size() < m_Width)
+        {
+            scratch.resize(m_Width);
+        }
+        for (uint32_t y = first; y < last; y++)
+        {
+            UnpackLine(frame.data + size_t(y) * frame.bytesPerLine, scratch.data(), m_Width, packing);
+            uint32_t *sums = accumulator.sums.data() + size_t(y) * m_Width;
+            for (uint32_t x = 0; x < m_Width; x++)
+            {
+                sums[x] += scratch[x];
+            }
+        }
+    });
+
+    accumulator.frames++;
+    m_Remaining--;
+}
+
+std::shared_ptr<FlatFieldCorrection> FlatFieldCalibration::Build() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    const Accumulator &darkFrames = m_References[int(Reference::Dark)];
+    const Accumulator &flatFrames = m_References[int(Reference::Flat)];
+    const PixelFormatDescriptor *desc = RawDescriptor(m_PixelFormat);
+    if (m_Remaining > 0 || !desc || (darkFrames.frames == 0 && flatFrames.frames == 0))
+    {
+        return nullptr;
+    }
+
+    const size_t pixels = size_t(m_Width) * m_Height;
+    const uint32_t step = ColorStep(*desc);
+    const double fullScale = MaxValue(*desc);
+    std::vector<uint16_t> dark(pixels, 0);
+    std::vector<uint16_t> gain(pixels, s_UnityGain);
+    std::vector<uint32_t> defects;
+
+    if (darkFrames.frames > 0)
+    {
+        double sum[4] = {};
+        double squares[4] = {};
+        double count[4] = {};
+        for (uint32_t y = 0; y < m_Height; y++)
+        {
+            for (uint32_t x = 0; x < m_Width; x++)
+            {
+                const size_t i = size_t(y) * m_Width + x;
+                dark[i] = uint16_t((darkFrames.sums[i] + darkFrames.frames / 2) / darkFrames.frames);
+                const uint32_t phase = Phase(x, y, step);
+                sum[phase] += dark[i];
+                squares[phase] += double(dark[i]) * dark[i];
+                count[phase]++;
+            }
+        }
+
+        double threshold[4] = {};
+        for (int phase = 0; phase < 4; phase++)
+        {
+            if (count[phase] > 0)
+            {
+                const double mean = sum[phase] / count[phase];
+                const double sigma = std::sqrt(std::max(squares[phase] / count[phase] - mean * mean, 0.0));
+                threshold[phase] = mean + std::max(s_HotSigma * sigma, s_HotMinimum * fullScale);
+            }
+        }
+        for (uint32_t y = 0; y < m_Height; y++)
+        {
+            for (uint32_t x = 0; x < m_Width; x++)
+            {
+                const size_t i = size_t(y) * m_Width + x;
+                if (dark[i] > threshold[Phase(x, y, step)])
+                {
+                    defects.push_back(uint32_t(i));
+                }
+            }
+        }
+    }
+
+    if (flatFrames.frames > 0)
+    {
+        // Response to the flat target above the dark level
+        std::vector<float> response(pixels);
+        double sum[4] = {};
+        double count[4] = {};
+        for (uint32_t y = 0; y < m_Height; y++)
+        {
+            for (uint32_t x = 0; x < m_Width; x++)
+            {
+                const size_t i = size_t(y) * m_Width + x;
+                response[i] = std::max(float(flatFrames.sums[i]) / flatFrames.frames - dark[i], 0.0f);
+                sum[Phase(x, y, step)] += response[i];
+                count[Phase(x, y, step)]++;
+            }
+        }
+
+        // Every CFA position is scaled to its own mean, so a tinted target
+        // does not change the white balance
+        for (uint32_t y = 0; y < m_Height; y++)
+        {
+            for (uint32_t x = 0; x < m_Width; x++)
+            {
+                const size_t i = size_t(y) * m_Width + x;
+                const uint32_t phase = Phase(x, y, step);
+                const double mean = count[phase] > 0 ? sum[phase] / count[phase] : 0.0;
+                const double factor = response[i] > 0.0f ? std::min(mean / response[i], s_MaxGain) : s_MaxGain;
+                gain[i] = uint16_t(std::lround(factor * (1 << FlatFieldCorrection::s_GainShift)));
+
+                // Vignetting changes the response slowly, a defect differs from its neighbors
+                double local = 0.0;
+                int neighbors = 0;
+                if (x >= step) { local += response[i - step]; neighbors++; }
+                if (x + step < m_Width) { local += response[i + step]; neighbors++; }
+                if (y >= step) { local += response[i - size_t(step) * m_Width]; neighbors++; }
+                if (y + step < m_Height) { local += response[i + size_t(step) * m_Width]; neighbors++; }
+                local /= std::max(neighbors, 1);
+                if (local > 0.0 && (response[i] < s_DeadBelow * local || response[i] > s_StuckAbove * local))
+                {
+                    defects.push_back(uint32_t(i));
+                }
+            }
+        }
+    }
+
+    std::sort(defects.begin(), defects.end());
+    defects.erase(std::unique(defects.begin(), defects.end()), defects.end());
+    return std::make_shared<FlatFieldCorrection>(m_PixelFormat, m_Width, m_Height,
+                                                 std::move(dark), std::move(gain), std::move(defects));
+}
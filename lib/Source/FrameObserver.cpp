@@ -41,6 +41,8 @@ FrameObserver::FrameObserver(bool showFrames)
     , m_PayloadSize(0)
     , m_RealPayloadSize(0)
     , m_BytesPerLine(0)
+    , m_YcbcrEnc(V4L2_YCBCR_ENC_DEFAULT)
+    , m_Quantization(V4L2_QUANTIZATION_DEFAULT)
     , m_FrameId(0)
     , m_DQBUF_last_errno(0)
     , m_MessageSendFlag(false)
@@ -60,6 +62,7 @@ FrameObserver::~FrameObserver()
 
 int FrameObserver::StartStream(bool blockingMode, int fileDescriptor, uint32_t pixelFormat,
                                uint32_t payloadSize, uint32_t width, uint32_t height, uint32_t bytesPerLine,
+                               uint32_t ycbcrEnc, uint32_t quantization,
                                uint32_t enableLogging)
 {
     int nResult = 0;
@@ -73,6 +76,8 @@ int FrameObserver::StartStream(bool blockingMode, int fileDescriptor, uint32_t p
     m_PayloadSize = payloadSize;
     m_PixelFormat = pixelFormat;
     m_BytesPerLine = bytesPerLine;
+    m_YcbcrEnc = ycbcrEnc;
+    m_Quantization = quantization;
     m_MessageSendFlag = false;
 
     m_bStreamStopped = false;
@@ -122,6 +127,14 @@ int FrameObserver::AddRawDataProcessor(DataProcessorFunc processor)
     return index;
 }
 
+int FrameObserver::AddRawDataCorrection(DataCorrectionFunc correction)
+{
+    int index = m_rawDataCorrections.size();
+    m_rawDataCorrections.push_back(correction);
+
+    return index;
+}
+
 
 uint64_t constexpr allOnes(int count) {
     assert(count < sizeof(uint64_t) * 8);
@@ -151,13 +164,21 @@ void FrameObserver::DequeueAndProcessFrame()
 
           if (0 == GetFrameData(buf, buffer, length))
           {
+              for (auto const & correction : m_rawDataCorrections) {
+                  correction(BufferWrapper { buf, buffer, length, m_nWidth, m_nHeight,
+                                             m_PixelFormat, m_PayloadSize, m_BytesPerLine, m_FrameId,
+                                             m_YcbcrEnc, m_Quantization },
+                             buffer);
+              }
+
               auto const procCount = m_rawDataProcessors.size();
               if(procCount > 0) {
                   m_UserBufferContainerList[buf.index]->processMap = allOnes(procCount);
                   int i = 0;
                   for (auto const & cb : m_rawDataProcessors) {
                       cb(BufferWrapper { buf, buffer, length, m_nWidth, m_nHeight,
-                                         m_PixelFormat, m_PayloadSize, m_BytesPerLine, m_FrameId },
+                                         m_PixelFormat, m_PayloadSize, m_BytesPerLine, m_FrameId,
+                                         m_YcbcrEnc, m_Quantization },
                           [i, idx = buf.index, this] {
                               auto& map = m_UserBufferContainerList[idx]->processMap;
                               map &= ~(1ULL << i);
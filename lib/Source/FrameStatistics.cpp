@@ -0,0 +1,225 @@
+#include "FrameStatistics.h"
+#include "PixelFormatRegistry.h"
+
+#include <algorithm>
+#include <cstring>
+
+using PixelFormatRegistry::CfaOrder;
+using PixelFormatRegistry::PixelFamily;
+using PixelFormatRegistry::PixelFormatDescriptor;
+using PixelFormatRegistry::SamplePacking;
+
+// Samples with a channel at or above this value count as clipped
+static const uint8_t s_ClipLevel = 252;
+
+// Samples below this luminance carry too much noise for the color means
+static const uint32_t s_BlackLevel = 8;
+
+// Share of the samples that make up the highlights for white patch balance
+static const double s_HighlightShare = 0.05;
+
+// This function reads the 8 most significant bits of sample x of a raw line
+static inline uint8_t RawSample(const uint8_t *line, uint32_t x, const PixelFormatDescriptor &desc)
+{
+    switch (desc.packing)
+    {
+    case SamplePacking::Word16:
+    {
+        uint16_t value;
+        std::memcpy(&value, line + 2 * size_t(x), sizeof(value));
+        return uint8_t(value >> desc.shift);
+    }
+    case SamplePacking::Csi2Packed10:
+        return line[size_t(x / 4) * 5 + x % 4];
+    case SamplePacking::Csi2Packed12:
+        return line[size_t(x / 2) * 3 + x % 2];
+    case SamplePacking::Byte:
+    default:
+        return line[x];
+    }
+}
+
+// This function reads the R, G and B value of pixel x of an RGB line
+static inline void RgbSample(const uint8_t *line, uint32_t x, SamplePacking packing, uint8_t rgb[3])
+{
+    switch (packing)
+    {
+    case SamplePacking::Rgb24:
+        line += 3 * size_t(x);
+        rgb[0] = line[0], rgb[1] = line[1], rgb[2] = line[2];
+        break;
+    case SamplePacking::Bgr24:
+        line += 3 * size_t(x);
+        rgb[0] = line[2], rgb[1] = line[1], rgb[2] = line[0];
+        break;
+    case SamplePacking::Rgb565:
+    {
+        uint16_t value;
+        std::memcpy(&value, line + 2 * size_t(x), sizeof(value));
+        rgb[0] = uint8_t((value >> 8) & 0xF8);
+        rgb[1] = uint8_t((value >> 3) & 0xFC);
+        rgb[2] = uint8_t(value << 3);
+        break;
+    }
+    case SamplePacking::Xrgb32:
+        line += 4 * size_t(x);
+        rgb[0] = line[1], rgb[1] = line[2], rgb[2] = line[3];
+        break;
+    case SamplePacking::Bgrx32:
+    case SamplePacking::Bgra32:
+    case SamplePacking::Native32:
+    default:
+        line += 4 * size_t(x);
+        rgb[0] = line[2], rgb[1] = line[1], rgb[2] = line[0];
+        break;
+    }
+}
+
+// Offset of the luminance of pixel x within a YUV line
+static inline size_t LumaOffset(uint32_t x, SamplePacking packing)
+{
+    switch (packing)
+    {
+    case SamplePacking::Yuyv:
+    case SamplePacking::Yvyu:
+        return 2 * size_t(x);
+    case SamplePacking::Uyvy:
+    case SamplePacking::Vyuy:
+        return 2 * size_t(x) + 1;
+    default:
+        return x;
+    }
+}
+
+// Positions of red and blue inside a CFA cell { row0[0], row0[1], row1[0], row1[1] }
+static void CfaPositions(CfaOrder cfa, int &red, int &blue)
+{
+    switch (cfa)
+    {
+    case CfaOrder::GRBG: red = 1, blue = 2; break;
+    case CfaOrder::GBRG: red = 2, blue = 1; break;
+    case CfaOrder::BGGR: red = 3, blue = 0; break;
+    case CfaOrder::RGGB:
+    default:             red = 0, blue = 3; break;
+    }
+}
+
+int FrameStatistics::Compute(const BufferWrapper &frame, Statistics &stats, uint32_t columns, uint32_t rows)
+{
+    stats = Statistics();
+
+    const PixelFormatDescriptor *desc = PixelFormatRegistry::Find(frame.pixelFormat);
+    if (!desc || desc->family == PixelFamily::Compressed || frame.width < 2 || frame.height < 2 ||
+        frame.bytesPerLine < desc->MinimumBytesPerLine(frame.width) ||
+        size_t(frame.bytesPerLine) * frame.height > frame.length)
+    {
+        return -1;
+    }
+
+    // Cells are at least 2x2 pixels and start on even coordinates, so every
+    // sample of a Bayer frame is one complete CFA cell
+    columns = std::max(1u, std::min(columns, frame.width / 2));
+    rows = std::max(1u, std::min(rows, frame.height / 2));
+
+    int red = 0;
+    int blue = 3;
+    CfaPositions(desc->cfa, red, blue);
+
+    // Sums of R, G and B per histogram bin, so both white balance estimates
+    // come out of the one pass over the grid
+    uint32_t binSums[s_HistogramBins][3] = {};
+    uint64_t luminanceSum = 0;
+    uint32_t clipped = 0;
+    uint32_t clippedPerBin[s_HistogramBins] = {};
+
+    for (uint32_t row = 0; row < rows; row++)
+    {
+        const uint32_t y = uint32_t((uint64_t(2 * row + 1) * frame.height / (2 * rows))) & ~1u;
+        const uint8_t *line = frame.data + size_t(y) * frame.bytesPerLine;
+
+        for (uint32_t column = 0; column < columns; column++)
+        {
+            const uint32_t x = uint32_t((uint64_t(2 * column + 1) * frame.width / (2 * columns))) & ~1u;
+
+            uint8_t rgb[3];
+            switch (desc->family)
+            {
+            case PixelFamily::Bayer:
+            {
+                const uint8_t cell[4] = { RawSample(line, x, *desc), RawSample(line, x + 1, *desc),
+                                          RawSample(line + frame.bytesPerLine, x, *desc),
+                                          RawSample(line + frame.bytesPerLine, x + 1, *desc) };
+                rgb[0] = cell[red];
+                rgb[2] = cell[blue];
+                rgb[1] = uint8_t((cell[0] + cell[1] + cell[2] + cell[3] - cell[red] - cell[blue] + 1) / 2);
+                break;
+            }
+            case PixelFamily::Mono:
+                rgb[0] = rgb[1] = rgb[2] = RawSample(line, x, *desc);
+                break;
+            case PixelFamily::Rgb:
+                RgbSample(line, x, desc->packing, rgb);
+                break;
+            case PixelFamily::Yuv:
+            default:
+                rgb[0] = rgb[1] = rgb[2] = line[LumaOffset(x, desc->packing)];
+                break;
+            }
+
+            const uint32_t luminance = (77u * rgb[0] + 150u * rgb[1] + 29u * rgb[2] + 128) >> 8;
+            const uint32_t bin = luminance * s_HistogramBins / 256;
+            stats.histogram[bin]++;
+            luminanceSum += luminance;
+
+            if (std::max({ rgb[0], rgb[1], rgb[2] }) >= s_ClipLevel)
+            {
+                clipped++;
+                clippedPerBin[bin]++;
+            }
+            else
+            {
+                binSums[bin][0] += rgb[0];
+                binSums[bin][1] += rgb[1];
+                binSums[bin][2] += rgb[2];
+            }
+        }
+    }
+
+    stats.samples = rows * columns;
+    stats.color = desc->family == PixelFamily::Bayer || desc->family == PixelFamily::Rgb;
+    stats.luminance = double(luminanceSum) / stats.samples;
+    stats.clipped = double(clipped) / stats.samples;
+
+    // Gray world: everything that is neither clipped nor close to black
+    uint64_t meanSums[3] = {};
+    uint32_t meanCount = 0;
+    const uint32_t firstBin = s_BlackLevel * s_HistogramBins / 256;
+    for (int bin = firstBin; bin < s_HistogramBins; bin++)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            meanSums[c] += binSums[bin][c];
+        }
+        meanCount += stats.histogram[bin] - clippedPerBin[bin];
+    }
+
+    // White patch: the brightest unclipped samples
+    uint64_t highlightSums[3] = {};
+    uint32_t highlightCount = 0;
+    const uint32_t highlightWanted = std::max(1u, uint32_t(stats.samples * s_HighlightShare));
+    for (int bin = s_HistogramBins - 1; bin >= int(firstBin) && highlightCount < highlightWanted; bin--)
+    {
+        for (int c = 0; c < 3; c++)
+        {
+            highlightSums[c] += binSums[bin][c];
+        }
+        highlightCount += stats.histogram[bin] - clippedPerBin[bin];
+    }
+
+    for (int c = 0; c < 3; c++)
+    {
+        stats.mean[c] = meanCount ? double(meanSums[c]) / meanCount : 0.0;
+        stats.highlight[c] = highlightCount ? double(highlightSums[c]) / highlightCount : 0.0;
+    }
+    return 0;
+}
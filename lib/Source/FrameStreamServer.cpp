@@ -1,52 +1,618 @@
 #include "FrameStreamServer.h"
 #include "ImageTransform.h"
+#include "PixelFormatRegistry.h"
 
 #include <QBuffer>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTimer>
+#include <QUrl>
+#include <QUrlQuery>
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef HAS_LIBJPEG
+#include "JpegEncoder.h"
+#endif
+#ifdef HAS_X264
+#include "H264Encoder.h"
+static const bool s_VideoEncoding = true;
+#else
+static const bool s_VideoEncoding = false;
+#endif
+
+using PixelFormatRegistry::PixelFamily;
+using PixelFormatRegistry::PixelFormatDescriptor;
+using PixelFormatRegistry::SamplePacking;
+
+static const int s_JpegQuality = 80;
+
+// Upper bound of encoder threads, which is also the number of frames in
+// flight between taking a buffer and its delivery
+static const unsigned s_MaxEncoders = 3;
+
+// Largest window of unacknowledged frames a client can ask for
+static const uint32_t s_MaxClientWindow = 4;
+
+// Frames a video client has in flight. Its decoder holds a few pictures
+// before the first comes out, and a video client can't skip one.
+static const uint32_t s_VideoWindow = 6;
+// Pictures waiting for the video encoder, a newer one pushes the oldest
+// stream picture out, which the clients never see. Recorded pictures are
+// kept, they hold back the encoders instead.
+static const size_t s_MaxVideoPictures = 2;
+// Packets the I/O thread has not picked up, beyond this it fell behind
+// and the video clients start over at a key frame
+static const size_t s_MaxVideoPackets = 16;
+
+// Longest HTTP request head accepted, and how long a JPEG snapshot waits
+// for a frame
+static const qint64 s_MaxHttpRequestBytes = 8192;
+static const int s_SnapshotTimeoutMs = 5000;
+// PNG and raw snapshot requests waiting for the snapshot thread, beyond
+// this they are turned away
+static const size_t s_MaxSnapshotRequests = 4;
+static const char s_MjpegBoundary[] = "v4l2viewerframe";
+
+// Rate control levels, from the best quality down. A level sets the JPEG
+// quality and the smallest binning factor, the viewport may ask for more.
+// Few distinct levels let clients in similar conditions share encodes.
+struct RateLevel
+{
+    int quality;
+    int downscale;
+};
+static const RateLevel s_RateLevels[] = {
+    { s_JpegQuality, 1 }, { 65, 1 }, { 50, 1 }, { 65, 2 }, { 50, 2 }, { 65, 4 }, { 50, 4 }
+};
+static const int s_RateLevelCount = int(sizeof(s_RateLevels) / sizeof(s_RateLevels[0]));
+
+// A client keeps up when it acknowledges and the encoders produce its
+// frames as fast as the camera delivers them, but no faster than this
+static const double s_MinFrameIntervalMs = 1000.0 / 30;
+// Hysteresis of the controller: a level drop needs a clear overrun, a
+// rise a long run of frames that left plenty of time
+static const double s_OverrunRatio = 1.25;
+static const double s_SpareRatio = 0.6;
+static const uint32_t s_SettleAcks = 4;
+static const uint32_t s_CalmAcks = 30;
+// Weight of a new sample in the averages
+static const double s_Smoothing = 0.2;
+
+// Every message starts with [width:u32][height:u32][frameId:u64], the size
+// of the oriented frame, followed by either a JPEG or a raw frame. A raw
+// frame carries the samples of the buffer as they are, the client converts
+// them in a WebGL shader:
+//
+//   [magic:u32 "VRAW"][fourcc:u32][width:u32][height:u32][lineBytes:u32]
+//   [layout:u8][bytesPerSample:u8][shift:u8][order:u8][orientation:u8][reserved:7]
+//   [height lines of lineBytes bytes]
+//
+// width and height are those of the unoriented frame. layout is one of
+// RawLayout, order the CfaOrder of Bayer frames or the position of the
+// samples in a YUV 4:2:2 group. orientation holds flipX in bit 0, flipY in
+// bit 1 and the clockwise quarter turns in bits 2 and 3. The payload starts
+// at a multiple of 16 so the client can view 16 bit samples in place.
+//
+// Clients that composite tiles get the tiles of their JPEG rendition that
+// changed since their last message instead:
+//
+//   [magic:u32 "VTIL"][width:u32][height:u32][count:u32]
+//   count times [x:u32][y:u32][size:u32][size bytes of JPEG]
+//
+// width and height are those of the tiled image, which is binned like a
+// smaller JPEG. The client draws the JPEGs at x, y onto its copy of the
+// image in the order they come, the first message of an image covers all
+// of it. Without changes nothing is sent.
+//
+// Clients that show only part of the frame, a crop or a zoomed in view,
+// get a JPEG of that part:
+//
+//   [magic:u32 "VREG"][x:u32][y:u32][width:u32][height:u32][JPEG]
+//
+// x, y, width and height are the part of the oriented frame the JPEG
+// shows, the requested region widened to whole binned pixels. The JPEG
+// is binned like a full frame one and may be smaller than that part.
+//
+// Clients that decode video get the frames as one H.264 stream instead:
+//
+//   [magic:u32 "VVID"][flags:u32][width:u32][height:u32][access unit]
+//
+// flags holds the key frame bit 0, width and height are the size of the
+// picture, the oriented frame binned for the viewport and cut to even
+// sizes. The access unit is a run of Annex B NAL units, a key frame
+// starts with the SPS and PPS. A client that lost a packet gets nothing
+// until the next key frame.
+static const uint32_t s_HeaderSize = 16;
+static const uint32_t s_RawHeaderSize = 32;
+static const uint32_t s_RawMagic = 0x57415256; // "VRAW" in memory
+static const uint32_t s_TileMagic = 0x4C495456; // "VTIL" in memory
+static const uint32_t s_RegionMagic = 0x47455256; // "VREG" in memory
+static const uint32_t s_VideoMagic = 0x44495656; // "VVID" in memory
+
+// Tiles are squares of the sent image, a multiple of the 16 pixel MCU of
+// 4:2:0 JPEGs. Change detection compares s_TileCells x s_TileCells mean
+// samples per tile, which averages the sensor noise away but still sees a
+// small object move.
+static const uint32_t s_TileSize = 128;
+static const uint32_t s_TileCells = 4;
+// Change of a cell mean, in 8 bit levels, that makes a tile changed
+static const double s_TileThreshold = 1.5;
+// Beyond this share of changed tiles the frame goes out whole
+static const double s_TileKeyRatio = 0.5;
+
+enum class RawLayout : uint8_t
+{
+    Mono,
+    Bayer,
+    Yuv422
+};
+
+// Position of the samples in a YUV 4:2:2 group, in the order of the packings
+enum class YuvOrder : uint8_t
+{
+    Yuyv,
+    Uyvy,
+    Vyuy,
+    Yvyu
+};
+
+static void AppendHeader(QByteArray &message, uint32_t width, uint32_t height, uint64_t frameId)
+{
+    message.append(reinterpret_cast<const char *>(&width), 4);
+    message.append(reinterpret_cast<const char *>(&height), 4);
+    message.append(reinterpret_cast<const char *>(&frameId), 8);
+}
+
+// This function returns whether the client shader handles the layout of the format
+static bool RawLayoutOf(const PixelFormatDescriptor &desc, RawLayout &layout, uint8_t &order)
+{
+    const bool unpacked = desc.packing == SamplePacking::Byte || desc.packing == SamplePacking::Word16;
+    switch (desc.family)
+    {
+    case PixelFamily::Mono:
+        layout = RawLayout::Mono;
+        order = 0;
+        return unpacked;
+    case PixelFamily::Bayer:
+        layout = RawLayout::Bayer;
+        order = uint8_t(desc.cfa);
+        return unpacked;
+    case PixelFamily::Yuv:
+        layout = RawLayout::Yuv422;
+        switch (desc.packing)
+        {
+        case SamplePacking::Yuyv: order = uint8_t(YuvOrder::Yuyv); return true;
+        case SamplePacking::Uyvy: order = uint8_t(YuvOrder::Uyvy); return true;
+        case SamplePacking::Vyuy: order = uint8_t(YuvOrder::Vyuy); return true;
+        case SamplePacking::Yvyu: order = uint8_t(YuvOrder::Yvyu); return true;
+        default:                  return false;
+        }
+    default:
+        return false;
+    }
+}
+
+// This function builds the raw message of a frame. It fails for formats
+// the client can't convert, which are sent as JPEG instead.
+static bool BuildRawMessage(const BufferWrapper &buffer, const ImageOrientation::Orientation &orientation,
+                            uint32_t orientedWidth, uint32_t orientedHeight, QByteArray &message)
+{
+    const PixelFormatDescriptor *desc = PixelFormatRegistry::Find(buffer.pixelFormat);
+    RawLayout layout;
+    uint8_t order;
+    if (desc == nullptr || !RawLayoutOf(*desc, layout, order) ||
+        buffer.data == nullptr || buffer.width == 0 || buffer.height == 0)
+        return false;
+
+    // Lines go out without their padding
+    const uint32_t lineBytes = desc->MinimumBytesPerLine(buffer.width);
+    const uint32_t bytesPerLine = buffer.bytesPerLine < lineBytes ? lineBytes : buffer.bytesPerLine;
+    if (buffer.length < size_t(bytesPerLine) * (buffer.height - 1) + lineBytes)
+        return false;
+
+    const size_t payloadOffset = s_HeaderSize + s_RawHeaderSize;
+    message.resize(int(payloadOffset + size_t(lineBytes) * buffer.height));
+    char *data = message.data();
+    std::memset(data, 0, payloadOffset);
+
+    const uint32_t width = buffer.width;
+    const uint32_t height = buffer.height;
+    const uint32_t fourcc = buffer.pixelFormat;
+    std::memcpy(data + 0, &orientedWidth, 4);
+    std::memcpy(data + 4, &orientedHeight, 4);
+    std::memcpy(data + 8, &buffer.frameID, 8);
+    std::memcpy(data + 16, &s_RawMagic, 4);
+    std::memcpy(data + 20, &fourcc, 4);
+    std::memcpy(data + 24, &width, 4);
+    std::memcpy(data + 28, &height, 4);
+    std::memcpy(data + 32, &lineBytes, 4);
+    data[36] = char(layout);
+    data[37] = char(desc->packing == SamplePacking::Word16 ? 2 : 1);
+    data[38] = char(desc->shift);
+    data[39] = char(order);
+    data[40] = char((orientation.flipX ? 1 : 0) | (orientation.flipY ? 2 : 0) | ((orientation.Degrees() / 90) << 2));
+
+    if (bytesPerLine == lineBytes) {
+        std::memcpy(data + payloadOffset, buffer.data, size_t(lineBytes) * height);
+    } else {
+        for (uint32_t y = 0; y < height; y++) {
+            std::memcpy(data + payloadOffset + size_t(y) * lineBytes, buffer.data + size_t(y) * bytesPerLine, lineBytes);
+        }
+    }
+    return true;
+}
+
+static double Smooth(double average, double sample)
+{
+    return average == 0 ? sample : average + s_Smoothing * (sample - average);
+}
+
+static double ElapsedMs(std::chrono::steady_clock::time_point since, std::chrono::steady_clock::time_point until)
+{
+    return std::chrono::duration<double, std::milli>(until - since).count();
+}
+
+// The Huffman tables of JPEG Annex K.3, which Motion JPEG frames leave out
+// and imply. Decoders outside AVI players don't all know that.
+static const uint8_t s_StandardHuffmanTables[] = {
+    0xFF, 0xC4, 0x01, 0xA2, 0x00, 0x00, 0x01, 0x05, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x00, 0x00,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,
+    0x0B, 0x10, 0x00, 0x02, 0x01, 0x03, 0x03, 0x02, 0x04, 0x03, 0x05, 0x05, 0x04, 0x04, 0x00, 0x00,
+    0x01, 0x7D, 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51,
+    0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xA1, 0x08, 0x23, 0x42, 0xB1, 0xC1, 0x15, 0x52,
+    0xD1, 0xF0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0A, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x25, 0x26,
+    0x27, 0x28, 0x29, 0x2A, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46, 0x47,
+    0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66, 0x67,
+    0x68, 0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x83, 0x84, 0x85, 0x86, 0x87,
+    0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3, 0xA4, 0xA5,
+    0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA, 0xC2, 0xC3,
+    0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8, 0xD9, 0xDA,
+    0xE1, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF1, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6,
+    0xF7, 0xF8, 0xF9, 0xFA, 0x01, 0x00, 0x03, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01, 0x01,
+    0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A,
+    0x0B, 0x11, 0x00, 0x02, 0x01, 0x02, 0x04, 0x04, 0x03, 0x04, 0x07, 0x05, 0x04, 0x04, 0x00, 0x01,
+    0x02, 0x77, 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07,
+    0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xA1, 0xB1, 0xC1, 0x09, 0x23, 0x33,
+    0x52, 0xF0, 0x15, 0x62, 0x72, 0xD1, 0x0A, 0x16, 0x24, 0x34, 0xE1, 0x25, 0xF1, 0x17, 0x18, 0x19,
+    0x1A, 0x26, 0x27, 0x28, 0x29, 0x2A, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3A, 0x43, 0x44, 0x45, 0x46,
+    0x47, 0x48, 0x49, 0x4A, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5A, 0x63, 0x64, 0x65, 0x66,
+    0x67, 0x68, 0x69, 0x6A, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7A, 0x82, 0x83, 0x84, 0x85,
+    0x86, 0x87, 0x88, 0x89, 0x8A, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9A, 0xA2, 0xA3,
+    0xA4, 0xA5, 0xA6, 0xA7, 0xA8, 0xA9, 0xAA, 0xB2, 0xB3, 0xB4, 0xB5, 0xB6, 0xB7, 0xB8, 0xB9, 0xBA,
+    0xC2, 0xC3, 0xC4, 0xC5, 0xC6, 0xC7, 0xC8, 0xC9, 0xCA, 0xD2, 0xD3, 0xD4, 0xD5, 0xD6, 0xD7, 0xD8,
+    0xD9, 0xDA, 0xE2, 0xE3, 0xE4, 0xE5, 0xE6, 0xE7, 0xE8, 0xE9, 0xEA, 0xF2, 0xF3, 0xF4, 0xF5, 0xF6,
+    0xF7, 0xF8, 0xF9, 0xFA,
+};
+
+// This function builds the message of a frame the camera compressed itself,
+// the bitstream is copied as it is and only gets the Huffman tables if it
+// lacks them
+//
+// Returns:
+// (bool) - false if the payload is no JPEG
+static bool BuildPassthroughMessage(const BufferWrapper &buffer, QByteArray &message)
+{
+    const size_t size = std::min(size_t(buffer.payloadSize), buffer.length);
+    const uint8_t *data = buffer.data;
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8) {
+        return false;
+    }
+
+    // Walk the marker segments up to the start of scan
+    size_t scan = 0;
+    bool tables = false;
+    for (size_t i = 2; i + 4 <= size && scan == 0;) {
+        if (data[i] != 0xFF) {
+            return false;
+        }
+        const uint8_t marker = data[i + 1];
+        if (marker == 0xFF) {
+            i++;
+        } else if (marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) {
+            i += 2;
+        } else if (marker == 0xDA) {
+            scan = i;
+        } else {
+            tables = tables || marker == 0xC4;
+            i += 2 + ((size_t(data[i + 2]) << 8) | data[i + 3]);
+        }
+    }
+    if (scan == 0) {
+        return false;
+    }
+
+    const size_t insert = tables ? 0 : sizeof(s_StandardHuffmanTables);
+    message.reserve(int(s_HeaderSize + size + insert));
+    AppendHeader(message, buffer.width, buffer.height, buffer.frameID);
+    message.append(reinterpret_cast<const char *>(data), int(scan));
+    if (!tables) {
+        message.append(reinterpret_cast<const char *>(s_StandardHuffmanTables), int(insert));
+    }
+    message.append(reinterpret_cast<const char *>(data + scan), int(size - scan));
+    return true;
+}
+
+// This function returns the largest binning factor for which the converted
+// frame still covers the client viewport pixel for pixel
+static int PreviewDownscale(uint32_t viewportWidth, uint32_t viewportHeight, uint32_t width, uint32_t height)
+{
+    if (viewportWidth == 0 || viewportHeight == 0) {
+        return 1;
+    }
+
+    int scale = 1;
+    while (scale < 8 &&
+           width / uint32_t(scale * 2) >= viewportWidth &&
+           height / uint32_t(scale * 2) >= viewportHeight) {
+        scale *= 2;
+    }
+    return scale;
+}
+
+// This function returns the full resolution JPEG a recording frame carries
+const FrameStreamServer::StreamJpeg *FrameStreamServer::RecordingJpeg(const StreamFrame &frame)
+{
+    for (const StreamJpeg &jpeg : frame.jpegs) {
+        if (jpeg.downscale == 1 && (jpeg.quality == s_JpegQuality || jpeg.quality == 0)) {
+            return &jpeg;
+        }
+    }
+    return nullptr;
+}
+
+// This function returns the JPEG a client at a rate control level needs
+static RateLevel ClientJpeg(int level, uint32_t viewportWidth, uint32_t viewportHeight,
+                            uint32_t width, uint32_t height, bool recording)
+{
+    // Recordings keep the full resolution JPEG, which clients at the best level get as well
+    if (recording && level == 0) {
+        return { s_JpegQuality, 1 };
+    }
+    const RateLevel &rate = s_RateLevels[level];
+    return { rate.quality, std::max(rate.downscale, PreviewDownscale(viewportWidth, viewportHeight, width, height)) };
+}
+
+// This function returns the part of the width x height oriented frame a
+// client shows, empty when it shows all of it
+static QRect ClientRegion(const QRect &requested, uint32_t width, uint32_t height)
+{
+    const QRect frame(0, 0, int(width), int(height));
+    const QRect region = requested.intersected(frame);
+    return region == frame ? QRect() : region;
+}
+
+// This function compresses an image straight into message, behind the
+// header already written to it
+//
+// Returns:
+// (bool) - false if the image could not be compressed
+static bool AppendJpeg(QByteArray &message, const QImage &image, int quality, JpegEncoder *encoder)
+{
+#ifdef HAS_LIBJPEG
+    return encoder->Encode(image, quality, message);
+#else
+    Q_UNUSED(encoder);
+    QBuffer jpegBuffer(&message);
+    jpegBuffer.open(QIODevice::Append);
+    const bool saved = image.save(&jpegBuffer, "JPEG", quality);
+    jpegBuffer.close();
+    return saved;
+#endif
+}
+
+// This function returns the size of the image a conversion with downscale
+// produces, before orienting it. The conversion keeps every downscale-th pixel.
+static void ScaledSize(const BufferWrapper &buffer, int downscale, uint32_t &scaledWidth, uint32_t &scaledHeight)
+{
+    const uint32_t step = uint32_t(downscale);
+    scaledWidth = buffer.width >= step ? buffer.width / step : 1;
+    scaledHeight = buffer.height >= step ? buffer.height / step : 1;
+}
+
+// This function finds the frame pixels a rectangle of the oriented image
+// a conversion with downscale produces is converted from
+static QRect FrameRegion(const ImageOrientation::Orientation &orientation, uint32_t scaledWidth,
+                         uint32_t scaledHeight, int downscale, const QRect &rect)
+{
+    // Opposite corners of the rectangle are opposite corners in the frame
+    double x0 = rect.left();
+    double y0 = rect.top();
+    double x1 = rect.left() + rect.width();
+    double y1 = rect.top() + rect.height();
+    ImageOrientation::MapToFrame(orientation, scaledWidth, scaledHeight, x0, y0);
+    ImageOrientation::MapToFrame(orientation, scaledWidth, scaledHeight, x1, y1);
+    return QRect(int(std::min(x0, x1)) * downscale, int(std::min(y0, y1)) * downscale,
+                 int(std::abs(x1 - x0)) * downscale, int(std::abs(y1 - y0)) * downscale);
+}
+
+// This function lays the tiles over the image a conversion with downscale
+// produces and finds the frame pixels each of them is converted from
+static void TileGrid(const BufferWrapper &buffer, const ImageOrientation::Orientation &orientation, int downscale,
+                     uint32_t &width, uint32_t &height, uint32_t &columns, uint32_t &rows, std::vector<QRect> &regions)
+{
+    uint32_t scaledWidth = 0;
+    uint32_t scaledHeight = 0;
+    ScaledSize(buffer, downscale, scaledWidth, scaledHeight);
+    ImageOrientation::OrientedSize(orientation, scaledWidth, scaledHeight, width, height);
+    columns = (width + s_TileSize - 1) / s_TileSize;
+    rows = (height + s_TileSize - 1) / s_TileSize;
+
+    regions.resize(size_t(columns) * rows);
+    for (uint32_t row = 0; row < rows; row++) {
+        for (uint32_t column = 0; column < columns; column++) {
+            const uint32_t x = column * s_TileSize;
+            const uint32_t y = row * s_TileSize;
+            const QRect tile(int(x), int(y), int(std::min(s_TileSize, width - x)), int(std::min(s_TileSize, height - y)));
+            regions[size_t(row) * columns + column] =
+                FrameRegion(orientation, scaledWidth, scaledHeight, downscale, tile);
+        }
+    }
+}
+
+static uint32_t SumBytes(const uint8_t *data, uint32_t count)
+{
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += data[i];
+    }
+    return sum;
+}
+
+static uint64_t SumWords(const uint8_t *data, uint32_t count)
+{
+    uint64_t sum = 0;
+    for (uint32_t i = 0; i < count; i++) {
+        sum += uint32_t(data[2 * i]) | uint32_t(data[2 * i + 1]) << 8;
+    }
+    return sum;
+}
+
+// This function computes the mean sample of each cell of a tile region,
+// in 8 bit levels. It reads the bytes of packed formats and the first
+// plane of planar ones as they are, which tells a change just as well.
+static void TileSignature(const BufferWrapper &buffer, const PixelFormatDescriptor &desc, uint32_t bytesPerLine,
+                          const QRect &region, double *cells)
+{
+    const bool words = desc.packing == SamplePacking::Word16;
+    const double scale = words ? double(1u << desc.shift) : 1.0;
+    for (uint32_t cy = 0; cy < s_TileCells; cy++) {
+        const uint32_t y0 = uint32_t(region.top()) + uint32_t(region.height()) * cy / s_TileCells;
+        const uint32_t y1 = uint32_t(region.top()) + uint32_t(region.height()) * (cy + 1) / s_TileCells;
+        for (uint32_t cx = 0; cx < s_TileCells; cx++) {
+            const uint32_t x0 = uint32_t(region.left()) + uint32_t(region.width()) * cx / s_TileCells;
+            const uint32_t x1 = uint32_t(region.left()) + uint32_t(region.width()) * (cx + 1) / s_TileCells;
+            const uint32_t first = desc.MinimumBytesPerLine(x0);
+            const uint32_t bytes = desc.MinimumBytesPerLine(x1) - first;
+            const uint32_t samples = words ? bytes / 2 : bytes;
+
+            uint64_t sum = 0;
+            for (uint32_t y = y0; y < y1; y++) {
+                const uint8_t *line = buffer.data + size_t(y) * bytesPerLine + first;
+                sum += words ? SumWords(line, samples) : SumBytes(line, samples);
+            }
+            const uint64_t count = uint64_t(samples) * (y1 - y0);
+            cells[cy * s_TileCells + cx] = count > 0 ? double(sum) / double(count) / scale : 0;
+        }
+    }
+}
+
+static bool SameOrientation(const ImageOrientation::Orientation &a, const ImageOrientation::Orientation &b)
+{
+    return a.flipX == b.flipX && a.flipY == b.flipY && a.rotation == b.rotation;
+}
 
 FrameStreamServer::FrameStreamServer(QObject *parent)
     : QObject(parent)
 {
+    // The servers and the sockets they accept are children of m_pIo and
+    // move to the I/O thread with it, the thread deletes them when it ends
+    m_pIo = new QObject;
     m_pServer = new QWebSocketServer(QStringLiteral("FrameStream"),
-                                     QWebSocketServer::NonSecureMode, this);
+                                     QWebSocketServer::NonSecureMode, m_pIo);
+    m_pIo->moveToThread(&m_ioThread);
+    connect(&m_ioThread, &QThread::finished, m_pIo, &QObject::deleteLater);
+    m_ioThread.setObjectName(QStringLiteral("FrameStreamIO"));
+    m_ioThread.start();
 
-    // Connect signal for thread-safe WebSocket broadcasting
+    // The encoders deliver frames on their threads, the I/O thread sends them
     connect(this, &FrameStreamServer::broadcastReady,
-            this, &FrameStreamServer::onBroadcast, Qt::QueuedConnection);
+            m_pIo, [this] { onBroadcast(); }, Qt::QueuedConnection);
+    connect(this, &FrameStreamServer::videoReady,
+            m_pIo, [this] { onVideo(); }, Qt::QueuedConnection);
 }
 
 FrameStreamServer::~FrameStreamServer()
 {
     stop();
+    m_ioThread.quit();
+    m_ioThread.wait();
 }
 
 int FrameStreamServer::port() const
 {
-    return m_pServer->serverPort();
+    return m_port;
+}
+
+// This function runs call on the I/O thread and returns once it is done.
+// On the I/O thread itself, or once that has ended, call runs right away.
+void FrameStreamServer::runOnIoThread(const std::function<void()> &call)
+{
+    if (QThread::currentThread() == &m_ioThread || !m_ioThread.isRunning()) {
+        call();
+    } else {
+        QMetaObject::invokeMethod(m_pIo, call, Qt::BlockingQueuedConnection);
+    }
 }
 
 void FrameStreamServer::start()
 {
-    if (m_pServer->listen(QHostAddress::LocalHost, 0)) {
-        connect(m_pServer, &QWebSocketServer::newConnection,
-                this, &FrameStreamServer::onNewConnection);
+    runOnIoThread([this] {
+        if (m_pServer->listen(QHostAddress::LocalHost, 0)) {
+            m_port = m_pServer->serverPort();
+            connect(m_pServer, &QWebSocketServer::newConnection,
+                    m_pIo, [this] { onNewConnection(); });
+
+            startEncoders();
+        }
+    });
+}
+
+// One encoder per two cores, the conversion of each frame already spreads
+// across the WorkerPool when it is idle
+void FrameStreamServer::startEncoders()
+{
+    m_encoderCount = std::max(1u, std::min(s_MaxEncoders, std::thread::hardware_concurrency() / 2));
+    m_stopThread = false;
+    for (unsigned i = 0; i < m_encoderCount; i++) {
+        m_encoderThreads.emplace_back([this] {
+            encoderThreadMain();
+        });
+    }
 
-        m_stopThread = false;
-        m_conversionThread = std::make_unique<std::thread>([this] {
-            conversionThreadMain();
+    if (s_VideoEncoding) {
+        m_videoStop = false;
+        m_videoThread = std::thread([this] {
+            videoThreadMain();
         });
     }
 }
 
-void FrameStreamServer::flush()
+// Every frame an encoder has taken is delivered before it exits, so only
+// the frame waiting in the slot still holds a buffer afterwards
+void FrameStreamServer::stopEncoders()
 {
-    // Stop conversion thread and release any pending callback,
-    // but keep the WebSocket server listening on the same port
-    m_stopThread = true;
+    {
+        // Under the lock, an encoder between its check and its wait would miss it
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        m_stopThread = true;
+    }
     m_frameAvailable.notify_all();
 
-    if (m_conversionThread && m_conversionThread->joinable()) {
-        m_conversionThread->join();
-        m_conversionThread.reset();
+    for (auto &thread : m_encoderThreads) {
+        if (thread.joinable()) {
+            thread.join();
+        }
+    }
+    m_encoderThreads.clear();
+
+    // The pictures the encoders delivered last are dropped, the next
+    // session starts a new stream
+    if (m_videoThread.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_videoMutex);
+            m_videoStop = true;
+        }
+        m_videoWake.notify_all();
+        m_videoThread.join();
+
+        const auto recorded = std::count_if(m_videoPictures.begin(), m_videoPictures.end(),
+                                            [](const VideoPicture &picture) { return picture.recording; });
+        m_videoPictures.clear();
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        m_inFlight -= uint32_t(recorded);
     }
 
     {
@@ -59,61 +625,125 @@ void FrameStreamServer::flush()
             cb();
         }
     }
+}
 
-    // Restart conversion thread for next streaming session
-    m_clientReady = true;
-    m_stopThread = false;
-    m_conversionThread = std::make_unique<std::thread>([this] {
-        conversionThreadMain();
+void FrameStreamServer::flush()
+{
+    runOnIoThread([this] {
+        // Stop the encoders and release any pending callback,
+        // but keep the WebSocket server listening on the same port
+        stopEncoders();
+
+        // Frames of the old session are not sent anymore, the clients stay
+        for (ClientState &client : m_clientStates) {
+            client.inFlight = 0;
+            client.pending.clear();
+            client.pendingTiles.reset();
+            client.offered = false;
+            client.sendTimes.clear();
+            client.tileGeneration = 0;
+            client.videoKeyed = false;
+        }
+        {
+            // The encoders are stopped, the next session starts with key frames
+            std::lock_guard<std::mutex> lock(m_tileMutex);
+            m_tileStates.clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_deliveryMutex);
+            m_tileTables.clear();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_latestMutex);
+            m_latestFrame.reset();
+            m_videoPackets.clear();
+            m_videoLost = false;
+        }
+        // The next session may bring a format the video encoder takes
+        m_videoFailed = false;
+        {
+            // The next session may run at another frame rate
+            std::lock_guard<std::mutex> lock(m_frameMutex);
+            m_lastPush = Clock::time_point();
+            m_sourceIntervalMs = 0;
+        }
+        updateClientRoom();
+
+        // Restart the encoders for next streaming session
+        startEncoders();
     });
 }
 
 void FrameStreamServer::stop()
 {
-    m_stopThread = true;
-    m_frameAvailable.notify_all();
-
-    if (m_conversionThread && m_conversionThread->joinable()) {
-        m_conversionThread->join();
-        m_conversionThread.reset();
-    }
+    runOnIoThread([this] {
+        stopEncoders();
+        stopHttp();
 
-    {
-        std::unique_lock<std::mutex> lock(m_frameMutex);
-        if (m_nextDoneCallback) {
-            auto cb = m_nextDoneCallback;
-            m_nextDoneCallback = nullptr;
-            m_bufferReady = false;
-            lock.unlock();
-            cb();
+        for (ClientState &client : m_clientStates) {
+            client.socket->close();
+            client.socket->deleteLater();
         }
-    }
-
-    for (auto *client : m_clients) {
-        client->close();
-        client->deleteLater();
-    }
-    m_clients.clear();
+        m_clientStates.clear();
+        updateClientNeeds();
 
-    m_pServer->close();
+        m_pServer->close();
+    });
 }
 
 void FrameStreamServer::setRecordingCallback(RecordingCallback cb)
 {
     std::lock_guard<std::mutex> lock(m_recordMutex);
     m_recordingCallback = std::move(cb);
+    m_recording = m_recordingCallback || m_videoRecordingCallback;
+    m_frameAvailable.notify_all();
+}
+
+void FrameStreamServer::setVideoRecordingCallback(VideoRecordingCallback cb)
+{
+    std::lock_guard<std::mutex> lock(m_recordMutex);
+    m_videoRecordingCallback = std::move(cb);
+    m_recording = m_recordingCallback || m_videoRecordingCallback;
+    // The recording starts at a key frame, with an encoder that failed for
+    // an earlier picture size given another try
+    m_videoKeyRequest = true;
+    if (m_videoRecordingCallback) {
+        m_videoFailed = false;
+    }
+    m_frameAvailable.notify_all();
 }
 
 void FrameStreamServer::clearRecordingCallback()
 {
     std::lock_guard<std::mutex> lock(m_recordMutex);
     m_recordingCallback = nullptr;
+    m_videoRecordingCallback = nullptr;
+    m_recording = false;
+}
+
+bool FrameStreamServer::hasVideoEncoding()
+{
+    return s_VideoEncoding;
 }
 
 void FrameStreamServer::pushFrame(const BufferWrapper &buffer, std::function<void()> doneCallback)
 {
+    // Don't wake the encoders for formats they can't handle
+    if (PixelFormatRegistry::Find(buffer.pixelFormat) == nullptr) {
+        if (doneCallback) {
+            doneCallback();
+        }
+        return;
+    }
+
     std::unique_lock<std::mutex> lock(m_frameMutex);
 
+    const Clock::time_point now = Clock::now();
+    if (m_lastPush != Clock::time_point()) {
+        m_sourceIntervalMs = Smooth(m_sourceIntervalMs, ElapsedMs(m_lastPush, now));
+    }
+    m_lastPush = now;
+
     // Release previous frame if still held
     if (m_nextDoneCallback) {
         auto cb = m_nextDoneCallback;
@@ -133,128 +763,1568 @@ void FrameStreamServer::onNewConnection()
 {
     auto *client = m_pServer->nextPendingConnection();
     connect(client, &QWebSocket::disconnected,
-            this, &FrameStreamServer::onClientDisconnected);
+            m_pIo, [this, client] { onClientDisconnected(client); });
     connect(client, &QWebSocket::textMessageReceived,
-            this, &FrameStreamServer::onClientTextMessage);
-    m_clients.append(client);
-    m_clientReady = true;
+            m_pIo, [this, client](const QString &msg) { onClientTextMessage(client, msg); });
+
+    ClientState state;
+    state.socket = client;
+    m_clientStates.push_back(state);
+    m_endpoints[size_t(Endpoint::WebSocket)].requests++;
+    updateClientNeeds();
+    updateClientRoom();
+}
+
+void FrameStreamServer::onClientDisconnected(QWebSocket *socket)
+{
+    removeClient(socket);
+    socket->deleteLater();
+}
+
+void FrameStreamServer::removeClient(QObject *socket)
+{
+    m_clientStates.erase(std::remove_if(m_clientStates.begin(), m_clientStates.end(),
+                                        [socket](const ClientState &state) {
+                                            return state.socket == socket || state.http == socket;
+                                        }),
+                         m_clientStates.end());
+    updateClientNeeds();
+    updateClientRoom();
 }
 
-void FrameStreamServer::onClientDisconnected()
+FrameStreamServer::ClientState *FrameStreamServer::clientState(QObject *socket)
 {
-    auto *client = qobject_cast<QWebSocket *>(sender());
-    if (client) {
-        m_clients.removeAll(client);
-        client->deleteLater();
+    if (socket == nullptr) {
+        return nullptr;
+    }
+    for (ClientState &client : m_clientStates) {
+        if (client.socket == socket || client.http == socket) {
+            return &client;
+        }
     }
+    return nullptr;
 }
 
-void FrameStreamServer::onClientTextMessage(const QString &msg)
+void FrameStreamServer::onClientTextMessage(QWebSocket *socket, const QString &msg)
 {
+    ClientState *client = clientState(socket);
+    if (client == nullptr) {
+        return;
+    }
+
+    // "ack" - the client is done with one frame
     if (msg == QStringLiteral("ack")) {
-        m_clientReady = true;
-        m_frameAvailable.notify_one();  // Wake conversion thread to process waiting frame
+        acknowledge(*client);
+        return;
+    }
+
+    // {"type":"viewport","width":W,"height":H} - the frame area in source
+    // pixels the client needs to fill its canvas at device resolution
+    // {"type":"raw","enabled":B} - the client can convert raw frames
+    // {"type":"window","frames":N} - frames the client takes before its
+    // first ack, more than one hides the round trip of remote clients
+    // {"type":"tiles","enabled":B} - the client composites the changed
+    // tiles of JPEG frames, see the tile message above
+    // {"type":"region","x":X,"y":Y,"width":W,"height":H} - the part of the
+    // oriented frame the client shows, a zero size for all of it
+    // {"type":"video","enabled":B} - the client decodes the H.264 stream,
+    // see the video message above. Without libx264 it keeps getting JPEGs.
+    const QJsonObject obj = QJsonDocument::fromJson(msg.toUtf8()).object();
+    const QString type = obj.value(QStringLiteral("type")).toString();
+    if (type == QStringLiteral("viewport")) {
+        client->needs.viewportWidth = uint32_t(qMax(0, obj.value(QStringLiteral("width")).toInt()));
+        client->needs.viewportHeight = uint32_t(qMax(0, obj.value(QStringLiteral("height")).toInt()));
+        updateClientNeeds();
+    } else if (type == QStringLiteral("raw")) {
+        client->needs.raw = obj.value(QStringLiteral("enabled")).toBool();
+        updateClientNeeds();
+    } else if (type == QStringLiteral("tiles")) {
+        client->needs.tiles = obj.value(QStringLiteral("enabled")).toBool();
+        client->tileGeneration = 0;
+        updateClientNeeds();
+    } else if (type == QStringLiteral("region")) {
+        const int x = qMax(0, obj.value(QStringLiteral("x")).toInt());
+        const int y = qMax(0, obj.value(QStringLiteral("y")).toInt());
+        const int width = qMax(0, obj.value(QStringLiteral("width")).toInt());
+        const int height = qMax(0, obj.value(QStringLiteral("height")).toInt());
+        client->needs.region = width > 0 && height > 0 ? QRect(x, y, width, height) : QRect();
+        updateClientNeeds();
+    } else if (type == QStringLiteral("video")) {
+        client->needs.video = s_VideoEncoding && obj.value(QStringLiteral("enabled")).toBool();
+        client->videoKeyed = false;
+        if (client->needs.video) {
+            m_videoKeyRequest = true;
+        }
+        updateClientNeeds();
+        updateClientRoom();
+    } else if (type == QStringLiteral("window")) {
+        client->window = uint32_t(qBound(1, obj.value(QStringLiteral("frames")).toInt(), int(s_MaxClientWindow)));
+        updateClientRoom();
     }
 }
 
-void FrameStreamServer::onBroadcast(const QByteArray &message)
+// The client is done with its oldest frame in flight, the frame parked
+// while its window was full goes out right away
+void FrameStreamServer::acknowledge(ClientState &client)
 {
-    m_broadcastPending = false;
+    client.acknowledged++;
+    if (!client.sendTimes.empty()) {
+        const double roundTripMs = ElapsedMs(client.sendTimes.front(), Clock::now());
+        client.sendTimes.pop_front();
+        updateRate(client, roundTripMs);
+    }
+    if (client.inFlight > 0) {
+        client.inFlight--;
+    }
+    if (!client.pending.isEmpty() && client.inFlight < client.window) {
+        QByteArray message;
+        message.swap(client.pending);
+        send(client, message);
+    } else if (client.pendingTiles && client.inFlight < client.window) {
+        std::shared_ptr<const TileTable> table;
+        table.swap(client.pendingTiles);
+        sendTiles(client, *table);
+    }
+    updateClientRoom();
+}
 
-    if (!m_clientReady)
-        return;  // Drop frame — client hasn't finished rendering the previous one
+QJsonArray FrameStreamServer::clientStatistics()
+{
+    QJsonArray result;
+    runOnIoThread([this, &result] {
+        for (const ClientState &client : m_clientStates) {
+            static const char *const endpoints[] = { "websocket", "mjpeg", "snapshot" };
+            QJsonObject entry;
+            entry["endpoint"] = endpoints[size_t(client.endpoint)];
+            entry["raw"] = client.needs.raw;
+            entry["tiles"] = client.needs.tiles;
+            entry["region"] = !client.needs.region.isNull();
+            entry["video"] = client.needs.video;
+            entry["window"] = int(client.window);
+            entry["inFlight"] = int(client.inFlight);
+            entry["sent"] = double(client.sent);
+            entry["acknowledged"] = double(client.acknowledged);
+            entry["dropped"] = double(client.dropped);
+            entry["level"] = client.needs.level;
+            entry["quality"] = client.quality;
+            entry["downscale"] = client.downscale;
+            entry["roundTripMs"] = client.roundTripMs;
+            entry["encodeMs"] = client.encodeMs;
+            result.append(entry);
+        }
+    });
+    return result;
+}
 
-    m_clientReady = false;
-    for (auto *client : m_clients) {
-        client->sendBinaryMessage(message);
+// The encoders read the needs of all clients once per frame
+void FrameStreamServer::updateClientNeeds()
+{
+    std::vector<ClientNeeds> needs;
+    needs.reserve(m_clientStates.size());
+    for (const ClientState &client : m_clientStates) {
+        needs.push_back(client.needs);
     }
+
+    std::lock_guard<std::mutex> lock(m_needsMutex);
+    m_clientNeeds.swap(needs);
 }
 
-void FrameStreamServer::conversionThreadMain()
+// The encoders take frames ahead only while some client has room for one
+void FrameStreamServer::updateClientRoom()
 {
-    std::unique_lock<std::mutex> lock(m_frameMutex);
-    while (!m_stopThread) {
-        // Wait for a frame to be available
-        m_frameAvailable.wait(lock, [this] {
-            return m_bufferReady || m_stopThread;
-        });
-        if (m_stopThread) break;
+    bool room = false;
+    for (const ClientState &client : m_clientStates) {
+        const uint32_t window = client.needs.video ? s_VideoWindow : client.window;
+        room = room || (client.inFlight < window && client.pending.isEmpty() && !client.pendingTiles);
+    }
+    {
+        // Under the lock, an encoder between its check and its wait would miss it
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        m_clientRoom = room;
+    }
+    m_frameAvailable.notify_all();
+}
 
-        // Frame available — but only take it if client can receive
-        if (!m_clientReady || m_broadcastPending) {
-            // Can't send — leave buffer in place and wait.
-            // pushFrame will replace it with a newer frame at camera rate,
-            // releasing the old buffer's callback each time. This avoids
-            // the tight busy-loop that occurred when we took + released
-            // the buffer immediately.
-            m_frameAvailable.wait(lock, [this] {
-                return m_clientReady || m_stopThread;
-            });
-            continue;  // Re-check all conditions from top
+void FrameStreamServer::send(ClientState &client, const QByteArray &message)
+{
+    qint64 bytes = message.size();
+    if (client.endpoint == Endpoint::WebSocket) {
+        client.socket->sendBinaryMessage(message);
+    } else {
+        // HTTP clients get the JPEG without the frame header, as a part of
+        // the multipart stream or as the whole response
+        const char *jpeg = message.constData() + s_HeaderSize;
+        const qint64 jpegSize = message.size() - qint64(s_HeaderSize);
+        QByteArray head;
+        if (client.endpoint == Endpoint::Mjpeg) {
+            head = QByteArray("--") + s_MjpegBoundary + "\r\nContent-Type: image/jpeg\r\nContent-Length: " +
+                   QByteArray::number(jpegSize) + "\r\n\r\n";
+        } else {
+            head = "HTTP/1.1 200 OK\r\nContent-Type: image/jpeg\r\nContent-Length: " + QByteArray::number(jpegSize) +
+                   "\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n";
         }
+        client.http->write(head);
+        client.http->write(jpeg, jpegSize);
+        bytes = head.size() + jpegSize;
+        if (client.endpoint == Endpoint::Mjpeg) {
+            client.http->write("\r\n", 2);
+            bytes += 2;
+        } else {
+            client.http->disconnectFromHost();
+        }
+    }
+    m_endpoints[size_t(client.endpoint)].bytes += uint64_t(bytes);
+    client.sendTimes.push_back(Clock::now());
+    client.inFlight++;
+    client.sent++;
+}
 
-        // Take the buffer
-        BufferWrapper buffer = m_nextBuffer;
-        auto doneCallback = m_nextDoneCallback;
-        m_nextDoneCallback = nullptr;
-        m_bufferReady = false;
-        lock.unlock();
+// This function moves a client one rate control level down when its frames
+// can't keep up with the camera, and back up once they clearly can. The
+// time a frame costs the client is whichever is longer, the round trip per
+// frame of its window or the encode per encoder.
+void FrameStreamServer::updateRate(ClientState &client, double roundTripMs)
+{
+    client.roundTripMs = Smooth(client.roundTripMs, roundTripMs);
+    if (client.settleAcks > 0) {
+        // The averages still hold frames of the previous level
+        client.settleAcks--;
+        return;
+    }
 
-        // Convert frame to QImage
-        QImage convertedImage;
-        int result = ImageTransform::ConvertFrame(
-            buffer.data, buffer.length,
-            buffer.width, buffer.height, buffer.pixelFormat,
-            buffer.payloadSize, buffer.bytesPerLine, convertedImage);
-
-        if (result != 0 || convertedImage.isNull()) {
-            // Release buffer and skip
-            if (doneCallback) {
-                doneCallback();
-            }
-            lock.lock();
-            continue;
+    const double costMs = std::max(client.roundTripMs / client.window,
+                                   client.encodeMs / std::max(1u, m_encoderCount));
+    const double targetMs = std::max(double(m_sourceIntervalMs), s_MinFrameIntervalMs);
+    int level = client.needs.level;
+    if (costMs > targetMs * s_OverrunRatio) {
+        client.calmAcks = 0;
+        level = std::min(level + 1, s_RateLevelCount - 1);
+    } else if (costMs < targetMs * s_SpareRatio) {
+        if (++client.calmAcks >= s_CalmAcks) {
+            client.calmAcks = 0;
+            level = std::max(level - 1, 0);
         }
+    } else {
+        client.calmAcks = 0;
+    }
 
-        // JPEG compress
-        QByteArray jpegData;
-        QBuffer jpegBuffer(&jpegData);
-        jpegBuffer.open(QIODevice::WriteOnly);
-        convertedImage.save(&jpegBuffer, "JPEG", 80);
-        jpegBuffer.close();
+    if (level != client.needs.level) {
+        client.needs.level = level;
+        client.settleAcks = s_SettleAcks;
+        updateClientNeeds();
+    }
+}
 
-        // Feed recording callback (if active) — BEFORE releasing buffer
-        // so raw data pointer is still valid
-        {
-            std::lock_guard<std::mutex> rlock(m_recordMutex);
-            if (m_recordingCallback) {
-                m_recordingCallback(jpegData, buffer);
+// This function hands a frame to one client: the JPEG of its region if it
+// shows part of the frame, the raw frame if it converts them itself,
+// otherwise the JPEG of its viewport and rate control level.
+// With a full window the frame replaces the one parked before.
+void FrameStreamServer::offer(ClientState &client, const StreamFrame &frame)
+{
+    // A snapshot client gets one frame and leaves
+    if (client.endpoint == Endpoint::Snapshot && client.sent > 0) {
+        return;
+    }
+
+    if (client.offered && frame.sequence <= client.lastSequence) {
+        return;
+    }
+    // Video clients get the frame from the video thread, see offerVideo
+    if (client.needs.video && frame.video) {
+        client.offered = true;
+        client.lastSequence = frame.sequence;
+        return;
+    }
+    // Frames delivered while the I/O thread was busy never reached it
+    if (client.offered) {
+        client.dropped += frame.sequence - client.lastSequence - 1;
+    }
+    client.offered = true;
+    client.lastSequence = frame.sequence;
+
+    const RateLevel wanted = ClientJpeg(client.needs.level, client.needs.viewportWidth,
+                                        client.needs.viewportHeight, frame.width, frame.height, false);
+    const QByteArray *message = nullptr;
+    if (!client.needs.region.isNull()) {
+        // Encoded for an earlier region or level it takes a whole frame
+        for (const StreamJpeg &region : frame.regions) {
+            if (region.region == client.needs.region && region.quality == wanted.quality &&
+                region.downscale == wanted.downscale) {
+                message = &region.message;
+                client.quality = region.quality;
+                client.downscale = region.downscale;
+                client.encodeMs = Smooth(client.encodeMs, region.encodeMs);
+                break;
             }
         }
-
-        // Release buffer back to FrameObserver after recording callback
-        if (doneCallback) {
-            doneCallback();
+    }
+    if (message == nullptr && client.needs.raw && !frame.raw.isEmpty()) {
+        message = &frame.raw;
+        client.quality = 0;
+        client.downscale = 1;
+    } else if (message == nullptr && client.needs.tiles && !frame.tiles.empty()) {
+        for (const StreamTiles &tiles : frame.tiles) {
+            if (tiles.quality != wanted.quality || tiles.downscale != wanted.downscale) {
+                continue;
+            }
+            client.quality = tiles.quality;
+            client.downscale = tiles.downscale;
+            client.encodeMs = Smooth(client.encodeMs, tiles.encodeMs);
+            if (client.inFlight < client.window) {
+                sendTiles(client, *tiles.table);
+            } else {
+                // The parked table has all tiles of the one it replaces
+                if (!client.pending.isEmpty() || client.pendingTiles) {
+                    client.dropped++;
+                }
+                client.pending.clear();
+                client.pendingTiles = tiles.table;
+            }
+            return;
+        }
+    }
+    if (message == nullptr && !frame.jpegs.empty()) {
+        // The needs may have changed since the encode, or a recording may
+        // have supplied the JPEG, then the closest one does: the wanted
+        // quality first, the largest size not below the wanted one next
+        const StreamJpeg *jpeg = &frame.jpegs.front();
+        for (const StreamJpeg &candidate : frame.jpegs) {
+            if (candidate.downscale > wanted.downscale) {
+                continue;
+            }
+            const bool quality = candidate.quality == wanted.quality;
+            if (jpeg->downscale > wanted.downscale || (quality && jpeg->quality != wanted.quality) ||
+                (quality == (jpeg->quality == wanted.quality) && candidate.downscale > jpeg->downscale)) {
+                jpeg = &candidate;
+            }
         }
+        message = &jpeg->message;
+        client.quality = jpeg->quality;
+        client.downscale = jpeg->downscale;
+        client.encodeMs = Smooth(client.encodeMs, jpeg->encodeMs);
+    }
+    if (message == nullptr) {
+        client.dropped++;
+        return;
+    }
 
-        // Build message: [width:u32][height:u32][frameId:u64][jpeg...]
-        QByteArray message;
-        message.reserve(16 + jpegData.size());
+    // The tiles a client has are lost under anything else
+    client.tileGeneration = 0;
+    if (client.inFlight < client.window) {
+        send(client, *message);
+    } else {
+        if (!client.pending.isEmpty() || client.pendingTiles) {
+            client.dropped++;
+        }
+        client.pendingTiles.reset();
+        client.pending = *message;
+    }
+}
 
-        uint32_t w = buffer.width;
-        uint32_t h = buffer.height;
-        uint64_t fid = buffer.frameID;
-        message.append(reinterpret_cast<const char *>(&w), 4);
-        message.append(reinterpret_cast<const char *>(&h), 4);
-        message.append(reinterpret_cast<const char *>(&fid), 8);
-        message.append(jpegData);
+// This function sends a tile client the patches of the tiles that changed
+// since its last tile message, oldest first so the newer ones paint over
+// them. A client new to the tile grid gets all tiles.
+void FrameStreamServer::sendTiles(ClientState &client, const TileTable &table)
+{
+    if (client.tileGeneration != table.generation) {
+        client.tileGeneration = table.generation;
+        client.tileVersions.assign(table.versions.size(), 0);
+    }
 
-        // Emit signal — delivery happens on main thread via QueuedConnection
-        if (!m_broadcastPending.exchange(true)) {
-            emit broadcastReady(message);
+    std::vector<std::pair<uint64_t, const TilePatch *>> patches;
+    for (size_t i = 0; i < table.versions.size(); i++) {
+        if (table.versions[i] > client.tileVersions[i]) {
+            patches.emplace_back(table.versions[i], table.patches[i].get());
+            client.tileVersions[i] = table.versions[i];
+        }
+    }
+    if (patches.empty()) {
+        return;
+    }
+    std::sort(patches.begin(), patches.end());
+    patches.erase(std::unique(patches.begin(), patches.end()), patches.end());
+
+    size_t size = s_HeaderSize + 16;
+    for (const auto &patch : patches) {
+        size += 12 + size_t(patch.second->jpeg.size());
+    }
+    QByteArray message;
+    message.reserve(int(size));
+    AppendHeader(message, table.frameWidth, table.frameHeight, table.frameId);
+    const uint32_t count = uint32_t(patches.size());
+    const uint32_t head[] = { s_TileMagic, table.width, table.height, count };
+    message.append(reinterpret_cast<const char *>(head), int(sizeof(head)));
+    for (const auto &patch : patches) {
+        const uint32_t place[] = { patch.second->x, patch.second->y, uint32_t(patch.second->jpeg.size()) };
+        message.append(reinterpret_cast<const char *>(place), int(sizeof(place)));
+        message.append(patch.second->jpeg);
+    }
+    send(client, message);
+}
+
+void FrameStreamServer::onBroadcast()
+{
+    // Cleared before reading, a frame delivered meanwhile triggers another call
+    m_broadcastPending = false;
+    std::shared_ptr<const StreamFrame> frame;
+    {
+        std::lock_guard<std::mutex> lock(m_latestMutex);
+        frame = m_latestFrame;
+    }
+    if (!frame) {
+        return;
+    }
+
+    for (ClientState &client : m_clientStates) {
+        offer(client, *frame);
+    }
+    updateClientRoom();
+}
+
+// This function hands the video clients the packets the video thread
+// encoded since the last call, every one of them in order
+void FrameStreamServer::onVideo()
+{
+    // Cleared before reading, a packet encoded meanwhile triggers another call
+    m_videoPending = false;
+    std::deque<std::shared_ptr<const VideoPacket>> packets;
+    bool lost = false;
+    {
+        std::lock_guard<std::mutex> lock(m_latestMutex);
+        packets.swap(m_videoPackets);
+        lost = m_videoLost;
+        m_videoLost = false;
+    }
+
+    for (ClientState &client : m_clientStates) {
+        if (!client.needs.video) {
+            continue;
+        }
+        if (lost) {
+            client.videoKeyed = false;
+        }
+        for (const std::shared_ptr<const VideoPacket> &packet : packets) {
+            offerVideo(client, *packet);
+        }
+    }
+    updateClientRoom();
+}
+
+// This function sends a video client a packet. Each packet builds on the
+// ones before it, so instead of parking a packet a full window drops it,
+// and the client waits for a key frame, which it asks the encoder for.
+void FrameStreamServer::offerVideo(ClientState &client, const VideoPacket &packet)
+{
+    if (!client.videoKeyed && !packet.key) {
+        client.dropped++;
+        return;
+    }
+    if (client.inFlight >= s_VideoWindow) {
+        client.videoKeyed = false;
+        m_videoKeyRequest = true;
+        client.dropped++;
+        return;
+    }
+
+    client.videoKeyed = true;
+    client.tileGeneration = 0;
+    client.quality = 0;
+    client.downscale = packet.downscale;
+    client.encodeMs = Smooth(client.encodeMs, packet.encodeMs);
+    send(client, packet.message);
+}
+
+bool FrameStreamServer::startHttp(const QHostAddress &address, quint16 port)
+{
+    bool listening = false;
+    runOnIoThread([this, &address, port, &listening] {
+        stopHttp();
+
+        m_pHttpServer = new QTcpServer(m_pIo);
+        if (!m_pHttpServer->listen(address, port)) {
+            delete m_pHttpServer;
+            m_pHttpServer = nullptr;
+            return;
+        }
+        connect(m_pHttpServer, &QTcpServer::newConnection,
+                m_pIo, [this] { onHttpConnection(); });
+        startSnapshots();
+        listening = true;
+    });
+    return listening;
+}
+
+void FrameStreamServer::stopHttp()
+{
+    runOnIoThread([this] {
+        if (m_pHttpServer == nullptr) {
+            return;
         }
-        emit frameConverted(buffer.frameID, buffer.width, buffer.height);
 
+        // The viewers connected through it go with it. Aborting a socket
+        // reports its disconnect right away, so their states go first.
+        std::vector<QTcpSocket *> sockets;
+        for (ClientState &client : m_clientStates) {
+            if (client.http) {
+                sockets.push_back(client.http);
+            }
+        }
+        m_clientStates.erase(std::remove_if(m_clientStates.begin(), m_clientStates.end(),
+                                            [](const ClientState &state) { return state.http != nullptr; }),
+                             m_clientStates.end());
+        updateClientNeeds();
+        updateClientRoom();
+        for (QTcpSocket *socket : sockets) {
+            socket->abort();
+        }
+
+        m_pHttpServer->close();
+        m_pHttpServer->deleteLater();
+        m_pHttpServer = nullptr;
+        stopSnapshots();
+    });
+}
+
+bool FrameStreamServer::isHttpListening()
+{
+    bool listening = false;
+    runOnIoThread([this, &listening] {
+        listening = m_pHttpServer != nullptr && m_pHttpServer->isListening();
+    });
+    return listening;
+}
+
+QHostAddress FrameStreamServer::httpAddress()
+{
+    QHostAddress address;
+    runOnIoThread([this, &address] {
+        address = m_pHttpServer ? m_pHttpServer->serverAddress() : QHostAddress();
+    });
+    return address;
+}
+
+int FrameStreamServer::httpPort()
+{
+    int port = 0;
+    runOnIoThread([this, &port] {
+        port = m_pHttpServer ? m_pHttpServer->serverPort() : 0;
+    });
+    return port;
+}
+
+void FrameStreamServer::setSnapshotProvider(SnapshotProvider provider)
+{
+    std::lock_guard<std::mutex> lock(m_snapshotMutex);
+    m_snapshotProvider = std::move(provider);
+}
+
+void FrameStreamServer::startSnapshots()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_snapshotMutex);
+        m_snapshotStop = false;
+    }
+    m_snapshotThread = std::thread(&FrameStreamServer::snapshotThreadMain, this);
+}
+
+// This function waits for the snapshot being taken, the requests still
+// queued are dropped with their sockets
+void FrameStreamServer::stopSnapshots()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_snapshotMutex);
+        m_snapshotStop = true;
+        m_snapshotRequests.clear();
+    }
+    m_snapshotWake.notify_all();
+    if (m_snapshotThread.joinable()) {
+        m_snapshotThread.join();
+    }
+    m_snapshotSockets.clear();
+}
+
+// This function runs the provider for one request after the other. The
+// response goes to the I/O thread, which still knows the socket if the
+// client waited for it.
+void FrameStreamServer::snapshotThreadMain()
+{
+    std::unique_lock<std::mutex> lock(m_snapshotMutex);
+    while (true) {
+        m_snapshotWake.wait(lock, [this] { return m_snapshotStop || !m_snapshotRequests.empty(); });
+        if (m_snapshotStop) break;
+
+        const SnapshotRequest request = m_snapshotRequests.front();
+        m_snapshotRequests.pop_front();
+        const SnapshotProvider provider = m_snapshotProvider;
+        lock.unlock();
+
+        Snapshot snapshot;
+        const bool served = provider && provider(request.format, snapshot);
+        QMetaObject::invokeMethod(m_pIo, [this, id = request.id, served, snapshot] {
+            onSnapshotDone(id, served, snapshot);
+        }, Qt::QueuedConnection);
         lock.lock();
     }
 }
+
+void FrameStreamServer::onSnapshotDone(uint64_t id, bool served, const Snapshot &snapshot)
+{
+    const auto found = m_snapshotSockets.find(id);
+    if (found == m_snapshotSockets.end()) {
+        return;
+    }
+    QTcpSocket *socket = found->second;
+    m_snapshotSockets.erase(found);
+
+    if (served) {
+        sendHttpResponse(socket, Endpoint::Snapshot, "200 OK", snapshot.contentType, snapshot.data,
+                         snapshot.headers);
+    } else {
+        sendHttpResponse(socket, Endpoint::Snapshot, "503 Service Unavailable", "text/plain",
+                         "No frame available\n");
+    }
+}
+
+void FrameStreamServer::onHttpConnection()
+{
+    while (QTcpSocket *socket = m_pHttpServer->nextPendingConnection()) {
+        connect(socket, &QTcpSocket::readyRead,
+                m_pIo, [this, socket] { onHttpReadyRead(socket); });
+        connect(socket, &QTcpSocket::disconnected,
+                m_pIo, [this, socket] { onHttpDisconnected(socket); });
+    }
+}
+
+void FrameStreamServer::onHttpReadyRead(QTcpSocket *socket)
+{
+    // Wait for the complete request head, the body of a GET is ignored
+    const QByteArray head = socket->peek(s_MaxHttpRequestBytes);
+    const int end = head.indexOf("\r\n\r\n");
+    if (end < 0) {
+        if (head.size() >= s_MaxHttpRequestBytes) {
+            disconnect(socket, &QTcpSocket::readyRead, m_pIo, nullptr);
+            sendHttpResponse(socket, Endpoint::Snapshot, "431 Request Header Fields Too Large",
+                             "text/plain", "Request too large\n");
+        }
+        return;
+    }
+    socket->read(end + 4);
+
+    // One request per connection
+    disconnect(socket, &QTcpSocket::readyRead, m_pIo, nullptr);
+
+    const QList<QByteArray> requestLine = head.left(head.indexOf("\r\n")).split(' ');
+    if (requestLine.size() != 3 || !requestLine[2].startsWith("HTTP/")) {
+        sendHttpResponse(socket, Endpoint::Snapshot, "400 Bad Request", "text/plain", "Bad request\n");
+    } else if (requestLine[0] != "GET") {
+        sendHttpResponse(socket, Endpoint::Snapshot, "405 Method Not Allowed", "text/plain",
+                         "Only GET is supported\n", "Allow: GET\r\n");
+    } else {
+        handleHttpRequest(socket, requestLine[1]);
+    }
+}
+
+// This function serves one request. Viewers of /stream.mjpg and requests
+// of /snapshot.jpg become clients of the stream, the PNG and raw snapshots
+// come from the snapshot provider.
+//
+// /stream.mjpg?width=W&height=H sets the viewport like the WebSocket
+// client does, without it the viewers get the full resolution.
+void FrameStreamServer::handleHttpRequest(QTcpSocket *socket, const QByteArray &target)
+{
+    const QUrl url(QString::fromLatin1(target));
+    const QString path = url.path();
+    const QUrlQuery query(url);
+
+    if (path == QStringLiteral("/")) {
+        sendHttpResponse(socket, Endpoint::Snapshot, "200 OK", "text/html",
+                         "<!DOCTYPE html><html><body><ul>"
+                         "<li><a href=\"/stream.mjpg\">/stream.mjpg</a></li>"
+                         "<li><a href=\"/snapshot.jpg\">/snapshot.jpg</a></li>"
+                         "<li><a href=\"/snapshot.png\">/snapshot.png</a></li>"
+                         "<li><a href=\"/snapshot.raw\">/snapshot.raw</a></li>"
+                         "</ul></body></html>\n");
+        return;
+    }
+
+    if (path == QStringLiteral("/stream.mjpg") || path == QStringLiteral("/snapshot.jpg")) {
+        ClientState state;
+        state.http = socket;
+        state.endpoint = path == QStringLiteral("/stream.mjpg") ? Endpoint::Mjpeg : Endpoint::Snapshot;
+        state.needs.viewportWidth = uint32_t(qMax(0, query.queryItemValue(QStringLiteral("width")).toInt()));
+        state.needs.viewportHeight = uint32_t(qMax(0, query.queryItemValue(QStringLiteral("height")).toInt()));
+        m_endpoints[size_t(state.endpoint)].requests++;
+
+        // The written part of a frame is the ack of HTTP clients
+        connect(socket, &QTcpSocket::bytesWritten,
+                m_pIo, [this, socket] { onHttpBytesWritten(socket); });
+
+        if (state.endpoint == Endpoint::Mjpeg) {
+            const QByteArray head = QByteArray("HTTP/1.1 200 OK\r\n"
+                                               "Content-Type: multipart/x-mixed-replace; boundary=") +
+                                    s_MjpegBoundary + "\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n";
+            socket->write(head);
+            m_endpoints[size_t(Endpoint::Mjpeg)].bytes += uint64_t(head.size());
+        } else {
+            // Without frames there is nothing to send
+            QTimer::singleShot(s_SnapshotTimeoutMs, socket, [this, socket] {
+                ClientState *client = clientState(socket);
+                if (client != nullptr && client->sent == 0) {
+                    removeClient(socket);
+                    sendHttpResponse(socket, Endpoint::Snapshot, "503 Service Unavailable", "text/plain",
+                                     "No frame available\n");
+                }
+            });
+        }
+        m_clientStates.push_back(state);
+        updateClientNeeds();
+        updateClientRoom();
+
+        // A snapshot takes the last frame if it has the full resolution
+        if (state.endpoint == Endpoint::Snapshot) {
+            std::shared_ptr<const StreamFrame> frame;
+            {
+                std::lock_guard<std::mutex> lock(m_latestMutex);
+                frame = m_latestFrame;
+            }
+            if (frame && std::any_of(frame->jpegs.begin(), frame->jpegs.end(),
+                                     [](const StreamJpeg &jpeg) { return jpeg.downscale == 1; })) {
+                offer(m_clientStates.back(), *frame);
+            }
+        }
+        return;
+    }
+
+    if (path == QStringLiteral("/snapshot.png") || path == QStringLiteral("/snapshot.raw")) {
+        m_endpoints[size_t(Endpoint::Snapshot)].requests++;
+        bool queued = false;
+        {
+            std::lock_guard<std::mutex> lock(m_snapshotMutex);
+            if (m_snapshotRequests.size() < s_MaxSnapshotRequests) {
+                m_snapshotRequests.push_back({ m_nextSnapshotId, path.mid(10) });
+                queued = true;
+            }
+        }
+        if (!queued) {
+            sendHttpResponse(socket, Endpoint::Snapshot, "503 Service Unavailable", "text/plain",
+                             "Too many snapshot requests\n");
+            return;
+        }
+        m_snapshotSockets[m_nextSnapshotId++] = socket;
+        m_snapshotWake.notify_one();
+        return;
+    }
+
+    sendHttpResponse(socket, Endpoint::Snapshot, "404 Not Found", "text/plain", "Not found\n");
+}
+
+void FrameStreamServer::sendHttpResponse(QTcpSocket *socket, Endpoint endpoint, const QByteArray &status,
+                                         const QByteArray &contentType, const QByteArray &body,
+                                         const QByteArray &headers)
+{
+    const QByteArray head = "HTTP/1.1 " + status + "\r\nContent-Type: " + contentType +
+                            "\r\nContent-Length: " + QByteArray::number(body.size()) +
+                            "\r\nCache-Control: no-cache\r\n" + headers + "Connection: close\r\n\r\n";
+    socket->write(head);
+    socket->write(body);
+    socket->disconnectFromHost();
+    m_endpoints[size_t(endpoint)].bytes += uint64_t(head.size() + body.size());
+}
+
+// Everything written to an HTTP client has reached the kernel, which
+// acknowledges the frames in flight. Slow viewers fill their socket
+// buffers and skip frames like slow WebSocket clients.
+void FrameStreamServer::onHttpBytesWritten(QTcpSocket *socket)
+{
+    ClientState *client = clientState(socket);
+    if (client == nullptr || client->http->bytesToWrite() > 0) {
+        return;
+    }
+    for (uint32_t done = client->inFlight; done > 0; done--) {
+        acknowledge(*client);
+    }
+}
+
+void FrameStreamServer::onHttpDisconnected(QTcpSocket *socket)
+{
+    if (clientState(socket) != nullptr) {
+        removeClient(socket);
+    }
+    // A snapshot taken for it is thrown away
+    for (auto it = m_snapshotSockets.begin(); it != m_snapshotSockets.end();) {
+        it = it->second == socket ? m_snapshotSockets.erase(it) : std::next(it);
+    }
+    socket->deleteLater();
+}
+
+QJsonObject FrameStreamServer::endpointStatistics()
+{
+    static const char *const names[] = { "websocket", "mjpeg", "snapshot" };
+    const Clock::time_point now = Clock::now();
+
+    QJsonObject result;
+    runOnIoThread([this, now, &result] {
+        for (size_t i = 0; i < m_endpoints.size(); i++) {
+            EndpointStatistics &endpoint = m_endpoints[i];
+
+            // The bandwidth over the last second or more
+            if (endpoint.sampleTime == Clock::time_point()) {
+                endpoint.sampleTime = now;
+                endpoint.sampleBytes = endpoint.bytes;
+            }
+            const double elapsedMs = ElapsedMs(endpoint.sampleTime, now);
+            if (elapsedMs >= 1000) {
+                endpoint.bytesPerSecond = double(endpoint.bytes - endpoint.sampleBytes) * 1000 / elapsedMs;
+                endpoint.sampleTime = now;
+                endpoint.sampleBytes = endpoint.bytes;
+            }
+
+            int connections = 0;
+            for (const ClientState &client : m_clientStates) {
+                connections += client.endpoint == static_cast<Endpoint>(i) ? 1 : 0;
+            }
+
+            QJsonObject entry;
+            entry["connections"] = connections;
+            entry["requests"] = double(endpoint.requests);
+            entry["bytes"] = double(endpoint.bytes);
+            entry["bytesPerSecond"] = endpoint.bytesPerSecond;
+            result[names[i]] = entry;
+        }
+    });
+    return result;
+}
+
+void FrameStreamServer::encoderThreadMain()
+{
+#ifdef HAS_LIBJPEG
+    JpegEncoder encoder;
+    JpegEncoder *pEncoder = &encoder;
+#else
+    JpegEncoder *pEncoder = nullptr;
+#endif
+    QImage convertedImage;
+
+    std::unique_lock<std::mutex> lock(m_frameMutex);
+    while (!m_stopThread) {
+        // Take a frame when the pipeline has room for it. While all clients
+        // are busy one frame is prepared ahead, so the first to ack gets it
+        // right away, recordings want every frame.
+        m_frameAvailable.wait(lock, [this] {
+            return (m_bufferReady && m_inFlight < m_encoderCount &&
+                    (m_clientRoom || m_recording || m_inFlight == 0)) || m_stopThread;
+        });
+        if (m_stopThread) break;
+
+        // Take the buffer
+        BufferWrapper buffer = m_nextBuffer;
+        auto doneCallback = m_nextDoneCallback;
+        m_nextDoneCallback = nullptr;
+        m_bufferReady = false;
+        const uint64_t sequence = m_nextSequence++;
+        m_inFlight++;
+        lock.unlock();
+
+        EncodedFrame frame;
+        frame.buffer = buffer;
+        {
+            std::lock_guard<std::mutex> rlock(m_recordMutex);
+            frame.recording = static_cast<bool>(m_recordingCallback);
+            frame.videoRecording = static_cast<bool>(m_videoRecordingCallback);
+        }
+
+        encodeFrame(buffer, frame, convertedImage, pEncoder);
+
+        // The recording callback gets the raw data of its frame, that
+        // buffer is released once the frame has been delivered
+        if (frame.recording && RecordingJpeg(frame.stream) != nullptr) {
+            frame.doneCallback = doneCallback;
+        } else if (doneCallback) {
+            doneCallback();
+        }
+
+        deliver(sequence, std::move(frame));
+        lock.lock();
+    }
+}
+
+// This function produces each format the clients need once, clients that
+// need the same one share it
+void FrameStreamServer::encodeFrame(const BufferWrapper &buffer, EncodedFrame &frame, QImage &convertedImage,
+                                    JpegEncoder *encoder)
+{
+    std::vector<ClientNeeds> needs;
+    {
+        std::lock_guard<std::mutex> lock(m_needsMutex);
+        needs = m_clientNeeds;
+    }
+
+    // The clients measure their viewports against the oriented frame
+    const ImageOrientation::Orientation orientation = ImageOrientation::Current();
+    uint32_t orientedWidth = 0;
+    uint32_t orientedHeight = 0;
+    ImageOrientation::OrientedSize(orientation, buffer.width, buffer.height, orientedWidth, orientedHeight);
+    std::shared_ptr<const ColorCorrection> colorCorrection = ColorCorrection::Current();
+    frame.stream.width = orientedWidth;
+    frame.stream.height = orientedHeight;
+
+    // Video clients and H.264 recordings share one picture for the video
+    // encoder, binned for the largest viewport among them. A recording
+    // takes the full resolution.
+    int videoDownscale = 0;
+    if (s_VideoEncoding && !m_videoFailed) {
+        for (const ClientNeeds &client : needs) {
+            if (client.video) {
+                const int downscale = PreviewDownscale(client.viewportWidth, client.viewportHeight,
+                                                       orientedWidth, orientedHeight);
+                videoDownscale = videoDownscale == 0 ? downscale : std::min(videoDownscale, downscale);
+            }
+        }
+        if (frame.videoRecording) {
+            videoDownscale = 1;
+        }
+    }
+    frame.stream.video = videoDownscale > 0 &&
+                         convertVideoPicture(buffer, videoDownscale, frame.videoRecording, orientation,
+                                             colorCorrection, frame, convertedImage);
+
+    // Frames the camera compressed itself go to all clients and the
+    // recording as they are, unless their pixels have to change. That
+    // saves the decode and the encode and keeps the camera's quality.
+    const PixelFormatDescriptor *desc = PixelFormatRegistry::Find(buffer.pixelFormat);
+    if (desc != nullptr && desc->family == PixelFamily::Compressed && orientation.IsIdentity() && !colorCorrection) {
+        const Clock::time_point start = Clock::now();
+        StreamJpeg passthrough;
+        if (BuildPassthroughMessage(buffer, passthrough.message)) {
+            passthrough.encodeMs = ElapsedMs(start, Clock::now());
+            frame.stream.jpegs.push_back(std::move(passthrough));
+            return;
+        }
+    }
+
+    // Clients that convert raw frames themselves spare the encoders the
+    // conversion and the JPEG encode. The software ISP only exists here,
+    // with it enabled and for formats the client shader can't read they
+    // get a JPEG like everybody else.
+    bool rawWanted = false;
+    for (const ClientNeeds &client : needs) {
+        rawWanted = rawWanted || (client.raw && !(client.video && frame.stream.video) &&
+                                  ClientRegion(client.region, orientedWidth, orientedHeight).isEmpty());
+    }
+    const bool raw = rawWanted && !colorCorrection &&
+                     BuildRawMessage(buffer, orientation, orientedWidth, orientedHeight, frame.stream.raw);
+
+    std::vector<RateLevel> jpegs;
+    std::vector<RateLevel> tiled;
+    std::vector<std::pair<RateLevel, QRect>> regions;
+    auto add = [](std::vector<RateLevel> &levels, const RateLevel &jpeg) {
+        if (std::find_if(levels.begin(), levels.end(), [&jpeg](const RateLevel &other) {
+                return other.quality == jpeg.quality && other.downscale == jpeg.downscale;
+            }) == levels.end()) {
+            levels.push_back(jpeg);
+        }
+    };
+    for (const ClientNeeds &client : needs) {
+        // Video clients crop and scale the video themselves
+        if (client.video && frame.stream.video) {
+            continue;
+        }
+        // Clients that show part of the frame get just that part, whatever
+        // else they take
+        if (!ClientRegion(client.region, orientedWidth, orientedHeight).isEmpty()) {
+            const RateLevel level = ClientJpeg(client.level, client.viewportWidth, client.viewportHeight,
+                                               orientedWidth, orientedHeight, false);
+            if (std::none_of(regions.begin(), regions.end(), [&](const std::pair<RateLevel, QRect> &other) {
+                    return other.first.quality == level.quality && other.first.downscale == level.downscale &&
+                           other.second == client.region;
+                })) {
+                regions.emplace_back(level, client.region);
+            }
+            continue;
+        }
+        if (client.raw && raw) {
+            continue;
+        }
+        if (client.tiles) {
+            add(tiled, ClientJpeg(client.level, client.viewportWidth, client.viewportHeight,
+                                  orientedWidth, orientedHeight, false));
+        } else {
+            add(jpegs, ClientJpeg(client.level, client.viewportWidth, client.viewportHeight,
+                                  orientedWidth, orientedHeight, frame.recording));
+        }
+    }
+    if (frame.recording) {
+        add(jpegs, { s_JpegQuality, 1 });
+    }
+
+    // Tile clients get the tiles of their rendition that changed, a frame
+    // that can't be tiled goes to them whole
+    {
+        std::lock_guard<std::mutex> lock(m_tileMutex);
+        for (auto it = m_tileStates.begin(); it != m_tileStates.end();) {
+            const bool needed = std::any_of(tiled.begin(), tiled.end(), [&it](const RateLevel &level) {
+                return level.quality == it->first.first && level.downscale == it->first.second;
+            });
+            it = needed ? std::next(it) : m_tileStates.erase(it);
+        }
+    }
+    for (const RateLevel &level : tiled) {
+        EncodedTiles tiles;
+        if (encodeTiles(buffer, level.quality, level.downscale, orientation, colorCorrection,
+                        tiles, convertedImage, encoder)) {
+            frame.tiles.push_back(std::move(tiles));
+        } else {
+            add(jpegs, level);
+        }
+    }
+    std::sort(jpegs.begin(), jpegs.end(), [](const RateLevel &a, const RateLevel &b) {
+        return a.downscale != b.downscale ? a.downscale < b.downscale : a.quality > b.quality;
+    });
+
+    for (const RateLevel &jpeg : jpegs) {
+        const Clock::time_point start = Clock::now();
+        const bool forRecording = frame.recording && jpeg.downscale == 1 && jpeg.quality == s_JpegQuality;
+
+        // Convert frame to QImage. The JPEG is encoded before the buffer is
+        // released, so RGB frames can be encoded straight from the buffer
+        // and everything else reuses the image of the previous frame.
+        ImageTransform::ConversionOptions options;
+        options.allowBorrow = true;
+        options.orientation = orientation;
+        options.downscale = jpeg.downscale;
+        // Recordings get the best demosaic, the JPEG compressed preview
+        // hides the blockiness of Nearest
+        options.demosaic = forRecording ? Demosaic::Method::MalvarHeCutler : Demosaic::Method::Nearest;
+        options.colorCorrection = colorCorrection;
+        ImageTransform::SetColorimetry(buffer, options);
+        int result = ImageTransform::ConvertFrame(buffer, convertedImage, options);
+
+        // Build message: [width:u32][height:u32][frameId:u64][jpeg...]
+        // The header always carries the full size of the oriented frame, a
+        // smaller JPEG is a binned preview that the client scales up
+        QByteArray message;
+        if (result == 0 && !convertedImage.isNull()) {
+            AppendHeader(message, orientedWidth, orientedHeight, buffer.frameID);
+            if (!AppendJpeg(message, convertedImage, jpeg.quality, encoder)) {
+                message.clear();
+            }
+        }
+
+        // A borrowed view must not outlive the buffer
+        if (convertedImage.constBits() == buffer.data) {
+            convertedImage = QImage();
+        }
+
+        if (!message.isEmpty()) {
+            StreamJpeg encoded;
+            encoded.downscale = jpeg.downscale;
+            encoded.quality = jpeg.quality;
+            encoded.encodeMs = ElapsedMs(start, Clock::now());
+            encoded.message.swap(message);
+            frame.stream.jpegs.push_back(std::move(encoded));
+        }
+    }
+
+    for (const auto &request : regions) {
+        encodeRegion(buffer, request.first.quality, request.first.downscale, request.second, orientation,
+                     colorCorrection, frame.stream, convertedImage, encoder);
+    }
+}
+
+// This function converts a frame into the picture the video encoder takes
+// for it. The picture is a copy, the buffer may go before it is encoded.
+//
+// Returns:
+// (bool) - false if the frame could not be converted
+bool FrameStreamServer::convertVideoPicture(const BufferWrapper &buffer, int downscale, bool recording,
+                                            const ImageOrientation::Orientation &orientation,
+                                            const std::shared_ptr<const ColorCorrection> &colorCorrection,
+                                            EncodedFrame &frame, QImage &convertedImage)
+{
+#ifdef HAS_X264
+    const Clock::time_point start = Clock::now();
+    ImageTransform::ConversionOptions options;
+    options.allowBorrow = true;
+    options.orientation = orientation;
+    options.downscale = downscale;
+    // Recordings get the best demosaic, like the JPEG ones
+    options.demosaic = recording ? Demosaic::Method::MalvarHeCutler : Demosaic::Method::Nearest;
+    options.colorCorrection = colorCorrection;
+    ImageTransform::SetColorimetry(buffer, options);
+
+    VideoPicture &picture = frame.video;
+    const bool converted = ImageTransform::ConvertFrame(buffer, convertedImage, options) == 0 &&
+                           H264Encoder::ToI420(convertedImage, picture.planes, picture.width, picture.height);
+
+    // A borrowed view must not outlive the buffer
+    if (convertedImage.constBits() == buffer.data) {
+        convertedImage = QImage();
+    }
+    if (!converted) {
+        picture.planes.clear();
+        return false;
+    }
+
+    picture.frameId = buffer.frameID;
+    picture.frameWidth = frame.stream.width;
+    picture.frameHeight = frame.stream.height;
+    picture.downscale = downscale;
+    picture.recording = recording;
+    picture.encodeMs = ElapsedMs(start, Clock::now());
+    return true;
+#else
+    Q_UNUSED(buffer);
+    Q_UNUSED(downscale);
+    Q_UNUSED(recording);
+    Q_UNUSED(orientation);
+    Q_UNUSED(colorCorrection);
+    Q_UNUSED(frame);
+    Q_UNUSED(convertedImage);
+    return false;
+#endif
+}
+
+// This function converts and compresses the part of a frame a region
+// client shows, at the binning of its rate control level. Only the frame
+// pixels under the region are converted, so a zoomed in view of a large
+// frame costs a fraction of the full frame. A region that fails to
+// convert leaves the client without this frame.
+void FrameStreamServer::encodeRegion(const BufferWrapper &buffer, int quality, int downscale, const QRect &region,
+                                     const ImageOrientation::Orientation &orientation,
+                                     const std::shared_ptr<const ColorCorrection> &colorCorrection,
+                                     StreamFrame &stream, QImage &convertedImage, JpegEncoder *encoder)
+{
+    const Clock::time_point start = Clock::now();
+    uint32_t scaledWidth = 0;
+    uint32_t scaledHeight = 0;
+    ScaledSize(buffer, downscale, scaledWidth, scaledHeight);
+    uint32_t width = 0;
+    uint32_t height = 0;
+    ImageOrientation::OrientedSize(orientation, scaledWidth, scaledHeight, width, height);
+
+    // The region widened to whole pixels of the binned, oriented image
+    const QRect clipped = region.intersected(QRect(0, 0, int(stream.width), int(stream.height)));
+    const int left = clipped.left() / downscale;
+    const int top = clipped.top() / downscale;
+    const int right = std::min(int(width), (clipped.left() + clipped.width() + downscale - 1) / downscale);
+    const int bottom = std::min(int(height), (clipped.top() + clipped.height() + downscale - 1) / downscale);
+    if (clipped.isEmpty() || right <= left || bottom <= top) {
+        return;
+    }
+    const QRect scaled(left, top, right - left, bottom - top);
+
+    ImageTransform::ConversionOptions options;
+    options.allowBorrow = true;
+    options.orientation = orientation;
+    options.downscale = downscale;
+    options.demosaic = Demosaic::Method::Nearest;
+    options.colorCorrection = colorCorrection;
+    ImageTransform::SetColorimetry(buffer, options);
+    const int result = ImageTransform::ConvertFrame(
+        buffer, FrameRegion(orientation, scaledWidth, scaledHeight, downscale, scaled), convertedImage, options);
+
+    // Build message: [header]["VREG"][x][y][width][height][jpeg...]
+    QByteArray message;
+    if (result == 0 && !convertedImage.isNull()) {
+        const uint32_t head[] = { s_RegionMagic, uint32_t(scaled.left() * downscale),
+                                  uint32_t(scaled.top() * downscale), uint32_t(scaled.width() * downscale),
+                                  uint32_t(scaled.height() * downscale) };
+        AppendHeader(message, stream.width, stream.height, buffer.frameID);
+        message.append(reinterpret_cast<const char *>(head), int(sizeof(head)));
+        if (!AppendJpeg(message, convertedImage, quality, encoder)) {
+            message.clear();
+        }
+    }
+
+    // A borrowed view must not outlive the buffer
+    if (convertedImage.constBits() == buffer.data) {
+        convertedImage = QImage();
+    }
+    if (message.isEmpty()) {
+        return;
+    }
+
+    StreamJpeg encoded;
+    encoded.downscale = downscale;
+    encoded.quality = quality;
+    encoded.encodeMs = ElapsedMs(start, Clock::now());
+    encoded.region = region;
+    encoded.message.swap(message);
+    stream.regions.push_back(std::move(encoded));
+}
+
+// This function encodes the tiles of a tiled rendition that changed since
+// they were encoded last, or all of them as one key frame when the tile
+// grid is new or most of the frame changed. Runs of changed tiles in a row
+// are converted and compressed together, only the frame pixels they come
+// from are converted.
+//
+// Returns:
+// (bool) - false if the frame can't be tiled, compressed frames for one
+bool FrameStreamServer::encodeTiles(const BufferWrapper &buffer, int quality, int downscale,
+                                    const ImageOrientation::Orientation &orientation,
+                                    const std::shared_ptr<const ColorCorrection> &colorCorrection,
+                                    EncodedTiles &tiles, QImage &convertedImage, JpegEncoder *encoder)
+{
+    const PixelFormatDescriptor *desc = PixelFormatRegistry::Find(buffer.pixelFormat);
+    if (desc == nullptr || desc->family == PixelFamily::Compressed ||
+        buffer.data == nullptr || buffer.width == 0 || buffer.height == 0)
+        return false;
+    const uint32_t lineBytes = desc->MinimumBytesPerLine(buffer.width);
+    const uint32_t bytesPerLine = buffer.bytesPerLine < lineBytes ? lineBytes : buffer.bytesPerLine;
+    if (buffer.length < size_t(bytesPerLine) * (buffer.height - 1) + lineBytes)
+        return false;
+
+    const Clock::time_point start = Clock::now();
+    tiles.quality = quality;
+    tiles.downscale = downscale;
+    std::vector<QRect> regions;
+    TileGrid(buffer, orientation, downscale, tiles.width, tiles.height, tiles.columns, tiles.rows, regions);
+
+    const size_t cellsPerTile = size_t(s_TileCells) * s_TileCells;
+    std::vector<double> cells(regions.size() * cellsPerTile);
+    for (size_t i = 0; i < regions.size(); i++) {
+        TileSignature(buffer, *desc, bytesPerLine, regions[i], &cells[i * cellsPerTile]);
+    }
+
+    // Compared and taken as the new reference under the lock, so the
+    // encoders working on the next frames compare with what this one sends
+    std::vector<bool> changed(regions.size(), false);
+    {
+        std::lock_guard<std::mutex> lock(m_tileMutex);
+        TileState &state = m_tileStates[std::make_pair(quality, downscale)];
+        if (state.generation == 0 || state.pixelFormat != buffer.pixelFormat ||
+            state.frameWidth != buffer.width || state.frameHeight != buffer.height ||
+            !SameOrientation(state.orientation, orientation) || state.colorCorrection != colorCorrection) {
+            state.generation = ++m_tileGeneration;
+            state.keyed = false;
+            state.pixelFormat = buffer.pixelFormat;
+            state.frameWidth = buffer.width;
+            state.frameHeight = buffer.height;
+            state.orientation = orientation;
+            state.colorCorrection = colorCorrection;
+            state.reference.clear();
+        }
+
+        size_t count = 0;
+        if (state.keyed) {
+            for (size_t i = 0; i < regions.size(); i++) {
+                for (size_t c = i * cellsPerTile; c < (i + 1) * cellsPerTile && !changed[i]; c++) {
+                    changed[i] = std::abs(cells[c] - state.reference[c]) > s_TileThreshold;
+                }
+                count += changed[i] ? 1 : 0;
+            }
+        }
+        tiles.key = !state.keyed || double(count) > double(regions.size()) * s_TileKeyRatio;
+        tiles.generation = state.generation;
+
+        if (tiles.key) {
+            state.reference.swap(cells);
+            state.keyed = true;
+        } else {
+            for (size_t i = 0; i < regions.size(); i++) {
+                if (changed[i]) {
+                    std::copy(cells.begin() + ptrdiff_t(i * cellsPerTile), cells.begin() + ptrdiff_t((i + 1) * cellsPerTile),
+                              state.reference.begin() + ptrdiff_t(i * cellsPerTile));
+                }
+            }
+        }
+    }
+
+    ImageTransform::ConversionOptions options;
+    options.orientation = orientation;
+    options.downscale = downscale;
+    options.demosaic = Demosaic::Method::Nearest;
+    options.colorCorrection = colorCorrection;
+    ImageTransform::SetColorimetry(buffer, options);
+
+    bool encoded = true;
+    if (tiles.key) {
+        auto patch = std::make_shared<TilePatch>();
+        patch->columns = tiles.columns;
+        patch->rows = tiles.rows;
+        options.allowBorrow = true;
+        encoded = ImageTransform::ConvertFrame(buffer, convertedImage, options) == 0 &&
+                  AppendJpeg(patch->jpeg, convertedImage, quality, encoder);
+        // A borrowed view must not outlive the buffer
+        if (convertedImage.constBits() == buffer.data) {
+            convertedImage = QImage();
+        }
+        tiles.patches.push_back(std::move(patch));
+    } else {
+        for (uint32_t row = 0; row < tiles.rows && encoded; row++) {
+            for (uint32_t column = 0; column < tiles.columns && encoded;) {
+                const size_t first = size_t(row) * tiles.columns + column;
+                if (!changed[first]) {
+                    column++;
+                    continue;
+                }
+                QRect region = regions[first];
+                uint32_t end = column + 1;
+                for (; end < tiles.columns && changed[first + end - column]; end++) {
+                    region = region.united(regions[first + end - column]);
+                }
+
+                auto patch = std::make_shared<TilePatch>();
+                patch->column = column;
+                patch->row = row;
+                patch->columns = end - column;
+                patch->rows = 1;
+                patch->x = column * s_TileSize;
+                patch->y = row * s_TileSize;
+                encoded = ImageTransform::ConvertFrame(buffer, region, convertedImage, options) == 0 &&
+                          AppendJpeg(patch->jpeg, convertedImage, quality, encoder);
+                tiles.patches.push_back(std::move(patch));
+                column = end;
+            }
+        }
+    }
+
+    if (!encoded) {
+        // The references already moved on, only a key frame brings the tiles back in line
+        std::lock_guard<std::mutex> lock(m_tileMutex);
+        auto state = m_tileStates.find(std::make_pair(quality, downscale));
+        if (state != m_tileStates.end() && state->second.generation == tiles.generation) {
+            state->second.keyed = false;
+        }
+        return false;
+    }
+    tiles.encodeMs = ElapsedMs(start, Clock::now());
+    return true;
+}
+
+// This function applies the tiles of a frame to the tile tables of their
+// renditions, in the order of the frames. Each frame gets a table of its
+// own, clients may still be sending from the previous ones. Renditions the
+// frame doesn't carry are no longer needed.
+void FrameStreamServer::deliverTiles(uint64_t sequence, EncodedFrame &frame)
+{
+    std::map<std::pair<int, int>, std::shared_ptr<const TileTable>> tables;
+    for (const EncodedTiles &tiles : frame.tiles) {
+        const std::pair<int, int> key(tiles.quality, tiles.downscale);
+        const auto current = m_tileTables.find(key);
+        if (!tiles.key && (current == m_tileTables.end() || current->second->generation != tiles.generation)) {
+            // The key frame of the generation was lost, or an encoder
+            // working on a later frame took it, ask for another one
+            std::lock_guard<std::mutex> lock(m_tileMutex);
+            auto state = m_tileStates.find(key);
+            if (state != m_tileStates.end() && state->second.generation == tiles.generation) {
+                state->second.keyed = false;
+            }
+            continue;
+        }
+
+        auto table = tiles.key ? std::make_shared<TileTable>() : std::make_shared<TileTable>(*current->second);
+        if (tiles.key) {
+            table->generation = tiles.generation;
+            table->width = tiles.width;
+            table->height = tiles.height;
+            table->columns = tiles.columns;
+            table->rows = tiles.rows;
+            table->versions.assign(size_t(tiles.columns) * tiles.rows, 0);
+            table->patches.resize(table->versions.size());
+        }
+        table->frameId = frame.buffer.frameID;
+        table->frameWidth = frame.stream.width;
+        table->frameHeight = frame.stream.height;
+
+        // Versions start at 1, a client without a tile has version 0
+        for (const std::shared_ptr<const TilePatch> &patch : tiles.patches) {
+            for (uint32_t row = patch->row; row < patch->row + patch->rows; row++) {
+                for (uint32_t column = patch->column; column < patch->column + patch->columns; column++) {
+                    const size_t index = size_t(row) * table->columns + column;
+                    table->versions[index] = sequence + 1;
+                    table->patches[index] = patch;
+                }
+            }
+        }
+
+        StreamTiles stream;
+        stream.downscale = tiles.downscale;
+        stream.quality = tiles.quality;
+        stream.encodeMs = tiles.encodeMs;
+        stream.table = table;
+        frame.stream.tiles.push_back(stream);
+        tables[key] = table;
+    }
+    m_tileTables.swap(tables);
+}
+
+// This function passes the frames on to recording and clients in the order
+// the encoders took them. Whichever encoder completes the next frame in
+// order delivers it along with the completed frames that follow it.
+void FrameStreamServer::deliver(uint64_t sequence, EncodedFrame frame)
+{
+    uint32_t delivered = 0;
+    uint32_t held = 0;  // recorded pictures the video thread releases
+    {
+        std::lock_guard<std::mutex> dlock(m_deliveryMutex);
+        m_encodedFrames.emplace(sequence, std::move(frame));
+
+        for (auto it = m_encodedFrames.find(m_nextDelivery); it != m_encodedFrames.end();
+             it = m_encodedFrames.find(m_nextDelivery)) {
+            EncodedFrame &next = it->second;
+            const StreamJpeg *recordingJpeg = next.recording ? RecordingJpeg(next.stream) : nullptr;
+            if (recordingJpeg != nullptr) {
+                // Feed recording callback (if active) — BEFORE releasing buffer
+                // so raw data pointer is still valid
+                std::lock_guard<std::mutex> rlock(m_recordMutex);
+                // A callback installed after the conversion would get a preview sized JPEG
+                if (m_recordingCallback) {
+                    const QByteArray &message = recordingJpeg->message;
+                    const QByteArray jpegData = QByteArray::fromRawData(message.constData() + s_HeaderSize,
+                                                                        message.size() - int(s_HeaderSize));
+                    m_recordingCallback(jpegData, next.buffer);
+                }
+            }
+
+            // Release buffer back to FrameObserver after recording callback
+            if (next.doneCallback) {
+                next.doneCallback();
+            }
+
+            deliverTiles(m_nextDelivery, next);
+            if (!next.video.planes.isEmpty()) {
+                // A recorded picture stays in flight until the video thread
+                // encoded it, only stream pictures make room for newer ones
+                std::lock_guard<std::mutex> vlock(m_videoMutex);
+                if (m_videoPictures.size() >= s_MaxVideoPictures) {
+                    const auto stale = std::find_if(m_videoPictures.begin(), m_videoPictures.end(),
+                                                    [](const VideoPicture &picture) { return !picture.recording; });
+                    if (stale != m_videoPictures.end()) {
+                        m_videoPictures.erase(stale);
+                    }
+                }
+                held += next.video.recording ? 1 : 0;
+                m_videoPictures.push_back(std::move(next.video));
+                m_videoWake.notify_one();
+            }
+            if (!next.stream.IsEmpty()) {
+                // The I/O thread hands the newest frame to the clients, see onBroadcast
+                next.stream.sequence = m_nextDelivery;
+                {
+                    std::lock_guard<std::mutex> lock(m_latestMutex);
+                    m_latestFrame = std::make_shared<const StreamFrame>(std::move(next.stream));
+                }
+                if (!m_broadcastPending.exchange(true)) {
+                    emit broadcastReady();
+                }
+                emit frameConverted(next.buffer.frameID, next.buffer.width, next.buffer.height);
+            }
+
+            m_encodedFrames.erase(it);
+            m_nextDelivery++;
+            delivered++;
+        }
+    }
+
+    if (delivered > held) {
+        std::lock_guard<std::mutex> lock(m_frameMutex);
+        m_inFlight -= delivered - held;
+    }
+    m_frameAvailable.notify_all();
+}
+
+// This function compresses the pictures of the delivered frames, in their
+// order, into the H.264 stream of the video clients and the recording.
+// Recorded pictures hold their place in m_inFlight until they are encoded,
+// so the encoders take no frames the recording would have to lose.
+void FrameStreamServer::videoThreadMain()
+{
+#ifdef HAS_X264
+    H264Encoder encoder;
+
+    std::unique_lock<std::mutex> lock(m_videoMutex);
+    while (true) {
+        m_videoWake.wait(lock, [this] {
+            return !m_videoPictures.empty() || m_videoStop;
+        });
+        if (m_videoStop) break;
+
+        VideoPicture picture = std::move(m_videoPictures.front());
+        m_videoPictures.pop_front();
+        lock.unlock();
+
+        encodeVideoPicture(encoder, picture);
+        if (picture.recording) {
+            {
+                std::lock_guard<std::mutex> flock(m_frameMutex);
+                m_inFlight--;
+            }
+            m_frameAvailable.notify_all();
+        }
+        lock.lock();
+    }
+#endif
+}
+
+#ifdef HAS_X264
+// This function encodes one picture and hands the packet to the video
+// clients and the recording. A picture of another size starts the stream
+// over with a key frame.
+void FrameStreamServer::encodeVideoPicture(H264Encoder &encoder, const VideoPicture &picture)
+{
+    const Clock::time_point start = Clock::now();
+    if (encoder.Width() != picture.width || encoder.Height() != picture.height) {
+        const double intervalMs = m_sourceIntervalMs;
+        if (!encoder.Open(picture.width, picture.height, intervalMs > 0 ? 1000 / intervalMs : 0)) {
+            // The encoders send JPEGs from the next frame on, a running
+            // recording would get no frames anymore and is ended
+            m_videoFailed = true;
+            bool recordingEnded = false;
+            {
+                std::lock_guard<std::mutex> rlock(m_recordMutex);
+                if (m_videoRecordingCallback) {
+                    m_videoRecordingCallback = nullptr;
+                    m_recording = static_cast<bool>(m_recordingCallback);
+                    recordingEnded = true;
+                }
+            }
+            if (recordingEnded) {
+                emit recordingFailed(QStringLiteral("encoder_error"));
+            }
+            return;
+        }
+    }
+
+    // Build message: [header]["VVID"][flags][width][height][access unit...]
+    const bool key = m_videoKeyRequest.exchange(false);
+    auto packet = std::make_shared<VideoPacket>();
+    packet->downscale = picture.downscale;
+    AppendHeader(packet->message, picture.frameWidth, picture.frameHeight, picture.frameId);
+    const uint32_t head[] = { s_VideoMagic, 0, picture.width, picture.height };
+    packet->message.append(reinterpret_cast<const char *>(head), int(sizeof(head)));
+    const int payloadOffset = packet->message.size();
+    if (!encoder.Encode(picture.planes, key, packet->message, packet->key)) {
+        if (key) {
+            m_videoKeyRequest = true;
+        }
+        return;
+    }
+    const uint32_t flags = packet->key ? 1 : 0;
+    std::memcpy(packet->message.data() + s_HeaderSize + 4, &flags, 4);
+    packet->encodeMs = picture.encodeMs + ElapsedMs(start, Clock::now());
+
+    if (picture.recording) {
+        std::lock_guard<std::mutex> rlock(m_recordMutex);
+        if (m_videoRecordingCallback) {
+            m_videoRecordingCallback(QByteArray::fromRawData(packet->message.constData() + payloadOffset,
+                                                             packet->message.size() - payloadOffset),
+                                     packet->key, picture.width, picture.height);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> plock(m_latestMutex);
+        if (m_videoPackets.size() >= s_MaxVideoPackets) {
+            m_videoPackets.clear();
+            m_videoLost = true;
+            m_videoKeyRequest = true;
+        }
+        m_videoPackets.push_back(std::move(packet));
+    }
+    if (!m_videoPending.exchange(true)) {
+        emit videoReady();
+    }
+}
+#endif
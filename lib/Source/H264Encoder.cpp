@@ -0,0 +1,237 @@
+#include "H264Encoder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <x264.h>
+
+// The fastest preset that keeps CABAC and the deblocking filter, ultrafast
+// drops both and takes about twice the bits for the same quality
+static const char s_Preset[] = "superfast";
+// Constant rate factor, the quality x264 keeps, lower is better
+static const float s_RateFactor = 23;
+// Longest run of pictures between key frames, a client that lost a picture
+// asks for a key frame right away and doesn't wait for it
+static const double s_KeyIntervalSec = 2;
+
+struct H264Encoder::State
+{
+    x264_t *encoder = nullptr;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    int64_t pts = 0;
+};
+
+// Y of BT.601 limited range from 8 bit RGB, U and V from the sums of the
+// RGB of a 2 x 2 block
+static inline uint8_t Luma(int r, int g, int b)
+{
+    return uint8_t(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+}
+
+static inline uint8_t BlueDifference(int r4, int g4, int b4)
+{
+    return uint8_t(((-38 * r4 - 74 * g4 + 112 * b4 + 512) >> 10) + 128);
+}
+
+static inline uint8_t RedDifference(int r4, int g4, int b4)
+{
+    return uint8_t(((112 * r4 - 94 * g4 - 18 * b4 + 512) >> 10) + 128);
+}
+
+// This function converts two lines of pixels of Bytes bytes, red, green
+// and blue at offsets R, G and B, into two lines of Y and one of U and V
+template <int Bytes, int R, int G, int B>
+static void LinePairToI420(const uint8_t *top, const uint8_t *bottom, uint32_t width,
+                           uint8_t *yTop, uint8_t *yBottom, uint8_t *u, uint8_t *v)
+{
+    for (uint32_t x = 0; x < width; x += 2) {
+        const uint8_t *p0 = top + x * Bytes;
+        const uint8_t *p1 = p0 + Bytes;
+        const uint8_t *p2 = bottom + x * Bytes;
+        const uint8_t *p3 = p2 + Bytes;
+        yTop[x] = Luma(p0[R], p0[G], p0[B]);
+        yTop[x + 1] = Luma(p1[R], p1[G], p1[B]);
+        yBottom[x] = Luma(p2[R], p2[G], p2[B]);
+        yBottom[x + 1] = Luma(p3[R], p3[G], p3[B]);
+        const int r4 = p0[R] + p1[R] + p2[R] + p3[R];
+        const int g4 = p0[G] + p1[G] + p2[G] + p3[G];
+        const int b4 = p0[B] + p1[B] + p2[B] + p3[B];
+        u[x / 2] = BlueDifference(r4, g4, b4);
+        v[x / 2] = RedDifference(r4, g4, b4);
+    }
+}
+
+H264Encoder::H264Encoder()
+    : m_State(new State)
+{
+}
+
+H264Encoder::~H264Encoder()
+{
+    Close();
+}
+
+bool H264Encoder::Open(uint32_t width, uint32_t height, double fps)
+{
+    Close();
+    if (width < 2 || height < 2 || (width & 1) != 0 || (height & 1) != 0)
+        return false;
+
+    x264_param_t param;
+    if (x264_param_default_preset(&param, s_Preset, "zerolatency") < 0)
+        return false;
+
+    // zerolatency already turns off B-frames and the lookahead and slices
+    // the pictures for the threads, which this relies on
+    const double rate = fps > 0 ? fps : 30;
+    param.i_log_level = X264_LOG_ERROR;
+    param.i_threads = X264_THREADS_AUTO;
+    param.b_sliced_threads = 1;
+    param.i_bframe = 0;
+    param.i_width = int(width);
+    param.i_height = int(height);
+    param.i_csp = X264_CSP_I420;
+    param.i_fps_num = uint32_t(std::lround(rate * 1000));
+    param.i_fps_den = 1000;
+    param.i_keyint_max = std::max(1, int(rate * s_KeyIntervalSec));
+    param.rc.i_rc_method = X264_RC_CRF;
+    param.rc.f_rf_constant = s_RateFactor;
+    // Every key frame carries the SPS and PPS, a client can join at any of them
+    param.b_repeat_headers = 1;
+    param.b_annexb = 1;
+    if (x264_param_apply_profile(&param, "high") < 0)
+        return false;
+
+    State &state = *m_State;
+    state.encoder = x264_encoder_open(&param);
+    if (state.encoder == nullptr)
+        return false;
+    state.width = width;
+    state.height = height;
+    state.pts = 0;
+    return true;
+}
+
+void H264Encoder::Close()
+{
+    State &state = *m_State;
+    if (state.encoder != nullptr) {
+        x264_encoder_close(state.encoder);
+        state.encoder = nullptr;
+    }
+    state.width = 0;
+    state.height = 0;
+}
+
+bool H264Encoder::IsOpen() const
+{
+    return m_State->encoder != nullptr;
+}
+
+uint32_t H264Encoder::Width() const
+{
+    return m_State->width;
+}
+
+uint32_t H264Encoder::Height() const
+{
+    return m_State->height;
+}
+
+bool H264Encoder::Encode(const QByteArray &planes, bool key, QByteArray &output, bool &keyFrame)
+{
+    State &state = *m_State;
+    const size_t lumaBytes = size_t(state.width) * state.height;
+    if (state.encoder == nullptr || size_t(planes.size()) < lumaBytes + lumaBytes / 2)
+        return false;
+
+    // x264 reads the planes where they are
+    x264_picture_t picture;
+    x264_picture_init(&picture);
+    uint8_t *data = reinterpret_cast<uint8_t *>(const_cast<char *>(planes.constData()));
+    picture.img.i_csp = X264_CSP_I420;
+    picture.img.i_plane = 3;
+    picture.img.plane[0] = data;
+    picture.img.plane[1] = data + lumaBytes;
+    picture.img.plane[2] = data + lumaBytes + lumaBytes / 4;
+    picture.img.i_stride[0] = int(state.width);
+    picture.img.i_stride[1] = int(state.width / 2);
+    picture.img.i_stride[2] = int(state.width / 2);
+    picture.i_type = key ? X264_TYPE_IDR : X264_TYPE_AUTO;
+    picture.i_pts = state.pts++;
+
+    x264_picture_t encoded;
+    x264_nal_t *nals = nullptr;
+    int count = 0;
+    const int size = x264_encoder_encode(state.encoder, &nals, &count, &picture, &encoded);
+    if (size <= 0 || count == 0)
+        return false;
+
+    // The payloads of the NAL units follow each other in memory
+    output.append(reinterpret_cast<const char *>(nals[0].p_payload), size);
+    keyFrame = encoded.b_keyframe != 0;
+    return true;
+}
+
+bool H264Encoder::ToI420(const QImage &image, QByteArray &planes, uint32_t &width, uint32_t &height)
+{
+    width = uint32_t(image.width()) & ~1u;
+    height = uint32_t(image.height()) & ~1u;
+    if (width == 0 || height == 0)
+        return false;
+
+    const QImage *source = &image;
+    QImage converted;
+    switch (image.format())
+    {
+    case QImage::Format_Grayscale8:
+    case QImage::Format_RGB888:
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+        break;
+    default:
+        converted = image.convertToFormat(QImage::Format_RGB888);
+        source = &converted;
+        break;
+    }
+
+    const size_t lumaBytes = size_t(width) * height;
+    planes.resize(int(lumaBytes + lumaBytes / 2));
+    uint8_t *yPlane = reinterpret_cast<uint8_t *>(planes.data());
+    uint8_t *uPlane = yPlane + lumaBytes;
+    uint8_t *vPlane = uPlane + lumaBytes / 4;
+    const uint32_t chromaWidth = width / 2;
+
+    if (source->format() == QImage::Format_Grayscale8) {
+        // Gray has no color, the chroma planes are neutral
+        for (uint32_t y = 0; y < height; y++) {
+            const uint8_t *line = source->constScanLine(int(y));
+            uint8_t *luma = yPlane + size_t(y) * width;
+            for (uint32_t x = 0; x < width; x++) {
+                luma[x] = uint8_t(((line[x] * 56284 + 32768) >> 16) + 16);
+            }
+        }
+        std::fill(uPlane, uPlane + lumaBytes / 2, uint8_t(128));
+        return true;
+    }
+
+    for (uint32_t y = 0; y < height; y += 2) {
+        const uint8_t *top = source->constScanLine(int(y));
+        const uint8_t *bottom = source->constScanLine(int(y + 1));
+        uint8_t *yTop = yPlane + size_t(y) * width;
+        uint8_t *yBottom = yTop + width;
+        uint8_t *u = uPlane + size_t(y / 2) * chromaWidth;
+        uint8_t *v = vPlane + size_t(y / 2) * chromaWidth;
+        if (source->format() == QImage::Format_RGB888) {
+            LinePairToI420<3, 0, 1, 2>(top, bottom, width, yTop, yBottom, u, v);
+        } else if (Q_BYTE_ORDER == Q_LITTLE_ENDIAN) {
+            // 0xAARRGGBB words, BGRA in memory
+            LinePairToI420<4, 2, 1, 0>(top, bottom, width, yTop, yBottom, u, v);
+        } else {
+            LinePairToI420<4, 1, 2, 3>(top, bottom, width, yTop, yBottom, u, v);
+        }
+    }
+    return true;
+}
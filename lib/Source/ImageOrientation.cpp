@@ -0,0 +1,264 @@
+#include "ImageOrientation.h"
+
+#include <algorithm>
+#include <cstring>
+#include <mutex>
+#include <vector>
+
+using ImageOrientation::LineWriter;
+using ImageOrientation::Orientation;
+using ImageOrientation::Rotation;
+
+// Bytes of one destination run written by the transposition. A full cache
+// line per destination row keeps the scattered writes from fetching lines
+// that are only partially written.
+static const uint32_t s_RunBytes = 64;
+static const uint32_t s_MinBlockLines = 8;
+
+static std::mutex s_CurrentMutex;
+static Orientation s_Current;
+
+// Scratch memory of the calling thread, every band has its own
+static uint8_t *Scratch(size_t size)
+{
+    static thread_local std::vector<uint8_t> buffer;
+    if (buffer.size() < size)
+    {
+        buffer.resize(size);
+    }
+    return buffer.data();
+}
+
+// This function copies the pixels of a line in reverse order. N is the
+// pixel size when known at compile time, 0 takes bytesPerPixel.
+template <uint32_t N>
+static void ReverseLine(const uint8_t *__restrict src, uint8_t *__restrict dst, uint32_t width, uint32_t bytesPerPixel)
+{
+    const uint32_t size = N ? N : bytesPerPixel;
+    const uint8_t *last = src + size_t(width - 1) * size;
+    for (uint32_t x = 0; x < width; x++)
+    {
+        std::memcpy(dst + size_t(x) * size, last - size_t(x) * size, N ? N : size);
+    }
+}
+
+// This function writes column x of a block of count lines as row x of the
+// destination. Reading the block column by column touches count cache lines
+// that stay hot for the next s_RunBytes / size columns, so the block is
+// the tile of the transposition. Without ascending the lines go into the
+// row last to first.
+template <uint32_t N>
+static void TransposeBlock(const uint8_t *__restrict block, size_t lineBytes, uint32_t count, uint32_t width,
+                           uint32_t bytesPerPixel, bool mirrorX, bool ascending,
+                           uint8_t *__restrict dst, size_t bytesPerLine)
+{
+    const uint32_t size = N ? N : bytesPerPixel;
+    const ptrdiff_t lineStep = ascending ? ptrdiff_t(lineBytes) : -ptrdiff_t(lineBytes);
+    const uint8_t *firstLine = ascending ? block : block + size_t(count - 1) * lineBytes;
+    for (uint32_t x = 0; x < width; x++)
+    {
+        uint8_t *row = dst + size_t(mirrorX ? width - 1 - x : x) * bytesPerLine;
+        const uint8_t *src = firstLine + size_t(x) * size;
+        for (uint32_t j = 0; j < count; j++, src += lineStep)
+        {
+            std::memcpy(row + size_t(j) * size, src, N ? N : size);
+        }
+    }
+}
+
+bool Orientation::IsIdentity() const
+{
+    return !flipX && !flipY && rotation == Rotation::None;
+}
+
+bool Orientation::SwapsAxes() const
+{
+    return rotation == Rotation::Rotate90 || rotation == Rotation::Rotate270;
+}
+
+int Orientation::Degrees() const
+{
+    switch (rotation)
+    {
+    case Rotation::Rotate90:  return 90;
+    case Rotation::Rotate180: return 180;
+    case Rotation::Rotate270: return 270;
+    case Rotation::None:
+    default:                  return 0;
+    }
+}
+
+Rotation ImageOrientation::RotationFromDegrees(int degrees)
+{
+    switch (((degrees / 90) % 4 + 4) % 4)
+    {
+    case 1:  return Rotation::Rotate90;
+    case 2:  return Rotation::Rotate180;
+    case 3:  return Rotation::Rotate270;
+    default: return Rotation::None;
+    }
+}
+
+void ImageOrientation::OrientedSize(const Orientation &orientation, uint32_t width, uint32_t height,
+                                    uint32_t &orientedWidth, uint32_t &orientedHeight)
+{
+    orientedWidth = orientation.SwapsAxes() ? height : width;
+    orientedHeight = orientation.SwapsAxes() ? width : height;
+}
+
+// A half turn is both flips, and three quarter turns are a quarter turn
+// after a half turn, so every orientation is a mirroring of the source
+// optionally followed by one clockwise quarter turn
+static void Canonical(const Orientation &orientation, bool &mirrorX, bool &mirrorY, bool &transpose)
+{
+    const bool halfTurn = orientation.rotation == Rotation::Rotate180 || orientation.rotation == Rotation::Rotate270;
+    mirrorX = orientation.flipX != halfTurn;
+    mirrorY = orientation.flipY != halfTurn;
+    transpose = orientation.SwapsAxes();
+}
+
+void ImageOrientation::MapToFrame(const Orientation &orientation, uint32_t width, uint32_t height, double &x, double &y)
+{
+    bool mirrorX, mirrorY, transpose;
+    Canonical(orientation, mirrorX, mirrorY, transpose);
+
+    // Undo the quarter turn, which took (x, y) to (height - y, x)
+    double mirroredX = x;
+    double mirroredY = y;
+    if (transpose)
+    {
+        mirroredX = y;
+        mirroredY = height - x;
+    }
+    x = mirrorX ? width - mirroredX : mirroredX;
+    y = mirrorY ? height - mirroredY : mirroredY;
+}
+
+Orientation ImageOrientation::Current()
+{
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    return s_Current;
+}
+
+void ImageOrientation::SetCurrent(const Orientation &orientation)
+{
+    std::lock_guard<std::mutex> lock(s_CurrentMutex);
+    s_Current = orientation;
+}
+
+LineWriter::LineWriter(const Orientation &orientation, uint32_t width, uint32_t height,
+                       uint32_t bytesPerPixel, uint8_t *dst, size_t bytesPerLine)
+    : m_Width(width)
+    , m_Height(height)
+    , m_BytesPerPixel(bytesPerPixel)
+    , m_Dst(dst)
+    , m_BytesPerLine(bytesPerLine)
+    , m_BlockLines(std::max(s_MinBlockLines, s_RunBytes / std::max(bytesPerPixel, 1u)))
+{
+    Canonical(orientation, m_MirrorX, m_MirrorY, m_Transpose);
+}
+
+uint8_t *LineWriter::Row(uint32_t row) const
+{
+    return m_Dst + size_t(row) * m_BytesPerLine;
+}
+
+void LineWriter::StoreReversed(const uint8_t *line, uint32_t y) const
+{
+    uint8_t *dst = Row(m_MirrorY ? m_Height - 1 - y : y);
+    switch (m_BytesPerPixel)
+    {
+    case 1:  ReverseLine<1>(line, dst, m_Width, m_BytesPerPixel); break;
+    case 2:  ReverseLine<2>(line, dst, m_Width, m_BytesPerPixel); break;
+    case 3:  ReverseLine<3>(line, dst, m_Width, m_BytesPerPixel); break;
+    case 4:  ReverseLine<4>(line, dst, m_Width, m_BytesPerPixel); break;
+    case 8:  ReverseLine<8>(line, dst, m_Width, m_BytesPerPixel); break;
+    default: ReverseLine<0>(line, dst, m_Width, m_BytesPerPixel); break;
+    }
+}
+
+void LineWriter::StoreTransposed(const uint8_t *block, uint32_t first, uint32_t count) const
+{
+    // Line y becomes column height - 1 - y, or column y when mirrored
+    // vertically, so the block fills count adjacent columns
+    const uint32_t column = m_MirrorY ? first : m_Height - first - count;
+    uint8_t *dst = m_Dst + size_t(column) * m_BytesPerPixel;
+    const size_t lineBytes = size_t(m_Width) * m_BytesPerPixel;
+    switch (m_BytesPerPixel)
+    {
+    case 1:  TransposeBlock<1>(block, lineBytes, count, m_Width, 1, m_MirrorX, m_MirrorY, dst, m_BytesPerLine); break;
+    case 2:  TransposeBlock<2>(block, lineBytes, count, m_Width, 2, m_MirrorX, m_MirrorY, dst, m_BytesPerLine); break;
+    case 3:  TransposeBlock<3>(block, lineBytes, count, m_Width, 3, m_MirrorX, m_MirrorY, dst, m_BytesPerLine); break;
+    case 4:  TransposeBlock<4>(block, lineBytes, count, m_Width, 4, m_MirrorX, m_MirrorY, dst, m_BytesPerLine); break;
+    case 8:  TransposeBlock<8>(block, lineBytes, count, m_Width, 8, m_MirrorX, m_MirrorY, dst, m_BytesPerLine); break;
+    default: TransposeBlock<0>(block, lineBytes, count, m_Width, m_BytesPerPixel, m_MirrorX, m_MirrorY, dst, m_BytesPerLine); break;
+    }
+}
+
+LineWriter::Band::Band(const LineWriter &writer)
+    : m_Writer(writer)
+    , m_Scratch(nullptr)
+    , m_First(0)
+    , m_Count(0)
+{
+    const size_t lineBytes = size_t(writer.m_Width) * writer.m_BytesPerPixel;
+    if (writer.m_Transpose)
+    {
+        m_Scratch = Scratch(lineBytes * writer.m_BlockLines);
+    }
+    else if (writer.m_MirrorX)
+    {
+        m_Scratch = Scratch(lineBytes);
+    }
+}
+
+LineWriter::Band::~Band()
+{
+    Flush();
+}
+
+uint8_t *LineWriter::Band::Line(uint32_t y)
+{
+    if (m_Writer.m_Transpose)
+    {
+        // A block holds consecutive lines only
+        if (m_Count > 0 && y != m_First + m_Count)
+        {
+            Flush();
+        }
+        if (m_Count == 0)
+        {
+            m_First = y;
+        }
+        return m_Scratch + size_t(m_Count) * m_Writer.m_Width * m_Writer.m_BytesPerPixel;
+    }
+    if (m_Writer.m_MirrorX)
+    {
+        return m_Scratch;
+    }
+    return m_Writer.Row(m_Writer.m_MirrorY ? m_Writer.m_Height - 1 - y : y);
+}
+
+void LineWriter::Band::Commit(uint32_t y)
+{
+    if (m_Writer.m_Transpose)
+    {
+        if (++m_Count == m_Writer.m_BlockLines)
+        {
+            Flush();
+        }
+    }
+    else if (m_Writer.m_MirrorX)
+    {
+        m_Writer.StoreReversed(m_Scratch, y);
+    }
+}
+
+void LineWriter::Band::Flush()
+{
+    if (m_Count > 0)
+    {
+        m_Writer.StoreTransposed(m_Scratch, m_First, m_Count);
+        m_Count = 0;
+    }
+}
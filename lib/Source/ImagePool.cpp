@@ -0,0 +1,33 @@
+#include "ImagePool.h"
+
+ImagePool::ImagePool(size_t size)
+    : m_Images(size > 0 ? size : 1)
+{
+}
+
+QImage &ImagePool::Acquire()
+{
+    for (size_t i = 0; i < m_Images.size(); ++i)
+    {
+        size_t const index = (m_Next + i) % m_Images.size();
+        QImage &image = m_Images[index];
+        if (image.isNull() || image.isDetached())
+        {
+            m_Next = (index + 1) % m_Images.size();
+            return image;
+        }
+    }
+
+    QImage &image = m_Images[m_Next];
+    m_Next = (m_Next + 1) % m_Images.size();
+    return image;
+}
+
+void ImagePool::Clear()
+{
+    for (auto &image : m_Images)
+    {
+        image = QImage();
+    }
+    m_Next = 0;
+}
@@ -17,1204 +17,1300 @@
 
 
 #include "ImageTransform.h"
-#include "Logger.h"
-#include "videodev2_av.h"
-
-#include <regex>
+#include "PixelFormatRegistry.h"
+#ifdef HAS_LIBJPEG
+#include "JpegDecoder.h"
+#endif
 
-#include <QFile>
-#include <QPixmap>
+#include <QBuffer>
+#include <QImageReader>
 
+#include <algorithm>
+#include <atomic>
 #include <cstring>
-#include <linux/videodev2.h>
+#include <vector>
 
-#define CLIP(color) (unsigned char)(((color) > 0xFF) ? 0xff : (((color) < 0) ? 0 : (color)))
+using namespace PixelFormatRegistry;
+using ImageTransform::ConversionOptions;
+using Demosaic::CfaCell;
+using ImageOrientation::LineWriter;
+using ImageOrientation::Orientation;
 
-static std::unique_ptr<uint8_t[]> s_ConversionBuffer;
+// Scratch memory for intermediate 8 bit planes. Every converting thread
+// (renderer, stream server, snapshot) gets its own buffer.
+static thread_local std::vector<uint8_t> s_ConversionBuffer;
 
-int g_shift10Bit = -1;
-int g_shift12Bit = -1;
+static uint8_t *ConversionBuffer(size_t size)
+{
+    if (s_ConversionBuffer.size() < size)
+    {
+        s_ConversionBuffer.resize(size);
+    }
+    return s_ConversionBuffer.data();
+}
 
+// This function makes dst a writable image of the requested geometry. The
+// existing pixel memory is reused unless its shape differs or another
+// QImage (e.g. the renderer's copy of the previous frame) still shares it.
+static void PrepareImage(QImage &dst, uint32_t width, uint32_t height, QImage::Format format)
+{
+    if (dst.width() != int(width) || dst.height() != int(height) ||
+        dst.format() != format || !dst.isDetached())
+    {
+        dst = QImage(width, height, format);
+    }
+}
 
-static void ConvertMono12gToRGB24(const void *sourceBuffer, uint32_t width,
-                           uint32_t height, const void *destBuffer)
+// This function makes dst a writable image for a width x height result in
+// the given orientation and returns the writer that puts the lines in place
+static LineWriter PrepareOrientedImage(QImage &dst, uint32_t width, uint32_t height, QImage::Format format,
+                                       const Orientation &orientation)
 {
-    unsigned char *destdata = (unsigned char *)destBuffer;
-    unsigned char *srcdata = (unsigned char *)sourceBuffer;
-    uint32_t count = 0;
-    uint32_t bytesPerLine = width * 1.5;
+    uint32_t orientedWidth = width;
+    uint32_t orientedHeight = height;
+    ImageOrientation::OrientedSize(orientation, width, height, orientedWidth, orientedHeight);
+    PrepareImage(dst, orientedWidth, orientedHeight, format);
+    return LineWriter(orientation, width, height, uint32_t(dst.depth() / 8), dst.bits(), dst.bytesPerLine());
+}
+
+// JPEG frames are decoded here first when they have to be oriented, the
+// decoder stores its lines itself
+static thread_local QImage s_DecodedImage;
 
-    for (unsigned int i = 0; i < height; i++)
+// Region conversions that need a neighborhood or an aligned start convert
+// a slightly larger part of the frame here first
+static thread_local QImage s_RegionImage;
+
+// This function writes the part rect of an image that was converted without
+// a LineWriter into dst in the given orientation
+static void OrientImage(const QImage &source, const QRect &rect, QImage &dst, const Orientation &orientation)
+{
+    const size_t bytesPerPixel = size_t(source.depth() / 8);
+    const size_t lineBytes = size_t(rect.width()) * bytesPerPixel;
+    LineWriter writer = PrepareOrientedImage(dst, rect.width(), rect.height(), source.format(), orientation);
+    LineWriter::Band band(writer);
+    for (int y = 0; y < rect.height(); y++)
     {
-        for (unsigned int ii = 0; ii < bytesPerLine; ii++)
-        {
-            if (((count + 1) % 3) != 0)
-            {
-                *destdata++ = *srcdata;
-                *destdata++ = *srcdata;
-                *destdata++ = *srcdata;
-            }
-            count++;
-            srcdata++;
-        }
+        std::memcpy(band.Line(y), source.constScanLine(rect.y() + y) + rect.x() * bytesPerPixel, lineBytes);
+        band.Commit(y);
     }
 }
 
-static void ConvertMono10gToRGB24(const void *sourceBuffer, uint32_t width,
-                           uint32_t height, const void *destBuffer)
+static void OrientImage(const QImage &source, QImage &dst, const Orientation &orientation)
 {
-    unsigned char *destdata = (unsigned char *)destBuffer;
-    unsigned char *srcdata = (unsigned char *)sourceBuffer;
-    uint32_t count = 0;
-    uint32_t bytesPerLine = width * 1.25;
+    OrientImage(source, source.rect(), dst, orientation);
+}
 
-    for (unsigned int i = 0; i < height; i++)
+// This function returns the validated preview downscale factor (1, 2, 4 or 8)
+static uint32_t DownscaleStep(const ConversionOptions &options)
+{
+    switch (options.downscale)
     {
-        for (unsigned int ii = 0; ii < bytesPerLine; ii++)
-        {
-            if (((count + 1) % 5) != 0)
-            {
-                *destdata++ = *srcdata;
-                *destdata++ = *srcdata;
-                *destdata++ = *srcdata;
-            }
-            count++;
-            srcdata++;
-        }
+    case 2:
+    case 4:
+    case 8:
+        return options.downscale;
+    default:
+        return 1;
     }
 }
 
-static void ConvertRAW12gToRAW8(const void *sourceBuffer, uint32_t width,
-                         uint32_t height, const void *destBuffer)
+// Number of output samples when only every step-th input sample is kept
+static uint32_t ScaledExtent(uint32_t extent, uint32_t step)
 {
-    unsigned char *destdata = (unsigned char *)destBuffer;
-    unsigned char *srcdata = (unsigned char *)sourceBuffer;
-    uint32_t count = 0;
-    uint32_t bytesPerLine = width * 1.5;
+    return extent >= step ? extent / step : 1;
+}
 
-    for (unsigned int i = 0; i < height; i++)
+template <typename T>
+static void DecimateLine(const T *src, T *dst, uint32_t count, uint32_t step)
+{
+    for (uint32_t x = 0; x < count; x++)
     {
-        for (unsigned int ii = 0; ii < bytesPerLine; ii++)
-        {
-            if (((count + 1) % 3) != 0)
-            {
-                *destdata++ = *srcdata;
-            }
-            count++;
-            srcdata++;
-        }
+        dst[x] = src[size_t(x) * step];
     }
 }
 
-static void ConvertRAW10gToRAW8(const void *sourceBuffer, uint32_t width,
-                         uint32_t height, const void *destBuffer)
+// Describes the frame that is being converted, or the part of it that a
+// region conversion covers
+struct SourceFrame
+{
+    const uint8_t *data;
+    size_t length;
+    uint32_t width;
+    uint32_t height;
+    uint32_t payloadSize;
+    uint32_t bytesPerLine;
+
+    // First chroma plane of planar and semi-planar frames, a second plane
+    // follows chromaPlaneSize bytes later
+    const uint8_t *chroma;
+    size_t chromaPlaneSize;
+};
+
+// This function reduces one line of samples to their 8 most significant bits
+//
+// Parameters:
+// [in] (const uint8_t *) src - first byte of the line
+// [in] (uint8_t *) dst - destination with room for width bytes
+// [in] (uint32_t) width - number of samples
+// [in] (uint8_t) shift - right shift for 16 bit containers
+template <SamplePacking P>
+static void UnpackLine8(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t shift);
+
+template <>
+void UnpackLine8<SamplePacking::Word16>(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t shift)
 {
-    unsigned char *destdata = (unsigned char *)destBuffer;
-    unsigned char *srcdata = (unsigned char *)sourceBuffer;
-    uint32_t count = 0;
-    uint32_t bytesPerLine = width * 1.25;
+    for (uint32_t x = 0; x < width; x++)
+    {
+        uint16_t val16;
+        std::memcpy(&val16, src + 2 * x, sizeof(val16));
+        dst[x] = (val16 >> shift) & 0xFF;
+    }
+}
 
-    for (unsigned int i = 0; i < height; i++)
+template <>
+void UnpackLine8<SamplePacking::Csi2Packed10>(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t)
+{
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4, src += 5)
     {
-        for (unsigned int ii = 0; ii < bytesPerLine; ii++)
-        {
-            if (((count + 1) % 5) != 0)
-            {
-                *destdata++ = *srcdata;
-            }
-            count++;
-            srcdata++;
-        }
+        dst[x + 0] = src[0];
+        dst[x + 1] = src[1];
+        dst[x + 2] = src[2];
+        dst[x + 3] = src[3];
+    }
+    for (uint32_t i = 0; x < width; x++, i++)
+    {
+        dst[x] = src[i];
     }
 }
 
-static void ConvertRAW10ToRAW8(const void *sourceBuffer, uint32_t width,
-                        uint32_t height, const void *destBuffer)
+template <>
+void UnpackLine8<SamplePacking::Csi2Packed12>(const uint8_t *src, uint8_t *dst, uint32_t width, uint8_t)
 {
-    unsigned char *destdata = (unsigned char *)destBuffer;
-    unsigned char *srcdata = (unsigned char *)sourceBuffer;
-    uint32_t count = 0;
-    uint32_t bytesPerLine = width * 2;
+    uint32_t x = 0;
+    for (; x + 2 <= width; x += 2, src += 3)
+    {
+        dst[x + 0] = src[0];
+        dst[x + 1] = src[1];
+    }
+    if (x < width)
+    {
+        dst[x] = src[0];
+    }
+}
 
-    for (unsigned int i = 0; i < height; i++)
+// This function expands one line of samples to 16 bit, most significant bit first
+//
+// Parameters:
+// [in] (const uint8_t *) src - first byte of the line
+// [in] (uint16_t *) dst - destination with room for width samples
+// [in] (uint32_t) width - number of samples
+// [in] (uint8_t) shift - right shift for 16 bit containers
+template <SamplePacking P>
+static void UnpackLine16(const uint8_t *src, uint16_t *dst, uint32_t width, uint8_t shift);
+
+template <>
+void UnpackLine16<SamplePacking::Word16>(const uint8_t *src, uint16_t *dst, uint32_t width, uint8_t shift)
+{
+    // shift moves the 8 MSBs into the low byte, so 8 - shift aligns the MSB to bit 15
+    const int align = 8 - shift;
+    for (uint32_t x = 0; x < width; x++)
     {
-        for (unsigned int ii = 0; ii < bytesPerLine; ii++)
-        {
-            if (((count + 1) % 2) != 0)
-            {
-                *destdata++ = *srcdata;
-            }
-            count++;
-            srcdata++;
-        }
+        uint16_t val16;
+        std::memcpy(&val16, src + 2 * x, sizeof(val16));
+        dst[x] = uint16_t(val16 << align);
+    }
+}
+
+template <>
+void UnpackLine16<SamplePacking::Csi2Packed10>(const uint8_t *src, uint16_t *dst, uint32_t width, uint8_t)
+{
+    uint32_t x = 0;
+    for (; x + 4 <= width; x += 4, src += 5)
+    {
+        const uint8_t lsb = src[4];
+        dst[x + 0] = uint16_t((src[0] << 8) | ((lsb << 6) & 0xC0));
+        dst[x + 1] = uint16_t((src[1] << 8) | ((lsb << 4) & 0xC0));
+        dst[x + 2] = uint16_t((src[2] << 8) | ((lsb << 2) & 0xC0));
+        dst[x + 3] = uint16_t((src[3] << 8) | (lsb & 0xC0));
+    }
+    for (uint32_t i = 0; x < width; x++, i++)
+    {
+        dst[x] = uint16_t(src[i] << 8);
     }
 }
 
-static void v4lconvert_bayer8_to_rgb24(const unsigned char *bayer, unsigned char *bgr,
-                                int width, int height,
-                                const unsigned int stride, unsigned int pixfmt);
+template <>
+void UnpackLine16<SamplePacking::Csi2Packed12>(const uint8_t *src, uint16_t *dst, uint32_t width, uint8_t)
+{
+    uint32_t x = 0;
+    for (; x + 2 <= width; x += 2, src += 3)
+    {
+        const uint8_t lsb = src[2];
+        dst[x + 0] = uint16_t((src[0] << 8) | ((lsb << 4) & 0xF0));
+        dst[x + 1] = uint16_t((src[1] << 8) | (lsb & 0xF0));
+    }
+    if (x < width)
+    {
+        dst[x] = uint16_t(src[0] << 8);
+    }
+}
 
-static void  ConvertJetsonMono16ToRGB24(const void *sourceBuffer, uint32_t width, uint32_t height, QImage& dst, int shift, size_t bpl)
+#if QT_VERSION < QT_VERSION_CHECK(5,14,0)
+static void v4lconvert_swap_rgb(const unsigned char *src, unsigned char *dst,
+                         int width, int height, int offset)
 {
-    dst = QImage(width, height, QImage::Format_RGB888);
-    uint8_t *destdata = dst.bits();
-    auto const *srcdata = reinterpret_cast<uint8_t const*>(sourceBuffer);
+    int i,j;
+
 
-    for (unsigned int y = 0; y < height; y++) 
+    for (j = 0;j < height;j++)
     {
-        for (unsigned int x = 0; x < width; x++) {
-            auto const offs = y*bpl + 2*x;
-            auto const val16 = reinterpret_cast<uint16_t const*>(&srcdata[offs]);
-            uint8_t const val = (*val16 >> shift) & 0xFF;
-            *destdata++ = val;
-            *destdata++ = val;
-            *destdata++ = val;
+        for (i = 0; i < width; i++)
+        {
+            unsigned char tmp0, tmp1;
+            tmp0 = *src++;
+            tmp1 = *src++;
+            *dst++ = *src++;
+            *dst++ = tmp1;
+            *dst++ = tmp0;
         }
+        src += offset;
+    }
+}
+#endif
+
+static void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
+                                int width)
+{
+    for (int j = 0; j < width; j++)
+    {
+        unsigned short tmp;
+        std::memcpy(&tmp, src, sizeof(tmp));
+
+        /* Original format: rrrrrggg gggbbbbb */
+        *dest++ = 0xf8 & (tmp >> 8);
+        *dest++ = 0xfc & (tmp >> 3);
+        *dest++ = 0xf8 & (tmp << 3);
+
+        src += 2;
     }
 }
 
+static void v4lconvert_xrgb32_to_argb32(const unsigned char *src, unsigned char *dest,
+                                int width)
+{
+    for (int x = 0; x < width; ++x)
+    {
+        uint32_t pixel;
+        std::memcpy(&pixel, src + 4 * x, sizeof(pixel));
+        pixel = __bswap_32(pixel) | 0xFF000000;
+        std::memcpy(dest + 4 * x, &pixel, sizeof(pixel));
+    }
+}
 
+// Fixed point Y'CbCr to R'G'B' coefficient with 12 fractional bits, split
+// into its multiples of 1/64 and the 1/4096 below them. The products of 8 bit
+// samples with either part fit 16 bit lanes.
+struct YuvCoefficient
+{
+    int16_t high;
+    int16_t low;
+};
 
-static void ConvertJetsonBayer16ToRGB24(const void *sourceBuffer, uint32_t width, uint32_t height, QImage& dst, int shift, unsigned int pixfmt, size_t bpl)
+struct YuvCoefficients
 {
-    uint8_t *destdata = s_ConversionBuffer.get();
-    auto const *srcdata = reinterpret_cast<uint8_t const*>(sourceBuffer);
+    YuvCoefficient y;   // luma gain
+    int16_t yOffset;    // luma black level
+    YuvCoefficient rv;
+    YuvCoefficient gu;
+    YuvCoefficient gv;
+    YuvCoefficient bu;
+};
+
+static constexpr YuvCoefficient ToFixed(double value)
+{
+    const int32_t fixed = int32_t(value * 4096.0 + 0.5);
+    return { int16_t(fixed >> 6), int16_t(fixed & 63) };
+}
 
-    for (unsigned int y = 0; y < height; y++) 
+// kr and kb are the luma weights of red and blue. Limited range stretches
+// 16..235 luma and 16..240 chroma to the full 8 bit range.
+static constexpr YuvCoefficients MakeYuvCoefficients(double kr, double kb, bool limited)
+{
+    const double kg = 1.0 - kr - kb;
+    const double chromaGain = limited ? 255.0 / 224.0 : 1.0;
+    return { ToFixed(limited ? 255.0 / 219.0 : 1.0), int16_t(limited ? 16 : 0),
+             ToFixed(2.0 * (1.0 - kr) * chromaGain),
+             ToFixed(2.0 * kb * (1.0 - kb) / kg * chromaGain),
+             ToFixed(2.0 * kr * (1.0 - kr) / kg * chromaGain),
+             ToFixed(2.0 * (1.0 - kb) * chromaGain) };
+}
+
+static constexpr YuvCoefficients s_Bt601Limited = MakeYuvCoefficients(0.299, 0.114, true);
+static constexpr YuvCoefficients s_Bt601Full = MakeYuvCoefficients(0.299, 0.114, false);
+static constexpr YuvCoefficients s_Bt709Limited = MakeYuvCoefficients(0.2126, 0.0722, true);
+static constexpr YuvCoefficients s_Bt709Full = MakeYuvCoefficients(0.2126, 0.0722, false);
+
+static const YuvCoefficients &YuvCoefficientsFor(const ConversionOptions &options)
+{
+    const bool full = options.yuvRange == ImageTransform::YuvRange::Full;
+    if (options.yuvMatrix == ImageTransform::YuvMatrix::Bt709)
     {
-        for (unsigned int x = 0; x < width; x++) 
-        {
-            auto const offs = y*bpl + 2*x;
-            auto const val16 = reinterpret_cast<uint16_t const*>(&srcdata[offs]);
-            uint8_t const val = (*val16 >> shift) & 0xFF;
-            *destdata++ = val;
-        }
+        return full ? s_Bt709Full : s_Bt709Limited;
     }
+    return full ? s_Bt601Full : s_Bt601Limited;
+}
+
+// This function returns sample * coefficient with 6 fractional bits. The
+// scalar and the vector code share it, so both give the same results.
+template <typename T>
+static inline T MulFixed(T sample, const YuvCoefficient &c)
+{
+    return sample * c.high + ((sample * c.low + 32) >> 6);
+}
+
+// This function rounds a channel with 6 fractional bits to a byte
+static inline uint8_t FixedToByte(int32_t value)
+{
+    return uint8_t(std::min(std::max((value + 32) >> 6, 0), 255));
+}
 
-    dst = QImage(width, height, QImage::Format_RGB888);
-    v4lconvert_bayer8_to_rgb24(s_ConversionBuffer.get(), dst.bits(), width, height, width, pixfmt);
+// When the vector kernels are off, everything runs through the scalar code
+static std::atomic<bool> s_VectorKernels{true};
+
+// Eight 16 bit lanes, one SSE2 or NEON register. The compiler lowers the
+// arithmetic and the shuffles to whatever the target supports. Bytes and
+// words are reinterpreted as wider lanes in little endian order.
+typedef uint8_t Uint8x16 __attribute__((vector_size(16)));
+typedef int16_t Int16x8 __attribute__((vector_size(16)));
+typedef uint16_t Uint16x8 __attribute__((vector_size(16)));
+typedef uint32_t Uint32x4 __attribute__((vector_size(16)));
+
+// Pixel pairs per iteration of the vector kernel
+static constexpr uint32_t s_YuvBlockPairs = 8;
+
+// The sum of a luma and a chroma term with 6 fractional bits stays within
+// -20480..45055, more than an int16_t holds. Offset by s_YuvBias it is formed
+// in unsigned lanes, where shifting and clamping gives FixedToByte's result.
+static constexpr uint16_t s_YuvBias = 320 << 6;
+
+static inline Uint16x8 FixedToLanes(Int16x8 luma, Int16x8 chroma)
+{
+    const Int16x8 low = Int16x8{} + int16_t(320);
+    const Int16x8 high = Int16x8{} + int16_t(320 + 255);
+    Int16x8 value = Int16x8((Uint16x8(luma) + Uint16x8(chroma) + uint16_t(s_YuvBias + 32)) >> 6);
+    value = value < low ? low : value;
+    value = value > high ? high : value;
+    return Uint16x8(value - low);
 }
 
-/* inspired by OpenCV's Bayer decoding */
-static void v4lconvert_border_bayer8_line_to_bgr24(const unsigned char *bayer, const unsigned char *adjacent_bayer,
-                                                   unsigned char *bgr, int width, const int start_with_green,
-                                                   const int blue_line)
+static inline Uint8x16 LoadBytes(const uint8_t *p, size_t count = 16)
 {
-    int t0, t1;
+    Uint8x16 v = {};
+    std::memcpy(&v, p, count);
+    return v;
+}
 
-    if (start_with_green)
+// This function widens the first or the second eight bytes to 16 bit lanes
+template <int Half>
+static inline Uint16x8 WidenBytes(Uint8x16 v)
+{
+    const Uint8x16 zero = {};
+    return Half == 0 ? Uint16x8(__builtin_shufflevector(v, zero, 0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23))
+                     : Uint16x8(__builtin_shufflevector(v, zero, 8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31));
+}
+
+// One sample per pixel pair in v, repeated for both pixels of the first or
+// the second four pairs
+template <int Half>
+static inline Uint16x8 RepeatPairs(Uint16x8 v)
+{
+    return Half == 0 ? __builtin_shufflevector(v, v, 0, 0, 1, 1, 2, 2, 3, 3)
+                     : __builtin_shufflevector(v, v, 4, 4, 5, 5, 6, 6, 7, 7);
+}
+
+// The samples of sixteen pixels in pixel order, eight per half, with the
+// chroma of each pair repeated for both of its pixels
+struct YuvBlock
+{
+    Uint16x8 y[2];
+    Uint16x8 u[2];
+    Uint16x8 v[2];
+};
+
+// RGB888 of eight pixels in pixel order as the bytes R G B R of each pair in
+// the 32 bit lanes of x and the bytes G B in the low halves of those of z
+struct Rgb24Pairs
+{
+    Uint16x8 x;
+    Uint16x8 z;
+};
+
+static inline Rgb24Pairs PackRgb24(Uint16x8 r, Uint16x8 g, Uint16x8 b)
+{
+    const Uint32x4 r32 = Uint32x4(r);
+    const Uint32x4 g32 = Uint32x4(g);
+    const Uint32x4 b32 = Uint32x4(b);
+    return { Uint16x8((r32 & 0xFFFF) | ((g32 & 0xFFFF) << 8) | ((b32 & 0xFFFF) << 16) | ((r32 >> 16) << 24)),
+             Uint16x8((g32 >> 16) | ((b32 >> 16) << 8)) };
+}
+
+// One image line as a sequence of pixel pairs that share their chroma. Pair
+// k consists of the luma samples y0[k * lumaStep] and y1[k * lumaStep] and
+// the chroma samples u[k * chromaStep] and v[k * chromaStep].
+struct YuvLine
+{
+    const uint8_t *y0;
+    const uint8_t *y1;
+    const uint8_t *u;
+    const uint8_t *v;
+    uint32_t lumaStep;
+    uint32_t chromaStep;
+
+    void Skip(uint32_t pairs)
     {
-        /* First pixel */
-        if (blue_line)
-        {
-            *bgr++ = bayer[1];
-            *bgr++ = bayer[0];
-            *bgr++ = adjacent_bayer[0];
-        }
-        else
+        y0 += size_t(pairs) * lumaStep;
+        y1 += size_t(pairs) * lumaStep;
+        u += size_t(pairs) * chromaStep;
+        v += size_t(pairs) * chromaStep;
+    }
+};
+
+// This function converts count pixel pairs to 2 * count RGB888 pixels. Without
+// Pairs only the first pixel of each pair is converted, which is what odd
+// widths and decimated previews need.
+template <bool Pairs>
+static void YuvLineToRgb24(const YuvLine &line, uint32_t count, const YuvCoefficients &c, uint8_t *dest)
+{
+    for (uint32_t k = 0; k < count; k++)
+    {
+        const size_t luma = size_t(k) * line.lumaStep;
+        const size_t chroma = size_t(k) * line.chromaStep;
+        const int32_t u = int32_t(line.u[chroma]) - 128;
+        const int32_t v = int32_t(line.v[chroma]) - 128;
+        const int32_t r = MulFixed(v, c.rv);
+        const int32_t g = -MulFixed(u, c.gu) - MulFixed(v, c.gv);
+        const int32_t b = MulFixed(u, c.bu);
+
+        const int32_t y0 = MulFixed(int32_t(line.y0[luma]) - c.yOffset, c.y);
+        *dest++ = FixedToByte(y0 + r);
+        *dest++ = FixedToByte(y0 + g);
+        *dest++ = FixedToByte(y0 + b);
+        if (Pairs)
         {
-            *bgr++ = adjacent_bayer[0];
-            *bgr++ = bayer[0];
-            *bgr++ = bayer[1];
+            const int32_t y1 = MulFixed(int32_t(line.y1[luma]) - c.yOffset, c.y);
+            *dest++ = FixedToByte(y1 + r);
+            *dest++ = FixedToByte(y1 + g);
+            *dest++ = FixedToByte(y1 + b);
         }
-        /* Second pixel */
-        t0 = (bayer[0] + bayer[2] + adjacent_bayer[1] + 1) / 3;
-        t1 = (adjacent_bayer[0] + adjacent_bayer[2] + 1) >> 1;
-        if (blue_line)
+    }
+}
+
+// Byte offsets of the samples inside one packed 4:2:2 macro pixel
+template <SamplePacking P> struct Yuv422Layout;
+template <> struct Yuv422Layout<SamplePacking::Yuyv> { enum { Y0 = 0, U = 1, Y1 = 2, V = 3 }; };
+template <> struct Yuv422Layout<SamplePacking::Uyvy> { enum { U = 0, Y0 = 1, V = 2, Y1 = 3 }; };
+template <> struct Yuv422Layout<SamplePacking::Vyuy> { enum { V = 0, Y0 = 1, U = 2, Y1 = 3 }; };
+template <> struct Yuv422Layout<SamplePacking::Yvyu> { enum { Y0 = 0, V = 1, Y1 = 2, U = 3 }; };
+
+// This function loads s_YuvBlockPairs pixel pairs, starting with pair first,
+// from contiguous memory. Packed and semi-planar chroma is split by masking
+// and shifting 16 bit lanes, planar chroma is repeated byte by byte.
+template <SamplePacking P>
+static inline YuvBlock LoadYuvBlock(const YuvLine &line, uint32_t first)
+{
+    YuvBlock block;
+    if constexpr (P == SamplePacking::Planar || P == SamplePacking::SemiPlanar)
+    {
+        const Uint8x16 luma = LoadBytes(line.y0 + 2 * size_t(first));
+        block.y[0] = WidenBytes<0>(luma);
+        block.y[1] = WidenBytes<1>(luma);
+        if constexpr (P == SamplePacking::Planar)
         {
-            *bgr++ = bayer[1];
-            *bgr++ = t0;
-            *bgr++ = t1;
+            const Uint8x16 u = LoadBytes(line.u + first, s_YuvBlockPairs);
+            const Uint8x16 v = LoadBytes(line.v + first, s_YuvBlockPairs);
+            const Uint8x16 uu = __builtin_shufflevector(u, u, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+            const Uint8x16 vv = __builtin_shufflevector(v, v, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7);
+            block.u[0] = WidenBytes<0>(uu);
+            block.u[1] = WidenBytes<1>(uu);
+            block.v[0] = WidenBytes<0>(vv);
+            block.v[1] = WidenBytes<1>(vv);
         }
         else
         {
-            *bgr++ = t1;
-            *bgr++ = t0;
-            *bgr++ = bayer[1];
+            const Uint16x8 pairs = Uint16x8(LoadBytes(std::min(line.u, line.v) + 2 * size_t(first)));
+            const Uint16x8 low = pairs & 0xFF;
+            const Uint16x8 high = pairs >> 8;
+            const Uint16x8 u = line.u < line.v ? low : high;
+            const Uint16x8 v = line.u < line.v ? high : low;
+            block.u[0] = RepeatPairs<0>(u);
+            block.u[1] = RepeatPairs<1>(u);
+            block.v[0] = RepeatPairs<0>(v);
+            block.v[1] = RepeatPairs<1>(v);
         }
-        bayer++;
-        adjacent_bayer++;
-        width -= 2;
     }
     else
     {
-        /* First pixel */
-        t0 = (bayer[1] + adjacent_bayer[0] + 1) >> 1;
-        if (blue_line)
+        // Each 16 bit lane holds a luma and a chroma sample, each 32 bit lane
+        // one pixel pair
+        using Layout = Yuv422Layout<P>;
+        const uint8_t *pixels = line.y0 - Layout::Y0 + 4 * size_t(first);
+        for (int half = 0; half < 2; half++)
         {
-            *bgr++ = bayer[0];
-            *bgr++ = t0;
-            *bgr++ = adjacent_bayer[1];
+            const Uint16x8 samples = Uint16x8(LoadBytes(pixels + 16 * half));
+            block.y[half] = Layout::Y0 == 0 ? samples & 0xFF : samples >> 8;
+            const Uint32x4 chroma = Uint32x4(Layout::Y0 == 0 ? samples >> 8 : samples & 0xFF);
+            const Uint32x4 even = chroma & 0xFFFF;
+            const Uint32x4 odd = chroma >> 16;
+            const Uint16x8 evenRepeated = Uint16x8(even | (even << 16));
+            const Uint16x8 oddRepeated = Uint16x8(odd | (odd << 16));
+            block.u[half] = Layout::U < Layout::V ? evenRepeated : oddRepeated;
+            block.v[half] = Layout::U < Layout::V ? oddRepeated : evenRepeated;
         }
-        else
-        {
-            *bgr++ = adjacent_bayer[1];
-            *bgr++ = t0;
-            *bgr++ = bayer[0];
-        }
-        width--;
     }
+    return block;
+}
 
-    if (blue_line)
+// This function converts the pixel pairs of a full resolution line in blocks
+// of s_YuvBlockPairs: contiguous loads, the arithmetic in 16 bit lanes and
+// three stores of interleaved RGB888.
+//
+// Returns:
+// (uint32_t) - pairs converted, the rest is left to YuvLineToRgb24
+template <SamplePacking P>
+static uint32_t YuvBlocksToRgb24(const YuvLine &line, uint32_t count, const YuvCoefficients &c, uint8_t *dest)
+{
+    uint32_t first = 0;
+    for (; first + s_YuvBlockPairs <= count; first += s_YuvBlockPairs)
     {
-        for (; width > 2; width -= 2)
+        const YuvBlock block = LoadYuvBlock<P>(line, first);
+
+        Rgb24Pairs rgb[2];
+        for (int half = 0; half < 2; half++)
         {
-            t0 = (bayer[0] + bayer[2] + 1) >> 1;
-            *bgr++ = t0;
-            *bgr++ = bayer[1];
-            *bgr++ = adjacent_bayer[1];
-            bayer++;
-            adjacent_bayer++;
-
-            t0 = (bayer[0] + bayer[2] + adjacent_bayer[1] + 1) / 3;
-            t1 = (adjacent_bayer[0] + adjacent_bayer[2] + 1) >> 1;
-            *bgr++ = bayer[1];
-            *bgr++ = t0;
-            *bgr++ = t1;
-            bayer++;
-            adjacent_bayer++;
+            const Int16x8 u = Int16x8(block.u[half]) - int16_t(128);
+            const Int16x8 v = Int16x8(block.v[half]) - int16_t(128);
+            const Int16x8 y = MulFixed(Int16x8(block.y[half]) - c.yOffset, c.y);
+            rgb[half] = PackRgb24(FixedToLanes(y, MulFixed(v, c.rv)),
+                                  FixedToLanes(y, -MulFixed(u, c.gu) - MulFixed(v, c.gv)),
+                                  FixedToLanes(y, MulFixed(u, c.bu)));
         }
+
+        // 24 words: the two of x and the one of z of each pair in turn
+        const Uint16x8 z = __builtin_shufflevector(rgb[0].z, rgb[1].z, 0, 2, 4, 6, 8, 10, 12, 14);
+        const Uint16x8 middle = __builtin_shufflevector(rgb[0].x, rgb[1].x, 6, 7, 8, 9, 10, 11, 12, 13);
+        const Uint16x8 words[3] = {
+            __builtin_shufflevector(rgb[0].x, z, 0, 1, 8, 2, 3, 9, 4, 5),
+            __builtin_shufflevector(middle, z, 10, 0, 1, 11, 2, 3, 12, 4),
+            __builtin_shufflevector(rgb[1].x, z, 3, 13, 4, 5, 14, 6, 7, 15),
+        };
+        std::memcpy(dest + size_t(first) * 6, words, sizeof(words));
     }
-    else
+    return first;
+}
+
+// Bytes per line of a chroma plane, rounded up for odd luma strides
+static uint32_t ChromaPlaneStride(const PixelFormatDescriptor &desc, uint32_t bytesPerLine)
+{
+    if (desc.packing == SamplePacking::SemiPlanar)
     {
-        for (; width > 2; width -= 2)
-        {
-            t0 = (bayer[0] + bayer[2] + 1) >> 1;
-            *bgr++ = adjacent_bayer[1];
-            *bgr++ = bayer[1];
-            *bgr++ = t0;
-            bayer++;
-            adjacent_bayer++;
-
-            t0 = (bayer[0] + bayer[2] + adjacent_bayer[1] + 1) / 3;
-            t1 = (adjacent_bayer[0] + adjacent_bayer[2] + 1) >> 1;
-            *bgr++ = t1;
-            *bgr++ = t0;
-            *bgr++ = bayer[1];
-            bayer++;
-            adjacent_bayer++;
-        }
+        return bytesPerLine;
     }
+    return (bytesPerLine + (1u << desc.chromaShiftX) - 1) >> desc.chromaShiftX;
+}
+
+static uint32_t ChromaPlaneHeight(const PixelFormatDescriptor &desc, uint32_t height)
+{
+    return (height + (1u << desc.chromaShiftY) - 1) >> desc.chromaShiftY;
+}
 
-    if (width == 2)
+template <SamplePacking P>
+static YuvLine YuvLineOf(const PixelFormatDescriptor &desc, const SourceFrame &frame, uint32_t line)
+{
+    const uint8_t *luma = frame.data + size_t(line) * frame.bytesPerLine;
+    if constexpr (P == SamplePacking::Planar || P == SamplePacking::SemiPlanar)
     {
-        /* Second to last pixel */
-        t0 = (bayer[0] + bayer[2] + 1) >> 1;
-        if (blue_line)
+        const uint32_t chromaStride = ChromaPlaneStride(desc, frame.bytesPerLine);
+        const size_t chromaLine = size_t(line >> desc.chromaShiftY) * chromaStride;
+        const uint8_t *firstChroma = frame.chroma;
+        if constexpr (P == SamplePacking::Planar)
         {
-            *bgr++ = t0;
-            *bgr++ = bayer[1];
-            *bgr++ = adjacent_bayer[1];
+            const uint8_t *secondChroma = firstChroma + frame.chromaPlaneSize;
+            const uint8_t *uPlane = desc.swapChroma ? secondChroma : firstChroma;
+            const uint8_t *vPlane = desc.swapChroma ? firstChroma : secondChroma;
+            return { luma, luma + 1, uPlane + chromaLine, vPlane + chromaLine, 2, 1 };
         }
         else
         {
-            *bgr++ = adjacent_bayer[1];
-            *bgr++ = bayer[1];
-            *bgr++ = t0;
-        }
-        /* Last pixel */
-        t0 = (bayer[1] + adjacent_bayer[2] + 1) >> 1;
-        if (blue_line)
-        {
-            *bgr++ = bayer[2];
-            *bgr++ = t0;
-            *bgr++ = adjacent_bayer[1];
-        }
-        else
-        {
-            *bgr++ = adjacent_bayer[1];
-            *bgr++ = t0;
-            *bgr++ = bayer[2];
+            const uint8_t *pairs = firstChroma + chromaLine;
+            return { luma, luma + 1, pairs + (desc.swapChroma ? 1 : 0), pairs + (desc.swapChroma ? 0 : 1), 2, 2 };
         }
     }
     else
     {
-        /* Last pixel */
-        if (blue_line)
-        {
-            *bgr++ = bayer[0];
-            *bgr++ = bayer[1];
-            *bgr++ = adjacent_bayer[1];
-        }
-        else
-        {
-            *bgr++ = adjacent_bayer[1];
-            *bgr++ = bayer[1];
-            *bgr++ = bayer[0];
-        }
+        using Layout = Yuv422Layout<P>;
+        return { luma + Layout::Y0, luma + Layout::Y1, luma + Layout::U, luma + Layout::V, 4, 4 };
     }
 }
 
-/* From libdc1394, which on turn was based on OpenCV's Bayer decoding */
-static void bayer8_to_rgbbgr24(const unsigned char *bayer, unsigned char *bgr,
-                               int width, int height, const unsigned int stride,
-                               unsigned int pixfmt, int start_with_green,
-                               int blue_line)
+template <SamplePacking P>
+static int ConvertYuv(const PixelFormatDescriptor &desc, const SourceFrame &frame, const ConversionOptions &options, QImage &dst)
 {
-    /* render the first line */
-    v4lconvert_border_bayer8_line_to_bgr24(bayer, bayer + stride, bgr, width,
-                                           start_with_green, blue_line);
-    bgr += width * 3;
+    const YuvCoefficients &coefficients = YuvCoefficientsFor(options);
+    const bool vector = s_VectorKernels.load(std::memory_order_relaxed);
 
-    /* reduce height by 2 because of the special case top/bottom line */
-    for (height -= 2; height; height--)
-    {
-        int t0, t1;
-        /* (width - 2) because of the border */
-        const unsigned char *bayer_end = bayer + (width - 2);
+    const uint32_t step = DownscaleStep(options);
+    const uint32_t outWidth = ScaledExtent(frame.width, step);
+    const uint32_t outHeight = ScaledExtent(frame.height, step);
 
-        if (start_with_green)
+    LineWriter writer = PrepareOrientedImage(dst, outWidth, outHeight, QImage::Format_RGB888, options.orientation);
+    LineWriter::Band band(writer);
+    for (uint32_t y = 0; y < outHeight; y++)
+    {
+        YuvLine line = YuvLineOf<P>(desc, frame, y * step);
+        uint8_t *dest = band.Line(y);
+        if (step == 1)
         {
-
-            t0 = (bayer[1] + bayer[stride * 2 + 1] + 1) >> 1;
-            /* Write first pixel */
-            t1 = (bayer[0] + bayer[stride * 2] + bayer[stride + 1] + 1) / 3;
-            if (blue_line)
-            {
-                *bgr++ = t0;
-                *bgr++ = t1;
-                *bgr++ = bayer[stride];
-            }
-            else
+            const uint32_t pairs = frame.width / 2;
+            const uint32_t blocks = vector ? YuvBlocksToRgb24<P>(line, pairs, coefficients, dest) : 0;
+            line.Skip(blocks);
+            YuvLineToRgb24<true>(line, pairs - blocks, coefficients, dest + size_t(blocks) * 6);
+            if (frame.width & 1)
             {
-                *bgr++ = bayer[stride];
-                *bgr++ = t1;
-                *bgr++ = t0;
+                // The last pixel of an odd line still has a complete chroma pair
+                line.Skip(pairs - blocks);
+                YuvLineToRgb24<false>(line, 1, coefficients, dest + size_t(pairs) * 6);
             }
-
-            /* Write second pixel */
-            t1 = (bayer[stride] + bayer[stride + 2] + 1) >> 1;
-            if (blue_line)
-            {
-                *bgr++ = t0;
-                *bgr++ = bayer[stride + 1];
-                *bgr++ = t1;
-            }
-            else
-            {
-                *bgr++ = t1;
-                *bgr++ = bayer[stride + 1];
-                *bgr++ = t0;
-            }
-            bayer++;
         }
         else
         {
-            /* Write first pixel */
-            t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-            if (blue_line)
-            {
-                *bgr++ = t0;
-                *bgr++ = bayer[stride];
-                *bgr++ = bayer[stride + 1];
-            }
-            else
-            {
-                *bgr++ = bayer[stride + 1];
-                *bgr++ = bayer[stride];
-                *bgr++ = t0;
-            }
+            // step is even, so every kept pixel is the first one of its pair
+            line.lumaStep *= step / 2;
+            line.chromaStep *= step / 2;
+            YuvLineToRgb24<false>(line, outWidth, coefficients, dest);
         }
+        band.Commit(y);
+    }
+    return 0;
+}
+
+template <SamplePacking P>
+static int ConvertMono(const PixelFormatDescriptor &desc, const SourceFrame &frame, const ConversionOptions &options, QImage &dst)
+{
+    const uint32_t step = DownscaleStep(options);
+    const uint32_t outWidth = ScaledExtent(frame.width, step);
+    const uint32_t outHeight = ScaledExtent(frame.height, step);
 
-        if (blue_line)
+    if constexpr (P == SamplePacking::Byte)
+    {
+        if (options.allowBorrow && step == 1 && options.orientation.IsIdentity())
         {
-            for (; bayer <= bayer_end - 2; bayer += 2)
-            {
-                t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-                      bayer[stride * 2 + 2] + 2) >>
-                     2;
-                t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-                      bayer[stride * 2 + 1] + 2) >>
-                     2;
-                *bgr++ = t0;
-                *bgr++ = t1;
-                *bgr++ = bayer[stride + 1];
-
-                t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-                t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-                *bgr++ = t0;
-                *bgr++ = bayer[stride + 2];
-                *bgr++ = t1;
-            }
+            dst = QImage(frame.data, frame.width, frame.height, frame.bytesPerLine, QImage::Format_Grayscale8);
+            return 0;
         }
-        else
+    }
+    else
+    {
+#if QT_VERSION >= QT_VERSION_CHECK(5,13,0)
+        if (options.fullDepth)
         {
-            for (; bayer <= bayer_end - 2; bayer += 2)
+            uint16_t *line = reinterpret_cast<uint16_t *>(ConversionBuffer(size_t(frame.width) * sizeof(uint16_t)));
+
+            LineWriter writer = PrepareOrientedImage(dst, outWidth, outHeight, QImage::Format_Grayscale16, options.orientation);
+            LineWriter::Band band(writer);
+            for (uint32_t y = 0; y < outHeight; y++)
             {
-                t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-                      bayer[stride * 2 + 2] + 2) >>
-                     2;
-                t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-                      bayer[stride * 2 + 1] + 2) >>
-                     2;
-                *bgr++ = bayer[stride + 1];
-                *bgr++ = t1;
-                *bgr++ = t0;
-
-                t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-                t1 = (bayer[stride + 1] + bayer[stride + 3] + 1) >> 1;
-                *bgr++ = t1;
-                *bgr++ = bayer[stride + 2];
-                *bgr++ = t0;
+                const uint8_t *src = frame.data + size_t(y) * step * frame.bytesPerLine;
+                uint16_t *dest = reinterpret_cast<uint16_t *>(band.Line(y));
+                if (step == 1)
+                {
+                    UnpackLine16<P>(src, dest, frame.width, desc.shift);
+                }
+                else
+                {
+                    UnpackLine16<P>(src, line, frame.width, desc.shift);
+                    DecimateLine(line, dest, outWidth, step);
+                }
+                band.Commit(y);
             }
+            return 0;
         }
+#endif
+    }
+
+    uint8_t *line = ConversionBuffer(frame.width);
 
-        if (bayer < bayer_end)
+    LineWriter writer = PrepareOrientedImage(dst, outWidth, outHeight, QImage::Format_Grayscale8, options.orientation);
+    LineWriter::Band band(writer);
+    for (uint32_t y = 0; y < outHeight; y++)
+    {
+        const uint8_t *src = frame.data + size_t(y) * step * frame.bytesPerLine;
+        uint8_t *dest = band.Line(y);
+        if constexpr (P == SamplePacking::Byte)
         {
-            /* write second to last pixel */
-            t0 = (bayer[0] + bayer[2] + bayer[stride * 2] +
-                  bayer[stride * 2 + 2] + 2) >>
-                 2;
-            t1 = (bayer[1] + bayer[stride] + bayer[stride + 2] +
-                  bayer[stride * 2 + 1] + 2) >>
-                 2;
-            if (blue_line)
-            {
-                *bgr++ = t0;
-                *bgr++ = t1;
-                *bgr++ = bayer[stride + 1];
-            }
-            else
-            {
-                *bgr++ = bayer[stride + 1];
-                *bgr++ = t1;
-                *bgr++ = t0;
-            }
-            /* write last pixel */
-            t0 = (bayer[2] + bayer[stride * 2 + 2] + 1) >> 1;
-            if (blue_line)
+            if (step == 1)
             {
-                *bgr++ = t0;
-                *bgr++ = bayer[stride + 2];
-                *bgr++ = bayer[stride + 1];
+                std::memcpy(dest, src, frame.width);
             }
             else
             {
-                *bgr++ = bayer[stride + 1];
-                *bgr++ = bayer[stride + 2];
-                *bgr++ = t0;
+                DecimateLine(src, dest, outWidth, step);
             }
-
-            bayer++;
         }
         else
         {
-            /* write last pixel */
-            t0 = (bayer[0] + bayer[stride * 2] + 1) >> 1;
-            t1 = (bayer[1] + bayer[stride * 2 + 1] + bayer[stride] + 1) / 3;
-            if (blue_line)
+            if (step == 1)
             {
-                *bgr++ = t0;
-                *bgr++ = t1;
-                *bgr++ = bayer[stride + 1];
+                UnpackLine8<P>(src, dest, frame.width, desc.shift);
             }
             else
             {
-                *bgr++ = bayer[stride + 1];
-                *bgr++ = t1;
-                *bgr++ = t0;
+                UnpackLine8<P>(src, line, frame.width, desc.shift);
+                DecimateLine(line, dest, outWidth, step);
             }
         }
-
-        /* skip 2 border pixels and padding */
-        bayer += (stride - width) + 2;
-
-        blue_line = !blue_line;
-        start_with_green = !start_with_green;
+        band.Commit(y);
     }
+    return 0;
+}
 
-    /* render the last line */
-    v4lconvert_border_bayer8_line_to_bgr24(bayer + stride, bayer, bgr, width,
-                                           !start_with_green, !blue_line);
+static CfaCell CfaCellOf(CfaOrder cfa)
+{
+    switch (cfa)
+    {
+    case CfaOrder::GRBG: return { 1, 0, 3, 2 };
+    case CfaOrder::GBRG: return { 2, 0, 3, 1 };
+    case CfaOrder::BGGR: return { 3, 1, 2, 0 };
+    case CfaOrder::RGGB:
+    default:             return { 0, 1, 2, 3 };
+    }
 }
 
-static void v4lconvert_bayer8_to_rgb24(const unsigned char *bayer, unsigned char *bgr,
-                                int width, int height,
-                                const unsigned int stride, unsigned int pixfmt)
+// This function turns every step-th 2x2 CFA cell of a line pair into one RGB pixel
+static void BayerSuperpixelLine(const uint8_t *row0, const uint8_t *row1, uint8_t *rgb,
+                                uint32_t outWidth, uint32_t step, const CfaCell &cell)
 {
-    bayer8_to_rgbbgr24(bayer, bgr, width, height, stride, pixfmt,
-                       pixfmt == V4L2_PIX_FMT_SGBRG8 /* start with green */
-                           || pixfmt == V4L2_PIX_FMT_SGRBG8,
-                       pixfmt != V4L2_PIX_FMT_SBGGR8 /* blue line */
-                           && pixfmt != V4L2_PIX_FMT_SGBRG8);
+    for (uint32_t x = 0; x < outWidth; x++)
+    {
+        const size_t column = size_t(x) * step;
+        const uint8_t samples[4] = { row0[column], row0[column + 1], row1[column], row1[column + 1] };
+        *rgb++ = samples[cell.red];
+        *rgb++ = uint8_t((samples[cell.green0] + samples[cell.green1] + 1) >> 1);
+        *rgb++ = samples[cell.blue];
+    }
 }
 
-static void v4lconvert_grey_to_rgb24(const unsigned char *src, unsigned char *dest,
-                              int width, int height)
+template <SamplePacking P>
+static int ConvertBayer(const PixelFormatDescriptor &desc, const SourceFrame &frame, const ConversionOptions &options, QImage &dst)
 {
-    int j;
+    if (frame.width < 2 || frame.height < 2)
+        return -1;
+
+    const CfaCell cell = CfaCellOf(desc.cfa);
+    const uint32_t step = DownscaleStep(options);
+    if (step > 1)
+    {
+        // Preview: no interpolation, each output pixel is one CFA cell
+        const uint32_t outWidth = ScaledExtent(frame.width, step);
+        const uint32_t outHeight = ScaledExtent(frame.height, step);
+        uint8_t *lines = ConversionBuffer(size_t(frame.width) * 2);
+
+        LineWriter writer = PrepareOrientedImage(dst, outWidth, outHeight, QImage::Format_RGB888, options.orientation);
+        LineWriter::Band band(writer);
+        for (uint32_t y = 0; y < outHeight; y++)
+        {
+            const uint8_t *src0 = frame.data + size_t(y) * step * frame.bytesPerLine;
+            const uint8_t *src1 = src0 + frame.bytesPerLine;
+            if constexpr (P != SamplePacking::Byte)
+            {
+                UnpackLine8<P>(src0, lines, frame.width, desc.shift);
+                UnpackLine8<P>(src1, lines + frame.width, frame.width, desc.shift);
+                src0 = lines;
+                src1 = lines + frame.width;
+            }
+            uint8_t *dest = band.Line(y);
+            BayerSuperpixelLine(src0, src1, dest, outWidth, step, cell);
+            if (options.colorCorrection)
+            {
+                options.colorCorrection->Apply(dest, outWidth);
+            }
+            band.Commit(y);
+        }
+        return 0;
+    }
 
-    while (--height >= 0)
+#if QT_VERSION >= QT_VERSION_CHECK(5,12,0)
+    if constexpr (P != SamplePacking::Byte)
     {
-        for (j = 0; j < width; j++)
+        if (options.fullDepth)
         {
-            *dest++ = *src;
-            *dest++ = *src;
-            *dest++ = *src;
-            src++;
+            LineWriter writer = PrepareOrientedImage(dst, frame.width, frame.height, QImage::Format_RGBX64, options.orientation);
+            Demosaic::Run<uint16_t>(options.demosaic, cell, frame.width, frame.height,
+                                    [&](uint32_t y, uint16_t *line) {
+                                        UnpackLine16<P>(frame.data + size_t(y) * frame.bytesPerLine,
+                                                        line, frame.width, desc.shift);
+                                    },
+                                    writer, options.colorCorrection.get());
+            return 0;
         }
     }
+#endif
+
+    LineWriter writer = PrepareOrientedImage(dst, frame.width, frame.height, QImage::Format_RGB888, options.orientation);
+    Demosaic::Run<uint8_t>(options.demosaic, cell, frame.width, frame.height,
+                           [&](uint32_t y, uint8_t *line) {
+                               const uint8_t *src = frame.data + size_t(y) * frame.bytesPerLine;
+                               if constexpr (P == SamplePacking::Byte)
+                               {
+                                   std::memcpy(line, src, frame.width);
+                               }
+                               else
+                               {
+                                   UnpackLine8<P>(src, line, frame.width, desc.shift);
+                               }
+                           },
+                           writer, options.colorCorrection.get());
+    return 0;
 }
 
-static void v4lconvert_swap_rgb(const unsigned char *src, unsigned char *dst,
-                         int width, int height, int offset)
+// QImage format that holds the packing without any conversion
+template <SamplePacking P>
+static constexpr QImage::Format NativeImageFormat()
 {
-    int i,j;
+    switch (P)
+    {
+    case SamplePacking::Rgb24:    return QImage::Format_RGB888;
+#if QT_VERSION >= QT_VERSION_CHECK(5,14,0)
+    case SamplePacking::Bgr24:    return QImage::Format_BGR888;
+#endif
+    case SamplePacking::Bgrx32:
+    case SamplePacking::Native32: return QImage::Format_RGB32;
+    case SamplePacking::Bgra32:   return QImage::Format_ARGB32;
+    default:                      return QImage::Format_Invalid;
+    }
+}
 
+// QImage format the converted packing ends up in
+template <SamplePacking P>
+static constexpr QImage::Format RgbImageFormat()
+{
+    if constexpr (NativeImageFormat<P>() != QImage::Format_Invalid)
+        return NativeImageFormat<P>();
+    else if constexpr (P == SamplePacking::Xrgb32)
+        return QImage::Format_ARGB32;
+    else
+        return QImage::Format_RGB888;
+}
 
-    for (j = 0;j < height;j++)
+template <SamplePacking P>
+static void ConvertRgbLine(const PixelFormatDescriptor &desc, const uint8_t *src, uint8_t *dest, uint32_t width)
+{
+    if constexpr (NativeImageFormat<P>() != QImage::Format_Invalid)
     {
-        for (i = 0; i < width; i++)
-        {
-            unsigned char tmp0, tmp1;
-            tmp0 = *src++;
-            tmp1 = *src++;
-            *dst++ = *src++;
-            *dst++ = tmp1;
-            *dst++ = tmp0;
-        }
-        src += offset;
+        std::memcpy(dest, src, desc.MinimumBytesPerLine(width));
+    }
+    else if constexpr (P == SamplePacking::Xrgb32)
+    {
+        v4lconvert_xrgb32_to_argb32(src, dest, width);
+    }
+    else if constexpr (P == SamplePacking::Rgb565)
+    {
+        v4lconvert_rgb565_to_rgb24(src, dest, width);
+    }
+#if QT_VERSION < QT_VERSION_CHECK(5,14,0)
+    else if constexpr (P == SamplePacking::Bgr24)
+    {
+        v4lconvert_swap_rgb(src, dest, width, 1, 0);
     }
+#endif
 }
 
-static void v4lconvert_uyvy_to_rgb24(const unsigned char *src, unsigned char *dest,
-                              int width, int height, int stride,
-                              unsigned int pixfmt)
+template <SamplePacking P>
+static int ConvertRgb(const PixelFormatDescriptor &desc, const SourceFrame &frame, const ConversionOptions &options, QImage &dst)
 {
-    int j;
+    constexpr QImage::Format nativeFormat = NativeImageFormat<P>();
 
-    while (--height >= 0)
+    const uint32_t step = DownscaleStep(options);
+    if constexpr (nativeFormat != QImage::Format_Invalid)
     {
-        for (j = 0; j + 1 < width; j += 2)
+        if (options.allowBorrow && step == 1 && options.orientation.IsIdentity())
         {
+            // Wraps the read-only driver buffer, QImage deep copies on any write access
+            dst = QImage(frame.data, frame.width, frame.height, frame.bytesPerLine, nativeFormat);
+            return 0;
+        }
+    }
 
-            int u, v;
+    const uint32_t outWidth = ScaledExtent(frame.width, step);
+    const uint32_t outHeight = ScaledExtent(frame.height, step);
+    const uint32_t bytesPerPixel = desc.MinimumBytesPerLine(1);
+    uint8_t *line = step > 1 ? ConversionBuffer(size_t(outWidth) * bytesPerPixel) : nullptr;
 
-            if (pixfmt == V4L2_PIX_FMT_UYVY)
-            {
-                u = src[0];
-                v = src[2];
-            }
-            else if (pixfmt == V4L2_PIX_FMT_VYUY)
+    LineWriter writer = PrepareOrientedImage(dst, outWidth, outHeight, RgbImageFormat<P>(), options.orientation);
+    LineWriter::Band band(writer);
+    for (uint32_t y = 0; y < outHeight; y++)
+    {
+        const uint8_t *src = frame.data + size_t(y) * step * frame.bytesPerLine;
+        if (step > 1)
+        {
+            // Gather every step-th pixel into a tightly packed line of the source format
+            for (uint32_t x = 0; x < outWidth; x++)
             {
-                u = src[2];
-                v = src[0];
+                std::memcpy(line + size_t(x) * bytesPerPixel, src + size_t(x) * step * bytesPerPixel, bytesPerPixel);
             }
-
-            int u1 = (((u - 128) << 7) + (u - 128)) >> 6;
-            int rg = (((u - 128) << 1) + (u - 128) + ((v - 128) << 2) +
-                      ((v - 128) << 1)) >>
-                     3;
-            int v1 = (((v - 128) << 1) + (v - 128)) >> 1;
-
-            *dest++ = CLIP(src[1] + v1);
-            *dest++ = CLIP(src[1] - rg);
-            *dest++ = CLIP(src[1] + u1);
-
-            *dest++ = CLIP(src[3] + v1);
-            *dest++ = CLIP(src[3] - rg);
-            *dest++ = CLIP(src[3] + u1);
-
-            src += 4;
+            src = line;
         }
-        src += stride - width * 2;
+        ConvertRgbLine<P>(desc, src, band.Line(y), outWidth);
+        band.Commit(y);
     }
+    return 0;
 }
 
-static void v4lconvert_yuyv_to_rgb24(const unsigned char *src, unsigned char *dest,
-                              int width, int height, int stride)
+static int ConvertJpeg(const PixelFormatDescriptor &, const SourceFrame &frame, const ConversionOptions &options, QImage &dst)
 {
-    int j;
+    const uint32_t step = DownscaleStep(options);
+    const bool oriented = !options.orientation.IsIdentity();
 
-    while (--height >= 0)
+#ifdef HAS_LIBJPEG
+    JpegDecoder::Header header;
+    if (JpegDecoder::ReadHeader(frame.data, frame.payloadSize, step, header))
     {
-        for (j = 0; j + 1 < width; j += 2)
+        QImage &decoded = oriented ? s_DecodedImage : dst;
+        PrepareImage(decoded, header.width, header.height, header.format);
+        if (JpegDecoder::Decode(frame.data, frame.payloadSize, step, decoded))
         {
-            int u = src[1];
-            int v = src[3];
-            int u1 = (((u - 128) << 7) + (u - 128)) >> 6;
-            int rg = (((u - 128) << 1) + (u - 128) + ((v - 128) << 2) +
-                      ((v - 128) << 1)) >>
-                     3;
-            int v1 = (((v - 128) << 1) + (v - 128)) >> 1;
-
-            *dest++ = CLIP(src[0] + v1);
-            *dest++ = CLIP(src[0] - rg);
-            *dest++ = CLIP(src[0] + u1);
-
-            *dest++ = CLIP(src[2] + v1);
-            *dest++ = CLIP(src[2] - rg);
-            *dest++ = CLIP(src[2] + u1);
-            src += 4;
+            if (oriented)
+            {
+                OrientImage(decoded, dst, options.orientation);
+            }
+            return 0;
         }
-        src += stride - (width * 2);
     }
-}
-
-static void v4lconvert_yuv420_to_rgb24(const unsigned char *src, unsigned char *dest,
-                                int width, int height, int yvu)
-{
-    int i, j;
-
-    const unsigned char *ysrc = src;
-    const unsigned char *usrc, *vsrc;
+#endif
 
-    if (yvu)
+    // Qt image plugins as fallback for streams libjpeg rejects
+    QImage decoded;
+    if (step == 1)
     {
-        vsrc = src + width * height;
-        usrc = vsrc + (width * height) / 4;
+        decoded.loadFromData(frame.data, frame.payloadSize, "JPG");
     }
     else
     {
-        usrc = src + width * height;
-        vsrc = usrc + (width * height) / 4;
+        // The JPEG plugin decodes directly at 1/2, 1/4 or 1/8 size via DCT scaling
+        QByteArray data = QByteArray::fromRawData(reinterpret_cast<const char *>(frame.data), frame.payloadSize);
+        QBuffer device(&data);
+        QImageReader reader(&device, "JPG");
+        reader.setScaledSize(QSize(ScaledExtent(frame.width, step), ScaledExtent(frame.height, step)));
+        reader.read(&decoded);
     }
 
-    for (i = 0; i < height; i++)
+    // dst may still hold the previous frame, which must not be shown again
+    if (decoded.isNull() || !oriented)
     {
-        for (j = 0; j < width; j += 2)
-        {
-#if 1 /* fast slightly less accurate multiplication free code */
-            int u1 = (((*usrc - 128) << 7) + (*usrc - 128)) >> 6;
-            int rg = (((*usrc - 128) << 1) + (*usrc - 128) +
-                      ((*vsrc - 128) << 2) + ((*vsrc - 128) << 1)) >>
-                     3;
-            int v1 = (((*vsrc - 128) << 1) + (*vsrc - 128)) >> 1;
-
-            *dest++ = CLIP(*ysrc + v1);
-            *dest++ = CLIP(*ysrc - rg);
-            *dest++ = CLIP(*ysrc + u1);
-            ysrc++;
-
-            *dest++ = CLIP(*ysrc + v1);
-            *dest++ = CLIP(*ysrc - rg);
-            *dest++ = CLIP(*ysrc + u1);
-#else
-            *dest++ = YUV2R(*ysrc, *usrc, *vsrc);
-            *dest++ = YUV2G(*ysrc, *usrc, *vsrc);
-            *dest++ = YUV2B(*ysrc, *usrc, *vsrc);
-            ysrc++;
-
-            *dest++ = YUV2R(*ysrc, *usrc, *vsrc);
-            *dest++ = YUV2G(*ysrc, *usrc, *vsrc);
-            *dest++ = YUV2B(*ysrc, *usrc, *vsrc);
-#endif
-            ysrc++;
-            usrc++;
-            vsrc++;
-        }
-        /* Rewind u and v for next line */
-        if (!(i & 1))
-        {
-            usrc -= width / 2;
-            vsrc -= width / 2;
-        }
+        dst = decoded;
+    }
+    else
+    {
+        OrientImage(decoded, dst, options.orientation);
     }
+    return 0;
 }
 
-static void v4lconvert_rgb565_to_rgb24(const unsigned char *src, unsigned char *dest,
-                                int width, int height)
+using Converter = int (*)(const PixelFormatDescriptor &, const SourceFrame &, const ConversionOptions &, QImage &);
+
+// This function picks the converter instantiation matching the format traits
+//
+// Parameters:
+// [in] (const PixelFormatDescriptor &) desc - traits of the pixel format
+//
+// Returns:
+// (Converter) - converter or nullptr if the layout is not supported
+static Converter SelectConverter(const PixelFormatDescriptor &desc)
 {
-    int j;
-    while (--height >= 0)
+    switch (desc.family)
     {
-        for (j = 0; j < width; j++)
+    case PixelFamily::Rgb:
+        switch (desc.packing)
         {
-            unsigned short tmp = *(unsigned short *)src;
+        case SamplePacking::Rgb24:    return ConvertRgb<SamplePacking::Rgb24>;
+        case SamplePacking::Bgr24:    return ConvertRgb<SamplePacking::Bgr24>;
+        case SamplePacking::Rgb565:   return ConvertRgb<SamplePacking::Rgb565>;
+        case SamplePacking::Bgrx32:   return ConvertRgb<SamplePacking::Bgrx32>;
+        case SamplePacking::Bgra32:   return ConvertRgb<SamplePacking::Bgra32>;
+        case SamplePacking::Xrgb32:   return ConvertRgb<SamplePacking::Xrgb32>;
+        case SamplePacking::Native32: return ConvertRgb<SamplePacking::Native32>;
+        default: break;
+        }
+        break;
 
-            /* Original format: rrrrrggg gggbbbbb */
-            *dest++ = 0xf8 & (tmp >> 8);
-            *dest++ = 0xfc & (tmp >> 3);
-            *dest++ = 0xf8 & (tmp << 3);
+    case PixelFamily::Yuv:
+        switch (desc.packing)
+        {
+        case SamplePacking::Yuyv:       return ConvertYuv<SamplePacking::Yuyv>;
+        case SamplePacking::Uyvy:       return ConvertYuv<SamplePacking::Uyvy>;
+        case SamplePacking::Vyuy:       return ConvertYuv<SamplePacking::Vyuy>;
+        case SamplePacking::Yvyu:       return ConvertYuv<SamplePacking::Yvyu>;
+        case SamplePacking::Planar:     return ConvertYuv<SamplePacking::Planar>;
+        case SamplePacking::SemiPlanar: return ConvertYuv<SamplePacking::SemiPlanar>;
+        default: break;
+        }
+        break;
 
-            src += 2;
+    case PixelFamily::Mono:
+        switch (desc.packing)
+        {
+        case SamplePacking::Byte:         return ConvertMono<SamplePacking::Byte>;
+        case SamplePacking::Word16:       return ConvertMono<SamplePacking::Word16>;
+        case SamplePacking::Csi2Packed10: return ConvertMono<SamplePacking::Csi2Packed10>;
+        case SamplePacking::Csi2Packed12: return ConvertMono<SamplePacking::Csi2Packed12>;
+        default: break;
         }
-    }
-}
+        break;
 
-static void v4lconvert_xrgb32_to_argb32(const unsigned char *src, unsigned char *dest,
-                                int width, int height)
-{
-    auto src32 = reinterpret_cast<const uint32_t *>(src);
-    auto dest32 = reinterpret_cast<uint32_t *>(dest);
-    // iterate every pixel
-    for (int w = 0; w < width; ++w)
-    {
-        for (int h = 0; h < height; ++h)
+    case PixelFamily::Bayer:
+        switch (desc.packing)
         {
-            *dest32++ = __bswap_32(*src32++) | 0xFF000000;
+        case SamplePacking::Byte:         return ConvertBayer<SamplePacking::Byte>;
+        case SamplePacking::Word16:       return ConvertBayer<SamplePacking::Word16>;
+        case SamplePacking::Csi2Packed10: return ConvertBayer<SamplePacking::Csi2Packed10>;
+        case SamplePacking::Csi2Packed12: return ConvertBayer<SamplePacking::Csi2Packed12>;
+        default: break;
         }
+        break;
+
+    case PixelFamily::Compressed:
+        return ConvertJpeg;
     }
+
+    return nullptr;
 }
 
-static void v4lconvert_xbgr32_to_argb32(const unsigned char *src, unsigned char *dest,
-                                int width, int height)
+// This function returns the number of bytes a frame occupies at least
+static size_t RequiredLength(const PixelFormatDescriptor &desc, const SourceFrame &frame)
 {
-    auto src32 = reinterpret_cast<const uint32_t *>(src);
-    auto dest32 = reinterpret_cast<uint32_t *>(dest);
-    // iterate every pixel
-    for (int w = 0; w < width; ++w)
+    if (desc.family == PixelFamily::Compressed)
+        return frame.payloadSize;
+
+    if (desc.packing == SamplePacking::Planar || desc.packing == SamplePacking::SemiPlanar)
     {
-        for (int h = 0; h < height; ++h)
-        {
-            *dest32++ = *src32++ | 0xFF000000;
-        }
+        const size_t chromaStride = ChromaPlaneStride(desc, frame.bytesPerLine);
+        const size_t chromaHeight = ChromaPlaneHeight(desc, frame.height);
+        return size_t(frame.bytesPerLine) * frame.height + (desc.planes - 1) * chromaStride * chromaHeight;
     }
+
+    return size_t(frame.bytesPerLine) * (frame.height - 1) + desc.MinimumBytesPerLine(frame.width);
 }
 
-static void v4lconvert_remove_padding(const uint8_t **src,
-                               std::vector<uint8_t> *conversionBuffer,
-                               int width, int height, int bytesPerPixel,
-                               int bytesPerLine)
+// This function validates a frame and describes it for the converters
+//
+// Returns:
+// (const PixelFormatDescriptor *) - traits of the format, nullptr if the frame cannot be converted
+static const PixelFormatDescriptor *DescribeFrame(const uint8_t *pBuffer, uint32_t length,
+                                                  uint32_t width, uint32_t height,
+                                                  uint32_t pixelFormat, uint32_t payloadSize,
+                                                  uint32_t bytesPerLine, SourceFrame &frame)
 {
-    if (width * bytesPerPixel == bytesPerLine)
+    if (NULL == pBuffer || 0 == length || 0 == width || 0 == height)
+        return nullptr;
+
+    const PixelFormatDescriptor *desc = Find(pixelFormat);
+    if (desc == nullptr || SelectConverter(*desc) == nullptr)
+        return nullptr;
+
+    // Drivers occasionally report no or a too small stride, fall back to tightly packed lines
+    const uint32_t minimumBytesPerLine = desc->MinimumBytesPerLine(width);
+    frame = SourceFrame { pBuffer, length, width, height, payloadSize,
+                          bytesPerLine < minimumBytesPerLine ? minimumBytesPerLine : bytesPerLine,
+                          nullptr, 0 };
+
+    if (frame.length < RequiredLength(*desc, frame))
+        return nullptr;
+
+    if (desc->packing == SamplePacking::Planar || desc->packing == SamplePacking::SemiPlanar)
     {
-        // nothing to do
-        return;
+        frame.chroma = frame.data + size_t(frame.bytesPerLine) * frame.height;
+        frame.chromaPlaneSize = size_t(ChromaPlaneStride(*desc, frame.bytesPerLine)) * ChromaPlaneHeight(*desc, frame.height);
     }
+    return desc;
+}
 
-    const uint8_t *data = *src;
-    conversionBuffer->resize(width * height * bytesPerPixel);
-    uint8_t *dst = conversionBuffer->data();
-    size_t payloadPerLine = width * bytesPerPixel;
+// Pixels on each side of a region that the interpolation of a full
+// resolution Bayer frame reads, Malvar-He-Cutler being the widest
+static const uint32_t s_DemosaicMargin = 2;
 
-    // iterate every line
-    for (int y = 0; y < height; y++)
+// This function returns where a part of the frame may start so that it
+// begins with a whole packed sample group, chroma sample and CFA cell.
+// Both alignments are powers of two.
+static void RegionAlignment(const PixelFormatDescriptor &desc, uint32_t &alignX, uint32_t &alignY)
+{
+    alignX = 1u << desc.chromaShiftX;
+    alignY = 1u << desc.chromaShiftY;
+    if (desc.packing == SamplePacking::Csi2Packed10)
+    {
+        alignX = 4;
+    }
+    else if (desc.packing == SamplePacking::Csi2Packed12)
     {
-        // copy payload to buffer without padding
-        std::memcpy(dst, data, payloadPerLine);
-        dst += payloadPerLine;
-        data += bytesPerLine;
+        alignX = std::max(alignX, 2u);
     }
+    if (desc.family == PixelFamily::Bayer)
+    {
+        alignX = std::max(alignX, 2u);
+        alignY = 2;
+    }
+}
 
-    *src = conversionBuffer->data();
+// This function returns the part of the converted image that holds the
+// output pixels taken from [first, last] of the input, or an empty range
+static void OutputRange(uint32_t first, uint32_t last, uint32_t extent, uint32_t step,
+                        uint32_t &outFirst, uint32_t &outEnd)
+{
+    // Output pixel i is taken from input pixel i * step
+    outFirst = (first + step - 1) / step;
+    outEnd = std::min(last / step + 1, ScaledExtent(extent, step));
 }
 
 namespace ImageTransform {
     bool CanConvert(uint32_t pixelFormat)
     {
-        switch (pixelFormat)
+        const PixelFormatDescriptor *desc = Find(pixelFormat);
+        return desc != nullptr && SelectConverter(*desc) != nullptr;
+    }
+
+    void SetColorimetry(const BufferWrapper &buffer, ConversionOptions &options)
+    {
+        switch (buffer.ycbcrEnc)
         {
-            case V4L2_PIX_FMT_XBGR32:
-            case V4L2_PIX_FMT_ABGR32:
-            case V4L2_PIX_FMT_XRGB32:
-            case V4L2_PIX_FMT_JPEG:
-            case V4L2_PIX_FMT_MJPEG:
-            case V4L2_PIX_FMT_RGB565:
-            case V4L2_PIX_FMT_BGR24:
-            case V4L2_PIX_FMT_VYUY:
-            case V4L2_PIX_FMT_UYVY:
-            case V4L2_PIX_FMT_YUYV:
-            case V4L2_PIX_FMT_YUV420:
-            case V4L2_PIX_FMT_RGB24:
-            case V4L2_PIX_FMT_RGB32:
-            case V4L2_PIX_FMT_BGR32:
-            case V4L2_PIX_FMT_GREY:
-            case V4L2_PIX_FMT_SBGGR8:
-            case V4L2_PIX_FMT_SGBRG8:
-            case V4L2_PIX_FMT_SGRBG8:
-            case V4L2_PIX_FMT_SRGGB8:
-            case V4L2_PIX_FMT_Y10P:
-            case V4L2_PIX_FMT_SBGGR10P:
-            case V4L2_PIX_FMT_SGBRG10P:
-            case V4L2_PIX_FMT_SGRBG10P:
-            case V4L2_PIX_FMT_SRGGB10P:
-            case V4L2_PIX_FMT_GREY12P:
-            case V4L2_PIX_FMT_Y12P:
-            case V4L2_PIX_FMT_SBGGR12P:
-            case V4L2_PIX_FMT_SGBRG12P:
-            case V4L2_PIX_FMT_SGRBG12P:
-            case V4L2_PIX_FMT_SRGGB12P:
-            case V4L2_PIX_FMT_XAVIER_Y10:
-            case V4L2_PIX_FMT_XAVIER_Y12:
-            case V4L2_PIX_FMT_XAVIER_SGRBG10:
-            case V4L2_PIX_FMT_XAVIER_SGRBG12:
-            case V4L2_PIX_FMT_XAVIER_SRGGB10:
-            case V4L2_PIX_FMT_XAVIER_SRGGB12:
-            case V4L2_PIX_FMT_XAVIER_SGBRG10:
-            case V4L2_PIX_FMT_XAVIER_SGBRG12:
-            case V4L2_PIX_FMT_XAVIER_SBGGR10:
-            case V4L2_PIX_FMT_XAVIER_SBGGR12:
-            case V4L2_PIX_FMT_TX2_Y10:
-            case V4L2_PIX_FMT_TX2_Y12:
-            case V4L2_PIX_FMT_TX2_SGRBG10:
-            case V4L2_PIX_FMT_TX2_SGRBG12:
-            case V4L2_PIX_FMT_TX2_SRGGB10:
-            case V4L2_PIX_FMT_TX2_SRGGB12:
-            case V4L2_PIX_FMT_TX2_SGBRG10:
-            case V4L2_PIX_FMT_TX2_SGBRG12:
-            case V4L2_PIX_FMT_TX2_SBGGR10:
-            case V4L2_PIX_FMT_TX2_SBGGR12:
-            case V4L2_PIX_FMT_Y12:
-            case V4L2_PIX_FMT_SGRBG12:
-            case V4L2_PIX_FMT_SRGGB12:
-            case V4L2_PIX_FMT_SGBRG12:
-            case V4L2_PIX_FMT_SBGGR12:
-            case V4L2_PIX_FMT_Y10:
-            case V4L2_PIX_FMT_SGRBG10:
-            case V4L2_PIX_FMT_SRGGB10:
-            case V4L2_PIX_FMT_SGBRG10:
-            case V4L2_PIX_FMT_SBGGR10:
-                return true;
-            default:
-                break;
+        case V4L2_YCBCR_ENC_709:
+        case V4L2_YCBCR_ENC_XV709:
+        case V4L2_YCBCR_ENC_BT2020:
+        case V4L2_YCBCR_ENC_BT2020_CONST_LUM:
+        case V4L2_YCBCR_ENC_SMPTE240M:
+            options.yuvMatrix = YuvMatrix::Bt709;
+            break;
+        default:
+            options.yuvMatrix = YuvMatrix::Bt601;
+            break;
         }
+        options.yuvRange = buffer.quantization == V4L2_QUANTIZATION_FULL_RANGE ? YuvRange::Full
+                                                                               : YuvRange::Limited;
+    }
+
+    void SetVectorKernels(bool enabled)
+    {
+        s_VectorKernels = enabled;
+    }
 
-        return false;
+    bool VectorKernels()
+    {
+        return s_VectorKernels.load(std::memory_order_relaxed);
     }
 
     void Init(uint32_t width, uint32_t height)
     {
-        s_ConversionBuffer = std::make_unique<uint8_t[]>(width*height*4);
+        // Scratch buffers are per thread and grow on demand, this merely
+        // avoids the first allocation on the calling thread
+        ConversionBuffer(size_t(width) * height);
     }
 
     int ConvertFrame(const uint8_t *pBuffer, uint32_t length,
                                      uint32_t width, uint32_t height,
                                      uint32_t pixelFormat, uint32_t payloadSize,
-                                     uint32_t bytesPerLine, QImage &convertedImage)
+                                     uint32_t bytesPerLine, QImage &convertedImage,
+                                     const ConversionOptions &options)
     {
-        int result = 0;
-
-        if (NULL == pBuffer || 0 == length)
+        SourceFrame frame;
+        const PixelFormatDescriptor *desc = DescribeFrame(pBuffer, length, width, height, pixelFormat,
+                                                          payloadSize, bytesPerLine, frame);
+        if (desc == nullptr)
             return -1;
 
-        if (g_shift10Bit == -1 || g_shift12Bit == -1)
-        {
-            const int tegraShift10Bit = 2;
-            const int tegraShift12Bit = 4;
-
-            QFile socId("/sys/devices/soc0/soc_id");
-
-            if (socId.exists() && socId.open(QFile::ReadOnly))
-            {
-                auto socIdString = socId.readAll().trimmed().toStdString();
-
+        return SelectConverter(*desc)(*desc, frame, options, convertedImage);
+    }
 
-                LOG_EX("soc id: %s",socIdString.c_str());
+    int ConvertFrame(const BufferWrapper &buffer, QImage &convertedImage,
+                     const ConversionOptions &options)
+    {
+        return ConvertFrame(buffer.data, buffer.length, buffer.width, buffer.height,
+                            buffer.pixelFormat, buffer.payloadSize, buffer.bytesPerLine,
+                            convertedImage, options);
+    }
 
-                const std::regex imx8Regex(R"(i\.MX8.*)");
+    int ConvertFrame(const BufferWrapper &buffer, const QRect &region, QImage &convertedImage,
+                     const ConversionOptions &options)
+    {
+        SourceFrame frame;
+        const PixelFormatDescriptor *desc = DescribeFrame(buffer.data, buffer.length, buffer.width, buffer.height,
+                                                          buffer.pixelFormat, buffer.payloadSize, buffer.bytesPerLine,
+                                                          frame);
+        if (desc == nullptr)
+            return -1;
 
-                if (std::regex_match(socIdString,imx8Regex))
-                {
-                    LOG_EX("Is imx8");
+        const QRect clipped = region.intersected(QRect(0, 0, int(frame.width), int(frame.height)));
+        if (clipped.isEmpty())
+            return -1;
 
-                    g_shift10Bit = 8;
-                    g_shift12Bit = 8;
-                }
-                else
-                {
-                    g_shift10Bit = tegraShift10Bit;
-                    g_shift12Bit = tegraShift12Bit;
-                }
+        const Converter convert = SelectConverter(*desc);
+        const uint32_t step = DownscaleStep(options);
+        uint32_t outX0, outX1, outY0, outY1;
+        OutputRange(clipped.left(), clipped.right(), frame.width, step, outX0, outX1);
+        OutputRange(clipped.top(), clipped.bottom(), frame.height, step, outY0, outY1);
+        if (outX0 >= outX1 || outY0 >= outY1)
+            return -1;
 
-                socId.close();
-            }
-            else
-            {
-                LOG_EX("Opening soc_id failed");
+        ConversionOptions unoriented = options;
+        unoriented.allowBorrow = false;
+        unoriented.orientation = Orientation();
 
-                g_shift10Bit = tegraShift10Bit;
-                g_shift12Bit = tegraShift12Bit;
-            }
+        if (desc->family == PixelFamily::Compressed)
+        {
+            // A JPEG frame can only be decoded as a whole
+            const int result = convert(*desc, frame, unoriented, s_RegionImage);
+            const QRect crop = QRect(outX0, outY0, outX1 - outX0, outY1 - outY0).intersected(s_RegionImage.rect());
+            if (result != 0 || crop.isEmpty())
+                return -1;
+            OrientImage(s_RegionImage, crop, convertedImage, options.orientation);
+            return 0;
         }
 
-        std::vector<uint8_t> conversionBuffer;
-
-        switch (pixelFormat)
+        // The part of the frame to convert: the input of the kept output
+        // pixels, the neighbors the demosaic reads and the alignment of the
+        // format. Binned Bayer previews read the whole CFA cell of a pixel.
+        uint32_t alignX, alignY;
+        RegionAlignment(*desc, alignX, alignY);
+        alignX = std::max(alignX, step);
+        alignY = std::max(alignY, step);
+        const uint32_t margin = desc->family == PixelFamily::Bayer && step == 1 ? s_DemosaicMargin : 0;
+        const uint32_t cell = desc->family == PixelFamily::Bayer && step > 1 ? 2 : 1;
+        const uint32_t x0 = (outX0 * step - std::min(outX0 * step, margin)) & ~(alignX - 1);
+        const uint32_t y0 = (outY0 * step - std::min(outY0 * step, margin)) & ~(alignY - 1);
+        const uint32_t x1 = std::min(frame.width, ((outX1 - 1) * step + cell + margin + alignX - 1) & ~(alignX - 1));
+        const uint32_t y1 = std::min(frame.height, ((outY1 - 1) * step + cell + margin + alignY - 1) & ~(alignY - 1));
+
+        SourceFrame part = frame;
+        part.data = frame.data + size_t(y0) * frame.bytesPerLine + desc->MinimumBytesPerLine(x0);
+        part.length = frame.length - size_t(part.data - frame.data);
+        part.width = x1 - x0;
+        part.height = y1 - y0;
+        if (frame.chroma != nullptr)
         {
+            const uint32_t chromaX = desc->packing == SamplePacking::SemiPlanar ? x0 : x0 >> desc->chromaShiftX;
+            part.chroma = frame.chroma + size_t(y0 >> desc->chromaShiftY) * ChromaPlaneStride(*desc, frame.bytesPerLine) + chromaX;
+        }
 
-        case V4L2_PIX_FMT_ABGR32:
-            {
-                convertedImage = QImage(pBuffer, width, height, bytesPerLine, QImage::Format_ARGB32).copy();
-            }
-            break;
-        case V4L2_PIX_FMT_XBGR32:
-            {
-                convertedImage = QImage(pBuffer, width, height, bytesPerLine, QImage::Format_RGB32).copy();
-            }
-            break;
-        case V4L2_PIX_FMT_XRGB32:
-            {
-                v4lconvert_remove_padding(&pBuffer, &conversionBuffer, width, height, 4,
-                                          bytesPerLine);
-                convertedImage = QImage(width, height, QImage::Format_ARGB32);
-                v4lconvert_xrgb32_to_argb32(pBuffer, convertedImage.bits(), width,
-                                           height);
-            }
-            break;
-
-        case V4L2_PIX_FMT_JPEG:
-        case V4L2_PIX_FMT_MJPEG:
-            {
-                QPixmap pix;
-                pix.loadFromData(pBuffer, payloadSize, "JPG");
-                convertedImage = pix.toImage();
-            }
-            break;
-        case V4L2_PIX_FMT_RGB565:
-            {
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_rgb565_to_rgb24(pBuffer, convertedImage.bits(), width,
-                                           height);
-            }
-            break;
-        case V4L2_PIX_FMT_BGR24:
-            {
-#if QT_VERSION >= QT_VERSION_CHECK(5,14,0)
-                convertedImage = QImage(pBuffer, width, height, bytesPerLine, QImage::Format_BGR888).copy();
-#else
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                auto const offset = bytesPerLine - (width * 3);
-                v4lconvert_swap_rgb(pBuffer, convertedImage.bits(), width, height, offset);
-#endif
-            }
-            break;
-        case V4L2_PIX_FMT_VYUY:
-        case V4L2_PIX_FMT_UYVY:
-            {
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_uyvy_to_rgb24(pBuffer, convertedImage.bits(), width, height,
-                                         bytesPerLine, pixelFormat);
-            }
-            break;
-        case V4L2_PIX_FMT_YUYV:
-            {
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_yuyv_to_rgb24(pBuffer, convertedImage.bits(), width, height,
-                                         bytesPerLine);
-            }
-            break;
-        case V4L2_PIX_FMT_YUV420:
-            {
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_yuv420_to_rgb24(pBuffer, convertedImage.bits(), width,
-                                           height, 1);
-            }
-            break;
-        case V4L2_PIX_FMT_RGB24:
-            {
-                convertedImage = QImage(pBuffer, width, height, bytesPerLine, QImage::Format_RGB888).copy();
-            }
-            break;
-        case V4L2_PIX_FMT_RGB32:
-        case V4L2_PIX_FMT_BGR32:
-            {
-                convertedImage = QImage(width, height, QImage::Format_RGB32);
-                memcpy(convertedImage.bits(), pBuffer, width * height * 4);
-            }
-            break;
-        case V4L2_PIX_FMT_GREY:
-            {
-                v4lconvert_remove_padding(&pBuffer, &conversionBuffer, width, height, 1,
-                                          bytesPerLine);
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_grey_to_rgb24(pBuffer, convertedImage.bits(), width, height);
-            }
-            break;
-        case V4L2_PIX_FMT_SBGGR8:
-        case V4L2_PIX_FMT_SGBRG8:
-        case V4L2_PIX_FMT_SGRBG8:
-        case V4L2_PIX_FMT_SRGGB8:
-            {
-                v4lconvert_remove_padding(&pBuffer, &conversionBuffer, width, height, 1,
-                                          bytesPerLine);
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_bayer8_to_rgb24(pBuffer, convertedImage.bits(), width,
-                                           height, width, pixelFormat);
-            }
-            break;
-
-        /* L&T */
-        /* 10bit raw bayer packed, 5 bytes for every 4 pixels */
-        case V4L2_PIX_FMT_Y10P:
-            {
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                ConvertMono10gToRGB24(pBuffer, width, height, convertedImage.bits());
-                break;
-            }
-        case V4L2_PIX_FMT_SBGGR10P:
-            {
-                ConvertRAW10gToRAW8(pBuffer, width, height, s_ConversionBuffer.get());
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_bayer8_to_rgb24(s_ConversionBuffer.get(), convertedImage.bits(),
-                                           width, height, width,
-                                           V4L2_PIX_FMT_SBGGR8);
-                break;
-            }
-        case V4L2_PIX_FMT_SGBRG10P:
-            {
-                ConvertRAW10gToRAW8(pBuffer, width, height, s_ConversionBuffer.get());
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_bayer8_to_rgb24(s_ConversionBuffer.get(), convertedImage.bits(),
-                                           width, height, width,
-                                           V4L2_PIX_FMT_SGBRG8);
-                break;
-            }
-        case V4L2_PIX_FMT_SGRBG10P:
-            {
-                ConvertRAW10gToRAW8(pBuffer, width, height, s_ConversionBuffer.get());
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_bayer8_to_rgb24(s_ConversionBuffer.get(), convertedImage.bits(),
-                                           width, height, width,
-                                           V4L2_PIX_FMT_SGRBG8);
-                break;
-            }
-        case V4L2_PIX_FMT_SRGGB10P:
-            {
-                ConvertRAW10gToRAW8(pBuffer, width, height, s_ConversionBuffer.get());
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_bayer8_to_rgb24(s_ConversionBuffer.get(), convertedImage.bits(),
-                                           width, height, width,
-                                           V4L2_PIX_FMT_SRGGB8);
-                break;
-            }
-
-        /* 12bit raw bayer packed, 6 bytes for every 4 pixels */
-        case V4L2_PIX_FMT_GREY12P:
-        case V4L2_PIX_FMT_Y12P:
-            {
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                ConvertMono12gToRGB24(pBuffer, width, height, convertedImage.bits());
-                break;
-            }
-        case V4L2_PIX_FMT_SBGGR12P:
-            {
-                ConvertRAW12gToRAW8(pBuffer, width, height, s_ConversionBuffer.get());
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_bayer8_to_rgb24(s_ConversionBuffer.get(), convertedImage.bits(),
-                                           width, height, width,
-                                           V4L2_PIX_FMT_SBGGR8);
-                break;
-            }
-        case V4L2_PIX_FMT_SGBRG12P:
-            {
-                ConvertRAW12gToRAW8(pBuffer, width, height, s_ConversionBuffer.get());
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_bayer8_to_rgb24(s_ConversionBuffer.get(), convertedImage.bits(),
-                                           width, height, width,
-                                           V4L2_PIX_FMT_SGBRG8);
-                break;
-            }
-        case V4L2_PIX_FMT_SGRBG12P:
-            {
-                ConvertRAW12gToRAW8(pBuffer, width, height, s_ConversionBuffer.get());
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_bayer8_to_rgb24(s_ConversionBuffer.get(), convertedImage.bits(),
-                                           width, height, width,
-                                           V4L2_PIX_FMT_SGRBG8);
-                break;
-            }
-        case V4L2_PIX_FMT_SRGGB12P:
-            {
-                ConvertRAW12gToRAW8(pBuffer, width, height, s_ConversionBuffer.get());
-                convertedImage = QImage(width, height, QImage::Format_RGB888);
-                v4lconvert_bayer8_to_rgb24(s_ConversionBuffer.get(), convertedImage.bits(),
-                                           width, height, width,
-                                           V4L2_PIX_FMT_SRGGB8);
-                break;
-            }
-
-        /* Special 10 and 12 bit pixel formats for NVidia Jetson */
-
-        /* AGX Xavier and Xavier NX */
-        case V4L2_PIX_FMT_XAVIER_Y10:
-        case V4L2_PIX_FMT_XAVIER_Y12:
-            ConvertJetsonMono16ToRGB24(pBuffer, width, height, convertedImage, 7, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_XAVIER_SGRBG10:
-        case V4L2_PIX_FMT_XAVIER_SGRBG12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 7, V4L2_PIX_FMT_SGRBG8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_XAVIER_SRGGB10:
-        case V4L2_PIX_FMT_XAVIER_SRGGB12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 7, V4L2_PIX_FMT_SRGGB8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_XAVIER_SGBRG10:
-        case V4L2_PIX_FMT_XAVIER_SGBRG12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 7, V4L2_PIX_FMT_SGBRG8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_XAVIER_SBGGR10:
-        case V4L2_PIX_FMT_XAVIER_SBGGR12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 7, V4L2_PIX_FMT_SBGGR8, bytesPerLine);
-            break;
-
-        /* TX2 and Nano */
-        case V4L2_PIX_FMT_TX2_Y10:
-        case V4L2_PIX_FMT_TX2_Y12:
-            ConvertJetsonMono16ToRGB24(pBuffer, width, height, convertedImage, 6, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_TX2_SGRBG10:
-        case V4L2_PIX_FMT_TX2_SGRBG12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 6, V4L2_PIX_FMT_SGRBG8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_TX2_SRGGB10:
-        case V4L2_PIX_FMT_TX2_SRGGB12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 6, V4L2_PIX_FMT_SRGGB8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_TX2_SGBRG10:
-        case V4L2_PIX_FMT_TX2_SGBRG12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 6, V4L2_PIX_FMT_SGBRG8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_TX2_SBGGR10:
-        case V4L2_PIX_FMT_TX2_SBGGR12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 6, V4L2_PIX_FMT_SBGGR8, bytesPerLine);
-            break;
-
-        /* Nano/Generic 12 Bit */
-        case V4L2_PIX_FMT_Y12:
-            ConvertJetsonMono16ToRGB24(pBuffer, width, height, convertedImage, 8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_SGRBG12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 8, V4L2_PIX_FMT_SGRBG8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_SRGGB12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 8, V4L2_PIX_FMT_SRGGB8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_SGBRG12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 8, V4L2_PIX_FMT_SGBRG8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_SBGGR12:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 8, V4L2_PIX_FMT_SBGGR8, bytesPerLine);
-            break;
-
-        /* Nano/Generic 10 Bit */
-        case V4L2_PIX_FMT_Y10:
-            ConvertJetsonMono16ToRGB24(pBuffer, width, height, convertedImage, 8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_SGRBG10:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 8, V4L2_PIX_FMT_SGRBG8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_SRGGB10:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 8, V4L2_PIX_FMT_SRGGB8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_SGBRG10:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 8, V4L2_PIX_FMT_SGBRG8, bytesPerLine);
-            break;
-
-        case V4L2_PIX_FMT_SBGGR10:
-            ConvertJetsonBayer16ToRGB24(pBuffer, width, height, convertedImage, 8, V4L2_PIX_FMT_SBGGR8, bytesPerLine);
-            break;
-
-
-        default:
-            return -1;
+        // x0 and y0 are multiples of step, so the part starts on the output grid
+        const QRect crop(outX0 - x0 / step, outY0 - y0 / step, outX1 - outX0, outY1 - outY0);
+        if (crop.topLeft() == QPoint(0, 0) && uint32_t(crop.width()) == ScaledExtent(part.width, step) &&
+            uint32_t(crop.height()) == ScaledExtent(part.height, step))
+        {
+            return convert(*desc, part, options, convertedImage);
         }
 
-        return result;
+        const int result = convert(*desc, part, unoriented, s_RegionImage);
+        if (result != 0)
+            return result;
+        OrientImage(s_RegionImage, crop, convertedImage, options.orientation);
+        return 0;
     }
 }
@@ -0,0 +1,181 @@
+#include "ImageWriter.h"
+
+#include <QByteArray>
+#include <QFile>
+#include <QFileInfo>
+
+#include <cstdint>
+
+// TIFF field types used by the baseline tags below
+static const uint16_t s_TiffShort = 3;
+static const uint16_t s_TiffLong = 4;
+static const uint16_t s_TiffRational = 5;
+
+// Number of IFD entries written by SaveTiff
+static const uint16_t s_TiffEntries = 13;
+
+template <typename T>
+static void Append(QByteArray &out, T value)
+{
+    out.append(reinterpret_cast<const char *>(&value), sizeof(value));
+}
+
+// A single SHORT is stored left aligned in the value field, everything else
+// we write either fits a LONG or is an offset
+static void AppendEntry(QByteArray &out, uint16_t tag, uint16_t type, uint32_t count, uint32_t value)
+{
+    Append(out, tag);
+    Append(out, type);
+    Append(out, count);
+    if (type == s_TiffShort && count == 1)
+    {
+        Append(out, static_cast<uint16_t>(value));
+        Append(out, static_cast<uint16_t>(0));
+    }
+    else
+    {
+        Append(out, value);
+    }
+}
+
+// The TIFF is uncompressed baseline with a single strip. The file uses the
+// byte order of the host, so 16 bit samples are copied as they are.
+bool ImageWriter::SaveTiff(const QImage &source, const QString &path)
+{
+    QImage image = source;
+    uint16_t samples = 3;
+    uint16_t bits = 8;
+    bool dropAlpha = false;
+
+    switch (image.format())
+    {
+    case QImage::Format_Grayscale8:
+        samples = 1;
+        break;
+#if QT_VERSION >= QT_VERSION_CHECK(5,13,0)
+    case QImage::Format_Grayscale16:
+        samples = 1;
+        bits = 16;
+        break;
+#endif
+    case QImage::Format_RGB888:
+        break;
+#if QT_VERSION >= QT_VERSION_CHECK(5,12,0)
+    case QImage::Format_RGBA64_Premultiplied:
+        image = image.convertToFormat(QImage::Format_RGBA64);
+        // fall through
+    case QImage::Format_RGBX64:
+    case QImage::Format_RGBA64:
+        bits = 16;
+        dropAlpha = true;
+        break;
+#endif
+    default:
+        image = image.convertToFormat(QImage::Format_RGB888);
+        break;
+    }
+    if (image.isNull())
+    {
+        return false;
+    }
+
+    const uint32_t width = static_cast<uint32_t>(image.width());
+    const uint32_t height = static_cast<uint32_t>(image.height());
+    const uint32_t rowBytes = width * samples * (bits / 8);
+
+    // Header, IFD, the BitsPerSample array of RGB images and both resolution
+    // rationals, followed by the pixel data
+    const uint32_t ifdOffset = 8;
+    const uint32_t bitsOffset = ifdOffset + 2 + s_TiffEntries * 12 + 4;
+    const uint32_t xResolutionOffset = bitsOffset + (samples == 3 ? 8 : 0);
+    const uint32_t yResolutionOffset = xResolutionOffset + 8;
+    const uint32_t dataOffset = yResolutionOffset + 8;
+
+    QByteArray header;
+    header.reserve(dataOffset);
+#if Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+    header.append("II", 2);
+#else
+    header.append("MM", 2);
+#endif
+    Append(header, static_cast<uint16_t>(42));
+    Append(header, ifdOffset);
+
+    Append(header, s_TiffEntries);
+    AppendEntry(header, 256, s_TiffLong, 1, width);                     // ImageWidth
+    AppendEntry(header, 257, s_TiffLong, 1, height);                    // ImageLength
+    AppendEntry(header, 258, s_TiffShort, samples,                      // BitsPerSample
+                samples == 3 ? bitsOffset : bits);
+    AppendEntry(header, 259, s_TiffShort, 1, 1);                        // Compression: none
+    AppendEntry(header, 262, s_TiffShort, 1, samples == 3 ? 2 : 1);     // Photometric: RGB or BlackIsZero
+    AppendEntry(header, 273, s_TiffLong, 1, dataOffset);                // StripOffsets
+    AppendEntry(header, 277, s_TiffShort, 1, samples);                  // SamplesPerPixel
+    AppendEntry(header, 278, s_TiffLong, 1, height);                    // RowsPerStrip
+    AppendEntry(header, 279, s_TiffLong, 1, rowBytes * height);         // StripByteCounts
+    AppendEntry(header, 282, s_TiffRational, 1, xResolutionOffset);     // XResolution
+    AppendEntry(header, 283, s_TiffRational, 1, yResolutionOffset);     // YResolution
+    AppendEntry(header, 284, s_TiffShort, 1, 1);                        // PlanarConfiguration: chunky
+    AppendEntry(header, 296, s_TiffShort, 1, 2);                        // ResolutionUnit: inch
+    Append(header, static_cast<uint32_t>(0));
+
+    if (samples == 3)
+    {
+        for (int i = 0; i < 3; ++i)
+        {
+            Append(header, bits);
+        }
+        Append(header, static_cast<uint16_t>(0));
+    }
+    for (int i = 0; i < 2; ++i)
+    {
+        Append(header, static_cast<uint32_t>(72));
+        Append(header, static_cast<uint32_t>(1));
+    }
+
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+    {
+        return false;
+    }
+    bool ok = file.write(header) == header.size();
+
+    QByteArray row(static_cast<int>(rowBytes), Qt::Uninitialized);
+    for (uint32_t y = 0; ok && y < height; ++y)
+    {
+        const uchar *line = image.constScanLine(static_cast<int>(y));
+        if (dropAlpha)
+        {
+            const uint16_t *src = reinterpret_cast<const uint16_t *>(line);
+            uint16_t *dst = reinterpret_cast<uint16_t *>(row.data());
+            for (uint32_t x = 0; x < width; ++x)
+            {
+                dst[3 * x + 0] = src[4 * x + 0];
+                dst[3 * x + 1] = src[4 * x + 1];
+                dst[3 * x + 2] = src[4 * x + 2];
+            }
+            ok = file.write(row) == row.size();
+        }
+        else
+        {
+            ok = file.write(reinterpret_cast<const char *>(line), rowBytes) == static_cast<qint64>(rowBytes);
+        }
+    }
+
+    file.close();
+    return ok && file.error() == QFileDevice::NoError;
+}
+
+bool ImageWriter::Save(const QImage &image, const QString &path)
+{
+    if (image.isNull())
+    {
+        return false;
+    }
+
+    const QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == "tif" || suffix == "tiff")
+    {
+        return SaveTiff(image, path);
+    }
+    return image.save(path);
+}
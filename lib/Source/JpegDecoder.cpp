@@ -0,0 +1,310 @@
+#include "JpegDecoder.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <csetjmp>
+#include <cstdio>
+#include <vector>
+
+#include <jpeglib.h>
+
+// Streams with restart markers are split into chunks of at least this
+// many lines, below that the thread hand over costs more than it saves
+static const uint32_t s_MinChunkLines = 128;
+
+// libjpeg reports fatal errors through error_exit, which must not return
+struct ErrorManager
+{
+    jpeg_error_mgr base;
+    std::jmp_buf jump;
+};
+
+static void OnError(j_common_ptr cinfo)
+{
+    std::longjmp(reinterpret_cast<ErrorManager *>(cinfo->err)->jump, 1);
+}
+
+// MJPEG cameras regularly produce slightly corrupt frames, libjpeg still
+// decodes them and the warnings would only flood the console
+static void OnMessage(j_common_ptr)
+{
+}
+
+// This function decodes a complete JPEG stream, or only reads its header
+// when 'rows' is null. Output lines [keepBegin, keepEnd) are stored starting
+// at 'rows', all others are decoded into scratch memory and dropped.
+static bool DecodeStream(const uint8_t *data, size_t size, uint32_t scale,
+                         uint8_t *rows, size_t bytesPerLine, uint32_t width,
+                         uint32_t keepBegin, uint32_t keepEnd, JpegDecoder::Header *header)
+{
+    static thread_local std::vector<uint8_t> s_DroppedLine;
+
+    jpeg_decompress_struct cinfo;
+    ErrorManager error;
+    cinfo.err = jpeg_std_error(&error.base);
+    error.base.error_exit = OnError;
+    error.base.output_message = OnMessage;
+
+    if (setjmp(error.jump))
+    {
+        jpeg_destroy_decompress(&cinfo);
+        return false;
+    }
+
+    jpeg_create_decompress(&cinfo);
+    jpeg_mem_src(&cinfo, const_cast<unsigned char *>(data), static_cast<unsigned long>(size));
+    jpeg_read_header(&cinfo, TRUE);
+    cinfo.scale_num = 1;
+    cinfo.scale_denom = scale;
+    cinfo.out_color_space = cinfo.jpeg_color_space == JCS_GRAYSCALE ? JCS_GRAYSCALE : JCS_RGB;
+
+    if (header != nullptr)
+    {
+        jpeg_calc_output_dimensions(&cinfo);
+        header->width = cinfo.output_width;
+        header->height = cinfo.output_height;
+        header->format = cinfo.out_color_space == JCS_GRAYSCALE ? QImage::Format_Grayscale8 : QImage::Format_RGB888;
+    }
+
+    if (rows != nullptr)
+    {
+        jpeg_start_decompress(&cinfo);
+        if (cinfo.output_width != width || size_t(cinfo.output_components) * width > bytesPerLine)
+        {
+            jpeg_destroy_decompress(&cinfo);
+            return false;
+        }
+        s_DroppedLine.resize(bytesPerLine);
+
+        while (cinfo.output_scanline < cinfo.output_height)
+        {
+            const uint32_t line = cinfo.output_scanline;
+            JSAMPROW row = line >= keepBegin && line < keepEnd
+                         ? rows + size_t(line - keepBegin) * bytesPerLine
+                         : s_DroppedLine.data();
+            jpeg_read_scanlines(&cinfo, &row, 1);
+        }
+        jpeg_finish_decompress(&cinfo);
+    }
+
+    jpeg_destroy_decompress(&cinfo);
+    return true;
+}
+
+// Restart segments of a single scan sequential JPEG whose restart
+// interval covers whole MCU rows
+struct RestartLayout
+{
+    size_t sofHeight;               // offset of the 16 bit frame height
+    size_t scanStart;               // first byte of entropy coded data
+    size_t scanEnd;                 // offset of the EOI marker
+    uint32_t height;
+    uint32_t segmentLines;          // image lines per restart segment
+    std::vector<size_t> markers;    // offsets of the RSTn markers
+};
+
+static uint32_t ReadBigEndian16(const uint8_t *p)
+{
+    return uint32_t(p[0]) << 8 | p[1];
+}
+
+// This function walks the marker segments up to the start of scan
+static bool ParseHeaders(const uint8_t *data, size_t size, RestartLayout &layout,
+                         uint32_t &width, uint32_t &components, uint32_t &maxH, uint32_t &maxV,
+                         uint32_t &restartInterval)
+{
+    size_t pos = 2;
+    while (pos + 4 <= size)
+    {
+        if (data[pos] != 0xFF)
+            return false;
+
+        const uint8_t marker = data[pos + 1];
+        if (marker == 0xFF)
+        {
+            pos++;      // fill byte
+            continue;
+        }
+
+        const size_t length = ReadBigEndian16(data + pos + 2);
+        if (length < 2 || pos + 2 + length > size)
+            return false;
+
+        const uint8_t *segment = data + pos + 4;
+        switch (marker)
+        {
+        case 0xC0:      // baseline
+        case 0xC1:      // extended sequential, Huffman coded
+            if (length < 8)
+                return false;
+            layout.sofHeight = pos + 5;
+            layout.height = ReadBigEndian16(segment + 1);
+            width = ReadBigEndian16(segment + 3);
+            components = segment[5];
+            if (components == 0 || length < 8 + 3 * size_t(components))
+                return false;
+            for (uint32_t i = 0; i < components; i++)
+            {
+                maxH = std::max<uint32_t>(maxH, segment[7 + 3 * i] >> 4);
+                maxV = std::max<uint32_t>(maxV, segment[7 + 3 * i] & 0x0F);
+            }
+            break;
+
+        case 0xC2: case 0xC3: case 0xC5: case 0xC6: case 0xC7:
+        case 0xC9: case 0xCA: case 0xCB: case 0xCD: case 0xCE: case 0xCF:
+            return false;   // progressive, lossless, hierarchical or arithmetic
+
+        case 0xDD:
+            if (length != 4)
+                return false;
+            restartInterval = ReadBigEndian16(segment);
+            break;
+
+        case 0xDA:
+            // Only a scan with all components interleaved covers whole MCU rows
+            if (layout.sofHeight == 0 || segment[0] != components)
+                return false;
+            layout.scanStart = pos + 2 + length;
+            return true;
+
+        default:
+            break;
+        }
+        pos += 2 + length;
+    }
+    return false;
+}
+
+// This function locates the restart segments. It returns false for streams
+// that cannot be split at MCU row boundaries.
+static bool FindRestartLayout(const uint8_t *data, size_t size, RestartLayout &layout)
+{
+    if (size < 4 || data[0] != 0xFF || data[1] != 0xD8)
+        return false;
+
+    uint32_t width = 0, components = 0, maxH = 1, maxV = 1, restartInterval = 0;
+    layout.sofHeight = 0;
+    if (!ParseHeaders(data, size, layout, width, components, maxH, maxV, restartInterval))
+        return false;
+    if (restartInterval == 0 || width == 0 || layout.height == 0)
+        return false;
+
+    layout.markers.clear();
+    size_t pos = layout.scanStart;
+    for (; pos + 1 < size; pos++)
+    {
+        if (data[pos] != 0xFF)
+            continue;
+        const uint8_t next = data[pos + 1];
+        if (next == 0x00 || next == 0xFF)
+            continue;   // stuffed 0xFF data byte or fill
+        if (next >= 0xD0 && next <= 0xD7)
+        {
+            layout.markers.push_back(pos);
+            pos++;
+            continue;
+        }
+        break;
+    }
+    // Anything but a single, complete scan is left to the serial decoder
+    if (pos + 1 >= size || data[pos + 1] != 0xD9)
+        return false;
+    layout.scanEnd = pos;
+
+    const uint32_t mcuWidth = components == 1 ? 8 : 8 * maxH;
+    const uint32_t mcuHeight = components == 1 ? 8 : 8 * maxV;
+    const uint32_t mcusPerRow = (width + mcuWidth - 1) / mcuWidth;
+    if (restartInterval % mcusPerRow != 0)
+        return false;
+
+    layout.segmentLines = restartInterval / mcusPerRow * mcuHeight;
+    const size_t segments = (layout.height + layout.segmentLines - 1) / layout.segmentLines;
+    return layout.markers.size() + 1 == segments;
+}
+
+// This function decodes the lines of the restart segments [first, last).
+// The segments, extended by one neighbour on each side, are decoded as a
+// JPEG of their own: the original headers with a smaller frame height,
+// followed by the segments with their RST markers renumbered from 0. The
+// neighbours give vertical chroma upsampling the same context it has when
+// decoding the whole frame, their lines are dropped.
+static bool DecodeSegments(const uint8_t *data, const RestartLayout &layout, uint32_t first, uint32_t last,
+                           uint32_t scale, uint8_t *bits, size_t bytesPerLine, uint32_t width, uint32_t lines)
+{
+    static thread_local std::vector<uint8_t> s_Stream;
+
+    const uint32_t segments = uint32_t(layout.markers.size()) + 1;
+    const uint32_t decodeFirst = first > 0 ? first - 1 : 0;
+    const uint32_t decodeLast = last < segments ? last + 1 : segments;
+
+    const size_t begin = decodeFirst == 0 ? layout.scanStart : layout.markers[decodeFirst - 1] + 2;
+    const size_t end = decodeLast == segments ? layout.scanEnd : layout.markers[decodeLast - 1];
+    const uint32_t firstLine = decodeFirst * layout.segmentLines;
+    const uint32_t chunkHeight = std::min(layout.height, decodeLast * layout.segmentLines) - firstLine;
+
+    s_Stream.assign(data, data + layout.scanStart);
+    s_Stream[layout.sofHeight] = uint8_t(chunkHeight >> 8);
+    s_Stream[layout.sofHeight + 1] = uint8_t(chunkHeight);
+    s_Stream.insert(s_Stream.end(), data + begin, data + end);
+    for (uint32_t i = decodeFirst; i + 1 < decodeLast; i++)
+    {
+        s_Stream[layout.scanStart + (layout.markers[i] - begin) + 1] = uint8_t(0xD0 + ((i - decodeFirst) & 7));
+    }
+    s_Stream.push_back(0xFF);
+    s_Stream.push_back(0xD9);
+
+    // Segment heights are multiples of 8 lines, so this is exact for every scale
+    const uint32_t streamRow = firstLine / scale;
+    const uint32_t keepBegin = first * layout.segmentLines / scale;
+    const uint32_t keepEnd = last == segments ? lines : last * layout.segmentLines / scale;
+    return DecodeStream(s_Stream.data(), s_Stream.size(), scale, bits + size_t(keepBegin) * bytesPerLine,
+                        bytesPerLine, width, keepBegin - streamRow, keepEnd - streamRow, nullptr);
+}
+
+static bool DecodeParallel(const uint8_t *data, const RestartLayout &layout, uint32_t scale,
+                           uint8_t *bits, size_t bytesPerLine, uint32_t width, uint32_t lines)
+{
+    WorkerPool &pool = WorkerPool::Instance();
+    const uint32_t segments = uint32_t(layout.markers.size()) + 1;
+    const uint32_t chunks = std::min({ pool.Concurrency(), segments, layout.height / s_MinChunkLines });
+    if (chunks < 2)
+        return false;
+
+    std::atomic<bool> ok{true};
+    pool.ParallelFor(chunks, [&](uint32_t chunk) {
+        const uint32_t first = uint32_t(uint64_t(segments) * chunk / chunks);
+        const uint32_t last = uint32_t(uint64_t(segments) * (chunk + 1) / chunks);
+        if (!DecodeSegments(data, layout, first, last, scale, bits, bytesPerLine, width, lines))
+        {
+            ok = false;
+        }
+    });
+    return ok;
+}
+
+namespace JpegDecoder
+{
+    bool ReadHeader(const uint8_t *data, size_t size, uint32_t scale, Header &header)
+    {
+        return DecodeStream(data, size, scale, nullptr, 0, 0, 0, 0, &header);
+    }
+
+    bool Decode(const uint8_t *data, size_t size, uint32_t scale, QImage &dst)
+    {
+        uint8_t *bits = dst.bits();
+        const size_t bytesPerLine = dst.bytesPerLine();
+        const uint32_t width = dst.width();
+        const uint32_t lines = dst.height();
+
+        static thread_local RestartLayout s_Layout;
+        if (lines * scale >= 2 * s_MinChunkLines && WorkerPool::Instance().Concurrency() > 1 &&
+            FindRestartLayout(data, size, s_Layout) &&
+            DecodeParallel(data, s_Layout, scale, bits, bytesPerLine, width, lines))
+        {
+            return true;
+        }
+
+        return DecodeStream(data, size, scale, bits, bytesPerLine, width, 0, lines, nullptr);
+    }
+}
@@ -0,0 +1,193 @@
+#include "JpegEncoder.h"
+
+#include <algorithm>
+#include <csetjmp>
+#include <cstdio>
+
+#include <jpeglib.h>
+
+// Lines handed to libjpeg per jpeg_write_scanlines call
+static const uint32_t s_LinesPerCall = 16;
+
+// libjpeg reports fatal errors through error_exit, which must not return
+struct ErrorManager
+{
+    jpeg_error_mgr base;
+    std::jmp_buf jump;
+};
+
+static void OnError(j_common_ptr cinfo)
+{
+    std::longjmp(reinterpret_cast<ErrorManager *>(cinfo->err)->jump, 1);
+}
+
+static void OnMessage(j_common_ptr)
+{
+}
+
+struct JpegEncoder::State
+{
+    jpeg_compress_struct cinfo;
+    ErrorManager error;
+    jpeg_destination_mgr destination;
+    QByteArray *output = nullptr;   // of the running Encode
+    int offset = 0;                 // where the JPEG starts in it
+    size_t pixels = 0;              // of the image of the running Encode
+    double bytesPerPixel = 0;       // of the previous JPEG, sizes the next output
+    QImage converted;               // images of formats libjpeg can't read
+
+    static State *Of(j_compress_ptr cinfo)
+    {
+        return static_cast<State *>(cinfo->client_data);
+    }
+
+    // The output was sized by Encode, libjpeg writes behind its head
+    static void InitDestination(j_compress_ptr cinfo)
+    {
+        State *state = Of(cinfo);
+        state->destination.next_output_byte = reinterpret_cast<JOCTET *>(state->output->data() + state->offset);
+        state->destination.free_in_buffer = size_t(state->output->size() - state->offset);
+    }
+
+    // The output is full, double it and continue behind the written bytes
+    static boolean EmptyOutputBuffer(j_compress_ptr cinfo)
+    {
+        State *state = Of(cinfo);
+        const int written = state->output->size();
+        state->output->resize(written * 2);
+        state->destination.next_output_byte = reinterpret_cast<JOCTET *>(state->output->data() + written);
+        state->destination.free_in_buffer = size_t(state->output->size() - written);
+        return TRUE;
+    }
+
+    // Cut the output behind the JPEG
+    static void TermDestination(j_compress_ptr cinfo)
+    {
+        State *state = Of(cinfo);
+        state->output->resize(state->output->size() - int(state->destination.free_in_buffer));
+        state->bytesPerPixel = double(state->output->size() - state->offset) / double(state->pixels);
+    }
+};
+
+// This function returns the libjpeg input layout of a QImage format, false
+// for formats that have to be converted first
+static bool InputLayout(QImage::Format format, J_COLOR_SPACE &colorSpace, int &components)
+{
+    switch (format)
+    {
+    case QImage::Format_Grayscale8:
+        colorSpace = JCS_GRAYSCALE;
+        components = 1;
+        return true;
+    case QImage::Format_RGB888:
+        colorSpace = JCS_RGB;
+        components = 3;
+        return true;
+#ifdef JCS_EXTENSIONS
+    // libjpeg-turbo reads 32 bit pixels directly
+    case QImage::Format_RGB32:
+    case QImage::Format_ARGB32:
+        colorSpace = Q_BYTE_ORDER == Q_LITTLE_ENDIAN ? JCS_EXT_BGRX : JCS_EXT_XRGB;
+        components = 4;
+        return true;
+    case QImage::Format_RGBX8888:
+    case QImage::Format_RGBA8888:
+        colorSpace = JCS_EXT_RGBX;
+        components = 4;
+        return true;
+#endif
+    default:
+        return false;
+    }
+}
+
+// This function runs one compression, a failed one leaves the compressor
+// ready for the next frame
+static bool Compress(jpeg_compress_struct &cinfo, ErrorManager &error, const QImage &image,
+                     J_COLOR_SPACE colorSpace, int components, int quality)
+{
+    JSAMPROW rows[s_LinesPerCall];
+    if (setjmp(error.jump))
+    {
+        jpeg_abort_compress(&cinfo);
+        return false;
+    }
+
+    cinfo.image_width = JDIMENSION(image.width());
+    cinfo.image_height = JDIMENSION(image.height());
+    cinfo.input_components = components;
+    cinfo.in_color_space = colorSpace;
+    jpeg_set_defaults(&cinfo);
+    jpeg_set_quality(&cinfo, quality, TRUE);
+    jpeg_start_compress(&cinfo, TRUE);
+
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        JDIMENSION count = 0;
+        for (; count < s_LinesPerCall && cinfo.next_scanline + count < cinfo.image_height; count++)
+        {
+            rows[count] = const_cast<JSAMPROW>(image.constScanLine(int(cinfo.next_scanline + count)));
+        }
+        jpeg_write_scanlines(&cinfo, rows, count);
+    }
+    jpeg_finish_compress(&cinfo);
+    return true;
+}
+
+JpegEncoder::JpegEncoder()
+    : m_State(new State)
+{
+    State &state = *m_State;
+    state.cinfo.err = jpeg_std_error(&state.error.base);
+    state.error.base.error_exit = OnError;
+    state.error.base.output_message = OnMessage;
+    jpeg_create_compress(&state.cinfo);
+    state.cinfo.client_data = &state;
+
+    state.destination.init_destination = State::InitDestination;
+    state.destination.empty_output_buffer = State::EmptyOutputBuffer;
+    state.destination.term_destination = State::TermDestination;
+    state.cinfo.dest = &state.destination;
+}
+
+JpegEncoder::~JpegEncoder()
+{
+    jpeg_destroy_compress(&m_State->cinfo);
+}
+
+bool JpegEncoder::Encode(const QImage &image, int quality, QByteArray &output)
+{
+    State &state = *m_State;
+    if (image.isNull())
+        return false;
+
+    const QImage *source = &image;
+    J_COLOR_SPACE colorSpace;
+    int components;
+    if (!InputLayout(image.format(), colorSpace, components))
+    {
+        state.converted = image.convertToFormat(QImage::Format_RGB888);
+        source = &state.converted;
+        InputLayout(source->format(), colorSpace, components);
+    }
+
+    // A little more than the previous JPEG took per pixel holds the next
+    // one of a stream, the first gets a quarter of the raw size, which
+    // holds most frames at preview qualities
+    state.pixels = size_t(source->width()) * source->height();
+    const size_t rawSize = state.pixels * components;
+    const size_t expected = state.bytesPerPixel > 0
+                                ? std::min(size_t(double(state.pixels) * state.bytesPerPixel * 1.25), rawSize)
+                                : rawSize / 4;
+    state.output = &output;
+    state.offset = output.size();
+    output.resize(state.offset + int(expected) + 1024);
+
+    const bool compressed = Compress(state.cinfo, state.error, *source, colorSpace, components, quality);
+    if (!compressed)
+    {
+        output.resize(state.offset);
+    }
+    state.output = nullptr;
+    return compressed;
+}
@@ -0,0 +1,288 @@
+#include "SoftwareAutoControl.h"
+#include "Camera.h"
+#include "ColorCorrection.h"
+#include "Logger.h"
+#include "PixelFormatRegistry.h"
+
+#include <QMetaObject>
+
+#include <algorithm>
+#include <cmath>
+
+// Mean luminance the exposure loop aims for, 0..255
+static const double s_TargetLuminance = 100.0;
+
+// Above this fraction of clipped samples the frame is darkened regardless of its mean
+static const double s_MaxClipped = 0.02;
+
+// Errors below this many stops count as converged. Brightening needs the
+// larger error, so a frame darkened for clipping does not go straight back.
+static const double s_DarkenDeadBand = 0.12;
+static const double s_BrightenDeadBand = 0.25;
+
+// Share of the measured error corrected per iteration, and the largest step in stops
+static const double s_ExposureDamping = 0.6;
+static const double s_MaxStep = 1.0;
+
+// One stop of gain moves it by this fraction of its range
+static const double s_GainStopFraction = 1.0 / 16.0;
+
+// Frames a new exposure or gain needs to show up in the sensor output
+static const uint32_t s_SettleFrames = 3;
+
+// Frames between exposure measurements while converged
+static const uint32_t s_ExposureInterval = 2;
+
+// Frames between white balance updates, their smoothing, and the smallest change applied
+static const uint32_t s_BalanceInterval = 8;
+static const double s_BalanceDamping = 0.5;
+static const double s_MinBalanceChange = 0.01;
+static const double s_MaxBalanceGain = 8.0;
+
+SoftwareAutoControl::SoftwareAutoControl(Camera &camera)
+    : m_Camera(camera)
+    , m_AutoExposure(false)
+    , m_HasGain(false)
+    , m_Exposure(0)
+    , m_MinExposure(0)
+    , m_MaxExposure(0)
+    , m_Gain(0)
+    , m_MinGain(0)
+    , m_MaxGain(0)
+    , m_ExposureWait(0)
+    , m_WhiteBalance(WhiteBalance::Off)
+    , m_BalanceGains{ 1.0, 1.0, 1.0 }
+    , m_SavedGains{ 1.0, 1.0, 1.0 }
+    , m_SavedEnabled(false)
+    , m_BalanceWait(0)
+{
+}
+
+int SoftwareAutoControl::SetAutoExposure(bool enable)
+{
+    if (!enable)
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_AutoExposure = false;
+        return 0;
+    }
+
+    // ReadMinMax reports failures inconsistently, a valid range is what counts
+    int64_t exposure = 0;
+    int64_t minExposure = 0;
+    int64_t maxExposure = 0;
+    m_Camera.ReadMinMaxExposure(minExposure, maxExposure);
+    if (m_Camera.ReadExposure(exposure) != 0 || minExposure >= maxExposure)
+    {
+        LOG_EX("SoftwareAutoControl::SetAutoExposure: no usable exposure control");
+        return -1;
+    }
+
+    int64_t gain = 0;
+    int64_t minGain = 0;
+    int64_t maxGain = 0;
+    m_Camera.ReadMinMaxGain(minGain, maxGain);
+    const bool hasGain = m_Camera.ReadGain(gain) == 0 && minGain < maxGain;
+
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    m_AutoExposure = true;
+    m_Exposure = std::clamp(exposure, minExposure, maxExposure);
+    m_MinExposure = minExposure;
+    m_MaxExposure = maxExposure;
+    m_HasGain = hasGain;
+    m_Gain = hasGain ? std::clamp(gain, minGain, maxGain) : 0;
+    m_MinGain = minGain;
+    m_MaxGain = maxGain;
+    m_ExposureWait = 0;
+    return 0;
+}
+
+bool SoftwareAutoControl::IsAutoExposure() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_AutoExposure;
+}
+
+void SoftwareAutoControl::SetWhiteBalance(WhiteBalance mode)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    if (mode == m_WhiteBalance)
+    {
+        return;
+    }
+
+    ColorCorrectionSettings settings = ColorCorrection::CurrentSettings();
+    if (m_WhiteBalance == WhiteBalance::Off)
+    {
+        std::copy(settings.gains, settings.gains + 3, m_SavedGains);
+        m_SavedEnabled = settings.enabled;
+        for (int c = 0; c < 3; c++)
+        {
+            m_BalanceGains[c] = std::clamp(settings.gains[c], 1.0 / s_MaxBalanceGain, s_MaxBalanceGain);
+        }
+        m_BalanceWait = 0;
+    }
+    else if (mode == WhiteBalance::Off)
+    {
+        ColorCorrection::UpdateCurrent([this](ColorCorrectionSettings &current)
+        {
+            std::copy(m_SavedGains, m_SavedGains + 3, current.gains);
+            current.enabled = m_SavedEnabled;
+            return true;
+        });
+    }
+    m_WhiteBalance = mode;
+}
+
+SoftwareAutoControl::WhiteBalance SoftwareAutoControl::GetWhiteBalance() const
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+    return m_WhiteBalance;
+}
+
+void SoftwareAutoControl::ProcessFrame(const BufferWrapper &frame)
+{
+    std::lock_guard<std::mutex> lock(m_Mutex);
+
+    const bool exposureDue = m_AutoExposure && m_ExposureWait == 0;
+    const bool balanceDue = m_WhiteBalance != WhiteBalance::Off && m_BalanceWait == 0;
+    m_ExposureWait = m_ExposureWait ? m_ExposureWait - 1 : 0;
+    m_BalanceWait = m_BalanceWait ? m_BalanceWait - 1 : 0;
+    if (!exposureDue && !balanceDue)
+    {
+        return;
+    }
+
+    FrameStatistics::Statistics stats;
+    if (FrameStatistics::Compute(frame, stats) != 0)
+    {
+        return;
+    }
+
+    if (exposureDue)
+    {
+        UpdateExposure(stats);
+    }
+
+    // The color correction only applies to demosaiced frames
+    const PixelFormatRegistry::PixelFormatDescriptor *desc = PixelFormatRegistry::Find(frame.pixelFormat);
+    if (balanceDue && desc && desc->family == PixelFormatRegistry::PixelFamily::Bayer)
+    {
+        UpdateWhiteBalance(stats);
+    }
+}
+
+void SoftwareAutoControl::UpdateExposure(const FrameStatistics::Statistics &stats)
+{
+    m_ExposureWait = s_ExposureInterval - 1;
+
+    double ratio = s_TargetLuminance / std::max(stats.luminance, 1.0);
+    const bool clipping = stats.clipped > s_MaxClipped;
+    if (clipping)
+    {
+        ratio = std::min(ratio, 0.7);
+    }
+
+    const double error = std::log2(ratio);
+    if (!clipping && error > -s_DarkenDeadBand && error < s_BrightenDeadBand)
+    {
+        return;
+    }
+    double stops = std::clamp(error * s_ExposureDamping, -s_MaxStep, s_MaxStep);
+
+    int64_t exposure = m_Exposure;
+    int64_t gain = m_Gain;
+    const double gainPerStop = (m_MaxGain - m_MinGain) * s_GainStopFraction;
+
+    // Brighten with exposure first and darken with gain first, so the gain,
+    // and with it the noise, stays as low as the light allows
+    if (stops > 0.0)
+    {
+        const double base = double(std::max<int64_t>(exposure, 1));
+        exposure = std::min(int64_t(std::llround(base * std::exp2(stops))), m_MaxExposure);
+        stops -= std::log2(std::max<double>(double(exposure), 1.0) / base);
+        if (m_HasGain && stops > 0.05)
+        {
+            gain = std::min(gain + std::max<int64_t>(std::llround(stops * gainPerStop), 1), m_MaxGain);
+        }
+    }
+    else
+    {
+        if (m_HasGain && gain > m_MinGain)
+        {
+            const int64_t reduction = std::min(std::max<int64_t>(std::llround(-stops * gainPerStop), 1), gain - m_MinGain);
+            gain -= reduction;
+            stops = std::min(stops + reduction / gainPerStop, 0.0);
+        }
+        if (stops < -0.05)
+        {
+            const double base = double(std::max<int64_t>(exposure, 1));
+            exposure = std::max(int64_t(std::llround(base * std::exp2(stops))), m_MinExposure);
+        }
+    }
+
+    if (exposure == m_Exposure && gain == m_Gain)
+    {
+        return;
+    }
+    m_ExposureWait = s_SettleFrames;
+
+    Camera *camera = &m_Camera;
+    if (exposure != m_Exposure)
+    {
+        m_Exposure = exposure;
+        QMetaObject::invokeMethod(camera, [camera, exposure]()
+        {
+            camera->SetExposure(exposure);
+            emit camera->PassAutoExposureValue(exposure);
+        }, Qt::QueuedConnection);
+    }
+    if (gain != m_Gain)
+    {
+        m_Gain = gain;
+        QMetaObject::invokeMethod(camera, [camera, gain]()
+        {
+            camera->SetGain(gain);
+            emit camera->PassAutoGainValue(int32_t(gain));
+        }, Qt::QueuedConnection);
+    }
+}
+
+void SoftwareAutoControl::UpdateWhiteBalance(const FrameStatistics::Statistics &stats)
+{
+    m_BalanceWait = s_BalanceInterval - 1;
+
+    const double *rgb = m_WhiteBalance == WhiteBalance::WhitePatch ? stats.highlight : stats.mean;
+    if (!stats.color || rgb[0] < 1.0 || rgb[1] < 1.0 || rgb[2] < 1.0)
+    {
+        return;
+    }
+
+    // The statistics come from the raw frame, so these are the absolute
+    // gains and the smoothing alone determines how fast they settle
+    double target[3] = { rgb[1] / rgb[0], 1.0, rgb[1] / rgb[2] };
+    const double smallest = *std::min_element(target, target + 3);
+
+    bool changed = false;
+    double gains[3];
+    for (int c = 0; c < 3; c++)
+    {
+        const double wanted = std::min(target[c] / smallest, s_MaxBalanceGain);
+        const double current = std::log(m_BalanceGains[c]);
+        gains[c] = std::exp(current + (std::log(wanted) - current) * s_BalanceDamping);
+        changed |= std::fabs(gains[c] / m_BalanceGains[c] - 1.0) > s_MinBalanceChange;
+    }
+    if (!changed)
+    {
+        return;
+    }
+
+    // Only the gains, a profile change from the UI meanwhile is kept
+    std::copy(gains, gains + 3, m_BalanceGains);
+    ColorCorrection::UpdateCurrent([&gains](ColorCorrectionSettings &settings)
+    {
+        std::copy(gains, gains + 3, settings.gains);
+        settings.enabled = true;
+        return true;
+    });
+}
@@ -1,10 +1,12 @@
 #include "SoftwareRenderSystem.h"
 #include "ImageTransform.h"
 #include <QWheelEvent>
-#include <QGraphicsPixmapItem>
 #include <QToolTip>
 #include <QMutexLocker>
 
+#include <algorithm>
+#include <cmath>
+
 
 static void DoNothing() {}
 
@@ -40,7 +42,14 @@ void SoftwareRenderSystem::ZoomRequestedByWidget(QPointF center, bool zoomIn) {
 }
 
 void SoftwareRenderSystem::ImageClicked(QPointF point) {
-    emit PixelClicked(point);
+    // Report the position in the frame, as the EGL renderer does
+    double x = point.x();
+    double y = point.y();
+    {
+        QMutexLocker locker(&orientationMutex);
+        ImageOrientation::MapToFrame(shownOrientation, shownWidth, shownHeight, x, y);
+    }
+    emit PixelClicked(QPointF(x, y));
 }
 
 void SoftwareRenderSystem::ImageDoubleClicked() {
@@ -64,40 +73,120 @@ void SoftwareRenderSystem::ConversionThreadMain() {
         bufferAvailable = false;
         frameAvailableMutex.unlock();
 
-        QImage convertedImage;
-        int result = ImageTransform::ConvertFrame(buffer.data, buffer.length,
-                                              buffer.width, buffer.height, buffer.pixelFormat,
-                                              buffer.payloadSize, buffer.bytesPerLine, convertedImage);
-
-        auto pixmap = QPixmap::fromImage(convertedImage);
-        widget->SetPixmap(pixmap);
-        renderFPS.trigger();
-
+        // The widget keeps drawing the image after the buffer went back to
+        // the driver, so it has to be a copy. Converting into a recycled
+        // pool slot keeps that copy allocation free.
+        QImage &convertedImage = imagePool.Acquire();
+        ImageTransform::ConversionOptions options;
+        options.downscale = previewDownscale;
+        options.colorCorrection = ColorCorrection::Current();
+        ImageTransform::SetColorimetry(buffer, options);
+        {
+            QMutexLocker orientationLocker(&orientationMutex);
+            options.orientation = orientation;
+        }
+        // Zoomed in, only the visible part of the frame is converted
+        QRect region;
+        QRect orientedRegion;
+        bool const partial = options.downscale == 1 &&
+                             VisibleRegion(buffer, options.orientation, region, orientedRegion);
+        int result = partial ? ImageTransform::ConvertFrame(buffer, region, convertedImage, options)
+                             : ImageTransform::ConvertFrame(buffer, convertedImage, options);
         doneCallback();
+
+        if (result == 0) {
+            {
+                QMutexLocker orientationLocker(&orientationMutex);
+                shownOrientation = options.orientation;
+                shownWidth = buffer.width;
+                shownHeight = buffer.height;
+            }
+            // Rotated by 90 or 270 degrees, the image is as wide as the frame is high
+            uint32_t orientedWidth = 0;
+            uint32_t orientedHeight = 0;
+            ImageOrientation::OrientedSize(options.orientation, buffer.width, buffer.height,
+                                           orientedWidth, orientedHeight);
+            if (partial) {
+                widget->SetImage(convertedImage, orientedRegion.topLeft(), QSize(orientedWidth, orientedHeight));
+            } else {
+                // Formats without a binned path (JPEG fallbacks) may return full size
+                int const scale = convertedImage.width() < int(orientedWidth) ? options.downscale : 1;
+                widget->SetImage(convertedImage, scale);
+            }
+            renderFPS.trigger();
+        }
     }
 }
 
 void SoftwareRenderSystem::ApplyScale() {
     QTransform transformation;
-    transformation.scale(scaleFactor * (flipX ? -1.0 : 1.0),
-                         scaleFactor * (flipY ? -1.0 : 1.0));
+    transformation.scale(scaleFactor, scaleFactor);
     widget->setTransform(transformation);
+    widget->UpdateVisibleRect();
+}
+
+// This function returns the part of the frame worth converting when the
+// view shows only a small part of it. One view of margin on every side
+// keeps scrolling covered until the next frame arrives; a stopped stream
+// shows the background beyond it. 'orientedRegion' is where the converted
+// part lands in the oriented image.
+bool SoftwareRenderSystem::VisibleRegion(BufferWrapper const& buffer, ImageOrientation::Orientation const& orientation,
+                                         QRect &region, QRect &orientedRegion) const {
+    QRectF const visible = widget->VisibleSceneRect();
+    if (visible.isEmpty()) {
+        return false;
+    }
+
+    uint32_t orientedWidth = 0;
+    uint32_t orientedHeight = 0;
+    ImageOrientation::OrientedSize(orientation, buffer.width, buffer.height, orientedWidth, orientedHeight);
+    orientedRegion = visible.adjusted(-visible.width(), -visible.height(), visible.width(), visible.height())
+                         .toAlignedRect()
+                         .intersected(QRect(0, 0, int(orientedWidth), int(orientedHeight)));
+
+    // Converting most of the frame anyway does not pay for the extra copy
+    if (orientedRegion.isEmpty() ||
+        qint64(orientedRegion.width()) * orientedRegion.height() * 2 > qint64(orientedWidth) * orientedHeight) {
+        return false;
+    }
+
+    // Opposite corners of the oriented part are opposite corners in the frame
+    double x0 = orientedRegion.left();
+    double y0 = orientedRegion.top();
+    double x1 = orientedRegion.right() + 1;
+    double y1 = orientedRegion.bottom() + 1;
+    ImageOrientation::MapToFrame(orientation, buffer.width, buffer.height, x0, y0);
+    ImageOrientation::MapToFrame(orientation, buffer.width, buffer.height, x1, y1);
+    region = QRect(int(std::min(x0, x1)), int(std::min(y0, y1)),
+                   int(std::abs(x1 - x0)), int(std::abs(y1 - y0)));
+    return true;
+}
+
+// This function returns the largest downscale factor that still gives at
+// least one image pixel per screen pixel at the given zoom
+int SoftwareRenderSystem::PreviewDownscale(double scale) {
+    if (scale <= 0.125) {
+        return 8;
+    }
+    if (scale <= 0.25) {
+        return 4;
+    }
+    if (scale <= 0.5) {
+        return 2;
+    }
+    return 1;
 }
 
 void SoftwareRenderSystem::SetScaleFactor(double scale)
 {
     scaleFactor = scale;
+    previewDownscale = PreviewDownscale(scale * widget->devicePixelRatioF());
     ApplyScale();
 }
 
-void SoftwareRenderSystem::SetFlipX(bool flip) {
-    flipX = flip;
-    ApplyScale();
-}
-
-void SoftwareRenderSystem::SetFlipY(bool flip) {
-    flipY = flip;
-    ApplyScale();
+void SoftwareRenderSystem::SetOrientation(const ImageOrientation::Orientation &orientation) {
+    QMutexLocker locker(&orientationMutex);
+    this->orientation = orientation;
 }
 
 QWidget* SoftwareRenderSystem::GetWidget() const {
@@ -1,13 +1,38 @@
 #include "SoftwareRenderSystem.h"
+#include <QPainter>
 #include <QWheelEvent>
 
+void FrameImageItem::SetImage(QImage image, int scale) {
+    if (image.size() != m_Image.size()) {
+        prepareGeometryChange();
+    }
+    if (scale != m_Scale) {
+        m_Scale = scale;
+        setScale(scale);
+    }
+    m_Image = std::move(image);
+    update();
+}
+
+QRectF FrameImageItem::boundingRect() const {
+    return QRectF(0, 0, m_Image.width(), m_Image.height());
+}
+
+void FrameImageItem::paint(QPainter *painter, const QStyleOptionGraphicsItem *option, QWidget *widget) {
+    Q_UNUSED(option);
+    Q_UNUSED(widget);
+    if (!m_Image.isNull()) {
+        painter->drawImage(QPointF(0, 0), m_Image);
+    }
+}
+
 SoftwareRenderWidget::SoftwareRenderWidget(QWidget *parent)
   : QGraphicsView(parent) 
   , m_Scene(new QGraphicsScene)
   {
     setScene(m_Scene);
-    m_Scene->addItem(&m_PixmapItem);
-    connect(this, SIGNAL(SetPixmapSignal(QPixmap)), this, SLOT(OnSetPixmap(QPixmap)));
+    m_Scene->addItem(&m_ImageItem);
+    connect(this, SIGNAL(SetImageSignal(QImage,int,QPoint,QSize)), this, SLOT(OnSetImage(QImage,int,QPoint,QSize)));
     setStyleSheet("QGraphicsView {"
                   "  background-color: #010409;"
                   "  border: none;"
@@ -15,17 +40,48 @@ SoftwareRenderWidget::SoftwareRenderWidget(QWidget *parent)
   }
 
 SoftwareRenderWidget::~SoftwareRenderWidget() {
-    delete m_CurrentPixmap;
+    m_Scene->removeItem(&m_ImageItem);
 }
 
-void SoftwareRenderWidget::OnSetPixmap(QPixmap pixmap) {
-    m_PixmapItem.setPixmap(pixmap);
-    m_Scene->setSceneRect(0, 0, pixmap.width(), pixmap.height());
+void SoftwareRenderWidget::OnSetImage(QImage image, int scale, QPoint offset, QSize sceneSize) {
+    // The scene stays in full resolution frame coordinates, so pixel
+    // probing and zoom centers do not depend on the preview scale or on
+    // the part of the frame that was converted
+    m_Scene->setSceneRect(0, 0, sceneSize.width(), sceneSize.height());
+    m_ImageItem.setPos(offset);
+    m_ImageItem.SetImage(std::move(image), scale);
     show();
+    UpdateVisibleRect();
+}
+
+void SoftwareRenderWidget::SetImage(QImage image, int scale) {
+  QSize const sceneSize(image.width() * scale, image.height() * scale);
+  emit SetImageSignal(image, scale, QPoint(0, 0), sceneSize);
+}
+
+void SoftwareRenderWidget::SetImage(QImage image, QPoint offset, QSize sceneSize) {
+  emit SetImageSignal(image, 1, offset, sceneSize);
+}
+
+QRectF SoftwareRenderWidget::VisibleSceneRect() const {
+    QMutexLocker locker(&m_VisibleMutex);
+    return m_VisibleRect;
+}
+
+void SoftwareRenderWidget::UpdateVisibleRect() {
+    QRectF const visible = mapToScene(viewport()->rect()).boundingRect();
+    QMutexLocker locker(&m_VisibleMutex);
+    m_VisibleRect = visible;
+}
+
+void SoftwareRenderWidget::scrollContentsBy(int dx, int dy) {
+    QGraphicsView::scrollContentsBy(dx, dy);
+    UpdateVisibleRect();
 }
 
-void SoftwareRenderWidget::SetPixmap(QPixmap pixmap) {
-  emit SetPixmapSignal(pixmap);
+void SoftwareRenderWidget::resizeEvent(QResizeEvent *event) {
+    QGraphicsView::resizeEvent(event);
+    UpdateVisibleRect();
 }
 
 void SoftwareRenderWidget::wheelEvent(QWheelEvent *event)
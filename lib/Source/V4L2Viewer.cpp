@@ -33,6 +33,8 @@
 #include "CustomDialog.h"
 #include "GitRevision.h"
 #include "ImageTransform.h"
+#include "ImageWriter.h"
+#include "PixelFormatRegistry.h"
 #include "Version.h"
 
 #include <QtCore>
@@ -89,6 +91,7 @@ V4L2Viewer::V4L2Viewer(QWidget *parent, Qt::WindowFlags flags)
     , m_VIDIOC_TRY_FMT(true) // use VIDIOC_TRY_FMT by default
     , m_ShowFrames(true)
     , m_nStreamNumber(0)
+    , m_SoftwareAutoControl(m_Camera)
     , m_bIsOpen(false)
     , m_bIsStreaming(false)
     , m_sliderGainValue(0)
@@ -156,6 +159,7 @@ V4L2Viewer::V4L2Viewer(QWidget *parent, Qt::WindowFlags flags)
 
     connect(ui.m_FlipHorizontalCheckBox,      SIGNAL(stateChanged(int)), this, SLOT(OnFlipHorizontal(int)));
     connect(ui.m_FlipVerticalCheckBox,        SIGNAL(stateChanged(int)), this, SLOT(OnFlipVertical(int)));
+    connect(ui.m_RotationComboBox,            SIGNAL(currentIndexChanged(int)), this, SLOT(OnRotationChanged(int)));
 
     SetTitleText();
 
@@ -199,6 +203,16 @@ V4L2Viewer::V4L2Viewer(QWidget *parent, Qt::WindowFlags flags)
     connect(ui.m_DisplayImagesCheckBox, SIGNAL(clicked()), this, SLOT(OnShowFrames()));
 
     connect(ui.m_TitleLogtofile, SIGNAL(triggered()), this, SLOT(OnLogToFile()));
+    connect(ui.m_TitleColorCorrection, SIGNAL(triggered()), this, SLOT(OnColorCorrection()));
+    connect(ui.m_TitleLoadColorProfile, SIGNAL(triggered()), this, SLOT(OnLoadColorProfile()));
+    connect(ui.m_TitleSoftwareAutoExposure, SIGNAL(triggered()), this, SLOT(OnSoftwareAutoExposure()));
+    connect(ui.m_TitleGrayWorldBalance, SIGNAL(triggered()), this, SLOT(OnSoftwareWhiteBalance()));
+    connect(ui.m_TitleWhitePatchBalance, SIGNAL(triggered()), this, SLOT(OnSoftwareWhiteBalance()));
+    connect(ui.m_TitleFlatField, SIGNAL(triggered()), this, SLOT(OnFlatFieldCorrection()));
+    connect(ui.m_TitleCaptureDarkFrames, SIGNAL(triggered()), this, SLOT(OnCaptureFlatFieldReference()));
+    connect(ui.m_TitleCaptureFlatFrames, SIGNAL(triggered()), this, SLOT(OnCaptureFlatFieldReference()));
+    connect(ui.m_TitleSaveFlatField, SIGNAL(triggered()), this, SLOT(OnSaveFlatField()));
+    connect(ui.m_TitleLoadFlatField, SIGNAL(triggered()), this, SLOT(OnLoadFlatField()));
     connect(ui.m_TitleLangEnglish, SIGNAL(triggered()), this, SLOT(OnLanguageChange()));
     connect(ui.m_TitleLangGerman, SIGNAL(triggered()), this, SLOT(OnLanguageChange()));
 
@@ -275,6 +289,7 @@ V4L2Viewer::V4L2Viewer(QWidget *parent, Qt::WindowFlags flags)
     ui.m_ImageControlFrame->setEnabled(false);
     ui.m_FlipHorizontalCheckBox->setEnabled(false);
     ui.m_FlipVerticalCheckBox->setEnabled(false);
+    ui.m_RotationComboBox->setEnabled(false);
     ui.m_DisplayImagesCheckBox->setEnabled(false);
     ui.m_SaveImageButton->setEnabled(false);
 
@@ -338,6 +353,144 @@ void V4L2Viewer::OnLogToFile()
     Logger::LogSwitch(ui.m_TitleLogtofile->isChecked());
 }
 
+void V4L2Viewer::OnColorCorrection()
+{
+    const bool enabled = ui.m_TitleColorCorrection->isChecked();
+    ColorCorrection::UpdateCurrent([enabled](ColorCorrectionSettings &settings)
+    {
+        settings.enabled = enabled;
+        return true;
+    });
+}
+
+void V4L2Viewer::OnLoadColorProfile()
+{
+    QString path = QFileDialog::getOpenFileName(this, tr("Load color profile"), QDir::homePath(), "*.json");
+    if (path.isEmpty())
+        return;
+
+    // Loading a profile means the user wants to see it
+    const bool loaded = ColorCorrection::UpdateCurrent([&path](ColorCorrectionSettings &settings)
+    {
+        if (!ColorCorrection::LoadProfile(path, settings))
+        {
+            return false;
+        }
+        settings.enabled = true;
+        return true;
+    });
+    if (!loaded)
+    {
+        QMessageBox::warning(this, tr("Color correction"), tr("Could not read the color profile %1").arg(path));
+        return;
+    }
+    ui.m_TitleColorCorrection->setChecked(true);
+    LOG_EX("V4L2Viewer::OnLoadColorProfile: loaded %s", path.toStdString().c_str());
+}
+
+void V4L2Viewer::OnSoftwareAutoExposure()
+{
+    if (m_SoftwareAutoControl.SetAutoExposure(ui.m_TitleSoftwareAutoExposure->isChecked()) != 0)
+    {
+        ui.m_TitleSoftwareAutoExposure->setChecked(false);
+        if (m_bIsOpen)
+            QMessageBox::warning(this, tr("Software auto exposure"), tr("The camera has no exposure control that can be adjusted"));
+    }
+}
+
+void V4L2Viewer::OnSoftwareWhiteBalance()
+{
+    // The two estimates exclude each other
+    QAction *action = qobject_cast<QAction*>(sender());
+    if (action == ui.m_TitleGrayWorldBalance && action->isChecked())
+        ui.m_TitleWhitePatchBalance->setChecked(false);
+    else if (action == ui.m_TitleWhitePatchBalance && action->isChecked())
+        ui.m_TitleGrayWorldBalance->setChecked(false);
+
+    SoftwareAutoControl::WhiteBalance mode = SoftwareAutoControl::WhiteBalance::Off;
+    if (ui.m_TitleGrayWorldBalance->isChecked())
+        mode = SoftwareAutoControl::WhiteBalance::GrayWorld;
+    else if (ui.m_TitleWhitePatchBalance->isChecked())
+        mode = SoftwareAutoControl::WhiteBalance::WhitePatch;
+    m_SoftwareAutoControl.SetWhiteBalance(mode);
+
+    // The white balance works through the color correction
+    ui.m_TitleColorCorrection->setChecked(ColorCorrection::CurrentSettings().enabled || mode != SoftwareAutoControl::WhiteBalance::Off);
+}
+
+void V4L2Viewer::OnFlatFieldCorrection()
+{
+    if (ui.m_TitleFlatField->isChecked() && !FlatFieldCorrection::CurrentMaps())
+    {
+        ui.m_TitleFlatField->setChecked(false);
+        QMessageBox::warning(this, tr("Flat-field correction"), tr("Load or create flat-field maps first"));
+        return;
+    }
+    FlatFieldCorrection::SetEnabled(ui.m_TitleFlatField->isChecked());
+}
+
+void V4L2Viewer::OnCaptureFlatFieldReference()
+{
+    const bool dark = sender() == ui.m_TitleCaptureDarkFrames;
+    const QString text = dark ? tr("Cover the lens. Number of dark frames to average:")
+                              : tr("Point the camera at an evenly lit target. Number of flat frames to average:");
+    bool ok = false;
+    const int frames = QInputDialog::getInt(this, tr("Flat-field calibration"), text, 16, 1, 256, 1, &ok);
+    if (!ok)
+        return;
+
+    m_FlatFieldCalibration.Start(dark ? FlatFieldCalibration::Reference::Dark : FlatFieldCalibration::Reference::Flat, frames);
+    LOG_EX("V4L2Viewer::OnCaptureFlatFieldReference: averaging %d %s frames", frames, dark ? "dark" : "flat");
+}
+
+void V4L2Viewer::OnSaveFlatField()
+{
+    if (m_FlatFieldCalibration.IsCapturing())
+    {
+        QMessageBox::warning(this, tr("Flat-field correction"), tr("The reference frames are still being captured"));
+        return;
+    }
+    std::shared_ptr<FlatFieldCorrection> maps = m_FlatFieldCalibration.Build();
+    if (!maps)
+    {
+        QMessageBox::warning(this, tr("Flat-field correction"), tr("Capture dark or flat frames of a raw format first"));
+        return;
+    }
+
+    QString path = QFileDialog::getSaveFileName(this, tr("Save flat-field maps"), FlatFieldCorrection::DefaultPath(), "*.v4ff");
+    if (path.isEmpty())
+        return;
+    if (!maps->Save(path))
+    {
+        QMessageBox::warning(this, tr("Flat-field correction"), tr("Could not write the flat-field maps %1").arg(path));
+        return;
+    }
+
+    // Calibrating means the user wants to see the result
+    FlatFieldCorrection::SetCurrentMaps(maps);
+    FlatFieldCorrection::SetEnabled(true);
+    ui.m_TitleFlatField->setChecked(true);
+    LOG_EX("V4L2Viewer::OnSaveFlatField: saved %s with %d defect pixels", path.toStdString().c_str(), int(maps->DefectCount()));
+}
+
+void V4L2Viewer::OnLoadFlatField()
+{
+    QString path = QFileDialog::getOpenFileName(this, tr("Load flat-field maps"), FlatFieldCorrection::DefaultPath(), "*.v4ff");
+    if (path.isEmpty())
+        return;
+
+    std::shared_ptr<const FlatFieldCorrection> maps = FlatFieldCorrection::Load(path);
+    if (!maps)
+    {
+        QMessageBox::warning(this, tr("Flat-field correction"), tr("Could not read the flat-field maps %1").arg(path));
+        return;
+    }
+    FlatFieldCorrection::SetCurrentMaps(maps);
+    FlatFieldCorrection::SetEnabled(true);
+    ui.m_TitleFlatField->setChecked(true);
+    LOG_EX("V4L2Viewer::OnLoadFlatField: loaded %s", path.toStdString().c_str());
+}
+
 void V4L2Viewer::RemoteClose()
 {
     if ( true == m_bIsOpen )
@@ -595,6 +748,7 @@ void V4L2Viewer::OnOpenCloseButtonClicked()
                 ui.m_camerasListCheckBox->setChecked(false);
                 ui.m_FlipHorizontalCheckBox->setEnabled(true);
                 ui.m_FlipVerticalCheckBox->setEnabled(true);
+                ui.m_RotationComboBox->setEnabled(true);
                 ui.m_DisplayImagesCheckBox->setEnabled(true);
                 ui.m_SaveImageButton->setEnabled(true);
             }
@@ -617,6 +771,7 @@ void V4L2Viewer::OnOpenCloseButtonClicked()
 
             ui.m_FlipHorizontalCheckBox->setEnabled(false);
             ui.m_FlipVerticalCheckBox->setEnabled(false);
+            ui.m_RotationComboBox->setEnabled(false);
             ui.m_DisplayImagesCheckBox->setEnabled(false);
             ui.m_SaveImageButton->setEnabled(false);
 
@@ -1040,12 +1195,31 @@ void V4L2Viewer::OnCheckFrameRateAutoClicked()
 
 void V4L2Viewer::OnFlipHorizontal(int state)
 {
-    m_RenderSystem->SetFlipX(state != Qt::Unchecked);
+    ImageOrientation::Orientation orientation = ImageOrientation::Current();
+    orientation.flipX = state != Qt::Unchecked;
+    UpdateOrientation(orientation);
 }
 
 void V4L2Viewer::OnFlipVertical(int state)
 {
-    m_RenderSystem->SetFlipY(state != Qt::Unchecked);
+    ImageOrientation::Orientation orientation = ImageOrientation::Current();
+    orientation.flipY = state != Qt::Unchecked;
+    UpdateOrientation(orientation);
+}
+
+void V4L2Viewer::OnRotationChanged(int index)
+{
+    ImageOrientation::Orientation orientation = ImageOrientation::Current();
+    orientation.rotation = ImageOrientation::RotationFromDegrees(index * 90);
+    UpdateOrientation(orientation);
+}
+
+void V4L2Viewer::UpdateOrientation(const ImageOrientation::Orientation &orientation)
+{
+    // Snapshots, the stream and recordings read the shared orientation, the
+    // preview gets its own copy
+    ImageOrientation::SetCurrent(orientation);
+    m_RenderSystem->SetOrientation(orientation);
 }
 
 void V4L2Viewer::StartStreaming(uint32_t pixelFormat, uint32_t payloadSize, uint32_t width, uint32_t height, uint32_t bytesPerLine)
@@ -1218,23 +1392,28 @@ void V4L2Viewer::OnSaveImageClicked()
     }
 
     QString filename = "/Frame_"+QString::number(m_SavedFramesCounter)+m_LastImageSaveFormat;
-    QString fullPath = QFileDialog::getSaveFileName(this, tr("Save file"), QDir::homePath()+filename, "*.png *.raw");
+    QString fullPath = QFileDialog::getSaveFileName(this, tr("Save file"), QDir::homePath()+filename, "*.png *.tiff *.raw");
 
-    if (fullPath.contains(".png"))
+    if (fullPath.contains(".png") || fullPath.contains(".tif"))
     {
         ui.m_SaveImageButton->setEnabled(false);
-        m_LastImageSaveFormat = ".png";
+        m_LastImageSaveFormat = fullPath.contains(".png") ? ".png" : ".tiff";
         // Do pixel format conversion here.
         // When doing software rendering, this is redundant work, but it greatly simplifies the
         // RenderSystem interface and doesn't require render-to-texture in case of hardware
         // accelerated rendering
+        // PNG and TIFF keep mono and Bayer frames at their full bit depth
+        ImageTransform::ConversionOptions options;
+        options.fullDepth = true;
+        options.demosaic = Demosaic::Method::MalvarHeCutler;
+        options.colorCorrection = ColorCorrection::Current();
+        ImageTransform::SetColorimetry(lastFrame, options);
+        options.orientation = ImageOrientation::Current();
         QImage convertedImage;
-        ImageTransform::ConvertFrame(lastFrame.data, lastFrame.length,
-                                     lastFrame.width, lastFrame.height, lastFrame.pixelFormat,
-                                     lastFrame.payloadSize, lastFrame.bytesPerLine, convertedImage);
+        ImageTransform::ConvertFrame(lastFrame, convertedImage, options);
         locker.unlock();
         std::thread saveThread{[convertedImage,fullPath,this] {
-            convertedImage.save(fullPath,"png");
+            ImageWriter::Save(convertedImage, fullPath);
             ui.m_SaveImageButton->setEnabled(true);
         }};
         saveThread.detach();
@@ -1403,13 +1582,57 @@ void V4L2Viewer::OnImageClicked(QPointF point) {
     }
 
     QImage convertedImage;
-    // converting entire image is overkill, but this is not performance-relevant,
-    // so let's go with simple for now.
-    ImageTransform::ConvertFrame(lastFrame.data, lastFrame.length,
-                                 lastFrame.width, lastFrame.height, lastFrame.pixelFormat,
-                                 lastFrame.payloadSize, lastFrame.bytesPerLine, convertedImage);
+    // Only the clicked pixel is converted, at full depth so that we report
+    // the sensor values, not their 8 MSBs. The render systems report the
+    // click in frame coordinates, so the pixel is converted without orientation.
+    ImageTransform::ConversionOptions options;
+    options.fullDepth = true;
+    ImageTransform::SetColorimetry(lastFrame, options);
+    int const result = ImageTransform::ConvertFrame(lastFrame, QRect(x, y, 1, 1), convertedImage, options);
+    PixelFormatRegistry::PixelFormatDescriptor const *desc = PixelFormatRegistry::Find(lastFrame.pixelFormat);
     locker.unlock();
-    QColor const myPixel = convertedImage.pixel(x, y);
+
+    if (result != 0 || convertedImage.isNull()) {
+        return;
+    }
+
+    // 16 bit images hold MSB aligned samples
+    int const shift = desc && desc->bitDepth < 16 ? 16 - desc->bitDepth : 0;
+
+    if (convertedImage.format() == QImage::Format_Grayscale8)
+    {
+        QToolTip::showText(QCursor::pos(), QString("x:%1, y:%2, value:%3")
+                           .arg(x)
+                           .arg(y)
+                           .arg(convertedImage.constScanLine(0)[0]), this);
+        return;
+    }
+#if QT_VERSION >= QT_VERSION_CHECK(5,13,0)
+    if (convertedImage.format() == QImage::Format_Grayscale16)
+    {
+        uint16_t const *line = reinterpret_cast<uint16_t const*>(convertedImage.constScanLine(0));
+        QToolTip::showText(QCursor::pos(), QString("x:%1, y:%2, value:%3")
+                           .arg(x)
+                           .arg(y)
+                           .arg(line[0] >> shift), this);
+        return;
+    }
+#endif
+#if QT_VERSION >= QT_VERSION_CHECK(5,12,0)
+    if (convertedImage.format() == QImage::Format_RGBX64)
+    {
+        uint16_t const *pixel = reinterpret_cast<uint16_t const*>(convertedImage.constScanLine(0));
+        QToolTip::showText(QCursor::pos(), QString("x:%1, y:%2, r:%3/g:%4/b:%5")
+                           .arg(x)
+                           .arg(y)
+                           .arg(pixel[0] >> shift)
+                           .arg(pixel[1] >> shift)
+                           .arg(pixel[2] >> shift), this);
+        return;
+    }
+#endif
+
+    QColor const myPixel = convertedImage.pixel(0, 0);
 
     QToolTip::showText(QCursor::pos(), QString("x:%1, y:%2, r:%3/g:%4/b:%5")
                        .arg(x)
@@ -1521,6 +1744,14 @@ int V4L2Viewer::OpenAndSetupCamera(const uint32_t cardNumber, const QString &dev
     {
         CustomDialog::Error( this, tr("Video4Linux"), tr("The camera cannot be opened because it is in use by another application or it has been disconnected!"));
     } else {
+      // The flat-field calibration averages the raw frames, the correction
+      // then fixes them in place for all of the data processors
+      m_Camera.GetFrameObserver()->AddRawDataCorrection([this] (auto const& buf, uint8_t *data) {
+        m_FlatFieldCalibration.AddFrame(buf);
+        if (auto correction = FlatFieldCorrection::Current())
+          correction->Apply(buf, data);
+      });
+
       // Data processor for updating UI according to received data
       m_Camera.GetFrameObserver()->AddRawDataProcessor([this] (auto const& buf, auto doneCallback) {
         emit UpdateFrameInfo(buf.frameID,buf.width,buf.height);
@@ -1528,6 +1759,17 @@ int V4L2Viewer::OpenAndSetupCamera(const uint32_t cardNumber, const QString &dev
         doneCallback();
       });
 
+      // Data processor measuring the frames for the software auto exposure and white balance
+      m_Camera.GetFrameObserver()->AddRawDataProcessor([this] (auto const& buf, auto doneCallback) {
+        m_SoftwareAutoControl.ProcessFrame(buf);
+
+        doneCallback();
+      });
+
+      // The ranges of exposure and gain belong to the camera just opened
+      if (ui.m_TitleSoftwareAutoExposure->isChecked())
+        OnSoftwareAutoExposure();
+
       // Separate raw data processor for rendering
       m_Camera.GetFrameObserver()->AddRawDataProcessor([&] (auto const& buf, auto doneCallback) {
         if (m_StreamingState.load(std::memory_order_acquire) == StreamingState::Streaming && m_ShowFrames) {
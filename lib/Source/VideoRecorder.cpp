@@ -1,7 +1,10 @@
 #include "VideoRecorder.h"
+#include "PixelFormatRegistry.h"
 
 #include <QDataStream>
 
+#include <cstring>
+
 // Little-endian helpers
 static void writeU32LE(QFile &f, uint32_t v)
 {
@@ -26,6 +29,97 @@ static void writeU16LE(QFile &f, uint16_t v)
     f.write(buf, 2);
 }
 
+// Matroska (EBML) helpers: IDs and values are big-endian, element sizes
+// are variable length integers of 1 to 8 bytes
+static const int s_SeekHeadSpace = 32;  // reserved behind the segment start
+static const uint64_t s_UnknownSize = 0xFFFFFFFFFFFFFFull; // all ones in 8 bytes
+static const uint32_t s_CuesId = 0x1C53BB6B;
+
+static void appendEbmlId(QByteArray &out, uint32_t id)
+{
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        if ((id >> shift) != 0) {
+            out.append(char((id >> shift) & 0xFF));
+        }
+    }
+}
+
+static void appendEbmlSize(QByteArray &out, uint64_t size, int length)
+{
+    const uint64_t value = size | (uint64_t(1) << (7 * length));
+    for (int i = length - 1; i >= 0; i--) {
+        out.append(char((value >> (8 * i)) & 0xFF));
+    }
+}
+
+static void appendEbmlElement(QByteArray &out, uint32_t id, const QByteArray &data)
+{
+    int length = 1;
+    while (length < 8 && uint64_t(data.size()) >= (uint64_t(1) << (7 * length)) - 1) {
+        length++;
+    }
+    appendEbmlId(out, id);
+    appendEbmlSize(out, uint64_t(data.size()), length);
+    out.append(data);
+}
+
+static void appendEbmlUint(QByteArray &out, uint32_t id, uint64_t value)
+{
+    QByteArray data;
+    int bytes = 1;
+    while (bytes < 8 && (value >> (8 * bytes)) != 0) {
+        bytes++;
+    }
+    for (int i = bytes - 1; i >= 0; i--) {
+        data.append(char((value >> (8 * i)) & 0xFF));
+    }
+    appendEbmlElement(out, id, data);
+}
+
+static QByteArray ebmlFloat(double value)
+{
+    uint64_t bits;
+    std::memcpy(&bits, &value, 8);
+    QByteArray data;
+    for (int i = 7; i >= 0; i--) {
+        data.append(char((bits >> (8 * i)) & 0xFF));
+    }
+    return data;
+}
+
+// The NAL units of an Annex B access unit, without their start codes
+struct NalUnit {
+    int offset;
+    int size;
+};
+
+static QVector<NalUnit> splitNalUnits(const QByteArray &accessUnit)
+{
+    QVector<NalUnit> units;
+    const char *data = accessUnit.constData();
+    const int size = accessUnit.size();
+    int start = -1;
+    for (int i = 0; i + 2 < size; i++) {
+        if (data[i] != 0 || data[i + 1] != 0 || data[i + 2] != 1) {
+            continue;
+        }
+        if (start >= 0) {
+            // Zeros in front of a start code belong to it
+            int end = i;
+            while (end > start && data[end - 1] == 0) {
+                end--;
+            }
+            units.append({ start, end - start });
+        }
+        start = i + 3;
+        i += 2;
+    }
+    if (start >= 0 && start < size) {
+        units.append({ start, size - start });
+    }
+    return units;
+}
+
 VideoRecorder::VideoRecorder(QObject *parent)
     : QObject(parent)
 {
@@ -39,7 +133,7 @@ VideoRecorder::~VideoRecorder()
 }
 
 bool VideoRecorder::start(const QString &path, Format fmt, uint32_t width, uint32_t height,
-                           double fps, qint64 maxBytes)
+                           uint32_t pixelFormat, double fps, qint64 maxBytes)
 {
     std::lock_guard<std::mutex> lock(m_mutex);
     if (m_recording) return false;
@@ -52,25 +146,26 @@ bool VideoRecorder::start(const QString &path, Format fmt, uint32_t width, uint3
     m_format = fmt;
     m_width = width;
     m_height = height;
+    m_pixelFormat = pixelFormat;
+    m_rawFrameBytes = 0;
     m_fps = fps > 0 ? fps : 30.0;
     m_maxBytes = maxBytes;
     m_bytesWritten = 0;
     m_frameCount = 0;
     m_aviIndex.clear();
     m_moviStart = 0;
+    m_mkvCues.clear();
+    m_mkvStarted = false;
+    m_clusterSizePos = 0;
 
     if (fmt == AVI_MJPEG) {
         // Write placeholder AVI header — will be finalized on stop()
         writeAviHeader(false);
+    } else if (fmt == MKV_H264) {
+        // The header needs the SPS and PPS of the first key frame
     } else {
         // RAW: write text header
-        QString header = QString("V4L2RAW\n"
-                                 "width=%1\n"
-                                 "height=%2\n"
-                                 "bytesPerFrame=0\n"
-                                 "frameCount=0\n"
-                                 "END\n").arg(width).arg(height);
-        QByteArray hdr = header.toUtf8();
+        QByteArray hdr = rawHeader();
         m_file.write(hdr);
         m_bytesWritten = hdr.size();
     }
@@ -123,6 +218,85 @@ bool VideoRecorder::writeRawFrame(const uint8_t *data, size_t len)
     if (!m_recording || m_format != RAW) return false;
 
     m_file.write(reinterpret_cast<const char *>(data), len);
+    m_rawFrameBytes = static_cast<qint64>(len);
+    m_bytesWritten = m_file.pos();
+    m_frameCount++;
+
+    if (m_frameCount % 10 == 0) {
+        double elapsed = m_elapsed.elapsed() / 1000.0;
+        emit recordingProgress(m_bytesWritten, elapsed);
+    }
+
+    checkSizeLimit();
+    return true;
+}
+
+bool VideoRecorder::writeH264Frame(const QByteArray &accessUnit, bool key, uint32_t width, uint32_t height)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (!m_recording || m_format != MKV_H264) return false;
+
+    const QVector<NalUnit> units = splitNalUnits(accessUnit);
+    if (!m_mkvStarted) {
+        // Frames before the first key frame can't be decoded
+        QByteArray sps;
+        QByteArray pps;
+        for (const NalUnit &unit : units) {
+            const int type = accessUnit.at(unit.offset) & 0x1F;
+            if (type == 7 && sps.isEmpty() && unit.size >= 4) {
+                sps = accessUnit.mid(unit.offset, unit.size);
+            } else if (type == 8 && pps.isEmpty()) {
+                pps = accessUnit.mid(unit.offset, unit.size);
+            }
+        }
+        if (!key || sps.isEmpty() || pps.isEmpty()) {
+            return true;
+        }
+        m_width = width;
+        m_height = height;
+        writeMkvHeader(sps, pps);
+        m_mkvStarted = true;
+        m_firstFrameMs = m_elapsed.elapsed();
+    }
+
+    // Every key frame starts a cluster, which the cues point to for
+    // seeking. Block times are 16 bit offsets to the cluster time.
+    const qint64 time = m_elapsed.elapsed() - m_firstFrameMs;
+    if (key || m_clusterSizePos == 0 || time - m_clusterTime > 30000) {
+        closeMkvCluster();
+        if (key) {
+            m_mkvCues.append({ time, m_file.pos() - m_segmentStart });
+        }
+        QByteArray cluster;
+        appendEbmlId(cluster, 0x1F43B675);                      // Cluster
+        m_clusterSizePos = m_file.pos() + cluster.size();
+        appendEbmlSize(cluster, s_UnknownSize, 8);              // set when closed
+        appendEbmlUint(cluster, 0xE7, uint64_t(time));          // Timecode
+        m_file.write(cluster);
+        m_clusterTime = time;
+    }
+
+    // SimpleBlock: track 1, time, flags, then the NAL units with 4 byte
+    // lengths instead of start codes
+    const int16_t offset = int16_t(time - m_clusterTime);
+    QByteArray block;
+    block.append(char(0x81));
+    block.append(char((offset >> 8) & 0xFF));
+    block.append(char(offset & 0xFF));
+    block.append(char(key ? 0x80 : 0x00));
+    for (const NalUnit &unit : units) {
+        const uint32_t size = uint32_t(unit.size);
+        block.append(char(size >> 24));
+        block.append(char((size >> 16) & 0xFF));
+        block.append(char((size >> 8) & 0xFF));
+        block.append(char(size & 0xFF));
+        block.append(accessUnit.constData() + unit.offset, unit.size);
+    }
+    QByteArray element;
+    appendEbmlElement(element, 0xA3, block);
+    m_file.write(element);
+
+    m_lastFrameTime = time;
     m_bytesWritten = m_file.pos();
     m_frameCount++;
 
@@ -135,7 +309,7 @@ bool VideoRecorder::writeRawFrame(const uint8_t *data, size_t len)
     return true;
 }
 
-void VideoRecorder::stop()
+void VideoRecorder::stop(const QString &reason)
 {
     std::lock_guard<std::mutex> lock(m_mutex);
     if (!m_recording) return;
@@ -155,25 +329,17 @@ void VideoRecorder::stop()
 
         // Seek back and finalize the header with correct frame count and sizes
         writeAviHeader(true);
+    } else if (m_format == MKV_H264) {
+        finishMkv();
     } else {
-        // RAW: seek back and update header with frame count and bytes per frame
+        // RAW: seek back and update header with frame count and bytes per frame.
+        // The header has a fixed size, so this never overwrites frame data.
         m_file.seek(0);
-        size_t bytesPerFrame = m_frameCount > 0
-            ? (m_bytesWritten - 0) / m_frameCount  // approximate
-            : 0;
-        QString header = QString("V4L2RAW\n"
-                                 "width=%1\n"
-                                 "height=%2\n"
-                                 "bytesPerFrame=%3\n"
-                                 "frameCount=%4\n"
-                                 "END\n")
-                             .arg(m_width).arg(m_height)
-                             .arg(bytesPerFrame).arg(m_frameCount);
-        m_file.write(header.toUtf8());
+        m_file.write(rawHeader());
     }
 
     m_file.close();
-    emit recordingStopped("complete");
+    emit recordingStopped(reason);
 }
 
 qint64 VideoRecorder::bytesWritten() const
@@ -186,6 +352,29 @@ bool VideoRecorder::isRecording() const
     return m_recording;
 }
 
+QByteArray VideoRecorder::rawHeader() const
+{
+    // Counters are zero padded so the header keeps its size when it is
+    // rewritten with the final values on stop()
+    const auto *desc = PixelFormatRegistry::Find(m_pixelFormat);
+    const char fourcc[5] = { char(m_pixelFormat & 0xFF), char((m_pixelFormat >> 8) & 0xFF),
+                             char((m_pixelFormat >> 16) & 0xFF), char((m_pixelFormat >> 24) & 0xFF), 0 };
+    QString header = QString("V4L2RAW\n"
+                             "width=%1\n"
+                             "height=%2\n"
+                             "pixelFormat=%3\n"
+                             "bitDepth=%4\n"
+                             "bytesPerFrame=%5\n"
+                             "frameCount=%6\n"
+                             "END\n")
+                         .arg(m_width).arg(m_height)
+                         .arg(QString::fromLatin1(fourcc, 4))
+                         .arg(desc ? desc->bitDepth : 0)
+                         .arg(m_rawFrameBytes, 12, 10, QChar('0'))
+                         .arg(m_frameCount, 10, 10, QChar('0'));
+    return header.toUtf8();
+}
+
 void VideoRecorder::checkSizeLimit()
 {
     // Called with m_mutex held
@@ -202,6 +391,11 @@ void VideoRecorder::checkSizeLimit()
                 writeU32LE(m_file, entry.size);
             }
             writeAviHeader(true);
+        } else if (m_format == MKV_H264) {
+            finishMkv();
+        } else {
+            m_file.seek(0);
+            m_file.write(rawHeader());
         }
 
         m_file.close();
@@ -337,3 +531,149 @@ void VideoRecorder::writeAviHeader(bool finalize)
         m_moviStart = m_file.pos(); // Record start of movi data
     }
 }
+
+void VideoRecorder::writeMkvHeader(const QByteArray &sps, const QByteArray &pps)
+{
+    // Matroska structure:
+    // EBML(DocType 'matroska')
+    // Segment(
+    //   SeekHead(-> Cues), in space reserved now, written on stop()
+    //   Info(Duration, set on stop())
+    //   Tracks(TrackEntry(V_MPEG4/ISO/AVC, avcC))
+    //   Cluster(Timecode, SimpleBlock...)...
+    //   Cues(CuePoint per cluster)
+    // )
+    QByteArray ebml;
+    appendEbmlUint(ebml, 0x4286, 1);                // EBMLVersion
+    appendEbmlUint(ebml, 0x42F7, 1);                // EBMLReadVersion
+    appendEbmlUint(ebml, 0x42F2, 4);                // EBMLMaxIDLength
+    appendEbmlUint(ebml, 0x42F3, 8);                // EBMLMaxSizeLength
+    appendEbmlElement(ebml, 0x4282, "matroska");    // DocType
+    appendEbmlUint(ebml, 0x4287, 4);                // DocTypeVersion
+    appendEbmlUint(ebml, 0x4285, 2);                // DocTypeReadVersion
+
+    QByteArray head;
+    appendEbmlElement(head, 0x1A45DFA3, ebml);
+    appendEbmlId(head, 0x18538067);                 // Segment
+    appendEbmlSize(head, s_UnknownSize, 8);         // set on stop()
+    m_segmentStart = m_file.pos() + head.size();
+    m_seekHeadPos = m_segmentStart;
+    head.append(char(0xEC));                        // Void
+    appendEbmlSize(head, s_SeekHeadSpace - 2, 1);
+    head.append(QByteArray(s_SeekHeadSpace - 2, 0));
+
+    QByteArray info;
+    appendEbmlElement(info, 0x4489, ebmlFloat(0));  // Duration, first so its place is known
+    appendEbmlUint(info, 0x2AD7B1, 1000000);        // TimecodeScale, ms
+    appendEbmlElement(info, 0x4D80, "V4L2Viewer");  // MuxingApp
+    appendEbmlElement(info, 0x5741, "V4L2Viewer");  // WritingApp
+    QByteArray infoElement;
+    appendEbmlElement(infoElement, 0x1549A966, info);
+    m_durationPos = m_file.pos() + head.size() + (infoElement.size() - info.size()) + 3;
+    head.append(infoElement);
+
+    // AVCDecoderConfigurationRecord: profile, compatibility and level come
+    // from the SPS, NAL units are stored with 4 byte lengths
+    QByteArray avcc;
+    avcc.append(char(1));
+    avcc.append(sps.mid(1, 3));
+    avcc.append(char(0xFF));
+    avcc.append(char(0xE1));
+    avcc.append(char((sps.size() >> 8) & 0xFF));
+    avcc.append(char(sps.size() & 0xFF));
+    avcc.append(sps);
+    avcc.append(char(1));
+    avcc.append(char((pps.size() >> 8) & 0xFF));
+    avcc.append(char(pps.size() & 0xFF));
+    avcc.append(pps);
+
+    QByteArray video;
+    appendEbmlUint(video, 0xB0, m_width);           // PixelWidth
+    appendEbmlUint(video, 0xBA, m_height);          // PixelHeight
+
+    QByteArray track;
+    appendEbmlUint(track, 0xD7, 1);                 // TrackNumber
+    appendEbmlUint(track, 0x73C5, 1);               // TrackUID
+    appendEbmlUint(track, 0x83, 1);                 // TrackType, video
+    appendEbmlUint(track, 0x9C, 0);                 // FlagLacing
+    appendEbmlUint(track, 0x23E383, uint64_t(1e9 / m_fps)); // DefaultDuration, ns
+    appendEbmlElement(track, 0x86, "V_MPEG4/ISO/AVC");      // CodecID
+    appendEbmlElement(track, 0x63A2, avcc);         // CodecPrivate
+    appendEbmlElement(track, 0xE0, video);
+
+    QByteArray tracks;
+    appendEbmlElement(tracks, 0xAE, track);         // TrackEntry
+    appendEbmlElement(head, 0x1654AE6B, tracks);
+
+    m_file.write(head);
+}
+
+// This function sets the size of the open cluster, the file position
+// stays at its end
+void VideoRecorder::closeMkvCluster()
+{
+    if (m_clusterSizePos == 0) {
+        return;
+    }
+    const qint64 end = m_file.pos();
+    QByteArray size;
+    appendEbmlSize(size, uint64_t(end - m_clusterSizePos - 8), 8);
+    m_file.seek(m_clusterSizePos);
+    m_file.write(size);
+    m_file.seek(end);
+    m_clusterSizePos = 0;
+}
+
+// This function writes the cues and sets what the header left open. A
+// recording without a key frame stays an empty file.
+void VideoRecorder::finishMkv()
+{
+    // Called with m_mutex held
+    if (!m_mkvStarted) {
+        return;
+    }
+    closeMkvCluster();
+
+    const qint64 cuesPosition = m_file.pos() - m_segmentStart;
+    QByteArray cues;
+    for (const MkvCue &cue : m_mkvCues) {
+        QByteArray position;
+        appendEbmlUint(position, 0xF7, 1);                          // CueTrack
+        appendEbmlUint(position, 0xF1, uint64_t(cue.clusterPosition)); // CueClusterPosition
+        QByteArray point;
+        appendEbmlUint(point, 0xB3, uint64_t(cue.time));            // CueTime
+        appendEbmlElement(point, 0xB7, position);                   // CueTrackPositions
+        appendEbmlElement(cues, 0xBB, point);                       // CuePoint
+    }
+    QByteArray cuesElement;
+    appendEbmlElement(cuesElement, s_CuesId, cues);
+    m_file.write(cuesElement);
+    const qint64 end = m_file.pos();
+
+    // The SeekHead takes the reserved space, a Void fills the rest
+    QByteArray seek;
+    const char cuesId[] = { char(0x1C), char(0x53), char(0xBB), char(0x6B) };
+    appendEbmlElement(seek, 0x53AB, QByteArray(cuesId, 4));         // SeekID
+    appendEbmlUint(seek, 0x53AC, uint64_t(cuesPosition));          // SeekPosition
+    QByteArray entry;
+    appendEbmlElement(entry, 0x4DBB, seek);                         // Seek
+    QByteArray seekHead;
+    appendEbmlElement(seekHead, 0x114D9B74, entry);
+    const int rest = s_SeekHeadSpace - seekHead.size();
+    seekHead.append(char(0xEC));
+    appendEbmlSize(seekHead, uint64_t(rest - 2), 1);
+    seekHead.append(QByteArray(rest - 2, 0));
+    m_file.seek(m_seekHeadPos);
+    m_file.write(seekHead);
+
+    // The last frame lasts one frame interval
+    m_file.seek(m_durationPos);
+    m_file.write(ebmlFloat(double(m_lastFrameTime) + 1000.0 / m_fps));
+
+    QByteArray segmentSize;
+    appendEbmlSize(segmentSize, uint64_t(end - m_segmentStart), 8);
+    m_file.seek(m_segmentStart - 8);
+    m_file.write(segmentSize);
+    m_file.seek(end);
+    m_bytesWritten = end;
+}
@@ -0,0 +1,98 @@
+#include "WorkerPool.h"
+
+WorkerPool::WorkerPool(unsigned threadCount)
+{
+    for (unsigned i = 0; i < threadCount; ++i)
+    {
+        m_Threads.emplace_back([this] { WorkerMain(); });
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_Stop = true;
+    }
+    m_WorkAvailable.notify_all();
+    for (auto &thread : m_Threads)
+    {
+        thread.join();
+    }
+}
+
+WorkerPool &WorkerPool::Instance()
+{
+    static WorkerPool pool(std::thread::hardware_concurrency() > 1 ? std::thread::hardware_concurrency() - 1 : 0);
+    return pool;
+}
+
+unsigned WorkerPool::Concurrency() const
+{
+    return unsigned(m_Threads.size()) + 1;
+}
+
+void WorkerPool::ParallelFor(uint32_t count, const std::function<void(uint32_t)> &job)
+{
+    std::unique_lock<std::mutex> callLock(m_CallMutex, std::try_to_lock);
+    if (count <= 1 || m_Threads.empty() || !callLock.owns_lock())
+    {
+        for (uint32_t i = 0; i < count; ++i)
+        {
+            job(i);
+        }
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_Mutex);
+        m_pJob = &job;
+        m_Count = count;
+        m_NextIndex = 0;
+        m_Pending = count;
+        ++m_Generation;
+    }
+    m_WorkAvailable.notify_all();
+
+    RunJobs();
+
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    m_WorkDone.wait(lock, [this] { return m_Pending == 0; });
+    m_pJob = nullptr;
+}
+
+// This function takes job indices until none are left
+void WorkerPool::RunJobs()
+{
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (m_pJob != nullptr && m_NextIndex < m_Count)
+    {
+        const uint32_t index = m_NextIndex++;
+        const std::function<void(uint32_t)> &job = *m_pJob;
+        lock.unlock();
+        job(index);
+        lock.lock();
+        if (--m_Pending == 0)
+        {
+            m_WorkDone.notify_all();
+        }
+    }
+}
+
+void WorkerPool::WorkerMain()
+{
+    uint64_t seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(m_Mutex);
+    while (true)
+    {
+        m_WorkAvailable.wait(lock, [&] { return m_Stop || m_Generation != seenGeneration; });
+        if (m_Stop)
+        {
+            return;
+        }
+        seenGeneration = m_Generation;
+        lock.unlock();
+        RunJobs();
+        lock.lock();
+    }
+}